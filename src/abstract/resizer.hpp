@@ -0,0 +1,56 @@
+#ifndef __ANALLOC2_RESIZER_HPP__
+#define __ANALLOC2_RESIZER_HPP__
+
+#include "allocator.hpp"
+
+namespace analloc {
+
+/**
+ * An allocator which can grow or shrink an allocated region without moving
+ * it.
+ */
+template <typename AddressType, typename SizeType = AddressType>
+class Resizer : public virtual Allocator<AddressType, SizeType> {
+public:
+  /**
+   * Grow or shrink the region of [size] units at [address] to [newSize] units
+   * without moving it.
+   *
+   * Shrinking always succeeds. Growing only succeeds if the units right
+   * after the region are free. If `false` is returned, the region has not
+   * been affected.
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) = 0;
+};
+
+/**
+ * Call [allocator]'s [TryResize] method.
+ *
+ * Wrappers which may or may not wrap a [Resizer] call this, and get the
+ * fallback below if they do not.
+ */
+template <typename AddressType, typename SizeType>
+inline bool TryResizeAllocator(
+    Resizer<AddressType, SizeType> & allocator,
+    typename Allocator<AddressType, SizeType>::AddressType address,
+    typename Allocator<AddressType, SizeType>::SizeType size,
+    typename Allocator<AddressType, SizeType>::SizeType newSize) {
+  return allocator.TryResize(address, size, newSize);
+}
+
+/**
+ * Fail to resize a region of an allocator which is not a [Resizer].
+ */
+template <typename AddressType, typename SizeType>
+inline bool TryResizeAllocator(
+    Allocator<AddressType, SizeType> &,
+    typename Allocator<AddressType, SizeType>::AddressType,
+    typename Allocator<AddressType, SizeType>::SizeType,
+    typename Allocator<AddressType, SizeType>::SizeType) {
+  return false;
+}
+
+}
+
+#endif
@@ -2,32 +2,62 @@
 #define __ANALLOC2_BITMAP_HPP__
 
 #include "../abstract/offset-aligner.hpp"
+#include "../abstract/resizer.hpp"
 #include "raw-bitmap.hpp"
+#include "unit-scanner.hpp"
 
 namespace analloc {
 
+/**
+ * Determines how a [Bitmap] prepares its buffer when it is created.
+ */
+enum BitmapInit {
+  /**
+   * Zero the entire buffer in the constructor.
+   */
+  BitmapZero,
+  
+  /**
+   * Trust the buffer to be zeroed already, as it is when it comes from fresh
+   * anonymous pages.
+   */
+  BitmapPreZeroed,
+  
+  /**
+   * Zero units the first time an operation writes to them. Until then, they
+   * are known to be free and are never read.
+   */
+  BitmapLazyZero
+};
+
 /**
  * An offset aligner which runs in O(n) time for all operations.
  */
 template <typename Unit, typename AddressType, typename SizeType = AddressType>
 class Bitmap
     : protected RawBitmap<Unit, SizeType>,
-      public virtual OffsetAligner<AddressType, SizeType> {
+      public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
 public:
   typedef RawBitmap<Unit, SizeType> super;
   
   /**
    * Create a new [Bitmap] given a region of memory [ptr] and a bit count [bc].
+   *
+   * The [init] argument determines when the buffer is zeroed. With anything
+   * but [BitmapZero], construction takes constant time regardless of [bc].
    */
-  Bitmap(Unit * ptr, SizeType bc) : super(ptr, bc) {
-    // Zero the buffer as efficiently as possible without overwriting any bits
-    // that this bitmap doesn't own
-    SizeType fullUnits = bc / this->UnitBitCount;
-    for (SizeType i = 0; i < fullUnits; ++i) {
-      ptr[(size_t)i] = 0;
+  Bitmap(Unit * ptr, SizeType bc, BitmapInit init = BitmapZero)
+      : super(ptr, bc) {
+    if (init == BitmapZero) {
+      // Zero the buffer a unit at a time without overwriting any bits that
+      // this bitmap doesn't own
+      this->ClearRange(0, bc);
     }
-    for (SizeType i = fullUnits * this->UnitBitCount; i < bc; ++i) {
-      this->SetBit(i, 0);
+    if (init == BitmapLazyZero) {
+      zeroedUnits = 0;
+    } else {
+      zeroedUnits = this->GetUnitCount();
     }
   }
   
@@ -39,16 +69,13 @@ public:
       addressOut = 0;
       return true;
     }
-    // Keep attempting to find free regions
-    SizeType index = 0;
-    while (NextFree(index, size - 1)) {
-      if (Reserve(index + 1, size - 1, &index)) {
-        this->SetBit(index, true);
-        addressOut = (AddressType)index;
-        return true;
-      }
+    SizeType index;
+    if (!FindNextRun(index, size)) {
+      return false;
     }
-    return false;
+    Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
   }
   
   virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
@@ -58,120 +85,579 @@ public:
     } else if (align < 2 || !size) {
       return this->Alloc(addressOut, size);
     }
-    SizeType index = 0;
-    while (NextFreeAligned(index, offset, align, size - 1)) {
-      if (this->Reserve(index + 1, size - 1, &index)) {
-        this->SetBit(index, true);
-        addressOut = (AddressType)index;
-        return true;
-      }
+    SizeType index;
+    if (!FindNextAligned(index, align, offset, size)) {
+      return false;
     }
-    return false;
+    Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
   }
   
   virtual void Dealloc(AddressType address, SizeType size) {
     assert((SizeType)address == address);
     assert(!ansa::AddWraps<SizeType>((SizeType)address, size));
     assert((SizeType)address + size <= this->GetBitCount());
-    for (SizeType i = (SizeType)address; i < (SizeType)address + size; ++i) {
-      this->SetBit(i, false);
+    if (!size) return;
+    ZeroUnits(((SizeType)address + (size - 1)) / this->UnitBitCount + 1);
+    this->ClearRange((SizeType)address, size);
+    UnitsChanged((SizeType)address, size);
+  }
+  
+  /**
+   * Grow or shrink the [size] bits at [address] to [newSize] bits. Growing
+   * succeeds if the bits after the region are free, in which case they are
+   * claimed without searching the bitmap.
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    assert((SizeType)address == address);
+    assert((SizeType)address + size <= this->GetBitCount());
+    if (newSize <= size) {
+      this->Dealloc(address + newSize, size - newSize);
+      return true;
+    }
+    SizeType end = (SizeType)address + size;
+    if (!IsRunFree(end, newSize - size)) {
+      return false;
+    }
+    MarkUsed(end, newSize - size);
+    return true;
+  }
+  
+  /**
+   * Allocate [count] individual bits and store their indexes in [addresses].
+   *
+   * The bitmap is scanned once, and each unit is updated with a single write
+   * no matter how many of its bits are taken. The bits are the lowest free
+   * bits, or the first free bits at or after the cursor in next-fit mode.
+   *
+   * If fewer than [count] bits are free, nothing is allocated, `false` is
+   * returned, and the contents of [addresses] are undefined.
+   */
+  bool AllocMany(AddressType * addresses, size_t count) {
+    if (!count) return true;
+    size_t taken = 0;
+    SizeType start = nextFit ? cursor : 0;
+    if (!TakeBits(addresses, count, taken, start, this->GetBitCount()) &&
+        !TakeBits(addresses, count, taken, 0, start)) {
+      DeallocMany(addresses, taken);
+      return false;
+    }
+    lastUsed = addresses[count - 1];
+    cursor = (SizeType)lastUsed + 1;
+    if (cursor == this->GetBitCount()) {
+      cursor = 0;
+    }
+    return true;
+  }
+  
+  /**
+   * Deallocate [count] individual bits whose indexes are stored in
+   * [addresses].
+   *
+   * Consecutive addresses which fall in the same unit are freed with a single
+   * write, so this is fastest when [addresses] is sorted, as it is when it
+   * comes from [AllocMany].
+   */
+  void DeallocMany(const AddressType * addresses, size_t count) {
+    size_t i = 0;
+    while (i < count) {
+      assert((SizeType)addresses[i] == addresses[i]);
+      assert(addresses[i] < this->GetBitCount());
+      SizeType unitIndex = (SizeType)addresses[i] / this->UnitBitCount;
+      SizeType low = (SizeType)addresses[i];
+      SizeType high = low;
+      Unit mask = 0;
+      for (; i < count; ++i) {
+        SizeType idx = (SizeType)addresses[i];
+        if (idx / this->UnitBitCount != unitIndex) break;
+        mask |= (Unit)((Unit)1 << (idx % this->UnitBitCount));
+        low = ansa::Min<SizeType>(low, idx);
+        high = ansa::Max<SizeType>(high, idx);
+      }
+      ZeroUnits(unitIndex + 1);
+      assert((this->UnitAt(unitIndex) & mask) == mask);
+      this->UnitAt(unitIndex) &= (Unit)~mask;
+      UnitsChanged(low, high - low + 1);
     }
   }
   
   using super::GetBitCount;
   
+  /**
+   * Enable or disable next-fit allocation.
+   *
+   * By default, every allocation returns the lowest free region. In next-fit
+   * mode, the search resumes at the end of the most recent allocation and
+   * wraps around to the beginning of the bitmap. This avoids rescanning a
+   * dense prefix when addresses are handed out roughly in order, like
+   * process IDs or ports.
+   */
+  inline void SetNextFit(bool flag) {
+    nextFit = flag;
+  }
+  
+  inline bool IsNextFit() const {
+    return nextFit;
+  }
+  
+  /**
+   * Get the address of the most recent non-empty allocation, or 0 if no such
+   * allocation has been made.
+   */
+  inline AddressType LastUsedAddress() const {
+    return lastUsed;
+  }
+  
 protected:
-  inline bool NextFree(SizeType & idx, SizeType afterSize) {
-    assert(afterSize <= this->GetBitCount());
-    SizeType i = idx;
-    while (i < this->GetBitCount() - afterSize) {
-      if (!this->GetBit(i)) {
-        idx = i;
-        return true;
-      } else if (i % this->UnitBitCount) {
-        ++i;
-      } else {
-        // BitScanRight will allow us to quickly process the value
-        Unit unit = this->UnitAt(i / this->UnitBitCount);
-        unsigned int add = (unsigned int)ansa::BitScanRight<Unit>(~unit);
-        if ((SizeType)add != add || ansa::AddWraps<SizeType>(i, add)) {
-          return false;
-        }
-        i += add;
+  bool nextFit = false;
+  SizeType cursor = 0;
+  AddressType lastUsed = 0;
+  
+  /**
+   * Every unit at or after this index is free, but may not have been zeroed
+   * yet.
+   */
+  SizeType zeroedUnits;
+  
+  /**
+   * Zero every unit before [endUnit] which has not been zeroed yet.
+   */
+  inline void ZeroUnits(SizeType endUnit) {
+    if (endUnit <= zeroedUnits) return;
+    // Work in units rather than bits, since the bit index of the end of the
+    // range may not fit in a [SizeType].
+    SizeType lastUnit = this->GetUnitCount() - 1;
+    SizeType stopUnit = ansa::Min<SizeType>(endUnit, lastUnit);
+    for (SizeType i = zeroedUnits; i < stopUnit; ++i) {
+      this->UnitAt(i) = 0;
+    }
+    if (endUnit > lastUnit) {
+      // Keep the bits past the end of the bitmap
+      this->UnitAt(lastUnit) &= ~this->TailMask(this->GetBitCount() - 1);
+    }
+    zeroedUnits = endUnit;
+  }
+  
+  /**
+   * Read the unit at [idx], which may not have been zeroed yet.
+   */
+  inline Unit LoadUnit(SizeType idx) const {
+    return idx < zeroedUnits ? this->UnitAt(idx) : 0;
+  }
+  
+  /**
+   * Returns `true` if the bit at [idx] is used. Bits in units which have not
+   * been zeroed yet are free.
+   */
+  inline bool IsBitUsed(SizeType idx) const {
+    Unit unit = LoadUnit(idx / this->UnitBitCount);
+    return (unit & ((Unit)1 << (idx % this->UnitBitCount))) != 0;
+  }
+  
+  /**
+   * Like [FindFirstSet], but without reading units which have not been
+   * zeroed yet.
+   */
+  bool FindFirstUsed(SizeType idx, SizeType len, SizeType & result) const {
+    if (zeroedUnits < this->GetUnitCount()) {
+      if (idx / this->UnitBitCount >= zeroedUnits) {
+        return false;
       }
+      // This is the index of a bit inside the bitmap, so it cannot overflow.
+      SizeType zeroedEnd = zeroedUnits * this->UnitBitCount;
+      len = ansa::Min<SizeType>(len, zeroedEnd - idx);
     }
-    return false;
+    return this->FindFirstSet(idx, len, result);
   }
   
-  inline bool NextFreeAligned(SizeType & idx, AddressType offset,
-                              AddressType align, SizeType afterSize) {
-    assert(afterSize <= this->GetBitCount());
-    SizeType i = idx;
-    
-    if (!AlignIndex(i, align, offset)) {
+  /**
+   * Find the run of [size] free bits that [Alloc] would claim, without
+   * claiming it. The [size] argument must be non-zero and no larger than the
+   * bitmap.
+   */
+  bool FindNextRun(SizeType & index, SizeType size) {
+    SizeType lastStart = this->GetBitCount() - size;
+    if (!nextFit || !cursor) {
+      return FindFreeRun(index, size, 0, lastStart);
+    } else if (cursor <= lastStart &&
+               FindFreeRun(index, size, cursor, lastStart)) {
+      return true;
+    }
+    // Wrap around to the beginning of the bitmap
+    SizeType wrapLimit = ansa::Min<SizeType>(cursor - 1, lastStart);
+    return FindFreeRun(index, size, 0, wrapLimit);
+  }
+  
+  /**
+   * Find the run that [OffsetAlign] would claim, without claiming it. The
+   * [align] argument must be at least 2.
+   */
+  bool FindNextAligned(SizeType & index, AddressType align,
+                       AddressType offset, SizeType size) {
+    if (!nextFit || !cursor) {
+      return FindAligned(index, size, 0, offset, align);
+    } else if (FindAligned(index, size, cursor, offset, align)) {
+      return true;
+    }
+    return FindAligned(index, size, 0, offset, align) && index < cursor;
+  }
+  
+  /**
+   * Returns `true` if the [size] bits at [idx] are inside the bitmap and
+   * free. The [size] argument must be non-zero.
+   */
+  bool IsRunFree(SizeType idx, SizeType size) {
+    if (idx > this->GetBitCount() || this->GetBitCount() - idx < size) {
       return false;
     }
-    
-    // If the alignment is bigger than [SizeType]'s max, the first attempt is
-    // the only possible one
-    if ((SizeType)align != align) {
-      if (!this->GetBit(i)) {
-        idx = i;
-        return true;
-      } else {
+    SizeType used;
+    return !FindFirstUsed(idx, size, used);
+  }
+  
+  /**
+   * Mark [size] bits at [idx] as used.
+   */
+  inline void MarkUsed(SizeType idx, SizeType size) {
+    ZeroUnits((idx + (size - 1)) / this->UnitBitCount + 1);
+    this->SetRange(idx, size);
+    UnitsChanged(idx, size);
+  }
+  
+  /**
+   * Mark [size] bits at [idx] as used and record the allocation.
+   */
+  inline void Claim(SizeType idx, SizeType size) {
+    MarkUsed(idx, size);
+    lastUsed = (AddressType)idx;
+    cursor = idx + size;
+    if (cursor == this->GetBitCount()) {
+      cursor = 0;
+    }
+  }
+  
+  /**
+   * Claim free bits in the range [start, end) for [AllocMany], from lowest to
+   * highest, until [taken] reaches [count].
+   *
+   * Returns `true` once [count] bits have been taken.
+   */
+  bool TakeBits(AddressType * addresses, size_t count, size_t & taken,
+                SizeType start, SizeType end) {
+    if (start >= end) {
+      return false;
+    }
+    const SizeType firstUnit = start / this->UnitBitCount;
+    const SizeType endUnit = (end - 1) / this->UnitBitCount + 1;
+    SizeType unitIndex = firstUnit;
+    while (taken < count) {
+      if (!NextFreeUnit(unitIndex, endUnit)) {
         return false;
       }
+      Unit unit = LoadUnit(unitIndex);
+      if (unitIndex == firstUnit) {
+        // Bits before [start] are not candidates
+        unit |= (Unit)~this->HeadMask(start % this->UnitBitCount);
+      }
+      if (unitIndex == endUnit - 1 && end % this->UnitBitCount) {
+        // Neither are bits at or after [end]
+        unit |= this->HeadMask(end % this->UnitBitCount);
+      }
+      Unit free = (Unit)~unit;
+      Unit claimed = 0;
+      SizeType base = unitIndex * this->UnitBitCount;
+      while (free && taken < count) {
+        int bit = UnitBitScanRight<Unit>(free);
+        free = (Unit)(free & (free - 1));
+        claimed |= (Unit)((Unit)1 << bit);
+        addresses[taken++] = (AddressType)(base + (SizeType)bit);
+      }
+      if (claimed) {
+        ZeroUnits(unitIndex + 1);
+        this->UnitAt(unitIndex) |= claimed;
+        SizeType low = (SizeType)UnitBitScanRight<Unit>(claimed);
+        SizeType high = (SizeType)UnitBitScanLeft<Unit>(claimed);
+        UnitsChanged(base + low, high - low + 1);
+      }
+      ++unitIndex;
     }
-    
-    // If [UnitBitCount] is larger than [align], skipping using BitScanRight is
-    // worth it.
-    bool jumpByUnit = this->UnitBitCount > align;
-    
-    while (i < this->GetBitCount() - afterSize) {
-      // Skip to the next aligned region
-      if (!this->GetBit(i)) {
-        idx = i;
-        return true;
-      } else if (jumpByUnit && !(i % this->UnitBitCount)) {
-        // BitScanRight will allow us to quickly skip the unit
-        Unit unit = this->UnitAt(i / this->UnitBitCount);
-        unsigned int add = (unsigned int)ansa::BitScanRight<Unit>(~unit);
-        assert((SizeType)add == add);
-        if (ansa::AddWraps<SizeType>(add, i)) {
+    return true;
+  }
+  
+  /**
+   * Called after the bits in the range [idx, idx + len) have been modified.
+   *
+   * Subclasses which maintain auxiliary structures over the bitmap can
+   * override this to keep them up-to-date. The [len] argument is never 0.
+   */
+  virtual void UnitsChanged(SizeType idx, SizeType len) {
+    (void)idx;
+    (void)len;
+  }
+  
+  /**
+   * Find the first unit at or after [unitIdx] and before [endUnit] which
+   * contains at least one free bit.
+   *
+   * Bits past the end of the bitmap in the last unit may be treated as free.
+   * Callers should check the bit index which they eventually compute against
+   * the bit count.
+   */
+  virtual bool NextFreeUnit(SizeType & unitIdx, SizeType endUnit) {
+    if (unitIdx >= endUnit) {
+      return false;
+    } else if (LoadUnit(unitIdx) != (Unit)~(Unit)0) {
+      // Short runs of used units are common enough that it is worth checking
+      // the first unit before calling into the scan kernel.
+      return true;
+    }
+    // Units which have not been zeroed are free, so they end the scan.
+    SizeType scanEnd = ansa::Min<SizeType>(endUnit, zeroedUnits);
+    size_t result = UnitScanner::NextNonFull<Unit>(this->units,
+                                                   (size_t)unitIdx + 1,
+                                                   (size_t)scanEnd);
+    if (result >= (size_t)endUnit) {
+      return false;
+    }
+    unitIdx = (SizeType)result;
+    return true;
+  }
+  
+  /**
+   * Find the lowest index [idx] in the range [start, lastStart] at which
+   * [size] consecutive bits are free. The [lastStart] argument may not exceed
+   * `GetBitCount() - size`.
+   *
+   * The bitmap is processed a unit at a time. A run of free bits which
+   * reaches the top of a unit is carried into the next unit, runs which fit
+   * inside a unit are found with [UnitRunStarts], and units which are
+   * completely used are skipped with [NextFreeUnit].
+   */
+  bool FindFreeRun(SizeType & idx, SizeType size, SizeType start,
+                   SizeType lastStart) {
+    assert(size && size <= this->GetBitCount());
+    assert(lastStart <= this->GetBitCount() - size);
+    if (start > lastStart) {
+      return false;
+    }
+    const SizeType bitCount = this->GetBitCount();
+    const SizeType unitCount = this->GetUnitCount();
+    const SizeType firstUnit = start / this->UnitBitCount;
+    SizeType runStart = 0;
+    SizeType runLength = 0;
+    SizeType unitIndex = firstUnit;
+    while (unitIndex < unitCount) {
+      if (!runLength) {
+        // Nothing carries over from the previous unit, so we may skip every
+        // unit which is completely used.
+        if (!NextFreeUnit(unitIndex, unitCount)) {
           return false;
         }
-        i += add;
-        if (!AlignIndex(i, align, offset)) {
+        if (unitIndex * this->UnitBitCount > lastStart) {
           return false;
         }
       } else {
-        // Add the entire alignment
-        if (ansa::AddWraps<SizeType>(i, (SizeType)align)) {
+        // Extend the run over units which are completely free, stopping
+        // before the unit in which the run would be finished.
+        SizeType end = unitIndex + (size - runLength) / this->UnitBitCount;
+        if (end > bitCount / this->UnitBitCount) {
+          end = bitCount / this->UnitBitCount;
+        }
+        SizeType skipped = unitIndex;
+        while (unitIndex < end && !LoadUnit(unitIndex)) {
+          ++unitIndex;
+        }
+        runLength += (unitIndex - skipped) * this->UnitBitCount;
+        if (runLength >= size) {
+          idx = runStart;
+          return runStart <= lastStart;
+        } else if (unitIndex == unitCount) {
           return false;
         }
-        i += (SizeType)align;
       }
+      Unit unit = LoadUnit(unitIndex);
+      if (unitIndex == unitCount - 1 && bitCount % this->UnitBitCount) {
+        // Bits past the end of the bitmap can never be allocated
+        unit |= this->HeadMask(bitCount % this->UnitBitCount);
+      }
+      if (unitIndex == firstUnit) {
+        // Bits before [start] are not candidates
+        unit |= (Unit)~this->HeadMask(start % this->UnitBitCount);
+      }
+      if (!unit) {
+        if (!runLength) {
+          runStart = unitIndex * this->UnitBitCount;
+        }
+        runLength += this->UnitBitCount;
+        if (runLength >= size) {
+          idx = runStart;
+          return runStart <= lastStart;
+        }
+        ++unitIndex;
+        continue;
+      }
+      if (runLength) {
+        // The run from the previous unit ends at this unit's lowest used bit
+        SizeType available = (SizeType)UnitBitScanRight<Unit>(unit);
+        if (size - runLength <= available) {
+          idx = runStart;
+          return runStart <= lastStart;
+        }
+      }
+      if (size < this->UnitBitCount) {
+        Unit starts = UnitRunStarts<Unit>((Unit)~unit, (int)size);
+        if (starts) {
+          idx = unitIndex * this->UnitBitCount +
+              (SizeType)UnitBitScanRight<Unit>(starts);
+          return idx <= lastStart;
+        }
+      }
+      // Start a new run with the free bits at the top of this unit
+      runLength = this->UnitBitCount - 1 -
+          (SizeType)UnitBitScanLeft<Unit>(unit);
+      runStart = (unitIndex + 1) * this->UnitBitCount - runLength;
+      ++unitIndex;
     }
     return false;
   }
   
-  inline bool Reserve(SizeType idx, SizeType size, SizeType * firstUsed) {
-    assert(!ansa::AddWraps<SizeType>(idx, size));
-    assert(idx + size <= this->GetBitCount());
-    // Make sure that the next [size] cells are free.
-    for (SizeType i = 0; i < size; ++i) {
-      if (this->GetBit(idx + i)) {
-        if (firstUsed) {
-          (*firstUsed) = idx + i;
+  /**
+   * Find the lowest index [idx] at or after [start] which satisfies an
+   * alignment and at which [size] consecutive bits are free.
+   *
+   * Alignments which evenly divide [UnitBitCount] are handled a unit at a
+   * time with [FindAlignedInUnits]. For other alignments, each candidate
+   * index is tested with [FindFirstUsed], and the search jumps straight to the
+   * first aligned index after the used bit that it finds.
+   */
+  bool FindAligned(SizeType & idx, SizeType size, SizeType start,
+                   AddressType offset, AddressType align) {
+    const SizeType lastStart = this->GetBitCount() - size;
+    if (align < this->UnitBitCount && !(this->UnitBitCount % align)) {
+      return FindAlignedInUnits(idx, size, start, lastStart,
+                                (SizeType)(offset % align), (SizeType)align);
+    }
+    const SizeType unitCount = this->GetUnitCount();
+    SizeType index = start;
+    if (!AlignIndex(index, align, offset)) {
+      return false;
+    }
+    while (index <= lastStart) {
+      // Most candidates in a crowded bitmap fail on their first bit
+      SizeType used = index;
+      if (!IsBitUsed(index) && !FindFirstUsed(index, size, used)) {
+        idx = index;
+        return true;
+      }
+      // Every candidate before [used] would contain it. Stepping by [align]
+      // is much cheaper than realigning, so do that when possible.
+      bool aligned = false;
+      if (used - index < align && (SizeType)align == align &&
+          !ansa::AddWraps<SizeType>(index, (SizeType)align)) {
+        index += (SizeType)align;
+        aligned = true;
+      } else {
+        index = used + 1;
+      }
+      SizeType unitIndex = index / this->UnitBitCount;
+      if (unitIndex < unitCount &&
+          LoadUnit(unitIndex) == (Unit)~(Unit)0) {
+        ++unitIndex;
+        if (!NextFreeUnit(unitIndex, unitCount)) {
+          return false;
         }
+        index = unitIndex * this->UnitBitCount;
+        aligned = false;
+      }
+      if (!aligned && !AlignIndex(index, align, offset)) {
         return false;
       }
     }
-    // Reserve all the cells
-    for (SizeType i = 0; i < size; ++i) {
-      this->SetBit(idx + i, true);
+    return false;
+  }
+  
+  /**
+   * An implementation of [FindAligned] for an [align] which evenly divides
+   * [UnitBitCount]. Every unit then begins at an aligned index, so the same
+   * mask of aligned bits applies to every unit.
+   *
+   * Within a unit, the aligned bits which start a free run are found with
+   * [UnitRunStarts]. Only the lowest aligned bit in the free bits at the top
+   * of a unit may start a run which continues into the next unit.
+   */
+  bool FindAlignedInUnits(SizeType & idx, SizeType size, SizeType start,
+                          SizeType lastStart, SizeType offset,
+                          SizeType align) {
+    const SizeType bitCount = this->GetBitCount();
+    const SizeType unitCount = this->GetUnitCount();
+    // Dividing all ones by `2^align - 1` puts a one in every [align] bits
+    Unit pattern = (Unit)((Unit)~(Unit)0 /
+                          (Unit)(((Unit)1 << align) - 1));
+    Unit mask = (Unit)(pattern << ((align - offset) % align));
+    SizeType unitIndex = start / this->UnitBitCount;
+    // Bits before [start] are not candidates
+    Unit skipped = (Unit)~this->HeadMask(start % this->UnitBitCount);
+    while (unitIndex < unitCount) {
+      if (unitIndex * this->UnitBitCount > lastStart) {
+        return false;
+      }
+      Unit unit = LoadUnit(unitIndex) | skipped;
+      skipped = 0;
+      if (unitIndex == unitCount - 1 && bitCount % this->UnitBitCount) {
+        // Bits past the end of the bitmap can never be allocated
+        unit |= this->HeadMask(bitCount % this->UnitBitCount);
+      }
+      if (unit == (Unit)~(Unit)0) {
+        ++unitIndex;
+        if (!NextFreeUnit(unitIndex, unitCount)) {
+          return false;
+        }
+        continue;
+      }
+      Unit candidates = (Unit)(mask & ~unit);
+      if (!candidates) {
+        ++unitIndex;
+        continue;
+      }
+      if (size < this->UnitBitCount) {
+        Unit starts = (Unit)(candidates &
+                             UnitRunStarts<Unit>((Unit)~unit, (int)size));
+        if (starts) {
+          SizeType index = unitIndex * this->UnitBitCount +
+              (SizeType)UnitBitScanRight<Unit>(starts);
+          if (index > lastStart) {
+            return false;
+          }
+          idx = index;
+          return true;
+        }
+      }
+      if (unit) {
+        // Keep the candidates above the highest used bit
+        int highest = UnitBitScanLeft<Unit>(unit);
+        candidates &= (Unit)((Unit)((Unit)~(Unit)0 << highest) << 1);
+      }
+      if (!candidates) {
+        ++unitIndex;
+        continue;
+      }
+      SizeType bit = (SizeType)UnitBitScanRight<Unit>(candidates);
+      SizeType index = unitIndex * this->UnitBitCount + bit;
+      if (index > lastStart) {
+        return false;
+      }
+      SizeType free = this->UnitBitCount - bit;
+      SizeType used;
+      if (free >= size || !FindFirstUsed(index + free, size - free, used)) {
+        idx = index;
+        return true;
+      }
+      // Every candidate before [used] would contain it
+      unitIndex = used / this->UnitBitCount;
+      skipped = (Unit)~this->HeadMask(used % this->UnitBitCount);
     }
-    return true;
+    return false;
   }
   
   /**
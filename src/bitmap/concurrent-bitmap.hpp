@@ -0,0 +1,317 @@
+#ifndef __ANALLOC2_CONCURRENT_BITMAP_HPP__
+#define __ANALLOC2_CONCURRENT_BITMAP_HPP__
+
+#include "../abstract/allocator.hpp"
+#include "unit-math.hpp"
+#include <ansa/math>
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+
+namespace analloc {
+
+/**
+ * A bitmap allocator which may be used by many threads at once without a
+ * lock.
+ *
+ * The bitmap is stored in an array of `std::atomic<Unit>`, which has the same
+ * bit layout as the backing store of a [RawBitmap]. Bits are claimed with
+ * compare-and-swap and released with `fetch_and`, so allocations which touch
+ * different units never wait on each other.
+ *
+ * To spread contention, every thread begins its search at a different unit
+ * and resumes from the unit of its last allocation. Thus, unlike [Bitmap],
+ * this does not always return the lowest free region.
+ *
+ * An allocation which spans multiple units claims them one at a time, and
+ * releases them again if another thread got to one of them first. For this
+ * reason, [Alloc] may fail spuriously when other threads are allocating the
+ * same bits.
+ */
+template <typename Unit, typename AddressType, typename SizeType = AddressType>
+class ConcurrentBitmap : public virtual Allocator<AddressType, SizeType> {
+public:
+  static constexpr SizeType UnitBitCount = (SizeType)(sizeof(Unit) * 8);
+  
+  /**
+   * Create a new [ConcurrentBitmap] given a region of memory [ptr] and a bit
+   * count [bc].
+   *
+   * The bitmap is cleared by this constructor, which must finish before any
+   * other thread uses the allocator.
+   */
+  ConcurrentBitmap(std::atomic<Unit> * ptr, SizeType bc)
+      : units(ptr), bitCount(bc) {
+    assert(bc / UnitBitCount < ansa::NumericInfo<size_t>::max);
+    if (!bc) return;
+    // Clear the bits that this bitmap owns in the last unit without touching
+    // the rest of it.
+    SizeType lastUnit = (bc - 1) / UnitBitCount;
+    for (SizeType i = 0; i < lastUnit; ++i) {
+      UnitAt(i).store(0, std::memory_order_relaxed);
+    }
+    UnitAt(lastUnit).fetch_and((Unit)~RangeMask(0, bc - lastUnit *
+                                                   UnitBitCount),
+                               std::memory_order_relaxed);
+  }
+  
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    if (size > bitCount) {
+      return false;
+    } else if (!size) {
+      addressOut = 0;
+      return true;
+    }
+    SizeType index;
+    if (size <= UnitBitCount && AllocInUnit(index, size)) {
+      addressOut = (AddressType)index;
+      return true;
+    }
+    if (!AllocAcrossUnits(index, size)) {
+      return false;
+    }
+    addressOut = (AddressType)index;
+    return true;
+  }
+  
+  virtual void Dealloc(AddressType address, SizeType size) {
+    assert((SizeType)address == address);
+    assert(!ansa::AddWraps<SizeType>((SizeType)address, size));
+    assert((SizeType)address + size <= bitCount);
+    SizeType idx = (SizeType)address;
+    while (size) {
+      SizeType bit = idx % UnitBitCount;
+      SizeType count = ansa::Min<SizeType>(size, UnitBitCount - bit);
+      Unit mask = RangeMask(bit, count);
+      std::atomic<Unit> & unit = UnitAt(idx / UnitBitCount);
+      Unit old = unit.fetch_and((Unit)~mask, std::memory_order_release);
+      assert((old & mask) == mask);
+      (void)old;
+      idx += count;
+      size -= count;
+    }
+  }
+  
+  /**
+   * Get the number of bits in this bitmap.
+   */
+  inline SizeType GetBitCount() const {
+    return bitCount;
+  }
+  
+  /**
+   * Get the number of units which contain at least one bit of this bitmap.
+   */
+  inline SizeType GetUnitCount() const {
+    return bitCount / UnitBitCount + (bitCount % UnitBitCount ? 1 : 0);
+  }
+  
+  /**
+   * Read the bit at a given index [idx].
+   *
+   * The result may be out of date by the time it is returned if other threads
+   * are using the bitmap.
+   */
+  bool GetBit(SizeType idx) const {
+    assert(idx < bitCount);
+    Unit unit = UnitAt(idx / UnitBitCount).load(std::memory_order_acquire);
+    return (unit & ((Unit)1 << (idx % UnitBitCount))) != 0;
+  }
+  
+protected:
+  std::atomic<Unit> * units;
+  SizeType bitCount;
+  
+  inline std::atomic<Unit> & UnitAt(SizeType idx) {
+    return units[(size_t)idx];
+  }
+  
+  inline const std::atomic<Unit> & UnitAt(SizeType idx) const {
+    return units[(size_t)idx];
+  }
+  
+  /**
+   * Load a unit with the bits past the end of the bitmap set.
+   */
+  inline Unit LoadUnit(SizeType idx) const {
+    return UnitAt(idx).load(std::memory_order_acquire) | PaddingMask(idx);
+  }
+  
+  /**
+   * A mask of the bits in the unit at [idx] which lie past the end of the
+   * bitmap.
+   */
+  inline Unit PaddingMask(SizeType idx) const {
+    if (idx != bitCount / UnitBitCount) {
+      return 0;
+    }
+    return (Unit)~RangeMask(0, bitCount % UnitBitCount);
+  }
+  
+  /**
+   * Returns a reference to the calling thread's search hint, which is a unit
+   * index that may be out of range for this bitmap.
+   *
+   * The first time a thread uses any [ConcurrentBitmap], its hint is spread
+   * away from the hints of the threads which came before it.
+   */
+  static SizeType & ThreadHint() {
+    static std::atomic<size_t> threadCount(0);
+    static thread_local bool initialized = false;
+    static thread_local SizeType hint = 0;
+    if (!initialized) {
+      // Multiplying by a large odd constant scatters the thread indexes over
+      // the whole range of [SizeType].
+      size_t index = threadCount.fetch_add(1, std::memory_order_relaxed);
+      hint = (SizeType)(index * (size_t)0x9e3779b97f4a7c15ULL);
+      initialized = true;
+    }
+    return hint;
+  }
+  
+  /**
+   * Allocate a run of [size] bits which fits inside one unit.
+   *
+   * This visits every unit once, beginning at the calling thread's hint.
+   */
+  bool AllocInUnit(SizeType & idx, SizeType size) {
+    SizeType unitCount = GetUnitCount();
+    SizeType & hint = ThreadHint();
+    SizeType unitIndex = hint % unitCount;
+    for (SizeType i = 0; i < unitCount; ++i) {
+      std::atomic<Unit> & atomicUnit = UnitAt(unitIndex);
+      Unit padding = PaddingMask(unitIndex);
+      Unit unit = atomicUnit.load(std::memory_order_acquire);
+      while (true) {
+        Unit starts = UnitRunStarts<Unit>((Unit)~(unit | padding),
+                                          (int)size);
+        if (!starts) break;
+        SizeType bit = (SizeType)UnitBitScanRight<Unit>(starts);
+        if (atomicUnit.compare_exchange_weak(unit,
+                                             unit | RangeMask(bit, size),
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire)) {
+          hint = unitIndex;
+          idx = unitIndex * UnitBitCount + bit;
+          return true;
+        }
+        // [unit] now holds the latest value, so look again.
+      }
+      if (++unitIndex == unitCount) {
+        unitIndex = 0;
+      }
+    }
+    return false;
+  }
+  
+  /**
+   * Allocate a run of [size] bits which may span multiple units.
+   *
+   * Like [AllocInUnit], this begins at the calling thread's hint and wraps
+   * around to the beginning of the bitmap.
+   */
+  bool AllocAcrossUnits(SizeType & idx, SizeType size) {
+    SizeType unitCount = GetUnitCount();
+    SizeType & hint = ThreadHint();
+    SizeType firstUnit = hint % unitCount;
+    if (!AllocRunStartingIn(idx, size, firstUnit, unitCount) &&
+        !(firstUnit && AllocRunStartingIn(idx, size, 0, firstUnit))) {
+      return false;
+    }
+    // The last unit of the run is the only one which may have bits left.
+    hint = (idx + (size - 1)) / UnitBitCount;
+    return true;
+  }
+  
+  /**
+   * Allocate a run of [size] bits which starts in one of the units in the
+   * range [startUnit, endUnit), but which may extend past [endUnit].
+   *
+   * Runs are found in a snapshot of the bitmap, then claimed a unit at a
+   * time. If a claim fails, the search resumes at the unit which could not be
+   * claimed.
+   */
+  bool AllocRunStartingIn(SizeType & idx, SizeType size, SizeType startUnit,
+                          SizeType endUnit) {
+    SizeType runStart = 0;
+    SizeType runLength = 0;
+    SizeType unitCount = GetUnitCount();
+    SizeType unitIndex = startUnit;
+    while (unitIndex < unitCount) {
+      if (!runLength && unitIndex >= endUnit) {
+        return false;
+      }
+      Unit unit = LoadUnit(unitIndex);
+      if (!runLength) {
+        runStart = unitIndex * UnitBitCount;
+      }
+      // The run ends at this unit's lowest used bit
+      SizeType available = (SizeType)UnitBitScanRight<Unit>(unit);
+      if (size - runLength <= available) {
+        SizeType conflict;
+        if (Claim(runStart, size, conflict)) {
+          idx = runStart;
+          return true;
+        }
+        // Look at the unit which could not be claimed again
+        runLength = 0;
+        unitIndex = conflict;
+        continue;
+      } else if (!unit) {
+        runLength += UnitBitCount;
+        ++unitIndex;
+        continue;
+      }
+      // Start a new run with the free bits at the top of this unit
+      runLength = UnitBitCount - 1 - (SizeType)UnitBitScanLeft<Unit>(unit);
+      runStart = (unitIndex + 1) * UnitBitCount - runLength;
+      ++unitIndex;
+    }
+    return false;
+  }
+  
+  /**
+   * Atomically set [size] bits starting at [idx], a unit at a time.
+   *
+   * If one of the bits is already set, the units which were claimed so far
+   * are released, [conflict] is set to the index of the offending unit, and
+   * `false` is returned.
+   */
+  bool Claim(SizeType idx, SizeType size, SizeType & conflict) {
+    SizeType done = 0;
+    while (done < size) {
+      SizeType bit = (idx + done) % UnitBitCount;
+      SizeType count = ansa::Min<SizeType>(size - done, UnitBitCount - bit);
+      Unit mask = RangeMask(bit, count);
+      std::atomic<Unit> & atomicUnit = UnitAt((idx + done) / UnitBitCount);
+      Unit unit = atomicUnit.load(std::memory_order_relaxed);
+      do {
+        if (unit & mask) {
+          conflict = (idx + done) / UnitBitCount;
+          if (done) {
+            Dealloc(idx, done);
+          }
+          return false;
+        }
+      } while (!atomicUnit.compare_exchange_weak(unit, unit | mask,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed));
+      done += count;
+    }
+    return true;
+  }
+  
+  /**
+   * A mask of [len] bits starting at bit [bit] of a unit. The range must not
+   * extend past the end of the unit.
+   */
+  static inline Unit RangeMask(SizeType bit, SizeType len) {
+    assert(len <= UnitBitCount - bit);
+    if (!len) return 0;
+    return (Unit)((Unit)((Unit)~(Unit)0 >> (UnitBitCount - len)) << bit);
+  }
+};
+
+}
+
+#endif
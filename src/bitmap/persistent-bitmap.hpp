@@ -0,0 +1,356 @@
+#ifndef __ANALLOC2_PERSISTENT_BITMAP_HPP__
+#define __ANALLOC2_PERSISTENT_BITMAP_HPP__
+
+#include "bitmap.hpp"
+#include <ansa/cstring>
+#include <cstdint>
+
+namespace analloc {
+
+/**
+ * The stable storage behind the region of a [PersistentBitmap], such as a
+ * memory-mapped file.
+ */
+class PersistentStore {
+public:
+  virtual ~PersistentStore() {}
+  
+  /**
+   * Write the [length] bytes at [start] through to stable storage, and return
+   * once they are durable. With a memory-mapped file, this is `msync()`.
+   *
+   * Returns `false` if the bytes could not be written.
+   */
+  virtual bool Flush(const void * start, size_t length) = 0;
+};
+
+/**
+ * A [Bitmap] which lives in a region of persistent memory, like a mapped
+ * file, and survives crashes without losing or double-allocating bits.
+ *
+ * The region holds a header, an intent log, and the bitmap's units. Before
+ * any bits change, the change is appended to the log and flushed. The units
+ * themselves are only flushed by [Sync], which writes every dirty unit in one
+ * batch and then empties the log. Reopening the region replays the records
+ * which were logged since the last [Sync], so it never rescans the bitmap.
+ *
+ * An operation which was interrupted by a crash is either replayed in full
+ * or not at all.
+ */
+template <typename Unit, typename AddressType, typename SizeType = AddressType>
+class PersistentBitmap
+    : protected Bitmap<Unit, AddressType, SizeType>,
+      public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
+public:
+  typedef Bitmap<Unit, AddressType, SizeType> super;
+  typedef RawBitmap<Unit, SizeType> RawType;
+  
+  struct Header {
+    uint64_t magic;
+    uint64_t unitSize;
+    uint64_t bitCount;
+    uint64_t logCapacity;
+    uint64_t check;
+    
+    /**
+     * The sequence number of the last record whose change has reached the
+     * flushed units.
+     */
+    uint64_t checkpoint;
+  };
+  
+  struct Record {
+    uint64_t sequence;
+    uint64_t index;
+    
+    /**
+     * The number of bits which were changed, with [FreeFlag] set if they
+     * were freed rather than allocated.
+     */
+    uint64_t length;
+    uint64_t check;
+  };
+  
+  static constexpr uint64_t Magic = 0x50424d5041324e41ULL;
+  static constexpr uint64_t FreeFlag = (uint64_t)1 << 63;
+  
+  /**
+   * Returns the number of bytes in a region for a bitmap with [bc] bits and
+   * room for [logCapacity] records between calls to [Sync].
+   */
+  static size_t RegionSize(SizeType bc, size_t logCapacity) {
+    return UnitsOffset(logCapacity) +
+        (size_t)ansa::RoundUpDiv<SizeType>(bc, super::UnitBitCount) *
+        sizeof(Unit);
+  }
+  
+  /**
+   * Returns `true` if [region] contains a bitmap which was formatted with the
+   * same bit count, log capacity and unit type.
+   */
+  static bool IsFormatted(const void * region, SizeType bc,
+                          size_t logCapacity) {
+    const Header & header = *(const Header *)region;
+    return header.magic == Magic && header.unitSize == sizeof(Unit) &&
+        header.bitCount == (uint64_t)bc &&
+        header.logCapacity == (uint64_t)logCapacity &&
+        header.check == HeaderCheck(header);
+  }
+  
+  /**
+   * Write an empty bitmap with [bc] bits to [region], which must be
+   * `RegionSize(bc, logCapacity)` bytes and aligned to a [Unit].
+   *
+   * The header is flushed last, so a region whose formatting is interrupted
+   * is never mistaken for a formatted one. Returns `false` if [store] could
+   * not flush the region.
+   */
+  static bool Format(void * region, SizeType bc, size_t logCapacity,
+                     PersistentStore & store) {
+    Header & header = *(Header *)region;
+    header.magic = 0;
+    if (!store.Flush(&header.magic, sizeof(header.magic))) {
+      return false;
+    }
+    size_t size = RegionSize(bc, logCapacity);
+    ansa::Bzero((uint8_t *)region + sizeof(Header), size - sizeof(Header));
+    if (!store.Flush((uint8_t *)region + sizeof(Header),
+                     size - sizeof(Header))) {
+      return false;
+    }
+    header.unitSize = sizeof(Unit);
+    header.bitCount = (uint64_t)bc;
+    header.logCapacity = (uint64_t)logCapacity;
+    header.checkpoint = 0;
+    header.magic = Magic;
+    header.check = HeaderCheck(header);
+    return store.Flush(&header, sizeof(Header));
+  }
+  
+  /**
+   * Open the bitmap in a [region] which was created by [Format] with the same
+   * arguments, and replay any records which were logged after the last
+   * [Sync].
+   */
+  PersistentBitmap(void * region, SizeType bc, size_t logCapacity,
+                   PersistentStore & aStore)
+      : super((Unit *)((uint8_t *)region + UnitsOffset(logCapacity)), bc,
+              BitmapPreZeroed),
+        header((Header *)region),
+        log((Record *)((uint8_t *)region + sizeof(Header))),
+        capacity(logCapacity), store(aStore) {
+    assert(IsFormatted(region, bc, logCapacity));
+    assert(capacity > 0);
+    dirtyStart = this->GetUnitCount();
+    Replay();
+    if (logHead) {
+      Sync();
+    }
+  }
+  
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    if (size > this->GetBitCount()) {
+      return false;
+    } else if (!size) {
+      addressOut = 0;
+      return true;
+    }
+    SizeType index;
+    if (!this->FindNextRun(index, size) || !LogIntent(index, size, false)) {
+      return false;
+    }
+    this->Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
+  }
+  
+  virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
+                           AddressType offset, SizeType size) {
+    if (size > this->GetBitCount()) {
+      return false;
+    } else if (align < 2 || !size) {
+      return this->Alloc(addressOut, size);
+    }
+    SizeType index;
+    if (!this->FindNextAligned(index, align, offset, size) ||
+        !LogIntent(index, size, false)) {
+      return false;
+    }
+    this->Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
+  }
+  
+  /**
+   * Free [size] bits at [address].
+   *
+   * If the intent cannot be flushed, the bits are still freed, but the free
+   * is not durable until the next successful [Sync].
+   */
+  virtual void Dealloc(AddressType address, SizeType size) {
+    assert((SizeType)address == address);
+    assert(!ansa::AddWraps<SizeType>((SizeType)address, size));
+    assert((SizeType)address + size <= this->GetBitCount());
+    if (!size) return;
+    LogIntent((SizeType)address, size, true);
+    super::Dealloc(address, size);
+  }
+  
+  /**
+   * Grow or shrink the [size] bits at [address] to [newSize] bits, logging
+   * the bits which change like any other allocation or free.
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    if (newSize <= size) {
+      Dealloc(address + newSize, size - newSize);
+      return true;
+    }
+    SizeType end = (SizeType)address + size;
+    if (!this->IsRunFree(end, newSize - size) ||
+        !LogIntent(end, newSize - size, false)) {
+      return false;
+    }
+    this->MarkUsed(end, newSize - size);
+    return true;
+  }
+  
+  /**
+   * Flush every unit which has changed since the last [Sync], then empty the
+   * intent log.
+   *
+   * This is called automatically when the log fills up. Calling it more often
+   * shortens the log which must be replayed after a crash. Returns `false`
+   * if [store] could not flush the units or the header.
+   */
+  bool Sync() {
+    if (dirtyStart < dirtyEnd) {
+      if (!store.Flush(&this->UnitAt(dirtyStart),
+                       (size_t)(dirtyEnd - dirtyStart) * sizeof(Unit))) {
+        return false;
+      }
+      dirtyStart = this->GetUnitCount();
+      dirtyEnd = 0;
+    }
+    if (!logHead) {
+      return true;
+    }
+    // The log may only be reused once the new checkpoint is durable. Until
+    // then, its records are kept so that they can be replayed on top of
+    // either checkpoint.
+    header->checkpoint += logHead;
+    if (!store.Flush(&header->checkpoint, sizeof(header->checkpoint))) {
+      header->checkpoint -= logHead;
+      return false;
+    }
+    logHead = 0;
+    return true;
+  }
+  
+  using super::GetBitCount;
+  using super::SetNextFit;
+  using super::IsNextFit;
+  using super::LastUsedAddress;
+  using RawType::GetBit;
+  
+  /**
+   * Get the number of records which have been logged since the last [Sync].
+   */
+  inline size_t GetLogCount() const {
+    return logHead;
+  }
+  
+protected:
+  Header * header;
+  Record * log;
+  size_t capacity;
+  size_t logHead = 0;
+  PersistentStore & store;
+  
+  /**
+   * The range of units which have changed since the last [Sync].
+   */
+  SizeType dirtyStart;
+  SizeType dirtyEnd = 0;
+  
+  static size_t UnitsOffset(size_t logCapacity) {
+    size_t offset = sizeof(Header) + logCapacity * sizeof(Record);
+    return ansa::RoundUpDiv<size_t>(offset, alignof(Unit)) * alignof(Unit);
+  }
+  
+  static uint64_t HeaderCheck(const Header & header) {
+    return Mix(Mix(Mix(header.magic, header.unitSize), header.bitCount),
+               header.logCapacity);
+  }
+  
+  static uint64_t RecordCheck(const Record & record) {
+    return Mix(Mix(Mix(Magic, record.sequence), record.index),
+               record.length);
+  }
+  
+  static inline uint64_t Mix(uint64_t hash, uint64_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    return hash * 0xff51afd7ed558ccdULL;
+  }
+  
+  virtual void UnitsChanged(SizeType idx, SizeType len) {
+    dirtyStart = ansa::Min<SizeType>(dirtyStart, idx / this->UnitBitCount);
+    dirtyEnd = ansa::Max<SizeType>(dirtyEnd, (idx + (len - 1)) /
+                                   this->UnitBitCount + 1);
+  }
+  
+  /**
+   * Append a record for a change to [length] bits at [index] and flush it.
+   *
+   * If the record cannot be flushed, it is invalidated in memory so that a
+   * later write-back cannot make it look durable, and `false` is returned.
+   */
+  bool LogIntent(SizeType index, SizeType length, bool isFree) {
+    if (logHead == capacity && !Sync()) {
+      return false;
+    }
+    Record & record = log[logHead];
+    record.sequence = header->checkpoint + 1 + logHead;
+    record.index = (uint64_t)index;
+    record.length = (uint64_t)length | (isFree ? FreeFlag : 0);
+    record.check = RecordCheck(record);
+    if (!store.Flush(&record, sizeof(Record))) {
+      record.check = ~record.check;
+      return false;
+    }
+    ++logHead;
+    return true;
+  }
+  
+  /**
+   * Apply the records which follow the checkpoint, in order, stopping at the
+   * first one which is stale or was torn by a crash.
+   */
+  void Replay() {
+    while (logHead < capacity) {
+      const Record & record = log[logHead];
+      if (record.sequence != header->checkpoint + 1 + logHead ||
+          record.check != RecordCheck(record)) {
+        break;
+      }
+      SizeType index = (SizeType)record.index;
+      SizeType length = (SizeType)(record.length & ~FreeFlag);
+      assert(!ansa::AddWraps<SizeType>(index, length));
+      assert(index + length <= this->GetBitCount());
+      if (record.length & FreeFlag) {
+        this->ClearRange(index, length);
+      } else {
+        this->SetRange(index, length);
+      }
+      if (length) {
+        UnitsChanged(index, length);
+      }
+      ++logHead;
+    }
+  }
+};
+
+}
+
+#endif
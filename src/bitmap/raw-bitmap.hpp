@@ -3,7 +3,7 @@
 
 #include <cstddef>
 #include <cassert>
-#include <ansa/math>
+#include "unit-math.hpp"
 
 namespace analloc {
 
@@ -20,16 +20,14 @@ namespace analloc {
 template <typename Unit = unsigned int, typename IndexType = size_t>
 class RawBitmap {
 public:
-  static constexpr IndexType UnitBitCount =
-      (IndexType)ansa::NumericInfo<Unit>::bitCount;
+  static constexpr IndexType UnitBitCount = (IndexType)(sizeof(Unit) * 8);
   
   /**
    * Create a new [RawBitmap] with a region of memory [ptr] and a bit count
    * [bc].
    */
   RawBitmap(Unit * ptr, IndexType bc) : units(ptr), bitCount(bc) {
-    assert(bc / ansa::NumericInfo<Unit>::bitCount <
-           ansa::NumericInfo<size_t>::max);
+    assert(bc / UnitBitCount < ansa::NumericInfo<size_t>::max);
   }
   
   /**
@@ -104,6 +102,93 @@ public:
     return result;
   }
   
+  /**
+   * Set [len] bits starting at [idx] to `1`.
+   *
+   * This operates on entire units at a time, only masking the first and last
+   * units of the range.
+   */
+  void SetRange(IndexType idx, IndexType len) {
+    assert(!ansa::AddWraps<IndexType>(idx, len));
+    assert(idx + len <= bitCount);
+    if (!len) return;
+    IndexType firstUnit = idx / UnitBitCount;
+    IndexType lastUnit = (idx + (len - 1)) / UnitBitCount;
+    if (firstUnit == lastUnit) {
+      UnitAt(firstUnit) |= RangeMask(idx % UnitBitCount, len);
+      return;
+    }
+    UnitAt(firstUnit) |= HeadMask(idx % UnitBitCount);
+    for (IndexType i = firstUnit + 1; i < lastUnit; ++i) {
+      UnitAt(i) = (Unit)~(Unit)0;
+    }
+    UnitAt(lastUnit) |= TailMask(idx + (len - 1));
+  }
+  
+  /**
+   * Set [len] bits starting at [idx] to `0`.
+   *
+   * This operates on entire units at a time, only masking the first and last
+   * units of the range.
+   */
+  void ClearRange(IndexType idx, IndexType len) {
+    assert(!ansa::AddWraps<IndexType>(idx, len));
+    assert(idx + len <= bitCount);
+    if (!len) return;
+    IndexType firstUnit = idx / UnitBitCount;
+    IndexType lastUnit = (idx + (len - 1)) / UnitBitCount;
+    if (firstUnit == lastUnit) {
+      UnitAt(firstUnit) &= ~RangeMask(idx % UnitBitCount, len);
+      return;
+    }
+    UnitAt(firstUnit) &= ~HeadMask(idx % UnitBitCount);
+    for (IndexType i = firstUnit + 1; i < lastUnit; ++i) {
+      UnitAt(i) = 0;
+    }
+    UnitAt(lastUnit) &= ~TailMask(idx + (len - 1));
+  }
+  
+  /**
+   * Find the first bit which is set in the [len] bits starting at [idx].
+   *
+   * Returns `false` if every bit in the range is `0`. Otherwise, returns
+   * `true` and sets [result] to the index of the first set bit.
+   */
+  bool FindFirstSet(IndexType idx, IndexType len, IndexType & result) const {
+    assert(!ansa::AddWraps<IndexType>(idx, len));
+    assert(idx + len <= bitCount);
+    if (!len) return false;
+    IndexType firstUnit = idx / UnitBitCount;
+    IndexType lastUnit = (idx + (len - 1)) / UnitBitCount;
+    Unit unit;
+    if (firstUnit == lastUnit) {
+      unit = UnitAt(firstUnit) & RangeMask(idx % UnitBitCount, len);
+    } else {
+      unit = UnitAt(firstUnit) & HeadMask(idx % UnitBitCount);
+      IndexType i = firstUnit;
+      while (!unit && ++i < lastUnit) {
+        unit = UnitAt(i);
+      }
+      if (!unit) {
+        i = lastUnit;
+        unit = UnitAt(lastUnit) & TailMask(idx + (len - 1));
+      }
+      firstUnit = i;
+    }
+    if (!unit) return false;
+    result = firstUnit * UnitBitCount +
+        (IndexType)UnitBitScanRight<Unit>(unit);
+    return true;
+  }
+  
+  /**
+   * Returns `true` if all [len] bits starting at [idx] are `0`.
+   */
+  inline bool IsRangeClear(IndexType idx, IndexType len) const {
+    IndexType ignored;
+    return !FindFirstSet(idx, len, ignored);
+  }
+  
   /**
    * Get the number of bits in this bitmap.
    */
@@ -111,6 +196,13 @@ public:
     return bitCount;
   }
   
+  /**
+   * Get the number of units which contain at least one bit of this bitmap.
+   */
+  inline IndexType GetUnitCount() const {
+    return bitCount / UnitBitCount + (bitCount % UnitBitCount ? 1 : 0);
+  }
+  
 protected:
   Unit * units;
   IndexType bitCount;
@@ -122,6 +214,31 @@ protected:
   inline const Unit & UnitAt(IndexType idx) const {
     return units[(size_t)idx];
   }
+  
+  /**
+   * A mask of the bits in a unit at and above bit [bit].
+   */
+  static inline Unit HeadMask(IndexType bit) {
+    return (Unit)((Unit)~(Unit)0 << bit);
+  }
+  
+  /**
+   * A mask of the bits in a unit at and below the bit which corresponds to
+   * the bitmap index [lastIdx].
+   */
+  static inline Unit TailMask(IndexType lastIdx) {
+    return (Unit)((Unit)~(Unit)0 >> (UnitBitCount - 1 -
+                                     lastIdx % UnitBitCount));
+  }
+  
+  /**
+   * A mask of [len] bits starting at bit [bit] of a unit. The range must not
+   * extend past the end of the unit, and [len] must not be 0.
+   */
+  static inline Unit RangeMask(IndexType bit, IndexType len) {
+    assert(len && len <= UnitBitCount - bit);
+    return (Unit)((Unit)((Unit)~(Unit)0 >> (UnitBitCount - len)) << bit);
+  }
 };
 
 }
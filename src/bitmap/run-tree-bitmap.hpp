@@ -0,0 +1,417 @@
+#ifndef __ANALLOC2_RUN_TREE_BITMAP_HPP__
+#define __ANALLOC2_RUN_TREE_BITMAP_HPP__
+
+#include "bitmap.hpp"
+
+namespace analloc {
+
+/**
+ * A [Bitmap] which keeps a segment tree of free runs on top of its units.
+ *
+ * Every leaf of the tree describes one unit, and every other node describes
+ * the units below it: the number of free bits at its low end, the number of
+ * free bits at its high end, and the length of its longest free run. This
+ * lets a run of any size be found in O(log n) time, where n is the number of
+ * units, and lets aligned searches skip every region which is too small.
+ *
+ * By default, allocations return the lowest possible free index, just like a
+ * normal [Bitmap]. In best-fit mode, they are taken from the smallest free
+ * run which can hold them instead.
+ */
+template <typename Unit, typename AddressType, typename SizeType = AddressType>
+class RunTreeBitmap : public Bitmap<Unit, AddressType, SizeType> {
+public:
+  typedef Bitmap<Unit, AddressType, SizeType> super;
+  
+  /**
+   * The free runs in a subtree of the bitmap.
+   */
+  struct Node {
+    SizeType prefix;
+    SizeType suffix;
+    SizeType longest;
+  };
+  
+  /**
+   * The maximum depth of the tree, plus one for the leaves.
+   */
+  static constexpr int MaxLevels = ansa::NumericInfo<SizeType>::bitCount + 1;
+  
+  /**
+   * Returns the number of nodes which a [RunTreeBitmap] with a bit count of
+   * [bc] needs for its tree buffer.
+   */
+  static size_t TreeNodeCount(SizeType bc) {
+    return LeafCount(ansa::RoundUpDiv<SizeType>(bc, super::UnitBitCount)) * 2;
+  }
+  
+  /**
+   * Create a new [RunTreeBitmap] given a region of memory [ptr] and a bit
+   * count [bc].
+   *
+   * The [treePtr] buffer must contain at least `TreeNodeCount(bc)` nodes. It
+   * is always filled in by this constructor, so construction takes O(n) time
+   * even when [init] defers zeroing the bitmap itself.
+   */
+  RunTreeBitmap(Unit * ptr, SizeType bc, Node * treePtr,
+                BitmapInit init = BitmapZero)
+      : super(ptr, bc, init), tree(treePtr) {
+    leafCount = LeafCount(this->GetUnitCount());
+    levelBits[0] = super::UnitBitCount;
+    while (((size_t)1 << depth) < leafCount) {
+      assert(depth + 1 < MaxLevels);
+      SizeType bits = levelBits[depth];
+      if (bits > ansa::NumericInfo<SizeType>::max / 2) {
+        // Such a node must contain bits past the end of the bitmap, so it
+        // can never be completely free.
+        levelBits[depth + 1] = ansa::NumericInfo<SizeType>::max;
+      } else {
+        levelBits[depth + 1] = bits * 2;
+      }
+      ++depth;
+    }
+    for (size_t i = 0; i < leafCount; ++i) {
+      tree[leafCount + i] = LeafNode(i);
+    }
+    size_t first = leafCount;
+    for (int level = 1; level <= depth; ++level) {
+      first /= 2;
+      for (size_t i = first; i < first * 2; ++i) {
+        tree[i] = Merge(tree[i * 2], tree[i * 2 + 1], level);
+      }
+    }
+  }
+  
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    if (size > this->GetBitCount()) {
+      return false;
+    } else if (!size) {
+      addressOut = 0;
+      return true;
+    }
+    SizeType index;
+    if (!FindFit(index, size, 1, 0)) {
+      return false;
+    }
+    this->Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
+  }
+  
+  virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
+                           AddressType offset, SizeType size) {
+    if (size > this->GetBitCount()) {
+      return false;
+    } else if (align < 2 || !size) {
+      return this->Alloc(addressOut, size);
+    }
+    SizeType index;
+    if (!FindFit(index, size, align, offset)) {
+      return false;
+    }
+    this->Claim(index, size);
+    addressOut = (AddressType)index;
+    return true;
+  }
+  
+  /**
+   * Enable or disable best-fit allocation.
+   *
+   * In best-fit mode, every allocation comes from the smallest free run which
+   * can hold it, and the lowest such run if there is a tie. This keeps large
+   * runs intact when requests of many different sizes are mixed. Finding the
+   * best run takes O(k log n) time, where k is the number of free runs which
+   * are big enough. Best-fit takes precedence over next-fit.
+   */
+  inline void SetBestFit(bool flag) {
+    bestFit = flag;
+  }
+  
+  inline bool IsBestFit() const {
+    return bestFit;
+  }
+  
+  /**
+   * Returns the length of the longest run of free bits.
+   */
+  inline SizeType LongestFreeRun() const {
+    return tree[1].longest;
+  }
+  
+protected:
+  Node * tree;
+  size_t leafCount;
+  int depth = 0;
+  SizeType levelBits[MaxLevels];
+  bool bestFit = false;
+  
+  virtual void UnitsChanged(SizeType idx, SizeType len) {
+    size_t first = (size_t)(idx / super::UnitBitCount);
+    size_t last = (size_t)((idx + (len - 1)) / super::UnitBitCount);
+    for (size_t i = first; i <= last; ++i) {
+      tree[leafCount + i] = LeafNode(i);
+    }
+    first += leafCount;
+    last += leafCount;
+    for (int level = 1; level <= depth; ++level) {
+      first /= 2;
+      last /= 2;
+      for (size_t i = first; i <= last; ++i) {
+        tree[i] = Merge(tree[i * 2], tree[i * 2 + 1], level);
+      }
+    }
+  }
+  
+  /**
+   * Find where to allocate [size] aligned bits according to the allocation
+   * mode. An [align] of 1 means that any index will do.
+   */
+  bool FindFit(SizeType & idx, SizeType size, AddressType align,
+               AddressType offset) {
+    SizeType lastStart = this->GetBitCount() - size;
+    if (bestFit || !this->nextFit || !this->cursor) {
+      return FindFitInRange(idx, size, 0, lastStart, align, offset);
+    }
+    if (this->cursor <= lastStart &&
+        FindFitInRange(idx, size, this->cursor, lastStart, align, offset)) {
+      return true;
+    }
+    // Wrap around to the beginning of the bitmap
+    SizeType wrapLimit = ansa::Min<SizeType>(this->cursor - 1, lastStart);
+    return FindFitInRange(idx, size, 0, wrapLimit, align, offset);
+  }
+  
+  /**
+   * Find an index [idx] in the range [start, lastStart] at which [size]
+   * aligned bits are free.
+   *
+   * Free runs which can hold [size] bits are visited from lowest to highest.
+   * Each run yields its lowest aligned index, if it has one which leaves
+   * enough room. In best-fit mode, every run is visited until one is found
+   * which is exactly big enough.
+   */
+  bool FindFitInRange(SizeType & idx, SizeType size, SizeType start,
+                      SizeType lastStart, AddressType align,
+                      AddressType offset) {
+    bool found = false;
+    SizeType bestLength = 0;
+    SizeType runStart = start;
+    while (runStart <= lastStart && FindRun(runStart, size, runStart)) {
+      if (runStart > lastStart) {
+        break;
+      }
+      SizeType runEnd = NextUsed(runStart + size);
+      SizeType index = runStart;
+      if (this->AlignIndex(index, align, offset) && index <= lastStart &&
+          index < runEnd && runEnd - index >= size) {
+        SizeType length = runEnd - runStart;
+        if (!bestFit || length == size) {
+          idx = index;
+          return true;
+        } else if (!found || length < bestLength) {
+          found = true;
+          bestLength = length;
+          idx = index;
+        }
+      }
+      runStart = runEnd;
+    }
+    return found;
+  }
+  
+  /**
+   * Find the lowest index [idx] at or after [start] at which [size]
+   * consecutive bits are free.
+   */
+  bool FindRun(SizeType & idx, SizeType size, SizeType start) {
+    SizeType carry = 0;
+    return SearchNode(idx, size, start, 1, depth, 0, carry);
+  }
+  
+  /**
+   * Search the subtree rooted at [node], which sits at [level] and begins at
+   * the unit [firstUnit], for the lowest run of [size] free bits at or after
+   * [start].
+   *
+   * The [carry] argument is the number of free bits which lead up to the
+   * subtree. When the subtree does not finish a run, it is updated to the
+   * number of free bits which lead out of it.
+   */
+  bool SearchNode(SizeType & idx, SizeType size, SizeType start, size_t node,
+                  int level, size_t firstUnit, SizeType & carry) {
+    size_t startUnit = (size_t)(start / super::UnitBitCount);
+    if (firstUnit >= (size_t)this->GetUnitCount() ||
+        firstUnit + ((size_t)1 << level) <= startUnit) {
+      return false;
+    }
+    SizeType firstBit = (SizeType)firstUnit * super::UnitBitCount;
+    if (firstBit >= start) {
+      const Node & info = tree[node];
+      if (carry + info.prefix >= size) {
+        idx = firstBit - carry;
+        return true;
+      } else if (info.longest < size) {
+        if (info.prefix == levelBits[level]) {
+          carry += info.prefix;
+        } else {
+          carry = info.suffix;
+        }
+        return false;
+      }
+    }
+    if (!level) {
+      return SearchLeaf(idx, size, start, firstUnit, carry);
+    }
+    size_t half = (size_t)1 << (level - 1);
+    return SearchNode(idx, size, start, node * 2, level - 1, firstUnit,
+                      carry) ||
+        SearchNode(idx, size, start, node * 2 + 1, level - 1,
+                   firstUnit + half, carry);
+  }
+  
+  bool SearchLeaf(SizeType & idx, SizeType size, SizeType start,
+                  size_t unitIndex, SizeType & carry) {
+    SizeType firstBit = (SizeType)unitIndex * super::UnitBitCount;
+    Unit unit = LeafUnit(unitIndex);
+    if (firstBit < start) {
+      // Bits before [start] are not candidates
+      unit |= (Unit)~this->HeadMask(start - firstBit);
+    }
+    if (!unit) {
+      if (carry + super::UnitBitCount >= size) {
+        idx = firstBit - carry;
+        return true;
+      }
+      carry += super::UnitBitCount;
+      return false;
+    }
+    if (carry + (SizeType)UnitBitScanRight<Unit>(unit) >= size) {
+      idx = firstBit - carry;
+      return true;
+    }
+    if (size < super::UnitBitCount) {
+      Unit starts = UnitRunStarts<Unit>((Unit)~unit, (int)size);
+      if (starts) {
+        idx = firstBit + (SizeType)UnitBitScanRight<Unit>(starts);
+        return true;
+      }
+    }
+    carry = super::UnitBitCount - 1 - (SizeType)UnitBitScanLeft<Unit>(unit);
+    return false;
+  }
+  
+  /**
+   * Returns the index of the first used bit at or after [idx], or the bit
+   * count if there is no such bit.
+   */
+  SizeType NextUsed(SizeType idx) {
+    if (idx >= this->GetBitCount()) {
+      return this->GetBitCount();
+    }
+    size_t unitIndex = (size_t)(idx / super::UnitBitCount);
+    Unit unit = LeafUnit(unitIndex) & this->HeadMask(idx % super::UnitBitCount);
+    if (!unit) {
+      // Climb until there is a right sibling which is not completely free,
+      // then descend to its first unit which is not completely free.
+      size_t node = leafCount + unitIndex;
+      int level = 0;
+      while (!(node % 2 == 0 && !IsFree(node + 1, level))) {
+        if (node == 1) {
+          return this->GetBitCount();
+        }
+        node /= 2;
+        ++level;
+      }
+      ++node;
+      while (level > 0) {
+        --level;
+        node *= 2;
+        if (IsFree(node, level)) {
+          ++node;
+        }
+      }
+      unitIndex = node - leafCount;
+      if (unitIndex >= (size_t)this->GetUnitCount()) {
+        return this->GetBitCount();
+      }
+      unit = LeafUnit(unitIndex);
+    }
+    // The padding bits of the last unit are set, so this may land exactly on
+    // the bit count.
+    return (SizeType)unitIndex * super::UnitBitCount +
+        (SizeType)UnitBitScanRight<Unit>(unit);
+  }
+  
+  inline bool IsFree(size_t node, int level) const {
+    return tree[node].prefix == levelBits[level];
+  }
+  
+  /**
+   * Load a unit with the bits past the end of the bitmap set.
+   */
+  inline Unit LeafUnit(size_t unitIndex) const {
+    SizeType idx = (SizeType)unitIndex;
+    Unit unit = this->LoadUnit(idx);
+    SizeType used = this->GetBitCount() % super::UnitBitCount;
+    if (used && idx == this->GetUnitCount() - 1) {
+      unit |= this->HeadMask(used);
+    }
+    return unit;
+  }
+  
+  Node LeafNode(size_t unitIndex) const {
+    Node result;
+    if (unitIndex >= (size_t)this->GetUnitCount()) {
+      result.prefix = result.suffix = result.longest = 0;
+      return result;
+    }
+    Unit unit = LeafUnit(unitIndex);
+    if (!unit) {
+      result.prefix = result.suffix = result.longest = super::UnitBitCount;
+      return result;
+    }
+    result.prefix = (SizeType)UnitBitScanRight<Unit>(unit);
+    result.suffix = super::UnitBitCount - 1 -
+        (SizeType)UnitBitScanLeft<Unit>(unit);
+    // Every step shortens each run of set bits by one
+    Unit clear = (Unit)~unit;
+    result.longest = 0;
+    while (clear) {
+      clear &= (Unit)(clear >> 1);
+      ++result.longest;
+    }
+    return result;
+  }
+  
+  /**
+   * Combine two sibling nodes into a node at [level].
+   */
+  Node Merge(const Node & left, const Node & right, int level) const {
+    SizeType childBits = levelBits[level - 1];
+    Node result;
+    result.prefix = left.prefix;
+    if (left.prefix == childBits) {
+      result.prefix += right.prefix;
+    }
+    result.suffix = right.suffix;
+    if (right.suffix == childBits) {
+      result.suffix += left.suffix;
+    }
+    result.longest = ansa::Max<SizeType>(ansa::Max<SizeType>(left.longest,
+                                                             right.longest),
+                                         left.suffix + right.prefix);
+    return result;
+  }
+  
+  static size_t LeafCount(SizeType unitCount) {
+    size_t result = 1;
+    while (result < (size_t)unitCount) {
+      result *= 2;
+    }
+    return result;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef __ANALLOC2_SHARDED_BITMAP_HPP__
+#define __ANALLOC2_SHARDED_BITMAP_HPP__
+
+#include "bitmap.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#if __STDC_HOSTED__
+#include <thread>
+#endif
+
+namespace analloc {
+
+/**
+ * The default back-off for the shard locks of a [ShardedBitmap].
+ *
+ * A lock holder which has been preempted cannot release the lock while we
+ * spin, so hosted builds give up the CPU after every failed attempt.
+ * Freestanding builds have no scheduler to yield to and simply spin.
+ */
+struct ShardedBitmapBackoff {
+  static inline void Pause() {
+#if __STDC_HOSTED__
+    std::this_thread::yield();
+#endif
+  }
+};
+
+/**
+ * A bitmap allocator which splits its bits into shards so that many threads
+ * (or CPUs) can allocate at once without sharing a lock.
+ *
+ * Every shard is a [Bitmap] over a whole number of units, guarded by its own
+ * spin lock. A thread allocates from its home shard first and only steals
+ * from the other shards, in order, once its home shard cannot satisfy the
+ * request. Freed bits always go back to the shard which owns them.
+ *
+ * Since no run may span two shards, an allocation can never be larger than a
+ * single shard.
+ *
+ * The [Backoff] class provides a static `Pause()` method which is called
+ * after every failed attempt to take a shard's lock.
+ */
+template <typename Unit, typename AddressType, typename SizeType = AddressType,
+          class Backoff = ShardedBitmapBackoff>
+class ShardedBitmap : public virtual Allocator<AddressType, SizeType> {
+public:
+  typedef Bitmap<Unit, SizeType> ShardBitmap;
+  
+  static constexpr SizeType UnitBitCount = (SizeType)(sizeof(Unit) * 8);
+  
+  /**
+   * The storage for a single shard. Shards are padded to a cache line so that
+   * the locks and counters of neighbouring shards never share one.
+   *
+   * Before C++17, `new Shard[count]` does not have to honor this alignment,
+   * so callers which allocate shards dynamically should use aligned storage
+   * such as `posix_memalign()`.
+   */
+  struct alignas(64) Shard {
+    typename std::aligned_storage<sizeof(ShardBitmap),
+                                  alignof(ShardBitmap)>::type bitmap;
+    std::atomic_flag lock;
+    std::atomic<SizeType> used;
+    SizeType firstBit;
+    SizeType bitCount;
+  };
+  
+  /**
+   * Create a new [ShardedBitmap] given a region of memory [ptr] and a bit
+   * count [bc], split between [count] shards stored in [shardPtr].
+   *
+   * The units are divided as evenly as possible, and every shard must get at
+   * least one unit. This constructor must finish before any other thread
+   * uses the allocator.
+   */
+  ShardedBitmap(Unit * ptr, SizeType bc, Shard * shardPtr, size_t count,
+                BitmapInit init = BitmapZero)
+      : shards(shardPtr), shardCount(count), bitCount(bc) {
+    assert(count > 0);
+    assert(count <= (size_t)GetUnitCount());
+    for (size_t i = 0; i < count; ++i) {
+      Shard & shard = shards[i];
+      SizeType firstUnit = FirstUnit(i);
+      shard.firstBit = firstUnit * UnitBitCount;
+      if (i + 1 == count) {
+        shard.bitCount = bc - shard.firstBit;
+      } else {
+        shard.bitCount = (FirstUnit(i + 1) - firstUnit) * UnitBitCount;
+      }
+      new(&shard.bitmap) ShardBitmap(ptr + firstUnit, shard.bitCount, init);
+      shard.lock.clear(std::memory_order_relaxed);
+      shard.used.store(0, std::memory_order_relaxed);
+    }
+  }
+  
+  virtual ~ShardedBitmap() {
+    for (size_t i = 0; i < shardCount; ++i) {
+      BitmapOf(shards[i]).~ShardBitmap();
+    }
+  }
+  
+  /**
+   * Allocate [size] bits, starting with the calling thread's home shard.
+   */
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    return AllocLocal(ThreadShard() % shardCount, addressOut, size);
+  }
+  
+  virtual void Dealloc(AddressType address, SizeType size) {
+    assert((SizeType)address == address);
+    assert(!ansa::AddWraps<SizeType>((SizeType)address, size));
+    assert((SizeType)address + size <= bitCount);
+    if (!size) return;
+    Shard & shard = shards[ShardOf((SizeType)address)];
+    SizeType local = (SizeType)address - shard.firstBit;
+    assert(size <= shard.bitCount - local);
+    Lock(shard);
+    BitmapOf(shard).Dealloc(local, size);
+    shard.used.store(shard.used.load(std::memory_order_relaxed) - size,
+                     std::memory_order_relaxed);
+    Unlock(shard);
+  }
+  
+  /**
+   * Allocate [size] bits, starting with the shard at index [home].
+   *
+   * Callers which know which CPU they are running on can use this to keep
+   * each CPU on its own shard. Other shards are only tried once [home] is
+   * too full.
+   */
+  bool AllocLocal(size_t home, AddressType & addressOut, SizeType size) {
+    assert(home < shardCount);
+    if (!size) {
+      addressOut = 0;
+      return true;
+    }
+    size_t index = home;
+    for (size_t i = 0; i < shardCount; ++i) {
+      if (AllocInShard(shards[index], addressOut, size)) {
+        return true;
+      }
+      if (++index == shardCount) {
+        index = 0;
+      }
+    }
+    return false;
+  }
+  
+  /**
+   * Get the number of shards in this allocator.
+   */
+  inline size_t GetShardCount() const {
+    return shardCount;
+  }
+  
+  /**
+   * Get the index of the shard which owns the bit at [idx].
+   */
+  inline size_t ShardOf(SizeType idx) const {
+    assert(idx < bitCount);
+    // The inverse of [FirstUnit]: the last shard which starts at or before
+    // the unit containing [idx].
+    size_t unit = (size_t)(idx / UnitBitCount);
+    return ((unit + 1) * shardCount - 1) / (size_t)GetUnitCount();
+  }
+  
+  /**
+   * Get the index of the first bit in the shard at [index].
+   */
+  inline SizeType GetShardStart(size_t index) const {
+    assert(index < shardCount);
+    return shards[index].firstBit;
+  }
+  
+  /**
+   * Get the number of bits in the shard at [index].
+   */
+  inline SizeType GetShardBitCount(size_t index) const {
+    assert(index < shardCount);
+    return shards[index].bitCount;
+  }
+  
+  /**
+   * Get the number of allocated bits in the shard at [index].
+   *
+   * The result may be out of date by the time it is returned if other threads
+   * are using the allocator.
+   */
+  inline SizeType GetShardUsed(size_t index) const {
+    assert(index < shardCount);
+    return shards[index].used.load(std::memory_order_relaxed);
+  }
+  
+  /**
+   * Get the number of bits in this allocator.
+   */
+  inline SizeType GetBitCount() const {
+    return bitCount;
+  }
+  
+  /**
+   * Get the number of units which contain at least one bit of this allocator.
+   */
+  inline SizeType GetUnitCount() const {
+    return bitCount / UnitBitCount + (bitCount % UnitBitCount ? 1 : 0);
+  }
+  
+protected:
+  Shard * shards;
+  size_t shardCount;
+  SizeType bitCount;
+  
+  /**
+   * The index of the first unit given to the shard at [index].
+   */
+  inline SizeType FirstUnit(size_t index) const {
+    return (SizeType)(index * (size_t)GetUnitCount() / shardCount);
+  }
+  
+  static inline ShardBitmap & BitmapOf(Shard & shard) {
+    return *reinterpret_cast<ShardBitmap *>(&shard.bitmap);
+  }
+  
+  static inline void Lock(Shard & shard) {
+    while (shard.lock.test_and_set(std::memory_order_acquire)) {
+      Backoff::Pause();
+    }
+  }
+  
+  static inline void Unlock(Shard & shard) {
+    shard.lock.clear(std::memory_order_release);
+  }
+  
+  /**
+   * Try to allocate [size] bits from one [shard].
+   *
+   * A shard without enough free bits is skipped without taking its lock, so
+   * a thread looking to steal does not stall the owners of full shards.
+   */
+  bool AllocInShard(Shard & shard, AddressType & addressOut, SizeType size) {
+    if (shard.bitCount - shard.used.load(std::memory_order_relaxed) < size) {
+      return false;
+    }
+    SizeType local;
+    Lock(shard);
+    bool result = BitmapOf(shard).Alloc(local, size);
+    if (result) {
+      shard.used.store(shard.used.load(std::memory_order_relaxed) + size,
+                       std::memory_order_relaxed);
+    }
+    Unlock(shard);
+    if (result) {
+      addressOut = (AddressType)(shard.firstBit + local);
+    }
+    return result;
+  }
+  
+  /**
+   * Returns the calling thread's index, which is used to pick its home
+   * shard. Threads are numbered in the order they first use any
+   * [ShardedBitmap].
+   */
+  static size_t ThreadShard() {
+    static std::atomic<size_t> threadCount(0);
+    static thread_local bool initialized = false;
+    static thread_local size_t index = 0;
+    if (!initialized) {
+      index = threadCount.fetch_add(1, std::memory_order_relaxed);
+      initialized = true;
+    }
+    return index;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,1030 @@
+#ifndef __ANALLOC2_SPARSE_BITMAP_HPP__
+#define __ANALLOC2_SPARSE_BITMAP_HPP__
+
+#include "../abstract/offset-aligner.hpp"
+#include "raw-bitmap.hpp"
+#include <ansa/cstring>
+#include <ansa/math>
+#include <ansa/numeric-info>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+namespace analloc {
+
+/**
+ * An offset aligner for huge, mostly-free address spaces, whose memory use
+ * grows with the number of allocated bits rather than with the bit count.
+ *
+ * The bits are split into containers of 2^16 bits each. A container with no
+ * allocated bits takes no memory at all, and one with every bit allocated
+ * takes no memory beyond its index entry. Every other container is stored as
+ * whichever of these is smallest:
+ *
+ * - a sorted array of the allocated bits, at 2 bytes per bit;
+ * - a run list of the allocated runs, at 4 bytes per run;
+ * - a plain bitmap, at 8 KiB.
+ *
+ * A container only changes form once the new form is at most half the size
+ * of the current one, so alternating allocations and frees never flip it
+ * back and forth.
+ *
+ * Like [Bitmap], every allocation returns the lowest fitting region.
+ */
+template <typename AddressType, typename SizeType = AddressType>
+class SparseBitmap : public virtual OffsetAligner<AddressType, SizeType> {
+public:
+  static_assert(sizeof(AddressType) >= 4,
+                "AddressType must hold a container's bit count.");
+  
+  /**
+   * The function signature of a callback which a [SparseBitmap] will call
+   * when a container cannot be allocated.
+   *
+   * If this function returns true, the caller will re-attempt the operation.
+   */
+  typedef bool (* FailureHandler)(SparseBitmap<AddressType, SizeType> *);
+  
+  static constexpr uint32_t ContainerBitCount = 0x10000;
+  
+  /**
+   * The largest array container, which is the same size as a bitmap.
+   */
+  static constexpr uint32_t ArrayMaximum = 0x1000;
+  
+  enum ContainerType {
+    ArrayContainer,
+    BitmapContainer,
+    RunContainer,
+    FullContainer
+  };
+  
+  /**
+   * Create a [SparseBitmap] with [bc] bits, all of which are free.
+   *
+   * Containers and the container index are allocated from [anAlloc]. If an
+   * allocation fails, [onAllocFail] is called with this bitmap as its
+   * argument.
+   */
+  SparseBitmap(AddressType bc, Allocator<uintptr_t, size_t> & anAlloc,
+               FailureHandler onAllocFail)
+      : allocator(anAlloc), failureHandler(onAllocFail), bitCount(bc) {}
+  
+  /**
+   * Equivalent to the other constructor. This form can be used through
+   * [AllocatorTransformer], which passes its arguments by value.
+   */
+  SparseBitmap(AddressType bc, Allocator<uintptr_t, size_t> * anAlloc,
+               FailureHandler onAllocFail)
+      : SparseBitmap(bc, *anAlloc, onAllocFail) {}
+  
+  /**
+   * Deallocate every container and the container index.
+   */
+  virtual ~SparseBitmap() {
+    for (size_t i = 0; i < containerCount; ++i) {
+      FreeData(containers[i]);
+    }
+    if (containers) {
+      allocator.Dealloc((uintptr_t)containers,
+                        indexCapacity * sizeof(Container));
+    }
+  }
+  
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    return OffsetAlign(addressOut, 1, 0, size);
+  }
+  
+  virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
+                           AddressType offset, SizeType size) {
+    if (size > bitCount) {
+      return false;
+    } else if (!size) {
+      addressOut = 0;
+      return true;
+    }
+    AddressType index;
+    if (!FindRun(index, size, align, offset)) {
+      return false;
+    }
+    while (!Modify(index, size, true)) {
+      if (!failureHandler(this)) {
+        return false;
+      }
+    }
+    addressOut = index;
+    return true;
+  }
+  
+  /**
+   * Free [size] bits at [address].
+   *
+   * Freeing bits from a container can require a bigger container, such as
+   * when a run is split in two. If that memory cannot be obtained, the bits
+   * stay allocated.
+   */
+  virtual void Dealloc(AddressType address, SizeType size) {
+    assert(!ansa::AddWraps<AddressType>(address, size));
+    assert(address + size <= bitCount);
+    if (!size) return;
+    while (!Modify(address, size, false)) {
+      if (!failureHandler(this)) {
+        return;
+      }
+    }
+  }
+  
+  /**
+   * Returns `true` if the bit at [idx] is allocated.
+   */
+  bool GetBit(AddressType idx) const {
+    assert(idx < bitCount);
+    size_t i = LowerBound(idx / ContainerBitCount);
+    if (i == containerCount ||
+        containers[i].key != idx / ContainerBitCount) {
+      return false;
+    }
+    uint32_t bit = (uint32_t)(idx % ContainerBitCount);
+    return NextUsed(containers[i], bit) == bit;
+  }
+  
+  inline AddressType GetBitCount() const {
+    return bitCount;
+  }
+  
+  /**
+   * Get the number of containers which hold at least one allocated bit.
+   */
+  inline size_t GetContainerCount() const {
+    return containerCount;
+  }
+  
+  /**
+   * Get the form of the [index]th container, in order of address.
+   */
+  inline ContainerType GetContainerType(size_t index) const {
+    assert(index < containerCount);
+    return containers[index].type;
+  }
+  
+  /**
+   * Get the number of bytes which this bitmap has allocated from its
+   * allocator.
+   */
+  size_t GetMemoryUsage() const {
+    size_t result = indexCapacity * sizeof(Container);
+    for (size_t i = 0; i < containerCount; ++i) {
+      result += DataSize(containers[i].type, containers[i].capacity);
+    }
+    return result;
+  }
+  
+protected:
+  struct Container {
+    AddressType key;
+    uintptr_t data;
+    uint32_t cardinality;
+    uint32_t runCount;
+    
+    /**
+     * The number of values, runs or words which [data] has room for.
+     */
+    uint32_t capacity;
+    ContainerType type;
+  };
+  
+  struct Run {
+    uint16_t start;
+    uint16_t last;
+  };
+  
+  /**
+   * A container's form and storage after a pending change.
+   */
+  struct Change {
+    uint32_t low;
+    uint32_t high;
+    bool add;
+    uint32_t cardinality;
+    uint32_t runCount;
+    ContainerType type;
+    bool rebuild;
+    uintptr_t data;
+    uint32_t capacity;
+  };
+  
+  static constexpr uint32_t BitmapWords = ContainerBitCount / 64;
+  
+  Allocator<uintptr_t, size_t> & allocator;
+  FailureHandler failureHandler;
+  AddressType bitCount;
+  
+  /**
+   * The non-empty containers, sorted by key.
+   */
+  Container * containers = nullptr;
+  size_t containerCount = 0;
+  size_t indexCapacity = 0;
+  
+  /**
+   * Find the lowest index of [size] free bits which is [offset] bits short
+   * of a multiple of [align].
+   */
+  bool FindRun(AddressType & index, SizeType size, AddressType align,
+               AddressType offset) const {
+    AddressType pos = 0;
+    while (true) {
+      AddressType start = NextFreeRun(pos, size);
+      if (start >= bitCount) {
+        return false;
+      }
+      if (align > 1) {
+        AddressType misalign = (start % align + offset % align) % align;
+        if (misalign) {
+          if (ansa::AddWraps<AddressType>(start, align - misalign)) {
+            return false;
+          }
+          start += align - misalign;
+        }
+      }
+      if (start >= bitCount || bitCount - start < size) {
+        return false;
+      }
+      AddressType used = NextUsed(start);
+      if (used - start >= size) {
+        index = start;
+        return true;
+      }
+      pos = used;
+    }
+  }
+  
+  /**
+   * Find the first allocated bit at or after [pos], or [bitCount] if there
+   * is none.
+   */
+  AddressType NextUsed(AddressType pos) const {
+    AddressType key = pos / ContainerBitCount;
+    size_t i = LowerBound(key);
+    if (i < containerCount && containers[i].key == key) {
+      uint32_t bit = NextUsed(containers[i], pos % ContainerBitCount);
+      if (bit < ContainerBitCount) {
+        return key * ContainerBitCount + bit;
+      }
+      ++i;
+    }
+    if (i == containerCount) {
+      return bitCount;
+    }
+    return containers[i].key * ContainerBitCount +
+        NextUsed(containers[i], 0);
+  }
+  
+  /**
+   * Find the first free bit at or after [pos] which might start [size] free
+   * bits. The result is at least [bitCount] if there is none.
+   *
+   * Free bits which are too short a run to hold [size] bits are only skipped
+   * in bitmap containers, which are the ones that can have thousands of them.
+   */
+  AddressType NextFreeRun(AddressType pos, SizeType size) const {
+    uint32_t need = (uint32_t)ansa::Min<SizeType>(size, ContainerBitCount);
+    const AddressType lastKey = (bitCount - 1) / ContainerBitCount;
+    size_t i = LowerBound(pos / ContainerBitCount);
+    while (pos < bitCount) {
+      AddressType key = pos / ContainerBitCount;
+      if (i == containerCount || containers[i].key != key) {
+        return pos;
+      }
+      uint32_t bit = NextFreeRun(containers[i], pos % ContainerBitCount,
+                                 need);
+      if (bit < ContainerBitCount || key == lastKey) {
+        return key * ContainerBitCount + bit;
+      }
+      // The container is full, so try the one after it
+      pos = (key + 1) * ContainerBitCount;
+      ++i;
+    }
+    return bitCount;
+  }
+  
+  /**
+   * Find the index of the first container whose key is at least [key].
+   */
+  size_t LowerBound(AddressType key) const {
+    size_t low = 0;
+    size_t high = containerCount;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (containers[mid].key < key) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+  
+  /**
+   * Allocate or free [size] bits at [start], which span one or more
+   * containers.
+   *
+   * Any memory which the change needs is obtained before anything is
+   * modified, so `false` is returned with the bitmap unchanged if memory
+   * runs out.
+   */
+  bool Modify(AddressType start, AddressType size, bool add) {
+    AddressType last = start + (size - 1);
+    AddressType firstKey = start / ContainerBitCount;
+    AddressType lastKey = last / ContainerBitCount;
+    size_t firstIndex = LowerBound(firstKey);
+    bool firstExists = firstIndex < containerCount &&
+        containers[firstIndex].key == firstKey;
+    Container first = firstExists ? containers[firstIndex]
+                                  : EmptyContainer(firstKey);
+    uint32_t low = (uint32_t)(start % ContainerBitCount);
+    uint32_t high = (uint32_t)(last % ContainerBitCount);
+    
+    if (firstKey == lastKey) {
+      Change change;
+      if (!Prepare(first, low, high, add, change)) {
+        return false;
+      }
+      if (!firstExists && !Reserve(containerCount + 1)) {
+        ReleaseChange(change);
+        return false;
+      }
+      Apply(first, change);
+      Splice(firstIndex, firstExists, &first, 0, nullptr);
+      ShrinkIndex();
+      return true;
+    }
+    
+    // Every container between the first and last is either entirely free
+    // (and so missing), or entirely used.
+    size_t middles = (size_t)(lastKey - firstKey - 1);
+    size_t lastIndex = firstIndex + firstExists + (add ? 0 : middles);
+    bool lastExists = lastIndex < containerCount &&
+        containers[lastIndex].key == lastKey;
+    Container lastContainer = lastExists ? containers[lastIndex]
+                                         : EmptyContainer(lastKey);
+    assert(add || (firstExists && lastExists));
+    Change firstChange;
+    Change lastChange;
+    if (!Prepare(first, low, ContainerBitCount - 1, add, firstChange)) {
+      return false;
+    }
+    if (!Prepare(lastContainer, 0, high, add, lastChange)) {
+      ReleaseChange(firstChange);
+      return false;
+    }
+    size_t oldSpan = add ? firstExists + lastExists : middles + 2;
+    size_t newSpan = (firstChange.cardinality != 0) + (add ? middles : 0) +
+        (lastChange.cardinality != 0);
+    if (newSpan > oldSpan &&
+        !Reserve(containerCount + (newSpan - oldSpan))) {
+      ReleaseChange(firstChange);
+      ReleaseChange(lastChange);
+      return false;
+    }
+    Apply(first, firstChange);
+    Apply(lastContainer, lastChange);
+    Splice(firstIndex, oldSpan, &first, add ? middles : 0, &lastContainer);
+    ShrinkIndex();
+    return true;
+  }
+  
+  /**
+   * Replace the [oldSpan] index entries at [index] with [first] (if it is
+   * not empty), [middles] full containers and [last] (if it is given and not
+   * empty).
+   */
+  void Splice(size_t index, size_t oldSpan, const Container * first,
+              size_t middles, const Container * last) {
+    bool keepFirst = first->cardinality != 0;
+    bool keepLast = last && last->cardinality != 0;
+    size_t newSpan = keepFirst + middles + keepLast;
+    if (newSpan != oldSpan) {
+      MoveEntries(&containers[index + newSpan], &containers[index + oldSpan],
+                  containerCount - index - oldSpan);
+    }
+    size_t i = index;
+    if (keepFirst) {
+      containers[i++] = *first;
+    }
+    for (size_t j = 0; j < middles; ++j) {
+      Container & full = containers[i++];
+      full = EmptyContainer(first->key + 1 + (AddressType)j);
+      full.type = FullContainer;
+      full.cardinality = ContainerBitCount;
+      full.runCount = 1;
+    }
+    if (keepLast) {
+      containers[i++] = *last;
+    }
+    containerCount = containerCount + newSpan - oldSpan;
+  }
+  
+  /**
+   * Make room in the index for at least [count] containers.
+   */
+  bool Reserve(size_t count) {
+    if (count <= indexCapacity) {
+      return true;
+    }
+    size_t newCapacity = ansa::Max<size_t>(count, indexCapacity * 2);
+    uintptr_t buffer;
+    if (!allocator.Alloc(buffer, newCapacity * sizeof(Container))) {
+      return false;
+    }
+    if (containers) {
+      ansa::Memcpy((void *)buffer, containers,
+                   containerCount * sizeof(Container));
+      allocator.Dealloc((uintptr_t)containers,
+                        indexCapacity * sizeof(Container));
+    }
+    containers = (Container *)buffer;
+    indexCapacity = newCapacity;
+    return true;
+  }
+  
+  /**
+   * Give back most of the index once it is less than a quarter full. If the
+   * smaller index cannot be allocated, the old one is kept.
+   */
+  void ShrinkIndex() {
+    if (containerCount * 4 >= indexCapacity) {
+      return;
+    }
+    size_t newCapacity = containerCount * 2;
+    uintptr_t buffer = 0;
+    if (newCapacity) {
+      if (!allocator.Alloc(buffer, newCapacity * sizeof(Container))) {
+        return;
+      }
+      ansa::Memcpy((void *)buffer, containers,
+                   containerCount * sizeof(Container));
+    }
+    allocator.Dealloc((uintptr_t)containers,
+                      indexCapacity * sizeof(Container));
+    containers = (Container *)buffer;
+    indexCapacity = newCapacity;
+  }
+  
+  /**
+   * Work out what [container] will look like after the bits in
+   * [low, high] are allocated or freed, and allocate any new storage it
+   * will need.
+   *
+   * Returns `false` if the storage could not be allocated.
+   */
+  bool Prepare(const Container & container, uint32_t low, uint32_t high,
+               bool add, Change & change) {
+    uint32_t count = high - low + 1;
+    bool before = low > 0 && NextUsed(container, low - 1) == low - 1;
+    bool after = high + 1 < ContainerBitCount &&
+        NextUsed(container, high + 1) == high + 1;
+    change.low = low;
+    change.high = high;
+    change.add = add;
+    change.data = 0;
+    change.capacity = 0;
+    change.rebuild = false;
+    if (add) {
+      assert(NextUsed(container, low) > high);
+      change.cardinality = container.cardinality + count;
+      change.runCount = container.runCount + 1 - before - after;
+    } else {
+      assert(NextFree(container, low) > high);
+      change.cardinality = container.cardinality - count;
+      change.runCount = container.runCount - 1 + before + after;
+    }
+    if (!change.cardinality) {
+      return true;
+    }
+    change.type = ChooseType(container.type, change.cardinality,
+                             change.runCount);
+    uint32_t needed = Needed(change.type, change.cardinality,
+                             change.runCount);
+    if (change.type == container.type && needed <= container.capacity) {
+      // Give back most of the storage if the container has shrunk a lot,
+      // but only if that memory can be obtained.
+      if (container.capacity <= 4 * Capacity(change.type, needed)) {
+        return true;
+      }
+      change.capacity = Capacity(change.type, needed);
+      change.rebuild = allocator.Alloc(change.data,
+                                       DataSize(change.type,
+                                                change.capacity));
+      return true;
+    }
+    change.rebuild = true;
+    change.capacity = Capacity(change.type, needed);
+    if (!change.capacity) {
+      return true;
+    }
+    return allocator.Alloc(change.data, DataSize(change.type,
+                                                 change.capacity));
+  }
+  
+  /**
+   * Free the storage which [Prepare] allocated for a change that will not
+   * be applied.
+   */
+  void ReleaseChange(Change & change) {
+    if (change.rebuild && change.capacity) {
+      allocator.Dealloc(change.data, DataSize(change.type, change.capacity));
+    }
+  }
+  
+  /**
+   * Apply a prepared [change] to [container]. This never allocates memory.
+   */
+  void Apply(Container & container, Change & change) {
+    if (!change.cardinality) {
+      FreeData(container);
+      container.cardinality = 0;
+      return;
+    }
+    if (change.rebuild) {
+      Container result = container;
+      result.type = change.type;
+      result.data = change.data;
+      result.capacity = change.capacity;
+      result.cardinality = 0;
+      result.runCount = 0;
+      if (result.type == BitmapContainer) {
+        ansa::Bzero((void *)result.data, BitmapWords * 8);
+      }
+      // Copy every run of the old container, with the change applied.
+      uint32_t pos = 0;
+      bool inserted = !change.add;
+      uint32_t start;
+      while ((start = NextUsed(container, pos)) < ContainerBitCount) {
+        uint32_t end = NextFree(container, start);
+        if (!inserted && change.low < start) {
+          Append(result, change.low, change.high);
+          inserted = true;
+        }
+        if (change.add || end <= change.low || start > change.high) {
+          Append(result, start, end - 1);
+        } else {
+          if (start < change.low) {
+            Append(result, start, change.low - 1);
+          }
+          if (end - 1 > change.high) {
+            Append(result, change.high + 1, end - 1);
+          }
+        }
+        pos = end;
+      }
+      if (!inserted) {
+        Append(result, change.low, change.high);
+      }
+      FreeData(container);
+      container = result;
+      assert(container.runCount == change.runCount);
+    } else if (change.add) {
+      AddInPlace(container, change.low, change.high);
+    } else {
+      RemoveInPlace(container, change.low, change.high);
+    }
+    assert(container.cardinality == change.cardinality);
+    // Only run lists keep track of their runs as they are changed in place.
+    container.runCount = change.runCount;
+  }
+  
+  /**
+   * Add the run [start, last] to a container which is being rebuilt. Runs
+   * must be appended in order.
+   */
+  void Append(Container & container, uint32_t start, uint32_t last) {
+    bool joins = container.cardinality && start > 0 &&
+        NextUsed(container, start - 1) == start - 1;
+    container.cardinality += last - start + 1;
+    if (!joins) {
+      ++container.runCount;
+    }
+    switch (container.type) {
+      case ArrayContainer: {
+        uint16_t * values = (uint16_t *)container.data;
+        uint32_t index = container.cardinality - (last - start + 1);
+        for (uint32_t i = start; i <= last; ++i) {
+          values[index++] = (uint16_t)i;
+        }
+        break;
+      }
+      case BitmapContainer:
+        BitmapOf(container).SetRange(start, last - start + 1);
+        break;
+      case RunContainer: {
+        Run * runs = (Run *)container.data;
+        if (joins) {
+          runs[container.runCount - 1].last = (uint16_t)last;
+        } else {
+          runs[container.runCount - 1].start = (uint16_t)start;
+          runs[container.runCount - 1].last = (uint16_t)last;
+        }
+        break;
+      }
+      case FullContainer:
+        break;
+    }
+  }
+  
+  void AddInPlace(Container & container, uint32_t low, uint32_t high) {
+    uint32_t count = high - low + 1;
+    switch (container.type) {
+      case ArrayContainer: {
+        uint16_t * values = (uint16_t *)container.data;
+        uint32_t index = ArrayLowerBound(container, low);
+        MoveEntries(values + index + count, values + index,
+                    container.cardinality - index);
+        for (uint32_t i = 0; i < count; ++i) {
+          values[index + i] = (uint16_t)(low + i);
+        }
+        break;
+      }
+      case BitmapContainer:
+        BitmapOf(container).SetRange(low, count);
+        break;
+      case RunContainer: {
+        Run * runs = (Run *)container.data;
+        uint32_t index = RunLowerBound(container, low);
+        bool joinsBefore = index > 0 &&
+            (uint32_t)runs[index - 1].last + 1 == low;
+        bool joinsAfter = index < container.runCount &&
+            runs[index].start == high + 1;
+        if (joinsBefore && joinsAfter) {
+          runs[index - 1].last = runs[index].last;
+          MoveEntries(runs + index, runs + index + 1,
+                      container.runCount - index - 1);
+          --container.runCount;
+        } else if (joinsBefore) {
+          runs[index - 1].last = (uint16_t)high;
+        } else if (joinsAfter) {
+          runs[index].start = (uint16_t)low;
+        } else {
+          MoveEntries(runs + index + 1, runs + index,
+                      container.runCount - index);
+          runs[index].start = (uint16_t)low;
+          runs[index].last = (uint16_t)high;
+          ++container.runCount;
+        }
+        container.cardinality += count;
+        return;
+      }
+      case FullContainer:
+        assert(false);
+        break;
+    }
+    container.cardinality += count;
+  }
+  
+  void RemoveInPlace(Container & container, uint32_t low, uint32_t high) {
+    uint32_t count = high - low + 1;
+    switch (container.type) {
+      case ArrayContainer: {
+        uint16_t * values = (uint16_t *)container.data;
+        uint32_t index = ArrayLowerBound(container, low);
+        MoveEntries(values + index, values + index + count,
+                    container.cardinality - index - count);
+        break;
+      }
+      case BitmapContainer:
+        BitmapOf(container).ClearRange(low, count);
+        break;
+      case RunContainer: {
+        Run * runs = (Run *)container.data;
+        uint32_t index = RunLowerBound(container, low);
+        Run & run = runs[index];
+        if (run.start == low && run.last == high) {
+          MoveEntries(runs + index, runs + index + 1,
+                      container.runCount - index - 1);
+          --container.runCount;
+        } else if (run.start == low) {
+          run.start = (uint16_t)(high + 1);
+        } else if (run.last == high) {
+          run.last = (uint16_t)(low - 1);
+        } else {
+          MoveEntries(runs + index + 1, runs + index,
+                      container.runCount - index);
+          runs[index].last = (uint16_t)(low - 1);
+          runs[index + 1].start = (uint16_t)(high + 1);
+          ++container.runCount;
+        }
+        container.cardinality -= count;
+        return;
+      }
+      case FullContainer:
+        assert(false);
+        break;
+    }
+    container.cardinality -= count;
+  }
+  
+  /**
+   * Find the first allocated bit in [container] at or after [bit], or
+   * [ContainerBitCount] if there is none.
+   */
+  static uint32_t NextUsed(const Container & container, uint32_t bit) {
+    if (!container.cardinality) {
+      return ContainerBitCount;
+    }
+    switch (container.type) {
+      case ArrayContainer: {
+        uint32_t index = ArrayLowerBound(container, bit);
+        if (index == container.cardinality) {
+          return ContainerBitCount;
+        }
+        return ((const uint16_t *)container.data)[index];
+      }
+      case BitmapContainer: {
+        uint32_t result;
+        if (!BitmapOf(container).FindFirstSet(bit, ContainerBitCount - bit,
+                                              result)) {
+          return ContainerBitCount;
+        }
+        return result;
+      }
+      case RunContainer: {
+        uint32_t index = RunLowerBound(container, bit);
+        if (index == container.runCount) {
+          return ContainerBitCount;
+        }
+        return ansa::Max<uint32_t>(((const Run *)container.data)[index].start,
+                                   bit);
+      }
+      default:
+        return bit;
+    }
+  }
+  
+  /**
+   * Find the first free bit in [container] at or after [bit], or
+   * [ContainerBitCount] if there is none.
+   */
+  static uint32_t NextFree(const Container & container, uint32_t bit) {
+    if (!container.cardinality) {
+      return bit;
+    }
+    switch (container.type) {
+      case ArrayContainer: {
+        const uint16_t * values = (const uint16_t *)container.data;
+        uint32_t index = ArrayLowerBound(container, bit);
+        while (index < container.cardinality && values[index] == bit) {
+          ++index;
+          ++bit;
+        }
+        return bit;
+      }
+      case BitmapContainer: {
+        const uint64_t * words = (const uint64_t *)container.data;
+        uint32_t index = bit / 64;
+        uint64_t word = ~words[index] & (~(uint64_t)0 << (bit % 64));
+        while (!word && ++index < BitmapWords) {
+          word = ~words[index];
+        }
+        if (!word) {
+          return ContainerBitCount;
+        }
+        return index * 64 + (uint32_t)UnitBitScanRight<uint64_t>(word);
+      }
+      case RunContainer: {
+        const Run * runs = (const Run *)container.data;
+        uint32_t index = RunLowerBound(container, bit);
+        if (index < container.runCount && runs[index].start <= bit) {
+          return (uint32_t)runs[index].last + 1;
+        }
+        return bit;
+      }
+      default:
+        return ContainerBitCount;
+    }
+  }
+  
+  /**
+   * Find the first free bit in [container] at or after [bit] which starts
+   * [need] free bits, or which starts free bits that reach the end of the
+   * container. Returns [ContainerBitCount] if there is none.
+   *
+   * Bitmap containers are searched a word at a time with [UnitRunStarts].
+   * Other containers return their first free bit.
+   */
+  static uint32_t NextFreeRun(const Container & container, uint32_t bit,
+                              uint32_t need) {
+    if (container.type != BitmapContainer || need < 2) {
+      return NextFree(container, bit);
+    }
+    const uint64_t * words = (const uint64_t *)container.data;
+    const uint32_t none = ContainerBitCount;
+    uint32_t index = bit / 64;
+    uint64_t free = ~words[index] & (~(uint64_t)0 << (bit % 64));
+    // The start of free bits which reach the top of the previous word
+    uint32_t runStart = none;
+    while (true) {
+      if (runStart != none) {
+        uint32_t low = (uint32_t)UnitBitScanRight<uint64_t>(~free);
+        if (index * 64 + low - runStart >= need) {
+          return runStart;
+        } else if (low < 64) {
+          runStart = none;
+        }
+      }
+      if (runStart == none) {
+        if (need <= 64) {
+          uint64_t starts = UnitRunStarts<uint64_t>(free, (int)need);
+          if (starts) {
+            return index * 64 + (uint32_t)UnitBitScanRight<uint64_t>(starts);
+          }
+        }
+        if (free >> 63) {
+          int used = UnitBitScanLeft<uint64_t>(~free);
+          runStart = index * 64 + (uint32_t)(used + 1);
+        }
+      }
+      if (++index == BitmapWords) {
+        return runStart;
+      }
+      free = ~words[index];
+    }
+  }
+  
+  /**
+   * Find the index of the first value in an array container which is at
+   * least [bit].
+   */
+  static uint32_t ArrayLowerBound(const Container & container, uint32_t bit) {
+    const uint16_t * values = (const uint16_t *)container.data;
+    uint32_t low = 0;
+    uint32_t high = container.cardinality;
+    while (low < high) {
+      uint32_t mid = low + (high - low) / 2;
+      if (values[mid] < bit) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+  
+  /**
+   * Find the index of the first run in a run container which ends at or
+   * after [bit].
+   */
+  static uint32_t RunLowerBound(const Container & container, uint32_t bit) {
+    const Run * runs = (const Run *)container.data;
+    uint32_t low = 0;
+    uint32_t high = container.runCount;
+    while (low < high) {
+      uint32_t mid = low + (high - low) / 2;
+      if (runs[mid].last < bit) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+  
+  static inline RawBitmap<uint64_t, uint32_t>
+  BitmapOf(const Container & container) {
+    return RawBitmap<uint64_t, uint32_t>((uint64_t *)container.data,
+                                         ContainerBitCount);
+  }
+  
+  /**
+   * Pick the form of a container with [cardinality] bits in [runCount]
+   * runs, given its [current] form.
+   */
+  static ContainerType ChooseType(ContainerType current,
+                                  uint32_t cardinality, uint32_t runCount) {
+    if (cardinality == ContainerBitCount) {
+      return FullContainer;
+    }
+    ContainerType best = RunContainer;
+    size_t bestSize = FormSize(RunContainer, cardinality, runCount);
+    if (FormSize(ArrayContainer, cardinality, runCount) < bestSize) {
+      best = ArrayContainer;
+      bestSize = FormSize(ArrayContainer, cardinality, runCount);
+    }
+    if (FormSize(BitmapContainer, cardinality, runCount) < bestSize) {
+      best = BitmapContainer;
+      bestSize = FormSize(BitmapContainer, cardinality, runCount);
+    }
+    if (bestSize * 2 <= FormSize(current, cardinality, runCount)) {
+      return best;
+    }
+    return current;
+  }
+  
+  /**
+   * The number of bytes which the bits of a container would take in a given
+   * [type], or the maximum `size_t` if they do not fit in that form.
+   */
+  static size_t FormSize(ContainerType type, uint32_t cardinality,
+                         uint32_t runCount) {
+    switch (type) {
+      case ArrayContainer:
+        if (cardinality > ArrayMaximum) {
+          return ansa::NumericInfo<size_t>::max;
+        }
+        return cardinality * sizeof(uint16_t);
+      case BitmapContainer:
+        return BitmapWords * sizeof(uint64_t);
+      case RunContainer:
+        return runCount * sizeof(Run);
+      default:
+        if (cardinality != ContainerBitCount) {
+          return ansa::NumericInfo<size_t>::max;
+        }
+        return 0;
+    }
+  }
+  
+  /**
+   * The number of entries which a container of a given [type] needs.
+   */
+  static uint32_t Needed(ContainerType type, uint32_t cardinality,
+                         uint32_t runCount) {
+    switch (type) {
+      case ArrayContainer:
+        return cardinality;
+      case BitmapContainer:
+        return BitmapWords;
+      case RunContainer:
+        return runCount;
+      default:
+        return 0;
+    }
+  }
+  
+  /**
+   * Round [needed] up to the capacity of a new container, which leaves room
+   * for it to grow.
+   */
+  static uint32_t Capacity(ContainerType type, uint32_t needed) {
+    if (type == FullContainer) {
+      return 0;
+    } else if (type == BitmapContainer) {
+      return BitmapWords;
+    }
+    uint32_t capacity = 4;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+  
+  static size_t DataSize(ContainerType type, uint32_t capacity) {
+    switch (type) {
+      case ArrayContainer:
+        return capacity * sizeof(uint16_t);
+      case BitmapContainer:
+        return capacity * sizeof(uint64_t);
+      case RunContainer:
+        return capacity * sizeof(Run);
+      default:
+        return 0;
+    }
+  }
+  
+  /**
+   * Copy [count] entries from [source] to [dest], which may overlap.
+   */
+  template <typename T>
+  static void MoveEntries(T * dest, const T * source, size_t count) {
+    if (dest < source) {
+      for (size_t i = 0; i < count; ++i) {
+        dest[i] = source[i];
+      }
+    } else {
+      while (count--) {
+        dest[count] = source[count];
+      }
+    }
+  }
+  
+  void FreeData(const Container & container) {
+    if (container.capacity) {
+      allocator.Dealloc(container.data, DataSize(container.type,
+                                                 container.capacity));
+    }
+  }
+  
+  static Container EmptyContainer(AddressType key) {
+    Container result;
+    result.key = key;
+    result.data = 0;
+    result.cardinality = 0;
+    result.runCount = 0;
+    result.capacity = 0;
+    result.type = ArrayContainer;
+    return result;
+  }
+};
+
+}
+
+#endif
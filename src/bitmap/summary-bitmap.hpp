@@ -0,0 +1,188 @@
+#ifndef __ANALLOC2_SUMMARY_BITMAP_HPP__
+#define __ANALLOC2_SUMMARY_BITMAP_HPP__
+
+#include "bitmap.hpp"
+
+namespace analloc {
+
+/**
+ * A [Bitmap] which keeps a hierarchy of summary bitmaps on top of its units.
+ *
+ * Each bit in the first summary level is set if and only if the corresponding
+ * unit of the bitmap is completely used. Each bit in the next level is set if
+ * and only if the corresponding unit of the level below it is completely set,
+ * and so on until a level fits in a single unit.
+ *
+ * This allows the lowest free bit to be found with one [BitScanRight] per
+ * level, rather than with a linear scan over every unit. Allocations still
+ * return the lowest possible free index, just like a normal [Bitmap].
+ */
+template <typename Unit, typename AddressType, typename SizeType = AddressType>
+class SummaryBitmap : public Bitmap<Unit, AddressType, SizeType> {
+public:
+  typedef Bitmap<Unit, AddressType, SizeType> super;
+  
+  /**
+   * The maximum number of summary levels. Every level is at least 8 times
+   * smaller than the level below it.
+   */
+  static constexpr int MaxLevels = ansa::NumericInfo<SizeType>::bitCount / 3
+      + 1;
+  
+  /**
+   * Returns the number of units which a [SummaryBitmap] with a bit count of
+   * [bc] needs for its summary buffer.
+   */
+  static size_t SummaryUnitCount(SizeType bc) {
+    size_t result = 0;
+    SizeType count = ansa::RoundUpDiv<SizeType>(bc, super::UnitBitCount);
+    while (count > 1) {
+      count = ansa::RoundUpDiv<SizeType>(count, super::UnitBitCount);
+      result += (size_t)count;
+    }
+    return result;
+  }
+  
+  /**
+   * Create a new [SummaryBitmap] given a region of memory [ptr] and a bit
+   * count [bc].
+   *
+   * The [summaryPtr] buffer must contain at least `SummaryUnitCount(bc)`
+   * units. It will be zeroed by this constructor unless [init] is
+   * [BitmapPreZeroed], in which case it must be zeroed already.
+   */
+  SummaryBitmap(Unit * ptr, SizeType bc, Unit * summaryPtr,
+                BitmapInit init = BitmapZero)
+      : super(ptr, bc, init), summary(summaryPtr) {
+    size_t offset = 0;
+    SizeType count = this->GetUnitCount();
+    while (count > 1) {
+      assert(levelCount < MaxLevels);
+      levelBits[levelCount] = count;
+      levelOffsets[levelCount] = offset;
+      count = ansa::RoundUpDiv<SizeType>(count, super::UnitBitCount);
+      offset += (size_t)count;
+      ++levelCount;
+    }
+    if (init != BitmapPreZeroed) {
+      for (size_t i = 0; i < offset; ++i) {
+        summary[i] = 0;
+      }
+    }
+  }
+  
+  /**
+   * Get the number of summary levels above the bitmap.
+   */
+  inline int GetLevelCount() const {
+    return levelCount;
+  }
+  
+protected:
+  Unit * summary;
+  SizeType levelBits[MaxLevels];
+  size_t levelOffsets[MaxLevels];
+  int levelCount = 0;
+  
+  virtual void UnitsChanged(SizeType idx, SizeType len) {
+    SizeType first = idx / super::UnitBitCount;
+    SizeType last = (idx + (len - 1)) / super::UnitBitCount;
+    for (SizeType i = first; i <= last; ++i) {
+      UpdateSummary(i);
+    }
+  }
+  
+  virtual bool NextFreeUnit(SizeType & unitIdx, SizeType endUnit) {
+    if (!levelCount) {
+      return super::NextFreeUnit(unitIdx, endUnit);
+    }
+    
+    // Climb up the hierarchy until we find a level with a clear bit at or
+    // after our position.
+    SizeType pos = unitIdx;
+    int level = 0;
+    while (true) {
+      if (level == levelCount || pos >= levelBits[level]) {
+        return false;
+      }
+      SizeType unitIndex = pos / super::UnitBitCount;
+      Unit unit = SummaryUnit(level, unitIndex) |
+          PaddingMask(levelBits[level], unitIndex);
+      Unit clear = (Unit)((Unit)~unit >> (pos % super::UnitBitCount));
+      if (clear) {
+        pos += (SizeType)UnitBitScanRight<Unit>(clear);
+        break;
+      }
+      pos = unitIndex + 1;
+      ++level;
+    }
+    
+    // Descend back down, always taking the first clear bit.
+    while (level > 0) {
+      --level;
+      Unit unit = SummaryUnit(level, pos) |
+          PaddingMask(levelBits[level], pos);
+      assert(unit != (Unit)~(Unit)0);
+      pos = pos * super::UnitBitCount +
+          (SizeType)UnitBitScanRight<Unit>((Unit)~unit);
+    }
+    
+    if (pos >= endUnit) {
+      return false;
+    }
+    unitIdx = pos;
+    return true;
+  }
+  
+  /**
+   * Recompute the summary bits which describe a given unit of the bitmap.
+   */
+  void UpdateSummary(SizeType unitIndex) {
+    Unit unit = this->UnitAt(unitIndex) |
+        PaddingMask(this->GetBitCount(), unitIndex);
+    bool full = (unit == (Unit)~(Unit)0);
+    for (int level = 0; level < levelCount; ++level) {
+      SizeType summaryIndex = unitIndex / super::UnitBitCount;
+      Unit & summaryUnit = SummaryUnit(level, summaryIndex);
+      Unit flag = (Unit)1 << (unitIndex % super::UnitBitCount);
+      Unit oldValue = summaryUnit;
+      if (full) {
+        summaryUnit |= flag;
+      } else {
+        summaryUnit &= ~flag;
+      }
+      if (oldValue == summaryUnit) {
+        return;
+      }
+      // The level above only needs to change if the fullness of this summary
+      // unit changed.
+      Unit padding = PaddingMask(levelBits[level], summaryIndex);
+      bool wasFull = ((oldValue | padding) == (Unit)~(Unit)0);
+      full = ((summaryUnit | padding) == (Unit)~(Unit)0);
+      if (wasFull == full) {
+        return;
+      }
+      unitIndex = summaryIndex;
+    }
+  }
+  
+  inline Unit & SummaryUnit(int level, SizeType idx) {
+    return summary[levelOffsets[level] + (size_t)idx];
+  }
+  
+  /**
+   * Returns a mask of the bits in the unit at [unitIndex] which lie beyond
+   * the end of a sequence of [bitCount] bits.
+   */
+  static inline Unit PaddingMask(SizeType bitCount, SizeType unitIndex) {
+    SizeType used = bitCount % super::UnitBitCount;
+    if (!used || unitIndex != bitCount / super::UnitBitCount) {
+      return 0;
+    }
+    return (Unit)~(Unit)0 << used;
+  }
+};
+
+}
+
+#endif
@@ -18,7 +18,8 @@ public:
    */
   template <typename... Args>
   TransformedBitmapAligner(SizeType _scale, AddressType _offset, Unit * ptr,
-                           SizeType bc) : super(_scale, _offset, ptr, bc) {
+                           SizeType bc, BitmapInit init = BitmapZero)
+      : super(_scale, _offset, ptr, bc, init) {
     assert(ansa::IsPowerOf2(_scale));
     assert(ansa::IsAligned<AddressType>(_offset, _scale));
   }
@@ -17,12 +17,46 @@ public:
   typedef AllocatorTransformer<Bitmap<Unit, AddressType, SizeType> > super;
   
   TransformedBitmapAllocator(SizeType _scale, AddressType _offset, Unit * ptr,
-                             AddressType bc)
-      : super(_scale, _offset, ptr, bc) {}
+                             AddressType bc, BitmapInit init = BitmapZero)
+      : super(_scale, _offset, ptr, bc, init) {}
   
   inline SizeType GetBitCount() const {
     return this->wrapped.GetBitCount();
   }
+  
+  /**
+   * Allocate [count] regions of [GetScale] units each, using
+   * [Bitmap::AllocMany], and store their transformed addresses in
+   * [addresses].
+   */
+  bool AllocMany(AddressType * addresses, size_t count) {
+    if (!this->wrapped.AllocMany(addresses, count)) {
+      return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      addresses[i] = this->OutputAddress(addresses[i]);
+    }
+    return true;
+  }
+  
+  /**
+   * Deallocate [count] regions which were allocated with [AllocMany].
+   */
+  void DeallocMany(const AddressType * addresses, size_t count) {
+    // Translate the addresses in batches so that the bitmap can still clear
+    // a unit at a time.
+    AddressType batch[0x40];
+    while (count) {
+      size_t batchCount = ansa::Min<size_t>(count, 0x40);
+      for (size_t i = 0; i < batchCount; ++i) {
+        assert(!((addresses[i] - this->offset) % this->scale));
+        batch[i] = (addresses[i] - this->offset) / this->scale;
+      }
+      this->wrapped.DeallocMany(batch, batchCount);
+      addresses += batchCount;
+      count -= batchCount;
+    }
+  }
 };
 
 }
@@ -0,0 +1,85 @@
+#ifndef __ANALLOC2_UNIT_MATH_HPP__
+#define __ANALLOC2_UNIT_MATH_HPP__
+
+#include <ansa/math>
+#include <cassert>
+
+namespace analloc {
+
+/**
+ * Returns the index of the lowest set bit in [unit], or the number of bits in
+ * a [Unit] if [unit] is 0.
+ *
+ * Unlike `ansa::BitScanRight`, this works for any unsigned integer type,
+ * including `unsigned __int128`, and compiles to a single instruction per
+ * 64 bits on compilers which provide `__builtin_ctzll`.
+ */
+template <typename Unit>
+inline int UnitBitScanRight(Unit unit) {
+  const int bitCount = (int)(sizeof(Unit) * 8);
+  if (!unit) return bitCount;
+#if defined(__GNUC__) || defined(__clang__)
+  if (sizeof(Unit) <= sizeof(unsigned long long)) {
+    return __builtin_ctzll((unsigned long long)unit);
+  }
+  for (int i = 0; ; i += 64) {
+    unsigned long long part = (unsigned long long)(unit >> i);
+    if (part) {
+      return i + __builtin_ctzll(part);
+    }
+  }
+#else
+  return ansa::BitScanRight<Unit>(unit);
+#endif
+}
+
+/**
+ * Returns the index of the highest set bit in [unit], or -1 if [unit] is 0.
+ */
+template <typename Unit>
+inline int UnitBitScanLeft(Unit unit) {
+  const int bitCount = (int)(sizeof(Unit) * 8);
+  if (!unit) return -1;
+#if defined(__GNUC__) || defined(__clang__)
+  if (sizeof(Unit) <= sizeof(unsigned long long)) {
+    return 63 - __builtin_clzll((unsigned long long)unit);
+  }
+  for (int i = bitCount - 64; ; i -= 64) {
+    unsigned long long part = (unsigned long long)(unit >> i);
+    if (part) {
+      return i + 63 - __builtin_clzll(part);
+    }
+  }
+#else
+  int result = bitCount - 1;
+  while (!(unit & ((Unit)1 << result))) {
+    --result;
+  }
+  return result;
+#endif
+}
+
+/**
+ * Returns a mask in which bit `i` is set if and only if the [len] bits of
+ * [bits] starting at bit `i` are all set. A run must fit entirely within
+ * [bits] to be found.
+ *
+ * Every shift-and step doubles the length of the runs which are detected, so
+ * this takes about `log2(len)` steps.
+ */
+template <typename Unit>
+inline Unit UnitRunStarts(Unit bits, int len) {
+  assert(len > 0 && len <= (int)(sizeof(Unit) * 8));
+  // After each step, the bits of the result mark runs of [covered] bits.
+  int covered = 1;
+  while (covered < len && bits) {
+    int shift = covered < len - covered ? covered : len - covered;
+    bits &= (Unit)(bits >> shift);
+    covered += shift;
+  }
+  return bits;
+}
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef __ANALLOC2_UNIT_SCANNER_HPP__
+#define __ANALLOC2_UNIT_SCANNER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+// Define ANALLOC2_SIMD to let the scanner pick a vector kernel at runtime on
+// x86. Otherwise, only the portable kernel is built, so the scanner does not
+// touch the vector registers or query the CPU.
+#if defined(ANALLOC2_SIMD) && (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define __ANALLOC2_X86_SCANNER__
+#include <atomic>
+#include <immintrin.h>
+#endif
+
+namespace analloc {
+
+/**
+ * Finds the first unit of a bitmap which is not completely used.
+ *
+ * A unit is completely used when all of its bytes are `0xff`, so the scan is
+ * performed on bytes and works for any [Unit] type. On x86 with
+ * `ANALLOC2_SIMD` defined, vector kernels test 128, 256 or 512 bits per step,
+ * and the best kernel which the CPU supports is selected the first time a
+ * scan is performed.
+ */
+class UnitScanner {
+public:
+  /**
+   * A scan kernel returns the index of the first byte in the range
+   * [start, end) of [buffer] which is not `0xff`, or [end] if every byte in
+   * the range is `0xff`.
+   */
+  typedef size_t (* Kernel)(const uint8_t * buffer, size_t start, size_t end);
+  
+  enum KernelType {
+    ScalarKernel = 0,
+    Sse2Kernel,
+    Avx2Kernel,
+    Avx512Kernel,
+    KernelTypeCount
+  };
+  
+  /**
+   * Returns the index of the first unit in [start, end) which has at least
+   * one clear bit, or [end] if there is no such unit.
+   */
+  template <typename Unit>
+  static inline size_t NextNonFull(const Unit * units, size_t start,
+                                   size_t end) {
+    if (start >= end) return end;
+    size_t byte = Scan((const uint8_t *)units, start * sizeof(Unit),
+                       end * sizeof(Unit));
+    return byte / sizeof(Unit);
+  }
+  
+  /**
+   * Scan a byte buffer with the active kernel.
+   */
+  static inline size_t Scan(const uint8_t * buffer, size_t start,
+                            size_t end) {
+#ifdef __ANALLOC2_X86_SCANNER__
+    Kernel kernel = ActiveKernel().load(std::memory_order_relaxed);
+    if (!kernel) {
+      // Threads which get here at the same time all pick the same kernel,
+      // so it does not matter whose store wins.
+      kernel = KernelForType(BestSupported());
+      ActiveKernel().store(kernel, std::memory_order_relaxed);
+    }
+    return kernel(buffer, start, end);
+#else
+    return ScalarScan(buffer, start, end);
+#endif
+  }
+  
+  /**
+   * Returns `true` if the current CPU can run a given kernel.
+   */
+  static bool IsSupported(KernelType type) {
+    switch (type) {
+      case ScalarKernel:
+        return true;
+#ifdef __ANALLOC2_X86_SCANNER__
+      case Sse2Kernel:
+        return __builtin_cpu_supports("sse2");
+      case Avx2Kernel:
+        return __builtin_cpu_supports("avx2");
+      case Avx512Kernel:
+        return __builtin_cpu_supports("avx512f");
+#endif
+      default:
+        return false;
+    }
+  }
+  
+  /**
+   * Returns the fastest kernel which the current CPU supports.
+   */
+  static KernelType BestSupported() {
+#ifdef __ANALLOC2_X86_SCANNER__
+    __builtin_cpu_init();
+#endif
+    for (int i = KernelTypeCount - 1; i > 0; --i) {
+      if (IsSupported((KernelType)i)) {
+        return (KernelType)i;
+      }
+    }
+    return ScalarKernel;
+  }
+  
+  /**
+   * Force every subsequent scan to use a certain kernel. This is mainly
+   * useful for profiling. The kernel must be supported.
+   */
+  static void Select(KernelType type) {
+    assert(IsSupported(type));
+#ifdef __ANALLOC2_X86_SCANNER__
+    ActiveKernel().store(KernelForType(type), std::memory_order_relaxed);
+#else
+    (void)type;
+#endif
+  }
+  
+  /**
+   * Get the function which implements a kernel type.
+   */
+  static Kernel KernelForType(KernelType type) {
+    switch (type) {
+#ifdef __ANALLOC2_X86_SCANNER__
+      case Sse2Kernel:
+        return Sse2Scan;
+      case Avx2Kernel:
+        return Avx2Scan;
+      case Avx512Kernel:
+        return Avx512Scan;
+#endif
+      default:
+        return ScalarScan;
+    }
+  }
+  
+  /**
+   * The portable kernel, which tests one machine word per step.
+   */
+  static size_t ScalarScan(const uint8_t * buffer, size_t start, size_t end) {
+    size_t i = start;
+#if defined(__GNUC__) || defined(__clang__)
+    typedef unsigned long __attribute__((__may_alias__)) Word;
+    while (i < end && ((uintptr_t)(buffer + i) % sizeof(Word))) {
+      if (buffer[i] != 0xff) return i;
+      ++i;
+    }
+    while (i + sizeof(Word) <= end) {
+      if (*(const Word *)(buffer + i) != ~(Word)0) break;
+      i += sizeof(Word);
+    }
+#endif
+    return ByteScan(buffer, i, end);
+  }
+
+#ifdef __ANALLOC2_X86_SCANNER__
+  __attribute__((target("sse2")))
+  static size_t Sse2Scan(const uint8_t * buffer, size_t start, size_t end) {
+    size_t i = start;
+    while (i < end && ((uintptr_t)(buffer + i) & 0xf)) {
+      if (buffer[i] != 0xff) return i;
+      ++i;
+    }
+    const __m128i ones = _mm_set1_epi8((char)0xff);
+    // Test 64 bytes per iteration, then narrow it down 16 bytes at a time.
+    while (i + 0x40 <= end) {
+      const __m128i * ptr = (const __m128i *)(buffer + i);
+      __m128i all = _mm_and_si128(_mm_and_si128(_mm_load_si128(ptr),
+                                                _mm_load_si128(ptr + 1)),
+                                  _mm_and_si128(_mm_load_si128(ptr + 2),
+                                                _mm_load_si128(ptr + 3)));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(all, ones)) != 0xffff) break;
+      i += 0x40;
+    }
+    while (i + 0x10 <= end) {
+      __m128i vec = _mm_load_si128((const __m128i *)(buffer + i));
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(
+          _mm_cmpeq_epi8(vec, ones));
+      if (mask != 0xffff) {
+        return i + __builtin_ctz(~mask);
+      }
+      i += 0x10;
+    }
+    return ByteScan(buffer, i, end);
+  }
+  
+  __attribute__((target("avx2")))
+  static size_t Avx2Scan(const uint8_t * buffer, size_t start, size_t end) {
+    size_t i = start;
+    while (i < end && ((uintptr_t)(buffer + i) & 0x1f)) {
+      if (buffer[i] != 0xff) return i;
+      ++i;
+    }
+    const __m256i ones = _mm256_set1_epi8((char)0xff);
+    // Test 128 bytes per iteration, then narrow it down 32 bytes at a time.
+    while (i + 0x80 <= end) {
+      const __m256i * ptr = (const __m256i *)(buffer + i);
+      __m256i all = _mm256_and_si256(
+          _mm256_and_si256(_mm256_load_si256(ptr),
+                           _mm256_load_si256(ptr + 1)),
+          _mm256_and_si256(_mm256_load_si256(ptr + 2),
+                           _mm256_load_si256(ptr + 3)));
+      if (!_mm256_testc_si256(all, ones)) break;
+      i += 0x80;
+    }
+    while (i + 0x20 <= end) {
+      __m256i vec = _mm256_load_si256((const __m256i *)(buffer + i));
+      unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(vec, ones));
+      if (mask != 0xffffffff) {
+        return i + __builtin_ctz(~mask);
+      }
+      i += 0x20;
+    }
+    return ByteScan(buffer, i, end);
+  }
+  
+  __attribute__((target("avx512f")))
+  static size_t Avx512Scan(const uint8_t * buffer, size_t start, size_t end) {
+    size_t i = start;
+    while (i < end && ((uintptr_t)(buffer + i) & 0x3f)) {
+      if (buffer[i] != 0xff) return i;
+      ++i;
+    }
+    const __m512i ones = _mm512_set1_epi64(-1);
+    // Test 256 bytes per iteration, then narrow it down 64 bytes at a time.
+    while (i + 0x100 <= end) {
+      const __m512i * ptr = (const __m512i *)(buffer + i);
+      __m512i all = _mm512_and_si512(
+          _mm512_and_si512(_mm512_load_si512(ptr),
+                           _mm512_load_si512(ptr + 1)),
+          _mm512_and_si512(_mm512_load_si512(ptr + 2),
+                           _mm512_load_si512(ptr + 3)));
+      if (_mm512_cmpneq_epi64_mask(all, ones)) break;
+      i += 0x100;
+    }
+    while (i + 0x40 <= end) {
+      __m512i vec = _mm512_load_si512((const __m512i *)(buffer + i));
+      unsigned int mask = (unsigned int)_mm512_cmpneq_epi64_mask(vec, ones);
+      if (mask) {
+        // Narrow it down to the 64-bit lane, then to the byte.
+        i += __builtin_ctz(mask) * 8;
+        return ByteScan(buffer, i, i + 8);
+      }
+      i += 0x40;
+    }
+    return ByteScan(buffer, i, end);
+  }
+#endif
+  
+protected:
+#ifdef __ANALLOC2_X86_SCANNER__
+  /**
+   * The kernel used by [Scan], or `nullptr` until the first scan picks one.
+   * Bitmaps on different threads may scan for the first time at once, so it
+   * is atomic.
+   */
+  static inline std::atomic<Kernel> & ActiveKernel() {
+    static std::atomic<Kernel> kernel(nullptr);
+    return kernel;
+  }
+#endif
+  
+  static inline size_t ByteScan(const uint8_t * buffer, size_t start,
+                                size_t end) {
+    while (start < end && buffer[start] == 0xff) {
+      ++start;
+    }
+    return start;
+  }
+};
+
+}
+
+#endif
@@ -23,19 +23,22 @@ public:
    * Returns `nullptr` if there is not enough space to generate a
    * [VirtualBitmapAligner] object with the proper page size and unit
    * alignments.
+   *
+   * The [init] argument is passed along to the underlying [Bitmap].
    */
   static VirtualBitmapAligner<Unit> * Place(uintptr_t region, size_t size,
                                               size_t page =
-                                                  sizeof(uintptr_t)) {
+                                                  sizeof(uintptr_t),
+                                              BitmapInit init = BitmapZero) {
     // This might be perhaps the longest method call I have ever seen.
     return VirtualBitmapAllocator<Unit>::
            template PlaceObject<VirtualBitmapAligner<Unit> >
-           (region, size, page);
+           (region, size, page, init);
   }
   
   VirtualBitmapAligner(size_t pageSize, uintptr_t _offset, Unit * ptr,
-                       size_t size)
-      : super(pageSize, pageSize, _offset, ptr, size / pageSize) {}
+                       size_t size, BitmapInit init = BitmapZero)
+      : super(pageSize, pageSize, _offset, ptr, size / pageSize, init) {}
   
   inline size_t GetScale() {
     return this->wrapped.GetScale();
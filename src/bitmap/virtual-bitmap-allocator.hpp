@@ -26,16 +26,21 @@ public:
    * Returns `nullptr` if there is not enough space to generate a
    * [VirtualBitmapAllocator] object with the proper page size and unit
    * alignments.
+   *
+   * The [init] argument is passed along to the underlying [Bitmap]. Use
+   * [BitmapPreZeroed] if the region comes from fresh anonymous pages.
    */
   static VirtualBitmapAllocator<Unit> * Place(uintptr_t region, size_t size,
                                               size_t page =
-                                                  sizeof(uintptr_t)) {
-    return PlaceObject(region, size, page);
+                                                  sizeof(uintptr_t),
+                                              BitmapInit init = BitmapZero) {
+    return PlaceObject(region, size, page, init);
   }
   
   VirtualBitmapAllocator(size_t pageSize, uintptr_t _offset,
-                         Unit * ptr, size_t size)
-      : super(pageSize, pageSize, _offset, ptr, size / pageSize) {}
+                         Unit * ptr, size_t size,
+                         BitmapInit init = BitmapZero)
+      : super(pageSize, pageSize, _offset, ptr, size / pageSize, init) {}
   
   inline size_t GetScale() {
     return this->wrapped.GetScale();
@@ -53,6 +58,24 @@ public:
     return GetBitCount() * GetScale();
   }
   
+  /**
+   * Allocate [count] individual pages and store their addresses in
+   * [addresses].
+   *
+   * Unlike regions from [Alloc], these pages have no header. They must be
+   * freed with [DeallocMany] rather than [Dealloc] or [Free].
+   */
+  bool AllocMany(uintptr_t * addresses, size_t count) {
+    return this->wrapped.AllocMany(addresses, count);
+  }
+  
+  /**
+   * Deallocate [count] pages which were allocated with [AllocMany].
+   */
+  void DeallocMany(const uintptr_t * addresses, size_t count) {
+    this->wrapped.DeallocMany(addresses, count);
+  }
+  
 protected:
   friend class VirtualBitmapAligner<Unit>;
   
@@ -110,7 +133,8 @@ protected:
    * memory, even if they require more storage than [VirtualBitmapAllocator].
    */
   template <class T = VirtualBitmapAllocator<Unit> >
-  static T * PlaceObject(uintptr_t region, size_t size, size_t page) {
+  static T * PlaceObject(uintptr_t region, size_t size, size_t page,
+                         BitmapInit init) {
     size_t align = ansa::Align(sizeof(Unit), page);
     
     // Compute the number of bytes we have for the bitmap and buffers combined.
@@ -130,7 +154,7 @@ protected:
     Unit * buffer = (Unit *)(region + structureSize);
     uintptr_t offset = region + structureSize + bitmapSize;
     
-    return new(ptr) T(page, offset, buffer, freeSize);
+    return new(ptr) T(page, offset, buffer, freeSize, init);
   }
 };
 
@@ -0,0 +1,283 @@
+#ifndef __ANALLOC2_BOUNDARY_TAG_FREE_LIST_HPP__
+#define __ANALLOC2_BOUNDARY_TAG_FREE_LIST_HPP__
+
+#include "../abstract/virtual-offset-aligner.hpp"
+#include "boundary-tags.hpp"
+#include <ansa/math>
+#include <ansa/cstring>
+#include <cassert>
+#include <new>
+
+namespace analloc {
+
+/**
+ * A free list which stores everything it needs inside the memory it manages.
+ *
+ * Blocks use the [BoundaryTags] layout, so a freed block is merged with the
+ * blocks next to it in O(1) time. The free blocks are linked through their
+ * own memory, so freeing never allocates metadata. Allocating scans the free
+ * blocks in the order they were freed, which takes O(n) time.
+ */
+class BoundaryTagFreeList
+    : public virtual VirtualOffsetAligner,
+      public BoundaryTags {
+public:
+  /**
+   * Create an empty allocator. Use [AddRegion] to give it memory, or use
+   * [Place] to store the allocator inside the memory it manages.
+   */
+  BoundaryTagFreeList() {}
+  
+  /**
+   * Create a [BoundaryTagFreeList] at [start] which manages the rest of the
+   * [size] bytes after it.
+   *
+   * Returns `nullptr` if there is not enough room for the allocator and one
+   * free block.
+   */
+  static BoundaryTagFreeList * Place(uintptr_t start, size_t size) {
+    assert(ansa::IsAligned2<uintptr_t>(start, alignof(BoundaryTagFreeList)));
+    size_t instanceSize = ansa::Align2(sizeof(BoundaryTagFreeList), Granule);
+    if (instanceSize > size) {
+      return nullptr;
+    }
+    BoundaryTagFreeList * result = new((void *)start) BoundaryTagFreeList();
+    if (!result->AddRegion(start + instanceSize, size - instanceSize)) {
+      result->~BoundaryTagFreeList();
+      return nullptr;
+    }
+    return result;
+  }
+  
+  /**
+   * Add an arbitrary region of memory to this allocator.
+   *
+   * The region is trimmed to a multiple of [Granule], and its last
+   * [HeaderSize] bytes mark its end. Blocks from different regions are never
+   * merged.
+   *
+   * Returns the size of the free block which was added, or 0 if the region
+   * was too small to hold one.
+   */
+  size_t AddRegion(uintptr_t start, size_t size) {
+    FreeBlock * block = FormatRegion(start, size);
+    if (!block) {
+      return 0;
+    }
+    InsertFree(block);
+    return BlockSize(block);
+  }
+  
+  /**
+   * Allocate [size] bytes from the first free block which fits.
+   *
+   * If the rest of the block is big enough to stay free, the allocation is
+   * taken from its end, so the free block keeps its place in the list.
+   */
+  virtual bool Alloc(uintptr_t & addressOut, size_t size) {
+    size_t blockSize;
+    if (!GetBlockSize(size, blockSize)) {
+      return false;
+    }
+    for (FreeBlock * block = firstFree; block; block = block->nextFree) {
+      size_t freeSize = BlockSize(block);
+      if (freeSize < blockSize) {
+        continue;
+      }
+      size_t offset = 0;
+      if (freeSize - blockSize >= MinBlockSize) {
+        offset = freeSize - blockSize;
+      }
+      addressOut = Carve(block, offset, blockSize);
+      return true;
+    }
+    return false;
+  }
+  
+  /**
+   * Allocate [size] bytes at an aligned address from the first free block
+   * which can hold them.
+   *
+   * Since every address is a multiple of [Granule], this fails if [offset]
+   * makes the alignment impossible to meet.
+   */
+  virtual bool OffsetAlign(uintptr_t & addressOut, uintptr_t align,
+                           uintptr_t offset, size_t size) {
+    assert(!align || ansa::IsPowerOf2(align));
+    if (align <= Granule) {
+      if (align > 1 && offset % align) {
+        return false;
+      }
+      return Alloc(addressOut, size);
+    } else if (offset % Granule) {
+      return false;
+    }
+    size_t blockSize;
+    if (!GetBlockSize(size, blockSize)) {
+      return false;
+    }
+    for (FreeBlock * block = firstFree; block; block = block->nextFree) {
+      // A gap in front of the allocation must be big enough to stay free.
+      uintptr_t address = (uintptr_t)block + HeaderSize;
+      size_t gap = (size_t)((align - (address + offset) % align) % align);
+      if (gap && gap < MinBlockSize) {
+        gap += ansa::Align2<size_t>(MinBlockSize - gap, align);
+      }
+      size_t freeSize = BlockSize(block);
+      if (gap > freeSize || freeSize - gap < blockSize) {
+        continue;
+      }
+      addressOut = Carve(block, gap, blockSize);
+      return true;
+    }
+    return false;
+  }
+  
+  /**
+   * Free the block which [address] was allocated from. The [size] argument
+   * is only used for sanity checks.
+   */
+  virtual void Dealloc(uintptr_t address, size_t size) {
+    assert(BlockSize(BlockAt(address)) - HeaderSize >= size);
+    (void)size;
+    Free(address);
+  }
+  
+  /**
+   * Free the block which [address] was allocated from, and merge it with the
+   * blocks next to it if they are free.
+   */
+  virtual void Free(uintptr_t address) {
+    FreeBlock * block = BlockAt(address);
+    assert(!(block->header & FreeFlag));
+    size_t blockSize = BlockSize(block);
+    FreeBlock * next = NextBlock(block);
+    if (next->header & FreeFlag) {
+      RemoveFree(next);
+      blockSize += BlockSize(next);
+    }
+    if (block->header & PreviousFreeFlag) {
+      FreeBlock * previous = PreviousBlock(block);
+      assert(previous->header & FreeFlag);
+      RemoveFree(previous);
+      blockSize += BlockSize(previous);
+      block = previous;
+    }
+    SetFree(block, blockSize);
+    InsertFree(block);
+  }
+  
+  /**
+   * Resize the block at [address] in place if possible.
+   *
+   * Shrinking frees the end of the block if it is big enough to be a block
+   * of its own. Growing takes the front of the next block if it is free.
+   * Otherwise, a new block is allocated, the contents are copied over, and
+   * the old block is freed.
+   */
+  virtual bool Realloc(uintptr_t & address, size_t size) {
+    size_t newSize;
+    if (!GetBlockSize(size, newSize)) {
+      return false;
+    }
+    FreeBlock * block = BlockAt(address);
+    size_t blockSize = BlockSize(block);
+    if (newSize > blockSize) {
+      FreeBlock * next = NextBlock(block);
+      if ((next->header & FreeFlag) &&
+          BlockSize(next) >= newSize - blockSize) {
+        RemoveFree(next);
+        blockSize += BlockSize(next);
+        block->header = blockSize | (block->header & PreviousFreeFlag);
+        NextBlock(block)->header &= ~PreviousFreeFlag;
+      } else {
+        uintptr_t newAddress;
+        if (!Alloc(newAddress, size)) {
+          return false;
+        }
+        ansa::Memcpy((void *)newAddress, (void *)address,
+                     blockSize - HeaderSize);
+        Free(address);
+        address = newAddress;
+        return true;
+      }
+    }
+    if (blockSize - newSize >= MinBlockSize) {
+      block->header = newSize | (block->header & PreviousFreeFlag);
+      FreeBlock * rest = NextBlock(block);
+      rest->header = blockSize - newSize;
+      Free((uintptr_t)rest + HeaderSize);
+    }
+    return true;
+  }
+  
+protected:
+  FreeBlock * firstFree = nullptr;
+  
+  void InsertFree(FreeBlock * block) {
+    block->nextFree = firstFree;
+    block->previousFree = nullptr;
+    if (firstFree) {
+      firstFree->previousFree = block;
+    }
+    firstFree = block;
+    ++freeBlockCount;
+    freeSize += BlockSize(block);
+  }
+  
+  void RemoveFree(FreeBlock * block) {
+    if (block->nextFree) {
+      block->nextFree->previousFree = block->previousFree;
+    }
+    if (block->previousFree) {
+      block->previousFree->nextFree = block->nextFree;
+    } else {
+      assert(firstFree == block);
+      firstFree = block->nextFree;
+    }
+    --freeBlockCount;
+    freeSize -= BlockSize(block);
+  }
+  
+  /**
+   * Allocate a block of [size] bytes which starts [offset] bytes into the
+   * free [block], and return its address.
+   *
+   * The [offset] must be 0 or at least [MinBlockSize]. The space in front of
+   * the allocation stays in the free list in place of [block], and the space
+   * after it is freed if it is big enough to be a block of its own.
+   */
+  uintptr_t Carve(FreeBlock * block, size_t offset, size_t size) {
+    size_t blockSize = BlockSize(block);
+    assert(!offset || offset >= MinBlockSize);
+    assert(offset + size <= blockSize);
+    FreeBlock * used = block;
+    size_t flags = block->header & PreviousFreeFlag;
+    if (offset) {
+      used = (FreeBlock *)((uintptr_t)block + offset);
+      flags = PreviousFreeFlag;
+      freeSize -= blockSize - offset;
+      SetFree(block, offset);
+    } else {
+      RemoveFree(block);
+    }
+    size_t rest = blockSize - offset - size;
+    if (rest >= MinBlockSize) {
+      FreeBlock * restBlock = (FreeBlock *)((uintptr_t)used + size);
+      restBlock->header = 0;
+      SetFree(restBlock, rest);
+      InsertFree(restBlock);
+    } else {
+      size += rest;
+    }
+    used->header = size | flags;
+    if (rest < MinBlockSize) {
+      NextBlock(used)->header &= ~PreviousFreeFlag;
+    }
+    return (uintptr_t)used + HeaderSize;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef __ANALLOC2_BOUNDARY_TAGS_HPP__
+#define __ANALLOC2_BOUNDARY_TAGS_HPP__
+
+#include <ansa/math>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+namespace analloc {
+
+/**
+ * The block layout shared by allocators which store their metadata inside the
+ * memory they manage.
+ *
+ * Every block starts with a header which stores its size and two flags, and
+ * every free block ends with a footer which repeats its size, so a freed
+ * block can find both of its neighbors in O(1) time. A free block also holds
+ * two links, which its allocator uses to keep it in a free list.
+ */
+class BoundaryTags {
+public:
+  static_assert(sizeof(size_t) <= sizeof(void *),
+                "Headers must fit in a pointer.");
+  
+  /**
+   * Block sizes and the addresses which this allocator returns are multiples
+   * of [Granule] bytes.
+   */
+  static constexpr size_t Granule = sizeof(void *);
+  
+  /**
+   * The number of bytes in front of every allocation which store the size of
+   * its block.
+   */
+  static constexpr size_t HeaderSize = Granule;
+  
+  /**
+   * The smallest block, which has room for a header, two free list links and
+   * a footer.
+   */
+  static constexpr size_t MinBlockSize = Granule * 4;
+  
+  /**
+   * Returns the number of free blocks.
+   */
+  inline size_t GetFreeBlockCount() const {
+    return freeBlockCount;
+  }
+  
+  /**
+   * Returns the total size of the free blocks, including their headers.
+   */
+  inline size_t GetFreeSize() const {
+    return freeSize;
+  }
+  
+protected:
+  static constexpr size_t FreeFlag = 1;
+  static constexpr size_t PreviousFreeFlag = 2;
+  static constexpr size_t FlagMask = FreeFlag | PreviousFreeFlag;
+  
+  /**
+   * The layout of a block. The links are only valid while the block is free,
+   * and the rest of an allocated block belongs to its owner.
+   */
+  struct FreeBlock {
+    size_t header;
+    FreeBlock * nextFree;
+    FreeBlock * previousFree;
+  };
+  
+  size_t freeBlockCount = 0;
+  size_t freeSize = 0;
+  
+  /**
+   * Turn the [size] bytes at [start] into a single free block which is not
+   * in any free list yet.
+   *
+   * The region is trimmed to a multiple of [Granule], and its last
+   * [HeaderSize] bytes mark its end. Returns `nullptr` if the region is too
+   * small to hold a block.
+   */
+  static FreeBlock * FormatRegion(uintptr_t start, size_t size) {
+    size_t misalignment = (size_t)(start % Granule);
+    if (misalignment) {
+      if (Granule - misalignment > size) {
+        return nullptr;
+      }
+      start += Granule - misalignment;
+      size -= Granule - misalignment;
+    }
+    size -= size % Granule;
+    if (size < MinBlockSize + HeaderSize) {
+      return nullptr;
+    }
+    
+    // The end of the region is marked by an empty block which is always in
+    // use, so that the last real block never looks for a neighbor past it.
+    FreeBlock * block = (FreeBlock *)start;
+    block->header = 0;
+    SetFree(block, size - HeaderSize);
+    NextBlock(block)->header = PreviousFreeFlag;
+    return block;
+  }
+  
+  static inline FreeBlock * BlockAt(uintptr_t address) {
+    return (FreeBlock *)(address - HeaderSize);
+  }
+  
+  static inline size_t BlockSize(FreeBlock * block) {
+    return block->header & ~FlagMask;
+  }
+  
+  static inline FreeBlock * NextBlock(FreeBlock * block) {
+    return (FreeBlock *)((uintptr_t)block + BlockSize(block));
+  }
+  
+  /**
+   * Find the block before [block] from its footer. This is only valid if the
+   * previous block is free.
+   */
+  static inline FreeBlock * PreviousBlock(FreeBlock * block) {
+    size_t size = *((size_t *)block - 1);
+    return (FreeBlock *)((uintptr_t)block - size);
+  }
+  
+  /**
+   * Compute the size of the block which holds an allocation of [size] bytes.
+   * Returns `false` if it would overflow.
+   */
+  static inline bool GetBlockSize(size_t size, size_t & blockSize) {
+    if (size > ~(size_t)0 - HeaderSize - Granule) {
+      return false;
+    }
+    blockSize = ansa::Align2<size_t>(size + HeaderSize, Granule);
+    if (blockSize < MinBlockSize) {
+      blockSize = MinBlockSize;
+    }
+    return true;
+  }
+  
+  /**
+   * Mark [block] as a free block of [size] bytes and write its footer. This
+   * does not add it to a free list.
+   */
+  static inline void SetFree(FreeBlock * block, size_t size) {
+    block->header = size | FreeFlag | (block->header & PreviousFreeFlag);
+    *(size_t *)((uintptr_t)block + size - sizeof(size_t)) = size;
+    NextBlock(block)->header |= PreviousFreeFlag;
+  }
+};
+
+}
+
+#endif
@@ -31,6 +31,12 @@ public:
     super::Dealloc(address, ansa::Align2(size, chunkSize));
   }
   
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    return super::TryResize(address, ansa::Align2(size, chunkSize),
+                            ansa::Align2(newSize, chunkSize));
+  }
+  
   virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
                            AddressType offset, SizeType size) {
     if (!ansa::IsAligned2(offset, chunkSize)) {
@@ -2,12 +2,41 @@
 #define __ANALLOC2_FREE_LIST_HPP__
 
 #include "../abstract/offset-aligner.hpp"
+#include "../abstract/resizer.hpp"
 #include <ansa/math>
 #include <cstdint>
 #include <cstddef>
 
 namespace analloc {
 
+/**
+ * Determines which free region a [FreeList] allocates from.
+ */
+enum FreeListFit {
+  /**
+   * Use the region with the lowest address which fits.
+   */
+  FreeListFirstFit,
+  
+  /**
+   * Use the first region which fits, starting at the region which satisfied
+   * the previous allocation and wrapping around to the beginning of the list.
+   */
+  FreeListNextFit,
+  
+  /**
+   * Use the smallest region which fits, or the lowest one if several are
+   * equally small. This scans the whole list unless a region fits exactly.
+   */
+  FreeListBestFit,
+  
+  /**
+   * Use the largest region, or the lowest one if several are equally large.
+   * This always scans the whole list.
+   */
+  FreeListWorstFit
+};
+
 /**
  * An offset aligner which allocates and frees address space in O(n), where n
  * is the number of disjoint fragments of free space.
@@ -20,7 +49,9 @@ namespace analloc {
  * maximum value of SizeType.
  */
 template <typename AddressType, typename SizeType = AddressType>
-class FreeList : public virtual OffsetAligner<AddressType, SizeType> {
+class FreeList
+    : public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
 public:
   /**
    * The function signature of a callback which a [FreeList] will call when a
@@ -47,6 +78,7 @@ public:
    * Deallocate all free regions.
    */
   virtual ~FreeList() {
+    SetIndexed(false);
     while (firstRegion) {
       Remove(nullptr, firstRegion);
     }
@@ -55,99 +87,74 @@ public:
   /**
    * Allocate memory from a chunk.
    *
-   * This finds the first chunk which is big enough to accommodate the
-   * requested allocation. It slices off the beginning of the found chunk and
-   * returns it. The chunk will be completely removed if it is exactly [size]
-   * units large.
+   * This finds a chunk which is big enough to accommodate the requested
+   * allocation according to the fit policy (see [SetFit]). It slices off the
+   * beginning of the found chunk and returns it. The chunk will be completely
+   * removed if it is exactly [size] units large.
    *
    * If and only if no chunk is found which is big enough to fit [size], this
-   * method will return `false`.
+   * method will return `false`. This happens in O(1) time if [size] is
+   * bigger than [GetLargestRegionBound].
    */
   virtual bool Alloc(AddressType & out, SizeType size) {
-    FreeRegion * last = nullptr;
-    FreeRegion * reg = firstRegion;
-    while (reg) {
-      if (reg->size < size) {
-        last = reg;
-        reg = reg->next;
-      } else if (reg->size == size) {
-        // Remove the region from the list
-        out = reg->start;
-        Remove(last, reg);
+    if (size > largestBound) {
+      return false;
+    }
+    SizeType largest = 0;
+    if (fit == FreeListBestFit || fit == FreeListWorstFit) {
+      return AlignFitting(out, 1, 0, size);
+    } else if (fit == FreeListFirstFit || !rover) {
+      if (AllocRange(out, size, nullptr, nullptr, largest)) {
         return true;
-      } else {
-        // Take a chunk out of the region
-        out = reg->start;
-        reg->start += size;
-        reg->size -= size;
+      }
+    } else {
+      FreeRegion * stop = rover->next;
+      if (AllocRange(out, size, rover, nullptr, largest) ||
+          AllocRange(out, size, nullptr, stop, largest)) {
         return true;
       }
     }
+    // Every region was scanned, so the bound can be made exact.
+    largestBound = largest;
     return false;
   }
-
+  
   /**
    * Align address space.
    *
    * If the first region matching the alignment criteria is nested within a
    * chunk, that chunk will be split into two separate chunks.
+   *
+   * The region is chosen by the fit policy, just like it is for [Alloc].
+   * The best and worst fits are judged by the sizes of the regions which can
+   * hold the aligned allocation.
    */
   virtual bool OffsetAlign(AddressType & out, AddressType align,
                            AddressType alignOffset, SizeType size) {
-    FreeRegion * last = nullptr;
-    FreeRegion * reg = this->firstRegion;
-    while (reg) {
-      // Compute the offset in this region to align it properly.
-      SizeType offset = 0;
-      AddressType misalignment = (AddressType)(reg->start + alignOffset) %
-                                 align;
-      if (misalignment) {
-        AddressType compensation = align - misalignment;
-        offset = (SizeType)compensation;
-        if (offset != compensation || offset > reg->size) {
-          // The aligned address is out of bounds.
-          last = reg;
-          reg = reg->next;
-          continue;
-        }
-      }
-      // Check for the five cases:
-      // - there isn't enough room in this region
-      // - there is exactly enough room in this region and offset = 0
-      // - there is more than enough room in this region and offset = 0
-      // - there is just enough room in this region with offset != 0
-      // - there is more than enough room in this region with offset != 0
-      if (reg->size - offset < size) {
-        last = reg;
-        reg = reg->next;
-      } else if (offset == 0 && size == reg->size) {
-        // Remove the region from the list
-        out = reg->start;
-        this->Remove(last, reg);
-        return true;
-      } else if (offset == 0 && size < reg->size) {
-        // Take the first chunk out of the region
-        out = reg->start;
-        reg->size -= size;
-        reg->start += size;
-        return true;
-      } else if (offset != 0 && size + offset == reg->size) {
-        // Take the last chunk out of the region
-        out = reg->start + offset;
-        reg->size = offset;
+    if (size > largestBound) {
+      return false;
+    }
+    SizeType largest = 0;
+    if (fit == FreeListBestFit || fit == FreeListWorstFit) {
+      return AlignFitting(out, align, alignOffset, size);
+    } else if (fit == FreeListFirstFit || !rover) {
+      if (AlignRange(out, align, alignOffset, size, nullptr, nullptr,
+                     largest)) {
         return true;
-      } else {
-        // Carve out the middle of the region
-        out = reg->start + offset;
-        this->InsertAfter(reg, reg->start + offset + size,
-                          reg->size - (offset + size));
-        reg->size = offset;
+      }
+    } else {
+      FreeRegion * stop = rover->next;
+      if (AlignRange(out, align, alignOffset, size, rover, nullptr,
+                     largest) ||
+          AlignRange(out, align, alignOffset, size, nullptr, stop,
+                     largest)) {
         return true;
       }
     }
+    largestBound = largest;
     return false;
   }
- 
+  
   /**
    * Add a chunk to the chunk list which starts at [address] and is [size] 
    * units large.
@@ -161,16 +168,8 @@ public:
            (AddressType)(address + size) == 0);
     
     // Find the regions that surround the freed address
-    FreeRegion * after = firstRegion;
-    FreeRegion * before = nullptr;
-    while (after) {
-      if (after->start > address) {
-        break;
-      } else {
-        before = after;
-        after = after->next;
-      }
-    }
+    FreeRegion * before = FindBefore(address);
+    FreeRegion * after = before ? before->next : firstRegion;
     
     assert(!after || address + size <= after->start);
     
@@ -178,18 +177,23 @@ public:
       // The region before the freed address extends to the freed address.
       assert(!ansa::AddWraps<SizeType>(before->size, size));
       before->size += size;
+      freeSize += size;
       if (after && after->start == before->start + before->size) {
         // The expanded before region extends all the way to the after region.
         assert(!ansa::AddWraps<SizeType>(before->size, after->size));
         before->size += after->size;
+        freeSize += after->size;
         Remove(before, after);
       }
+      RaiseBound(before->size);
     } else if (after && address + size == after->start) {
       assert(!ansa::AddWraps<SizeType>(after->size, size));
       // The freed region does not touch the region before it, but it does
       // reach the region after it.
       after->start -= size;
       after->size += size;
+      freeSize += size;
+      RaiseBound(after->size);
     } else {
       // The freed region touches neither the region before it nor the one
       // after it.
@@ -197,36 +201,478 @@ public:
     }
   }
   
+  /**
+   * Grow or shrink a region which was allocated at [address].
+   *
+   * A region can only grow if a free region starts right where it ends and
+   * is big enough. Shrinking frees the end of the region, which may need
+   * memory for a new free region just like [Dealloc].
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    if (newSize <= size) {
+      this->Dealloc(address + newSize, size - newSize);
+      return true;
+    }
+    AddressType end = address + size;
+    SizeType extra = newSize - size;
+    FreeRegion * last = FindBefore(address);
+    FreeRegion * reg = last ? last->next : firstRegion;
+    if (!reg || reg->start != end || reg->size < extra) {
+      return false;
+    }
+    if (reg->size == extra) {
+      Remove(last, reg);
+    } else {
+      reg->start += extra;
+      reg->size -= extra;
+      freeSize -= extra;
+    }
+    return true;
+  }
+  
   /**
    * Returns the number of free regions.
    */
-  size_t GetRegionCount() {
-    size_t count = 0;
-    FreeRegion * region = firstRegion;
-    while (region) {
-      ++count;
-      region = region->next;
+  inline size_t GetRegionCount() const {
+    return regionCount;
+  }
+  
+  /**
+   * Returns the total number of free units.
+   */
+  inline AddressType GetFreeSize() const {
+    return freeSize;
+  }
+  
+  /**
+   * Returns a size which no free region is bigger than.
+   *
+   * The bound grows as soon as a region does, but it only shrinks when an
+   * allocation scans the whole list and fails. Allocations which are bigger
+   * than the bound fail without scanning anything.
+   */
+  inline SizeType GetLargestRegionBound() const {
+    return largestBound;
+  }
+  
+  /**
+   * Returns the size of the largest free region, or 0 if there are none.
+   * Unlike [GetLargestRegionBound], this walks the whole list.
+   */
+  SizeType GetLargestRegionSize() {
+    SizeType largest = 0;
+    for (FreeRegion * region = firstRegion; region; region = region->next) {
+      if (region->size > largest) {
+        largest = region->size;
+      }
+    }
+    return largest;
+  }
+  
+  /**
+   * Set the policy which chooses the region for each allocation.
+   *
+   * By default, every allocation uses the lowest region which fits. Next-fit
+   * avoids walking a long prefix of small regions when addresses are handed
+   * out roughly in order. Best-fit and worst-fit scan the whole list, and
+   * trade speed for leaving fewer tiny regions or more large ones behind.
+   */
+  inline void SetFit(FreeListFit policy) {
+    fit = policy;
+  }
+  
+  inline FreeListFit GetFit() const {
+    return fit;
+  }
+  
+  /**
+   * Switch between next-fit and first-fit allocation.
+   */
+  inline void SetNextFit(bool flag) {
+    fit = flag ? FreeListNextFit : FreeListFirstFit;
+  }
+  
+  inline bool IsNextFit() const {
+    return fit == FreeListNextFit;
+  }
+  
+  /**
+   * Enable or disable the skip list index over the free regions.
+   *
+   * Without the index, [Dealloc] and [TryResize] walk the list from the
+   * lowest region to find their neighbors. With it, about a quarter of the
+   * regions get a tower of [IndexNode]s, each level a quarter as likely as
+   * the one below it, so the neighbors are found in O(log n) time on
+   * average. The index is built in O(n log n) time when it is enabled.
+   *
+   * Index nodes are allocated from the same allocator as the regions. If it
+   * runs out of memory, towers are simply left shorter.
+   */
+  void SetIndexed(bool flag) {
+    if (flag == indexed) {
+      return;
     }
-    return count;
+    indexed = flag;
+    if (flag) {
+      for (FreeRegion * reg = firstRegion; reg; reg = reg->next) {
+        IndexRegion(reg);
+      }
+      return;
+    }
+    for (int i = 0; i < indexLevels; ++i) {
+      while (indexHeads[i]) {
+        IndexNode * node = indexHeads[i];
+        indexHeads[i] = node->right;
+        allocator.Dealloc((uintptr_t)node, sizeof(IndexNode));
+      }
+    }
+    indexLevels = 0;
+  }
+  
+  inline bool IsIndexed() const {
+    return indexed;
+  }
+  
+  /**
+   * Returns the number of levels above the list itself which the index
+   * currently has.
+   */
+  inline int GetIndexLevelCount() const {
+    return indexLevels;
+  }
+  
+  /**
+   * Get the address of the most recent successful allocation, or 0 if no
+   * allocation has been made.
+   */
+  inline AddressType LastUsedAddress() const {
+    return lastUsed;
   }
   
   /**
    * The structure which is used to represent a region of memory.
    *
    * All allocations that [FreeList] needs from its allocator will be of size
-   * `sizeof(FreeRegion)`.
+   * `sizeof(FreeRegion)`, or `sizeof(IndexNode)` if the index is enabled.
    */
   struct FreeRegion {
     FreeRegion * next;
     AddressType start;
     SizeType size;
   };
-
+  
+  /**
+   * A level of a region's tower in the skip list index. The [down] node of
+   * the lowest level is `nullptr`.
+   */
+  struct IndexNode {
+    IndexNode * right;
+    IndexNode * down;
+    FreeRegion * region;
+  };
+  
 protected:  
   FreeRegion * firstRegion = nullptr;
   Allocator<uintptr_t, size_t> & allocator;
   FailureHandler failureHandler;
   
+  FreeListFit fit = FreeListFirstFit;
+  AddressType lastUsed = 0;
+  
+  size_t regionCount = 0;
+  AddressType freeSize = 0;
+  SizeType largestBound = 0;
+  
+  /**
+   * The region before the one at which the next search will start, or
+   * `nullptr` if the next search should start at [firstRegion].
+   */
+  FreeRegion * rover = nullptr;
+  
+  static constexpr int MaxIndexLevels = 16;
+  
+  bool indexed = false;
+  int indexLevels = 0;
+  IndexNode * indexHeads[MaxIndexLevels] = {};
+  uint32_t indexSeed = 1;
+  
+  /**
+   * Find the last region which starts at or before [address], or `nullptr`
+   * if there is none.
+   */
+  FreeRegion * FindBefore(AddressType address) {
+    FreeRegion * before = nullptr;
+    if (indexLevels) {
+      IndexNode * node = nullptr;
+      for (int level = indexLevels - 1; level >= 0; --level) {
+        IndexNode * next = node ? node->right : indexHeads[level];
+        while (next && next->region->start <= address) {
+          node = next;
+          next = node->right;
+        }
+        if (level && node) {
+          node = node->down;
+        }
+      }
+      before = node ? node->region : nullptr;
+    }
+    FreeRegion * reg = before ? before->next : firstRegion;
+    while (reg && reg->start <= address) {
+      before = reg;
+      reg = reg->next;
+    }
+    return before;
+  }
+  
+  /**
+   * Find the last node on each level of the index which belongs to a region
+   * starting before [address]. A level with no such node gets `nullptr`.
+   */
+  void FindIndexPredecessors(AddressType address, IndexNode ** nodes) {
+    IndexNode * node = nullptr;
+    for (int level = indexLevels - 1; level >= 0; --level) {
+      IndexNode * next = node ? node->right : indexHeads[level];
+      while (next && next->region->start < address) {
+        node = next;
+        next = node->right;
+      }
+      nodes[level] = node;
+      if (level && node) {
+        node = node->down;
+      }
+    }
+  }
+  
+  /**
+   * Give a new region a tower of random height in the index.
+   */
+  void IndexRegion(FreeRegion * region) {
+    indexSeed ^= indexSeed << 13;
+    indexSeed ^= indexSeed >> 17;
+    indexSeed ^= indexSeed << 5;
+    uint32_t bits = indexSeed;
+    int height = 0;
+    while (height < MaxIndexLevels && !(bits & 3)) {
+      ++height;
+      bits >>= 2;
+    }
+    if (!height) {
+      return;
+    }
+    
+    IndexNode * nodes[MaxIndexLevels];
+    FindIndexPredecessors(region->start, nodes);
+    IndexNode * below = nullptr;
+    for (int level = 0; level < height; ++level) {
+      uintptr_t ptr;
+      if (!allocator.Alloc(ptr, sizeof(IndexNode))) {
+        return;
+      }
+      IndexNode * node = (IndexNode *)ptr;
+      node->down = below;
+      node->region = region;
+      if (level >= indexLevels) {
+        indexLevels = level + 1;
+        nodes[level] = nullptr;
+      }
+      IndexNode *& link = nodes[level] ? nodes[level]->right :
+                                         indexHeads[level];
+      node->right = link;
+      link = node;
+      below = node;
+    }
+  }
+  
+  /**
+   * Remove the tower of [region] from the index, if it has one.
+   */
+  void UnindexRegion(FreeRegion * region) {
+    IndexNode * nodes[MaxIndexLevels];
+    FindIndexPredecessors(region->start, nodes);
+    for (int level = 0; level < indexLevels; ++level) {
+      IndexNode *& link = nodes[level] ? nodes[level]->right :
+                                         indexHeads[level];
+      if (!link || link->region != region) {
+        break;
+      }
+      IndexNode * node = link;
+      link = node->right;
+      allocator.Dealloc((uintptr_t)node, sizeof(IndexNode));
+    }
+    while (indexLevels && !indexHeads[indexLevels - 1]) {
+      --indexLevels;
+    }
+  }
+  
+  /**
+   * Raise [largestBound] to [size] if it is lower.
+   */
+  inline void RaiseBound(SizeType size) {
+    if (size > largestBound) {
+      largestBound = size;
+    }
+  }
+  
+  /**
+   * Attempt to allocate from the regions which come after [last] and before
+   * [stop]. If [last] is `nullptr`, the search starts at [firstRegion]; if
+   * [stop] is `nullptr`, it continues to the end of the list.
+   *
+   * If the search fails, [largest] is raised to the size of the largest
+   * region which was scanned.
+   */
+  bool AllocRange(AddressType & out, SizeType size, FreeRegion * last,
+                  FreeRegion * stop, SizeType & largest) {
+    FreeRegion * reg = last ? last->next : firstRegion;
+    while (reg != stop) {
+      if (reg->size >= size) {
+        Carve(out, last, reg, 0, size);
+        return true;
+      } else if (reg->size > largest) {
+        largest = reg->size;
+      }
+      last = reg;
+      reg = reg->next;
+    }
+    return false;
+  }
+  
+  /**
+   * Attempt to align from the regions which come after [last] and before
+   * [stop], in the same way as [AllocRange].
+   */
+  bool AlignRange(AddressType & out, AddressType align,
+                  AddressType alignOffset, SizeType size, FreeRegion * last,
+                  FreeRegion * stop, SizeType & largest) {
+    FreeRegion * reg = last ? last->next : firstRegion;
+    while (reg != stop) {
+      SizeType offset;
+      if (FitAligned(reg, align, alignOffset, size, offset)) {
+        Carve(out, last, reg, offset, size);
+        return true;
+      } else if (reg->size > largest) {
+        largest = reg->size;
+      }
+      last = reg;
+      reg = reg->next;
+    }
+    return false;
+  }
+  
+  /**
+   * Align from the smallest or largest region which fits, depending on the
+   * fit policy.
+   */
+  bool AlignFitting(AddressType & out, AddressType align,
+                    AddressType alignOffset, SizeType size) {
+    FreeRegion * found = nullptr;
+    FreeRegion * foundLast = nullptr;
+    SizeType foundOffset = 0;
+    SizeType largest = 0;
+    FreeRegion * last = nullptr;
+    for (FreeRegion * reg = firstRegion; reg; reg = reg->next) {
+      if (reg->size > largest) {
+        largest = reg->size;
+      }
+      SizeType offset;
+      if (FitAligned(reg, align, alignOffset, size, offset)) {
+        bool better = !found ||
+            (fit == FreeListBestFit ? reg->size < found->size :
+                                      reg->size > found->size);
+        if (better) {
+          found = reg;
+          foundLast = last;
+          foundOffset = offset;
+          if (fit == FreeListBestFit && reg->size == size) {
+            // Nothing fits better than an exact fit. A region which only
+            // fits exactly after aligning is bigger than [size], so a
+            // smaller region may still come later.
+            break;
+          }
+        }
+      }
+      last = reg;
+    }
+    if (!found) {
+      largestBound = largest;
+      return false;
+    }
+    Carve(out, foundLast, found, foundOffset, size);
+    return true;
+  }
+  
+  /**
+   * Compute the [offset] into [reg] at which an allocation of [size] units
+   * would be aligned. Returns `false` if the allocation does not fit in
+   * [reg].
+   */
+  static bool FitAligned(FreeRegion * reg, AddressType align,
+                         AddressType alignOffset, SizeType size,
+                         SizeType & offset) {
+    offset = 0;
+    AddressType misalignment = (AddressType)(reg->start + alignOffset) %
+                               align;
+    if (misalignment) {
+      AddressType compensation = align - misalignment;
+      offset = (SizeType)compensation;
+      if (offset != compensation || offset > reg->size) {
+        // The aligned address is out of bounds.
+        return false;
+      }
+    }
+    return reg->size - offset >= size;
+  }
+  
+  /**
+   * Allocate the [size] units which start [offset] units into [reg], which
+   * comes after [last].
+   */
+  void Carve(AddressType & out, FreeRegion * last, FreeRegion * reg,
+             SizeType offset, SizeType size) {
+    // Check for the four cases:
+    // - there is exactly enough room in this region and offset = 0
+    // - there is more than enough room in this region and offset = 0
+    // - there is just enough room in this region with offset != 0
+    // - there is more than enough room in this region with offset != 0
+    if (offset == 0 && size == reg->size) {
+      // Remove the region from the list
+      out = reg->start;
+      Remove(last, reg);
+      Used(out, last);
+    } else if (offset == 0) {
+      // Take the first chunk out of the region
+      out = reg->start;
+      reg->start += size;
+      reg->size -= size;
+      freeSize -= size;
+      Used(out, last);
+    } else if (size + offset == reg->size) {
+      // Take the last chunk out of the region
+      out = reg->start + offset;
+      reg->size = offset;
+      freeSize -= size;
+      Used(out, reg);
+    } else {
+      // Carve out the middle of the region
+      out = reg->start + offset;
+      InsertAfter(reg, reg->start + offset + size,
+                  reg->size - (offset + size));
+      freeSize -= reg->size - offset;
+      reg->size = offset;
+      Used(out, reg);
+    }
+  }
+  
+  /**
+   * Record an allocation at [address], after which the next search should
+   * start with the region that follows [last].
+   */
+  inline void Used(AddressType address, FreeRegion * last) {
+    lastUsed = address;
+    rover = last;
+  }
+  
   void InsertAfter(FreeRegion * before, AddressType addr, SizeType size) {
     uintptr_t ptr;
     while (!allocator.Alloc(ptr, sizeof(FreeRegion))) {
@@ -244,14 +690,28 @@ protected:
       insert->next = firstRegion;
       firstRegion = insert;
     }
+    ++regionCount;
+    freeSize += size;
+    RaiseBound(size);
+    if (indexed) {
+      IndexRegion(insert);
+    }
   }
   
   void Remove(FreeRegion * last, FreeRegion * region) {
+    if (indexLevels) {
+      UnindexRegion(region);
+    }
+    if (rover == region) {
+      rover = last;
+    }
     if (last) {
       last->next = region->next;
     } else {
       firstRegion = region->next;
     }
+    --regionCount;
+    freeSize -= region->size;
     allocator.Dealloc((uintptr_t)region, sizeof(FreeRegion));
   }
 };
@@ -58,6 +58,16 @@ public:
     (void)result;
   }
   
+  virtual bool TryResize(uintptr_t address, size_t size, size_t newSize) {
+    if (!super::TryResize(address, size, newSize)) {
+      return false;
+    }
+    bool result = stack.ApplyBuffer();
+    assert(result);
+    (void)result;
+    return true;
+  }
+  
   inline size_t GetStackCount() {
     return stack.GetCount();
   }
@@ -129,6 +139,10 @@ protected:
   }
   
 private:
+  // The stack only buffers enough objects for the regions of a single
+  // operation, so it cannot provide index nodes as well.
+  using super::SetIndexed;
+  
   static void StackOverflowHandler(typename StackType::super *, uintptr_t,
                                    size_t) {
     assert(false);
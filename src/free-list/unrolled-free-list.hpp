@@ -0,0 +1,413 @@
+#ifndef __ANALLOC2_UNROLLED_FREE_LIST_HPP__
+#define __ANALLOC2_UNROLLED_FREE_LIST_HPP__
+
+#include "../abstract/offset-aligner.hpp"
+#include "../abstract/resizer.hpp"
+#include <ansa/math>
+#include <cstdint>
+#include <cstddef>
+
+namespace analloc {
+
+/**
+ * A first-fit free list which stores its free regions in sorted arrays.
+ *
+ * Each node of the list is [NodeSize] bytes large and holds the sizes and
+ * start addresses of up to [Capacity] consecutive free regions. Searching
+ * scans the sizes of a node one after the other, so it touches a new cache
+ * line every few regions instead of following a pointer for each one. The
+ * neighbors of a freed region are found by skipping whole nodes and then
+ * searching the addresses of a single node.
+ *
+ * Regions are handed out in exactly the same order as a [FreeList] with the
+ * first-fit policy.
+ */
+template <typename AddressType, typename SizeType = AddressType,
+          size_t NodeSize = 0x100>
+class UnrolledFreeList
+    : public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
+public:
+  /**
+   * The function signature of a callback which an [UnrolledFreeList] will
+   * call when a node cannot be allocated.
+   *
+   * If this function returns true, the caller will re-attempt the allocation.
+   */
+  typedef bool (* FailureHandler)(UnrolledFreeList *);
+  
+  /**
+   * The maximum number of free regions in a node.
+   */
+  static constexpr size_t Capacity = (NodeSize - sizeof(void *) -
+                                      sizeof(size_t)) /
+                                     (sizeof(AddressType) + sizeof(SizeType));
+  
+  static_assert(Capacity >= 4, "Nodes must hold at least four regions.");
+  
+  /**
+   * The structure which holds consecutive free regions.
+   *
+   * All allocations that [UnrolledFreeList] needs from its allocator will be
+   * of size `sizeof(Node)`, which is at most [NodeSize].
+   */
+  struct Node {
+    Node * next;
+    size_t count;
+    SizeType sizes[Capacity];
+    AddressType starts[Capacity];
+  };
+  
+  /**
+   * Create a new [UnrolledFreeList] with no free memory regions.
+   *
+   * The [anAlloc] argument is used to allocate nodes throughout the lifetime
+   * of this allocator. If one of these allocations fails, [onAllocFail] will
+   * be called with this allocator as the argument.
+   */
+  UnrolledFreeList(Allocator<uintptr_t, size_t> & anAlloc,
+                   FailureHandler onAllocFail)
+      : allocator(anAlloc), failureHandler(onAllocFail) {}
+  
+  /**
+   * Deallocate all nodes.
+   */
+  virtual ~UnrolledFreeList() {
+    while (firstNode) {
+      Node * node = firstNode;
+      firstNode = node->next;
+      allocator.Dealloc((uintptr_t)node, sizeof(Node));
+    }
+  }
+  
+  /**
+   * Allocate the beginning of the lowest region which is at least [size]
+   * units large.
+   */
+  virtual bool Alloc(AddressType & out, SizeType size) {
+    Node * last = nullptr;
+    for (Node * node = firstNode; node; node = node->next) {
+      for (size_t i = 0; i < node->count; ++i) {
+        if (node->sizes[i] >= size) {
+          Carve(out, last, node, i, 0, size);
+          return true;
+        }
+      }
+      last = node;
+    }
+    return false;
+  }
+  
+  /**
+   * Allocate from the lowest region which can hold an aligned allocation of
+   * [size] units.
+   */
+  virtual bool OffsetAlign(AddressType & out, AddressType align,
+                           AddressType alignOffset, SizeType size) {
+    Node * last = nullptr;
+    for (Node * node = firstNode; node; node = node->next) {
+      for (size_t i = 0; i < node->count; ++i) {
+        SizeType offset;
+        if (FitAligned(node->starts[i], node->sizes[i], align, alignOffset,
+                       size, offset)) {
+          Carve(out, last, node, i, offset, size);
+          return true;
+        }
+      }
+      last = node;
+    }
+    return false;
+  }
+  
+  /**
+   * Add a free region which starts at [address] and is [size] units large,
+   * merging it with its neighbors if possible.
+   */
+  virtual void Dealloc(AddressType address, SizeType size) {
+    if (!size) return;
+    
+    assert(!ansa::AddWraps<AddressType>(address, size) ||
+           (AddressType)(address + size) == 0);
+    
+    Node * last;
+    Node * node;
+    size_t index = FindAfter(address, last, node);
+    
+    // The region after the freed one may be the first one in the next node.
+    Node * afterNode = node;
+    size_t afterIndex = index;
+    if (node && index == node->count) {
+      afterNode = node->next;
+      afterIndex = 0;
+    }
+    
+    assert(!afterNode || address + size <= afterNode->starts[afterIndex]);
+    
+    if (index && (AddressType)(node->starts[index - 1] +
+                               node->sizes[index - 1]) == address) {
+      assert(!ansa::AddWraps<SizeType>(node->sizes[index - 1], size));
+      node->sizes[index - 1] += size;
+      if (afterNode && (AddressType)(address + size) ==
+                       afterNode->starts[afterIndex]) {
+        assert(!ansa::AddWraps<SizeType>(node->sizes[index - 1],
+                                         afterNode->sizes[afterIndex]));
+        node->sizes[index - 1] += afterNode->sizes[afterIndex];
+        Remove(afterNode == node ? last : node, afterNode, afterIndex);
+      }
+    } else if (afterNode && (AddressType)(address + size) ==
+                            afterNode->starts[afterIndex]) {
+      assert(!ansa::AddWraps<SizeType>(afterNode->sizes[afterIndex], size));
+      afterNode->starts[afterIndex] = address;
+      afterNode->sizes[afterIndex] += size;
+    } else {
+      Insert(node, index, address, size);
+    }
+  }
+  
+  /**
+   * Grow or shrink a region which was allocated at [address].
+   *
+   * A region can only grow if a free region starts right where it ends and
+   * is big enough. Shrinking frees the end of the region, which may need a
+   * new node just like [Dealloc].
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    if (newSize <= size) {
+      this->Dealloc(address + newSize, size - newSize);
+      return true;
+    }
+    AddressType end = address + size;
+    SizeType extra = newSize - size;
+    Node * last;
+    Node * node;
+    size_t index = FindAfter(address, last, node);
+    if (node && index == node->count) {
+      last = node;
+      node = node->next;
+      index = 0;
+    }
+    if (!node || node->starts[index] != end || node->sizes[index] < extra) {
+      return false;
+    }
+    if (node->sizes[index] == extra) {
+      Remove(last, node, index);
+    } else {
+      node->starts[index] += extra;
+      node->sizes[index] -= extra;
+    }
+    return true;
+  }
+  
+  /**
+   * Returns the number of free regions.
+   */
+  size_t GetRegionCount() {
+    size_t count = 0;
+    for (Node * node = firstNode; node; node = node->next) {
+      count += node->count;
+    }
+    return count;
+  }
+  
+  /**
+   * Returns the size of the largest free region, or 0 if there are none.
+   */
+  SizeType GetLargestRegionSize() {
+    SizeType largest = 0;
+    for (Node * node = firstNode; node; node = node->next) {
+      for (size_t i = 0; i < node->count; ++i) {
+        if (node->sizes[i] > largest) {
+          largest = node->sizes[i];
+        }
+      }
+    }
+    return largest;
+  }
+  
+  /**
+   * Returns the number of nodes which hold the free regions.
+   */
+  size_t GetNodeCount() {
+    size_t count = 0;
+    for (Node * node = firstNode; node; node = node->next) {
+      ++count;
+    }
+    return count;
+  }
+  
+protected:
+  Node * firstNode = nullptr;
+  Allocator<uintptr_t, size_t> & allocator;
+  FailureHandler failureHandler;
+  
+  /**
+   * Find the node which should hold a region starting at [address], along
+   * with the node before it.
+   *
+   * Returns the number of regions in that node which start at or before
+   * [address]. This is only 0 if no region does.
+   */
+  size_t FindAfter(AddressType address, Node *& last, Node *& node) {
+    last = nullptr;
+    node = firstNode;
+    if (!node) {
+      return 0;
+    }
+    while (node->next && node->next->starts[0] <= address) {
+      last = node;
+      node = node->next;
+    }
+    size_t low = 0;
+    size_t high = node->count;
+    while (low < high) {
+      size_t middle = (low + high) / 2;
+      if (node->starts[middle] <= address) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    return low;
+  }
+  
+  /**
+   * Compute the [offset] into a region at which an allocation of [size]
+   * units would be aligned. Returns `false` if the allocation does not fit.
+   */
+  static bool FitAligned(AddressType start, SizeType regionSize,
+                         AddressType align, AddressType alignOffset,
+                         SizeType size, SizeType & offset) {
+    offset = 0;
+    AddressType misalignment = (AddressType)(start + alignOffset) % align;
+    if (misalignment) {
+      AddressType compensation = align - misalignment;
+      offset = (SizeType)compensation;
+      if (offset != compensation || offset > regionSize) {
+        // The aligned address is out of bounds.
+        return false;
+      }
+    }
+    return regionSize - offset >= size;
+  }
+  
+  /**
+   * Allocate the [size] units which start [offset] units into region [index]
+   * of [node], which comes after [last].
+   */
+  void Carve(AddressType & out, Node * last, Node * node, size_t index,
+             SizeType offset, SizeType size) {
+    AddressType start = node->starts[index];
+    SizeType regionSize = node->sizes[index];
+    out = start + offset;
+    if (offset == 0 && size == regionSize) {
+      Remove(last, node, index);
+    } else if (offset == 0) {
+      node->starts[index] += size;
+      node->sizes[index] -= size;
+    } else if (size + offset == regionSize) {
+      node->sizes[index] = offset;
+    } else {
+      node->sizes[index] = offset;
+      Insert(node, index + 1, start + offset + size,
+             regionSize - (offset + size));
+    }
+  }
+  
+  Node * NewNode() {
+    uintptr_t ptr;
+    while (!allocator.Alloc(ptr, sizeof(Node))) {
+      if (!failureHandler(this)) {
+        return nullptr;
+      }
+    }
+    Node * node = (Node *)ptr;
+    node->count = 0;
+    return node;
+  }
+  
+  /**
+   * Insert a region at [index] in [node]. A full node is split in half
+   * first, unless the region goes at the end of the last node, in which case
+   * it starts a new node. If [node] is `nullptr`, the list must be empty.
+   */
+  void Insert(Node * node, size_t index, AddressType start, SizeType size) {
+    if (!node) {
+      assert(!firstNode);
+      node = NewNode();
+      if (!node) {
+        return;
+      }
+      node->next = nullptr;
+      firstNode = node;
+    } else if (node->count == Capacity) {
+      Node * split = NewNode();
+      if (!split) {
+        return;
+      }
+      bool isLast = !node->next;
+      split->next = node->next;
+      node->next = split;
+      if (index == Capacity && isLast) {
+        // Regions which are added in order fill each node completely.
+        node = split;
+        index = 0;
+      } else {
+        size_t half = Capacity / 2;
+        for (size_t i = half; i < Capacity; ++i) {
+          split->starts[i - half] = node->starts[i];
+          split->sizes[i - half] = node->sizes[i];
+        }
+        split->count = Capacity - half;
+        node->count = half;
+        if (index > half) {
+          node = split;
+          index -= half;
+        }
+      }
+    }
+    for (size_t i = node->count; i > index; --i) {
+      node->starts[i] = node->starts[i - 1];
+      node->sizes[i] = node->sizes[i - 1];
+    }
+    node->starts[index] = start;
+    node->sizes[index] = size;
+    ++node->count;
+  }
+  
+  /**
+   * Remove region [index] from [node], which comes after [last]. An empty
+   * node is freed, and a node is merged with the next one if the two of them
+   * fit in half a node.
+   */
+  void Remove(Node * last, Node * node, size_t index) {
+    --node->count;
+    for (size_t i = index; i < node->count; ++i) {
+      node->starts[i] = node->starts[i + 1];
+      node->sizes[i] = node->sizes[i + 1];
+    }
+    if (!node->count) {
+      if (last) {
+        last->next = node->next;
+      } else {
+        firstNode = node->next;
+      }
+      allocator.Dealloc((uintptr_t)node, sizeof(Node));
+      return;
+    }
+    Node * next = node->next;
+    if (next && node->count + next->count <= Capacity / 2) {
+      for (size_t i = 0; i < next->count; ++i) {
+        node->starts[node->count + i] = next->starts[i];
+        node->sizes[node->count + i] = next->sizes[i];
+      }
+      node->count += next->count;
+      node->next = next->next;
+      allocator.Dealloc((uintptr_t)next, sizeof(Node));
+    }
+  }
+};
+
+}
+
+#endif
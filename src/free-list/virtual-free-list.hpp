@@ -24,13 +24,21 @@ public:
   VirtualFreeList(size_t chunkSize, Allocator<uintptr_t, size_t> & allocator,
                   FailureHandler failure)
       : super(chunkSize, chunkSize, &allocator, failure) {}
-
+  
   /**
    * Returns the number of free regions.
    */
   inline size_t GetRegionCount() {
     return this->wrapped.GetRegionCount();
   }
+  
+  /**
+   * Returns the total number of free bytes, including the space which the
+   * memory headers of future allocations would take up.
+   */
+  inline size_t GetFreeSize() {
+    return this->wrapped.GetFreeSize();
+  }
 };
 
 }
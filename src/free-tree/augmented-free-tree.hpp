@@ -0,0 +1,258 @@
+#ifndef __ANALLOC2_AUGMENTED_FREE_TREE_HPP__
+#define __ANALLOC2_AUGMENTED_FREE_TREE_HPP__
+
+#include "../abstract/offset-aligner.hpp"
+#include "../abstract/resizer.hpp"
+#include "dynamic-tree.hpp"
+
+namespace analloc {
+
+/**
+ * A free-tree allocator which keeps each free region in a single tree.
+ *
+ * The tree is sorted by address, and every region records the size of the
+ * largest region in its subtree. This is enough to find the lowest region
+ * which fits an allocation in O(log(n)) time, so unlike [FreeTree], there is
+ * no need for a second tree sorted by size. Each region costs one node
+ * instead of two, and each change to a region updates one tree instead of
+ * two.
+ *
+ * Allocations use the first-fit policy: they come from the lowest region
+ * which is big enough.
+ */
+template <template <class T> class Tree, typename AddressType,
+          typename SizeType = AddressType>
+class AugmentedFreeTree
+    : public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
+public:
+  /**
+   * The function signature of a callback which an [AugmentedFreeTree] will
+   * call when a free region cannot be recorded because memory could not be
+   * obtained for its node in the tree.
+   *
+   * If this returns `true`, the caller will re-attempt the allocation.
+   */
+  typedef bool (* FailureHandler)(AugmentedFreeTree<Tree, AddressType,
+                                                    SizeType> *);
+  
+  AugmentedFreeTree(VirtualAllocator & allocator, FailureHandler handler)
+      : tree(allocator), failureHandler(handler) {}
+  
+  /**
+   * Allocate the beginning of the lowest region which is at least [size]
+   * units large.
+   */
+  virtual bool Alloc(AddressType & addressOut, SizeType size) {
+    return OffsetAlign(addressOut, 1, 0, size);
+  }
+  
+  virtual void Dealloc(AddressType address, SizeType size) {
+    FreeRegion before, after;
+    bool hasBefore, hasAfter;
+    tree.FindNeighbors(FreeRegion(address, size), before, hasBefore, after,
+                       hasAfter);
+    hasBefore = hasBefore && before.address + before.size == address;
+    hasAfter = hasAfter && address + size == after.address;
+    // A joined region takes the place of one of its neighbors in the tree,
+    // since nothing lies between them.
+    if (hasBefore && hasAfter) {
+      // Remove the next region and join them all together
+      tree.Remove(after);
+      tree.Update(before, FreeRegion(before.address,
+                                     before.size + size + after.size));
+    } else if (hasBefore) {
+      // Join the previous region with the freed region
+      tree.Update(before, FreeRegion(before.address, before.size + size));
+    } else if (hasAfter) {
+      // Join the next region with the freed region
+      tree.Update(after, FreeRegion(address, after.size + size));
+    } else {
+      AddRegion(FreeRegion(address, size));
+    }
+  }
+  
+  /**
+   * Grow or shrink a region which was allocated at [address].
+   *
+   * A region can only grow if a free region starts right where it ends and
+   * is big enough, in which case the front of that free region is taken.
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    if (newSize <= size) {
+      if (newSize < size) {
+        Dealloc(address + newSize, size - newSize);
+      }
+      return true;
+    }
+    SizeType extra = newSize - size;
+    FreeRegion after;
+    if (!tree.FindGE(after, FreeRegion(address + size, 0)) ||
+        after.address != address + size || after.size < extra) {
+      return false;
+    }
+    if (extra == after.size) {
+      tree.Remove(after);
+    } else {
+      tree.Update(after, FreeRegion(after.address + extra, after.size - extra));
+    }
+    return true;
+  }
+  
+  /**
+   * Allocate from the lowest region which can hold an aligned allocation of
+   * [size] units.
+   */
+  virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
+                           AddressType offset, SizeType size) {
+    FittingEnumerator callback(align, offset, size);
+    if (tree.Enumerate(callback)) {
+      // The callback didn't find a suitable region
+      return false;
+    }
+    addressOut = callback.result.address + callback.offset;
+    // The first sliver which remains takes the region's place in the tree.
+    bool replaced = false;
+    if (callback.offset > 0) {
+      // A sliver of free space remains at the beginning of the region.
+      tree.Update(callback.result, FreeRegion(callback.result.address,
+                                              (SizeType)callback.offset));
+      replaced = true;
+    }
+    if (callback.offset + size < callback.result.size) {
+      // A sliver of free space remains at the end of the region.
+      SizeType remainingSize = callback.result.size -
+          (SizeType)(callback.offset + size);
+      FreeRegion back(addressOut + size, remainingSize);
+      if (replaced) {
+        AddRegion(back);
+      } else {
+        tree.Update(callback.result, back);
+        replaced = true;
+      }
+    }
+    if (!replaced) {
+      tree.Remove(callback.result);
+    }
+    return true;
+  }
+  
+  /**
+   * A free region, sorted first by address and then by size.
+   *
+   * While it is in the tree, [largest] is the size of the largest region in
+   * the subtree which this region is the root of.
+   */
+  struct FreeRegion {
+    AddressType address;
+    SizeType size;
+    SizeType largest;
+    
+    FreeRegion() : address(0), size(0), largest(0) {}
+    
+    FreeRegion(AddressType _address, SizeType _size)
+        : address(_address), size(_size), largest(_size) {}
+    
+    inline bool operator==(const FreeRegion & reg) const {
+      return reg.address == address && reg.size == size;
+    }
+    
+    bool operator>(const FreeRegion & reg) const {
+      if (address > reg.address) return true;
+      else if (address < reg.address) return false;
+      else {
+        return size > reg.size;
+      }
+    }
+    
+    bool operator<(const FreeRegion & reg) const {
+      if (address < reg.address) return true;
+      else if (address > reg.address) return false;
+      else {
+        return size < reg.size;
+      }
+    }
+    
+    bool operator<=(const FreeRegion & reg) const {
+      return (*this) < reg || (*this) == reg;
+    }
+    
+    bool operator>=(const FreeRegion & reg) const {
+      return (*this) > reg || (*this) == reg;
+    }
+    
+    friend bool UpdateTreeAugment(FreeRegion & reg, const FreeRegion * left,
+                                  const FreeRegion * right) {
+      SizeType largest = reg.size;
+      if (left && left->largest > largest) {
+        largest = left->largest;
+      }
+      if (right && right->largest > largest) {
+        largest = right->largest;
+      }
+      if (largest == reg.largest) {
+        return false;
+      }
+      reg.largest = largest;
+      return true;
+    }
+  };
+  
+  /**
+   * An enumerator which finds the lowest region that can hold an aligned
+   * allocation, skipping subtrees in which every region is too small.
+   */
+  class FittingEnumerator
+      : public DynamicTree<FreeRegion>::EnumerateCallback {
+  public:
+    FittingEnumerator(AddressType _align, AddressType _offset, SizeType _size)
+        : align(_align), alignOffset(_offset), size(_size) {}
+    
+    bool EnterSubtree(const FreeRegion & root) {
+      return root.largest >= size;
+    }
+    
+    bool Yield(const FreeRegion & region) {
+      offset = 0;
+      if (align > 1 && (region.address + alignOffset) % align) {
+        offset = align - ((region.address + alignOffset) % align);
+      }
+      if (offset + size > region.size) {
+        // Continue enumerating
+        return true;
+      } else {
+        // Stop enumerating
+        result = region;
+        return false;
+      }
+    }
+    
+    // Result
+    AddressType offset;
+    FreeRegion result;
+  
+  protected:
+    // Parameters
+    AddressType align;
+    AddressType alignOffset;
+    SizeType size;
+  };
+  
+protected:
+  Tree<FreeRegion> tree;
+  FailureHandler failureHandler;
+  
+  bool AddRegion(FreeRegion region) {
+    while (!tree.Add(region)) {
+      if (!failureHandler(this)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef __ANALLOC2_AVL_NODE_HPP__
 #define __ANALLOC2_AVL_NODE_HPP__
 
+#include "dynamic-tree.hpp"
 #include <ansa/math>
 #include <cstddef>
 
@@ -45,6 +46,16 @@ struct AvlNode {
   inline const T & GetValue() const {
     return value;
   }
+  
+  /**
+   * Replace the value contained by this node with [val].
+   *
+   * The new value must sort in the same position as the old one, and the
+   * summaries of this node and its ancestors must be recomputed afterwards.
+   */
+  inline void SetValue(const T & val) {
+    value = val;
+  }
  
   /**
    * One more than the depth of the left subnode of this node, or zero if no
@@ -90,6 +101,15 @@ struct AvlNode {
     return oldDepth != depth;
   }
   
+  /**
+   * Recompute the summary which this node's value keeps of its subtree.
+   * Returns `true` if the summary changed.
+   */
+  inline bool RecomputeAugment() {
+    return UpdateTreeAugment(value, left ? &left->value : nullptr,
+                             right ? &right->value : nullptr);
+  }
+  
   /**
    * Rebalance this node and return the node that should take its place.
    *
@@ -140,6 +160,8 @@ protected:
     child->left = parent;
     parent->RecomputeDepth();
     child->RecomputeDepth();
+    parent->RecomputeAugment();
+    child->RecomputeAugment();
     return child;
   }
   
@@ -154,6 +176,8 @@ protected:
     child->right = parent;
     parent->RecomputeDepth();
     child->RecomputeDepth();
+    parent->RecomputeAugment();
+    child->RecomputeAugment();
     return child;
   }
   
@@ -51,6 +51,45 @@ public:
                         result, remove);
   }
   
+  virtual void FindNeighbors(const T & value, T & below, bool & hasBelow,
+                             T & above, bool & hasAbove) {
+    Node * belowNode = nullptr;
+    Node * aboveNode = nullptr;
+    Node * node = root;
+    while (node) {
+      if (node->GetValue() < value) {
+        belowNode = node;
+        node = node->right;
+      } else if (node->GetValue() > value) {
+        aboveNode = node;
+        node = node->left;
+      } else {
+        // The neighbors of an exact match are in its subtrees.
+        if (node->left) {
+          belowNode = node->left;
+          while (belowNode->right) {
+            belowNode = belowNode->right;
+          }
+        }
+        if (node->right) {
+          aboveNode = node->right;
+          while (aboveNode->left) {
+            aboveNode = aboveNode->left;
+          }
+        }
+        break;
+      }
+    }
+    hasBelow = belowNode != nullptr;
+    if (hasBelow) {
+      below = belowNode->GetValue();
+    }
+    hasAbove = aboveNode != nullptr;
+    if (hasAbove) {
+      above = aboveNode->GetValue();
+    }
+  }
+  
   virtual bool Search(T & result, const Query & function,
                       bool remove = false) {
     Node * node = root;
@@ -92,6 +131,20 @@ public:
     }
   }
   
+  /**
+   * Replace a value in the tree without rebalancing it. This runs in
+   * O(log(n)) time.
+   */
+  virtual bool Update(const T & value, const T & newValue) {
+    Node * node = FindEqual(value);
+    if (!node) {
+      return false;
+    }
+    node->SetValue(newValue);
+    UpdateAugments(node, node);
+    return true;
+  }
+  
   /**
    * Add a value to the tree. This runs in O(log(n)) time.
    */
@@ -185,7 +238,9 @@ protected:
     if (!this->GetAllocator().Alloc(ptr, sizeof(Node))) {
       return nullptr;
     }
-    return new((Node *)ptr) Node(value);
+    Node * node = new((Node *)ptr) Node(value);
+    node->RecomputeAugment();
+    return node;
   }
   
   /**
@@ -336,8 +391,10 @@ protected:
       // rebalanced as well.
       rightmost->depth = node->depth;
       
-      // Rebalance the old parent of the rightmost node.
-      Rebalance(balanceStart);
+      // Rebalance the old parent of the rightmost node. The summary which
+      // [rightmost] keeps is still the one for its old subtree, so it has to
+      // be recomputed along with its new ancestors.
+      Rebalance(balanceStart, rightmost);
     }
     // Deallocate the node which was removed.
     DeallocNode(node);
@@ -345,20 +402,55 @@ protected:
   
   /**
    * Rebalance a given [node] and all its ancestors. If an ancestor's depth is
-   * not changed, the balancing process can be safely halted.
+   * not changed, the balancing process can be safely halted, and only the
+   * summaries of the ancestors above it need to be updated.
+   *
+   * If [stale] is not `nullptr`, it must be an ancestor of [node] whose
+   * summary is out of date, and the summaries will be updated at least up to
+   * the parent of [stale].
    */
-  void Rebalance(Node * node) {
+  void Rebalance(Node * node, Node * stale = nullptr) {
+    bool augmentChanged = false;
     while (node) {
       int oldDepth = node->depth;
       node->RecomputeDepth();
+      augmentChanged = node->RecomputeAugment() || node == stale;
+      if (node == stale) {
+        stale = nullptr;
+      }
       Node ** parentSlot = NodeParentSlot(node);
       Node * parent = node->parent;
       (*parentSlot) = node->Rebalance();
       assert(*parentSlot != nullptr);
+      node = parent;
       if ((*parentSlot)->depth == oldDepth) {
         break;
       }
-      node = parent;
+    }
+    // The depths above this point are unchanged, so nothing else needs to
+    // be rotated.
+    if (augmentChanged || stale) {
+      UpdateAugments(node, stale);
+    }
+  }
+  
+  /**
+   * Recompute the summaries of a given [node] and its ancestors until one of
+   * them does not change.
+   *
+   * If [stale] is not `nullptr`, it must be [node] or one of its ancestors,
+   * and the summaries will be updated at least up to the parent of [stale].
+   */
+  void UpdateAugments(Node * node, Node * stale) {
+    while (node) {
+      bool augmentChanged = node->RecomputeAugment() || node == stale;
+      if (node == stale) {
+        stale = nullptr;
+      }
+      if (!augmentChanged && !stale) {
+        break;
+      }
+      node = node->parent;
     }
   }
   
@@ -382,6 +474,7 @@ protected:
   
   bool EnumerateFromNode(Node * node, EnumerateCallback & callback) {
     if (!node) return true;
+    if (!callback.EnterSubtree(node->GetValue())) return true;
     if (!EnumerateFromNode(node->left, callback)) return false;
     if (!callback.Yield(node->GetValue())) return false;
     return EnumerateFromNode(node->right, callback);
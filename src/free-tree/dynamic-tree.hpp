@@ -5,6 +5,20 @@
 
 namespace analloc {
 
+/**
+ * Recompute the summary which [value] keeps of its own subtree, given the
+ * values of its [left] and [right] children (either of which may be
+ * `nullptr`). Returns `true` if the summary changed.
+ *
+ * A tree calls this for every node whose subtree changes, from the bottom up.
+ * By default, values keep no summary. A type can keep one by providing its
+ * own overload, which is found by argument-dependent lookup.
+ */
+template <class T>
+inline bool UpdateTreeAugment(T &, const T *, const T *) {
+  return false;
+}
+
 /**
  * A tree which grows and shrinks based on the number of nodes it contains.
  *
@@ -38,6 +52,16 @@ public:
      * enumeration.
      */
     virtual bool Yield(const T & value) = 0;
+    
+    /**
+     * Return `false` to skip every value in the subtree whose root holds
+     * [root]. Together with [UpdateTreeAugment], this lets an enumeration
+     * skip whole subtrees which cannot contain what it is looking for.
+     */
+    virtual bool EnterSubtree(const T & root) {
+      (void)root;
+      return true;
+    }
   };
   
   /**
@@ -98,6 +122,16 @@ public:
    */
   virtual bool FindLE(T & result, const T & value, bool remove = false) = 0;
   
+  /**
+   * Find the highest value in this tree which is less than [value] and the
+   * lowest value which is greater than [value] with a single search.
+   *
+   * [hasBelow] and [hasAbove] are set to indicate which of the two values
+   * exist. The ones which do are stored in [below] and [above].
+   */
+  virtual void FindNeighbors(const T & value, T & below, bool & hasBelow,
+                             T & above, bool & hasAbove) = 0;
+  
   /**
    * Find a node in the tree using an arbitrary search [function].
    *
@@ -125,6 +159,18 @@ public:
    */
   virtual bool Remove(const T & value) = 0;
   
+  /**
+   * Replace a [value] in the tree with [newValue] without moving it.
+   *
+   * [newValue] must sort after every value below [value] and before every
+   * value above it. This is cheaper than a [Remove] followed by an [Add],
+   * since the tree's structure does not change and no nodes are allocated.
+   *
+   * If the value is found and replaced, `true` is returned. Otherwise,
+   * `false` is returned.
+   */
+  virtual bool Update(const T & value, const T & newValue) = 0;
+  
   /**
    * Add a given [value] to the tree.
    *
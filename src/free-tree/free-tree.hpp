@@ -2,12 +2,16 @@
 #define __ANALLOC2_FREE_TREE_HPP__
 
 #include "../abstract/offset-aligner.hpp"
+#include "../abstract/resizer.hpp"
+#include "dynamic-tree.hpp"
 
 namespace analloc {
 
 template <template <class T> class Tree, typename AddressType,
           typename SizeType = AddressType>
-class FreeTree : public virtual OffsetAligner<AddressType, SizeType> {
+class FreeTree
+    : public virtual OffsetAligner<AddressType, SizeType>,
+      public virtual Resizer<AddressType, SizeType> {
 public:
   /**
    * The function signature of a callback which a [FreeTree] will call when a
@@ -28,55 +32,84 @@ public:
       return false;
     }
     // [sized] is the lowest region whose size was >= [size]
-    AddressedRegion addressed(sized);
-    addressedTree.Remove(addressed);
     // The result is the beginning of this region
     addressOut = sized.address;
-    if (size < sized.size) {
-      // The free region has some excess; put it back in the trees.
-      sized.size -= size;
-      sized.address += size;
-      return AddRegion(sized);
+    if (size == sized.size) {
+      addressedTree.Remove(AddressedRegion(sized));
+      return true;
     }
-    return true;
+    // The free region has some excess, which stays in the same place in
+    // [addressedTree].
+    FreeRegion rest(sized.address + size, sized.size - size);
+    addressedTree.Update(AddressedRegion(sized), AddressedRegion(rest));
+    return AddSizedRegion(rest);
   }
   
   virtual void Dealloc(AddressType address, SizeType size) {
     AddressedRegion before, after;
-    bool hasBefore = false, hasAfter = false;
-    if (addressedTree.FindLT(before, AddressedRegion(address, size))) {
-      if (before.address + before.size == address) {
-        hasBefore = true;
-      }
-    }
-    if (addressedTree.FindGT(after, AddressedRegion(address, size))) {
-      if (address + size == after.address) {
-        hasAfter = true;
-      }
-    }
+    bool hasBefore, hasAfter;
+    addressedTree.FindNeighbors(AddressedRegion(address, size), before,
+                                hasBefore, after, hasAfter);
+    hasBefore = hasBefore && before.address + before.size == address;
+    hasAfter = hasAfter && address + size == after.address;
+    // A joined region takes the place of one of its neighbors in
+    // [addressedTree], since nothing lies between them.
     if (hasBefore && hasAfter) {
-      // Remove both regions and join them all together
-      addressedTree.Remove(before);
+      // Remove the next region and join them all together
+      FreeRegion joined(before.address, before.size + size + after.size);
       addressedTree.Remove(after);
       sizedTree.Remove(SizedRegion(before));
       sizedTree.Remove(SizedRegion(after));
-      AddRegion(FreeRegion(before.address, before.size + size + after.size));
+      addressedTree.Update(before, AddressedRegion(joined));
+      AddSizedRegion(joined);
     } else if (hasBefore) {
-      // Remove the previous region and join it with the freed region
-      addressedTree.Remove(before);
+      // Join the previous region with the freed region
+      FreeRegion joined(before.address, before.size + size);
       sizedTree.Remove(SizedRegion(before));
-      AddRegion(FreeRegion(before.address, before.size + size));
+      addressedTree.Update(before, AddressedRegion(joined));
+      AddSizedRegion(joined);
     } else if (hasAfter) {
-      // Remove the next region and join it with the freed region
-      addressedTree.Remove(after);
+      // Join the next region with the freed region
+      FreeRegion joined(address, after.size + size);
       sizedTree.Remove(SizedRegion(after));
-      AddRegion(FreeRegion(address, after.size + size));
+      addressedTree.Update(after, AddressedRegion(joined));
+      AddSizedRegion(joined);
     } else {
       // Simple case: insert the free region
       AddRegion(FreeRegion(address, size));
     }
   }
   
+  /**
+   * Grow or shrink a region which was allocated at [address].
+   *
+   * A region can only grow if a free region starts right where it ends and
+   * is big enough, in which case the front of that free region is taken.
+   */
+  virtual bool TryResize(AddressType address, SizeType size,
+                         SizeType newSize) {
+    if (newSize <= size) {
+      if (newSize < size) {
+        Dealloc(address + newSize, size - newSize);
+      }
+      return true;
+    }
+    SizeType extra = newSize - size;
+    AddressedRegion after;
+    if (!addressedTree.FindGE(after, AddressedRegion(address + size, 0)) ||
+        after.address != address + size || after.size < extra) {
+      return false;
+    }
+    sizedTree.Remove(SizedRegion(after));
+    if (extra == after.size) {
+      addressedTree.Remove(after);
+      return true;
+    }
+    FreeRegion rest(after.address + extra, after.size - extra);
+    addressedTree.Update(after, AddressedRegion(rest));
+    return AddSizedRegion(rest);
+  }
+  
   virtual bool OffsetAlign(AddressType & addressOut, AddressType align,
                            AddressType offset, SizeType size) {
     FittingEnumerator callback(align, offset, size);
@@ -84,16 +117,19 @@ public:
       // The callback didn't find a suitable region
       return false;
     }
-    addressedTree.Remove(callback.result);
     sizedTree.Remove(SizedRegion(callback.result));
     // Return the allocated address.
     addressOut = callback.result.address + callback.offset;
-    // Split up the block as needed.
+    // Split up the block as needed. The first sliver which remains takes the
+    // affected region's place in [addressedTree].
+    bool replaced = false;
     if (callback.offset > 0) {
       // A sliver of free space remains at the beginning of the affected
       // region.
-      AddRegion(FreeRegion(callback.result.address, 
-                           (SizeType)callback.offset));
+      FreeRegion front(callback.result.address, (SizeType)callback.offset);
+      addressedTree.Update(callback.result, AddressedRegion(front));
+      AddSizedRegion(front);
+      replaced = true;
     }
     if (callback.offset + size < callback.result.size) {
       // A sliver of free space remains at the end of the affected region.
@@ -103,7 +139,17 @@ public:
       SizeType remainingSize = callback.result.size -
           (SizeType)(callback.offset + size);
       
-      AddRegion(FreeRegion(addressOut + size, remainingSize));
+      FreeRegion back(addressOut + size, remainingSize);
+      if (replaced) {
+        AddRegion(back);
+      } else {
+        addressedTree.Update(callback.result, AddressedRegion(back));
+        AddSizedRegion(back);
+        replaced = true;
+      }
+    }
+    if (!replaced) {
+      addressedTree.Remove(callback.result);
     }
     return true;
   }
@@ -111,16 +157,22 @@ public:
   /**
    * A "free region" in this allocator. Both subclasses of [FreeRegion], namely
    * [AddressedRegion] and [SizedRegion], have the same size and packing
-   * properties as [FreeRegion].
+   * properties as [FreeRegion], so both trees can share one node size.
    */
   struct FreeRegion {
     AddressType address;
     SizeType size;
     
-    FreeRegion() : address(0), size(0) {}
+    /**
+     * Only meaningful for an [AddressedRegion]; it lives here so that every
+     * subclass has the same size.
+     */
+    SizeType largest;
+    
+    FreeRegion() : address(0), size(0), largest(0) {}
     
     FreeRegion(AddressType _address, SizeType _size)
-        : address(_address), size(_size) {}
+        : address(_address), size(_size), largest(_size) {}
     
     inline bool operator==(const FreeRegion & reg) const {
       return reg.address == address && reg.size == size;
@@ -165,6 +217,10 @@ public:
   
   /**
    * A [FreeRegion] which is sorted first by address and then by size.
+   *
+   * While it is in a tree, [largest] is the size of the largest region in the
+   * subtree which this region is the root of. This lets [OffsetAlign] skip
+   * subtrees in which no region is big enough.
    */
   struct AddressedRegion : public FreeRegion {
     AddressedRegion() : FreeRegion() {}
@@ -172,7 +228,25 @@ public:
     AddressedRegion(AddressType _address, SizeType _size)
         : FreeRegion(_address, _size) {}
     
-    AddressedRegion(const FreeRegion & reg) : FreeRegion(reg) {}
+    AddressedRegion(const FreeRegion & reg)
+        : FreeRegion(reg.address, reg.size) {}
+    
+    friend bool UpdateTreeAugment(AddressedRegion & reg,
+                                  const AddressedRegion * left,
+                                  const AddressedRegion * right) {
+      SizeType largest = reg.size;
+      if (left && left->largest > largest) {
+        largest = left->largest;
+      }
+      if (right && right->largest > largest) {
+        largest = right->largest;
+      }
+      if (largest == reg.largest) {
+        return false;
+      }
+      reg.largest = largest;
+      return true;
+    }
     
     bool operator>(const AddressedRegion & reg) const {
       if (this->address > reg.address) return true;
@@ -213,6 +287,11 @@ public:
     FittingEnumerator(AddressType _align, AddressType _offset, SizeType _size)
         : align(_align), alignOffset(_offset), size(_size) {}
     
+    bool EnterSubtree(const AddressedRegion & root) {
+      // No region in the subtree can fit [size] units, aligned or not.
+      return root.largest >= size;
+    }
+    
     bool Yield(const AddressedRegion & region) {
       offset = 0;
       if ((region.address + alignOffset) % align) {
@@ -231,7 +310,7 @@ public:
     // Result
     AddressType offset;
     AddressedRegion result;
-    
+  
   protected:
     // Parameters
     AddressType align;
@@ -250,6 +329,13 @@ protected:
         return false;
       }
     }
+    return AddSizedRegion(region);
+  }
+  
+  /**
+   * Add a [region] which is already in [addressedTree] to [sizedTree].
+   */
+  bool AddSizedRegion(FreeRegion region) {
     while (!sizedTree.Add(SizedRegion(region))) {
       if (!failureHandler(this)) {
         // Avoid having inconsistent trees (although the region will leak).
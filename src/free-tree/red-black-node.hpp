@@ -0,0 +1,78 @@
+#ifndef __ANALLOC2_RED_BLACK_NODE_HPP__
+#define __ANALLOC2_RED_BLACK_NODE_HPP__
+
+#include "dynamic-tree.hpp"
+
+namespace analloc {
+
+/**
+ * A node which is appropriate for use in a red-black tree.
+ */
+template <class T>
+struct RedBlackNode {
+  /**
+   * The parent of this node.
+   */
+  RedBlackNode * parent = nullptr;
+  
+  /**
+   * The left child of this node.
+   */
+  RedBlackNode * left = nullptr;
+  
+  /**
+   * The right child of this node.
+   */
+  RedBlackNode * right = nullptr;
+  
+  /**
+   * The color of this node. New nodes are red.
+   */
+  bool red = true;
+  
+  /**
+   * Create a new [RedBlackNode] with a given value [val].
+   */
+  RedBlackNode(const T & val) : value(val) {}
+  
+  /**
+   * Get the read-only value contained by this node.
+   */
+  inline const T & GetValue() const {
+    return value;
+  }
+  
+  /**
+   * Replace the value contained by this node with [val].
+   *
+   * The new value must sort in the same position as the old one, and the
+   * summaries of this node and its ancestors must be recomputed afterwards.
+   */
+  inline void SetValue(const T & val) {
+    value = val;
+  }
+  
+  /**
+   * Recompute the summary which this node's value keeps of its subtree.
+   * Returns `true` if the summary changed.
+   */
+  inline bool RecomputeAugment() {
+    return UpdateTreeAugment(value, left ? &left->value : nullptr,
+                             right ? &right->value : nullptr);
+  }
+  
+  /**
+   * Returns `true` if [node] exists and is red. Missing children count as
+   * black.
+   */
+  static inline bool IsRed(const RedBlackNode * node) {
+    return node && node->red;
+  }
+  
+private:
+  T value;
+};
+
+}
+
+#endif
@@ -0,0 +1,558 @@
+#ifndef __ANALLOC2_RED_BLACK_TREE_HPP__
+#define __ANALLOC2_RED_BLACK_TREE_HPP__
+
+#include "dynamic-tree.hpp"
+#include "red-black-node.hpp"
+#include <ansa/nocopy>
+
+namespace analloc {
+
+/**
+ * A self-balancing binary search tree with a lower modification cost than
+ * [AvlTree] but a slightly higher search cost.
+ *
+ * A red-black tree is at most twice as deep as a perfectly balanced tree,
+ * but it never needs more than three rotations to add or remove a value.
+ */
+template <class T>
+class RedBlackTree : public DynamicTree<T>, public ansa::NoCopy {
+public:
+  typedef DynamicTree<T> super;
+  typedef RedBlackNode<T> Node;
+  using typename super::Query;
+  using typename super::EnumerateCallback;
+  
+  /**
+   * Create a new, empty red-black tree.
+   */
+  RedBlackTree(VirtualAllocator & allocator) : super(allocator) {}
+  
+  /**
+   * Deallocate the red-black tree and all of its nodes.
+   */
+  virtual ~RedBlackTree() {
+    RecursivelyDeallocNode(root);
+  }
+  
+  virtual bool FindGT(T & result, const T & value, bool remove = false) {
+    return InternalFind(RecursivelySearchAbove(root, value, false),
+                        result, remove);
+  }
+  
+  virtual bool FindGE(T & result, const T & value, bool remove = false) {
+    return InternalFind(RecursivelySearchAbove(root, value, true),
+                        result, remove);
+  }
+  
+  virtual bool FindLT(T & result, const T & value, bool remove = false) {
+    return InternalFind(RecursivelySearchBelow(root, value, false),
+                        result, remove);
+  }
+  
+  virtual bool FindLE(T & result, const T & value, bool remove = false) {
+    return InternalFind(RecursivelySearchBelow(root, value, true),
+                        result, remove);
+  }
+  
+  virtual void FindNeighbors(const T & value, T & below, bool & hasBelow,
+                             T & above, bool & hasAbove) {
+    Node * belowNode = nullptr;
+    Node * aboveNode = nullptr;
+    Node * node = root;
+    while (node) {
+      if (node->GetValue() < value) {
+        belowNode = node;
+        node = node->right;
+      } else if (node->GetValue() > value) {
+        aboveNode = node;
+        node = node->left;
+      } else {
+        // The neighbors of an exact match are in its subtrees.
+        if (node->left) {
+          belowNode = node->left;
+          while (belowNode->right) {
+            belowNode = belowNode->right;
+          }
+        }
+        if (node->right) {
+          aboveNode = node->right;
+          while (aboveNode->left) {
+            aboveNode = aboveNode->left;
+          }
+        }
+        break;
+      }
+    }
+    hasBelow = belowNode != nullptr;
+    if (hasBelow) {
+      below = belowNode->GetValue();
+    }
+    hasAbove = aboveNode != nullptr;
+    if (hasAbove) {
+      above = aboveNode->GetValue();
+    }
+  }
+  
+  virtual bool Search(T & result, const Query & function,
+                      bool remove = false) {
+    Node * node = root;
+    while (node) {
+      int comparison = function.DirectionFromNode(node->GetValue());
+      if (comparison == 0) {
+        result = node->GetValue();
+        if (remove) {
+          RemoveNode(node);
+        }
+        return true;
+      } else if (comparison == -1) {
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+    }
+    return false;
+  }
+  
+  /**
+   * Returns `true` if the tree contains a given [value]. This runs in
+   * O(log(n)) time.
+   */
+  virtual bool Contains(const T & value) {
+    return FindEqual(value) != nullptr;
+  }
+  
+  /**
+   * Remove a value from the tree. This runs in O(log(n)) time.
+   */
+  virtual bool Remove(const T & value) {
+    Node * node = FindEqual(value);
+    if (!node) {
+      return false;
+    } else {
+      RemoveNode(node);
+      return true;
+    }
+  }
+  
+  /**
+   * Replace a value in the tree without rebalancing it. This runs in
+   * O(log(n)) time.
+   */
+  virtual bool Update(const T & value, const T & newValue) {
+    Node * node = FindEqual(value);
+    if (!node) {
+      return false;
+    }
+    node->SetValue(newValue);
+    UpdateAugments(node, node);
+    return true;
+  }
+  
+  /**
+   * Add a value to the tree. This runs in O(log(n)) time.
+   */
+  virtual bool Add(const T & value) {
+    Node * node = AllocNode(value);
+    if (!node) return false;
+    
+    // Find the leaf position where the node belongs
+    Node * parent = nullptr;
+    Node ** slot = &root;
+    while (*slot) {
+      parent = *slot;
+      if (value > parent->GetValue()) {
+        slot = &parent->right;
+      } else {
+        slot = &parent->left;
+      }
+    }
+    (*slot) = node;
+    node->parent = parent;
+    UpdateAugments(parent, nullptr);
+    InsertFixup(node);
+    return true;
+  }
+  
+  /**
+   * Recursively free all the nodes in this tree. This performs O(n)
+   * deallocations and runs in O(n) time (assuming constant-time deallocation).
+   */
+  virtual void Clear() {
+    RecursivelyDeallocNode(root);
+    root = nullptr;
+  }
+  
+  /**
+   * Enumerate over the elements in the tree from least to greatest order.
+   */
+  virtual bool Enumerate(EnumerateCallback & callback) {
+    return EnumerateFromNode(root, callback);
+  }
+  
+  /**
+   * Returns the root node of the tree, or `nullptr` if the tree is empty.
+   */
+  inline const Node * GetRoot() {
+    return root;
+  }
+  
+protected:
+  /**
+   * The root node in the tree.
+   */
+  Node * root = nullptr;
+  
+  /**
+   * Return a node's memory to the tree's allocator.
+   */
+  void DeallocNode(Node * node) {
+    this->GetAllocator().Dealloc((uintptr_t)node, sizeof(Node));
+  }
+  
+  /**
+   * Allocate a new node from the tree's allocator.
+   */
+  Node * AllocNode(const T & value) {
+    uintptr_t ptr;
+    if (!this->GetAllocator().Alloc(ptr, sizeof(Node))) {
+      return nullptr;
+    }
+    Node * node = new((Node *)ptr) Node(value);
+    node->RecomputeAugment();
+    return node;
+  }
+  
+  /**
+   * Used by the destructor to deallocate a node and its descendants.
+   */
+  void RecursivelyDeallocNode(Node * node) {
+    if (!node) return;
+    RecursivelyDeallocNode(node->left);
+    RecursivelyDeallocNode(node->right);
+    DeallocNode(node);
+  }
+  
+  /**
+   * Recursively find a value which is greater than (or equal to, if
+   * [allowEqual] is `true`) a given [value].
+   */
+  Node * RecursivelySearchAbove(Node * current, const T & value,
+                                bool allowEqual) {
+    if (!current) return nullptr;
+    bool areEqual = (current->GetValue() == value);
+    if (current->GetValue() < value || (!allowEqual && areEqual)) {
+      return RecursivelySearchAbove(current->right, value, allowEqual);
+    } else if (allowEqual && areEqual) {
+      return current;
+    } else {
+      Node * res = RecursivelySearchAbove(current->left, value, allowEqual);
+      if (res) {
+        return res;
+      } else {
+        return current;
+      }
+    }
+  }
+  
+  /**
+   * Recursively find a value which is less than (or equal to, if
+   * [allowEqual] is `true`) a given [value].
+   */
+  Node * RecursivelySearchBelow(Node * current, const T & value,
+                                bool allowEqual) {
+    if (!current) return nullptr;
+    bool areEqual = (current->GetValue() == value);
+    if (current->GetValue() > value || (!allowEqual && areEqual)) {
+      return RecursivelySearchBelow(current->left, value, allowEqual);
+    } else if (allowEqual && areEqual) {
+      return current;
+    } else {
+      Node * res = RecursivelySearchBelow(current->right, value, allowEqual);
+      if (res) {
+        return res;
+      } else {
+        return current;
+      }
+    }
+  }
+  
+  /**
+   * The internal mechanism behind all of the find methods.
+   */
+  inline bool InternalFind(Node * node, T & output, bool remove) {
+    if (!node) {
+      return false;
+    } else {
+      output = node->GetValue();
+      if (remove) {
+        RemoveNode(node);
+      }
+      return true;
+    }
+  }
+  
+  /**
+   * Find a node in the tree which contains a given [value].
+   */
+  Node * FindEqual(const T & value) {
+    Node * node = root;
+    while (node) {
+      if (node->GetValue() == value) {
+        return node;
+      } else if (node->GetValue() < value) {
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return nullptr;
+  }
+  
+  /**
+   * Remove a [node] from the tree and deallocate it.
+   */
+  void RemoveNode(Node * node) {
+    assert(node != nullptr);
+    // [child] takes the place of the node which is taken out of the tree,
+    // and may be `nullptr`.
+    Node * child;
+    Node * childParent;
+    bool removedRed;
+    if (!node->left || !node->right) {
+      // Trivial case: replace the node with its only child.
+      child = node->left ? node->left : node->right;
+      childParent = node->parent;
+      removedRed = node->red;
+      (*NodeParentSlot(node)) = child;
+      if (child) {
+        child->parent = childParent;
+      }
+      UpdateAugments(childParent, nullptr);
+    } else {
+      // Find the leftmost subnode of the node's right child (a.k.a. the
+      // in-order successor of [node]).
+      Node * successor = node->right;
+      while (successor->left) {
+        successor = successor->left;
+      }
+      removedRed = successor->red;
+      child = successor->right;
+      if (successor->parent == node) {
+        childParent = successor;
+      } else {
+        // Replace the successor with its right child.
+        childParent = successor->parent;
+        childParent->left = child;
+        if (child) {
+          child->parent = childParent;
+        }
+        successor->right = node->right;
+        successor->right->parent = successor;
+      }
+      
+      // Replace [node] with its successor, which takes on its color.
+      (*NodeParentSlot(node)) = successor;
+      successor->parent = node->parent;
+      successor->left = node->left;
+      successor->left->parent = successor;
+      successor->red = node->red;
+      
+      // The summary which [successor] keeps is still the one for its old
+      // subtree, so it has to be recomputed along with its new ancestors.
+      UpdateAugments(childParent, successor);
+    }
+    if (!removedRed) {
+      RemoveFixup(child, childParent);
+    }
+    DeallocNode(node);
+  }
+  
+  /**
+   * Restore the red-black properties after a red [node] was added.
+   */
+  void InsertFixup(Node * node) {
+    while (Node::IsRed(node->parent)) {
+      // The parent is red, so it cannot be the root.
+      Node * parent = node->parent;
+      Node * grandparent = parent->parent;
+      if (parent == grandparent->left) {
+        Node * uncle = grandparent->right;
+        if (Node::IsRed(uncle)) {
+          parent->red = false;
+          uncle->red = false;
+          grandparent->red = true;
+          node = grandparent;
+          continue;
+        }
+        if (node == parent->right) {
+          RotateLeft(parent);
+          parent = node;
+        }
+        parent->red = false;
+        grandparent->red = true;
+        RotateRight(grandparent);
+      } else {
+        Node * uncle = grandparent->left;
+        if (Node::IsRed(uncle)) {
+          parent->red = false;
+          uncle->red = false;
+          grandparent->red = true;
+          node = grandparent;
+          continue;
+        }
+        if (node == parent->left) {
+          RotateRight(parent);
+          parent = node;
+        }
+        parent->red = false;
+        grandparent->red = true;
+        RotateLeft(grandparent);
+      }
+      break;
+    }
+    root->red = false;
+  }
+  
+  /**
+   * Restore the red-black properties after a black node was removed.
+   *
+   * The path through [node], which is a child of [parent], has one black
+   * node less than the paths through its sibling. [node] may be `nullptr`.
+   */
+  void RemoveFixup(Node * node, Node * parent) {
+    while (node != root && !Node::IsRed(node)) {
+      if (node == parent->left) {
+        Node * sibling = parent->right;
+        if (sibling->red) {
+          sibling->red = false;
+          parent->red = true;
+          RotateLeft(parent);
+          sibling = parent->right;
+        }
+        if (!Node::IsRed(sibling->left) && !Node::IsRed(sibling->right)) {
+          sibling->red = true;
+          node = parent;
+          parent = node->parent;
+          continue;
+        }
+        if (!Node::IsRed(sibling->right)) {
+          sibling->left->red = false;
+          sibling->red = true;
+          RotateRight(sibling);
+          sibling = parent->right;
+        }
+        sibling->red = parent->red;
+        parent->red = false;
+        sibling->right->red = false;
+        RotateLeft(parent);
+      } else {
+        Node * sibling = parent->left;
+        if (sibling->red) {
+          sibling->red = false;
+          parent->red = true;
+          RotateRight(parent);
+          sibling = parent->left;
+        }
+        if (!Node::IsRed(sibling->left) && !Node::IsRed(sibling->right)) {
+          sibling->red = true;
+          node = parent;
+          parent = node->parent;
+          continue;
+        }
+        if (!Node::IsRed(sibling->left)) {
+          sibling->right->red = false;
+          sibling->red = true;
+          RotateLeft(sibling);
+          sibling = parent->left;
+        }
+        sibling->red = parent->red;
+        parent->red = false;
+        sibling->left->red = false;
+        RotateRight(parent);
+      }
+      node = root;
+    }
+    if (node) {
+      node->red = false;
+    }
+  }
+  
+  /**
+   * Make the right child of [node] take its place.
+   */
+  void RotateLeft(Node * node) {
+    Node * child = node->right;
+    (*NodeParentSlot(node)) = child;
+    child->parent = node->parent;
+    node->right = child->left;
+    if (node->right) {
+      node->right->parent = node;
+    }
+    child->left = node;
+    node->parent = child;
+    node->RecomputeAugment();
+    child->RecomputeAugment();
+  }
+  
+  /**
+   * Make the left child of [node] take its place.
+   */
+  void RotateRight(Node * node) {
+    Node * child = node->left;
+    (*NodeParentSlot(node)) = child;
+    child->parent = node->parent;
+    node->left = child->right;
+    if (node->left) {
+      node->left->parent = node;
+    }
+    child->right = node;
+    node->parent = child;
+    node->RecomputeAugment();
+    child->RecomputeAugment();
+  }
+  
+  /**
+   * Recompute the summaries of a given [node] and its ancestors until one of
+   * them does not change.
+   *
+   * If [stale] is not `nullptr`, it must be [node] or one of its ancestors,
+   * and the summaries will be updated at least up to the parent of [stale].
+   */
+  void UpdateAugments(Node * node, Node * stale) {
+    while (node) {
+      bool augmentChanged = node->RecomputeAugment() || node == stale;
+      if (node == stale) {
+        stale = nullptr;
+      }
+      if (!augmentChanged && !stale) {
+        break;
+      }
+      node = node->parent;
+    }
+  }
+  
+  /**
+   * Returns a pointer to the field which points to a given [node].
+   */
+  Node ** NodeParentSlot(Node * node) {
+    if (!node->parent) {
+      return &root;
+    } else if (node == node->parent->right) {
+      return &node->parent->right;
+    } else {
+      return &node->parent->left;
+    }
+  }
+  
+  bool EnumerateFromNode(Node * node, EnumerateCallback & callback) {
+    if (!node) return true;
+    if (!callback.EnterSubtree(node->GetValue())) return true;
+    if (!EnumerateFromNode(node->left, callback)) return false;
+    if (!callback.Yield(node->GetValue())) return false;
+    return EnumerateFromNode(node->right, callback);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __ANALLOC2_SPLAY_NODE_HPP__
+#define __ANALLOC2_SPLAY_NODE_HPP__
+
+#include "dynamic-tree.hpp"
+
+namespace analloc {
+
+/**
+ * A node which is appropriate for use in a splay tree.
+ */
+template <class T>
+struct SplayNode {
+  /**
+   * The parent of this node.
+   */
+  SplayNode * parent = nullptr;
+  
+  /**
+   * The left child of this node.
+   */
+  SplayNode * left = nullptr;
+  
+  /**
+   * The right child of this node.
+   */
+  SplayNode * right = nullptr;
+  
+  /**
+   * Create a new [SplayNode] with a given value [val].
+   */
+  SplayNode(const T & val) : value(val) {}
+  
+  /**
+   * Get the read-only value contained by this node.
+   */
+  inline const T & GetValue() const {
+    return value;
+  }
+  
+  /**
+   * Replace the value contained by this node with [val].
+   *
+   * The new value must sort in the same position as the old one, and the
+   * summaries of this node and its ancestors must be recomputed afterwards.
+   */
+  inline void SetValue(const T & val) {
+    value = val;
+  }
+  
+  /**
+   * Recompute the summary which this node's value keeps of its subtree.
+   * Returns `true` if the summary changed.
+   */
+  inline bool RecomputeAugment() {
+    return UpdateTreeAugment(value, left ? &left->value : nullptr,
+                             right ? &right->value : nullptr);
+  }
+  
+private:
+  T value;
+};
+
+}
+
+#endif
@@ -0,0 +1,469 @@
+#ifndef __ANALLOC2_SPLAY_TREE_HPP__
+#define __ANALLOC2_SPLAY_TREE_HPP__
+
+#include "dynamic-tree.hpp"
+#include "splay-node.hpp"
+#include <ansa/nocopy>
+
+namespace analloc {
+
+/**
+ * A self-adjusting binary search tree which moves every value it finds to
+ * its root, so values which were used recently are quick to find again.
+ *
+ * Each operation runs in O(log(n)) amortized time, but a single operation
+ * can take O(n) time. Since the tree can become as deep as it is large, none
+ * of its methods are recursive.
+ */
+template <class T>
+class SplayTree : public DynamicTree<T>, public ansa::NoCopy {
+public:
+  typedef DynamicTree<T> super;
+  typedef SplayNode<T> Node;
+  using typename super::Query;
+  using typename super::EnumerateCallback;
+  
+  /**
+   * Create a new, empty splay tree.
+   */
+  SplayTree(VirtualAllocator & allocator) : super(allocator) {}
+  
+  /**
+   * Deallocate the splay tree and all of its nodes.
+   */
+  virtual ~SplayTree() {
+    DeallocAllNodes();
+  }
+  
+  virtual bool FindGT(T & result, const T & value, bool remove = false) {
+    return InternalFind(SearchAbove(value, false), result, remove);
+  }
+  
+  virtual bool FindGE(T & result, const T & value, bool remove = false) {
+    return InternalFind(SearchAbove(value, true), result, remove);
+  }
+  
+  virtual bool FindLT(T & result, const T & value, bool remove = false) {
+    return InternalFind(SearchBelow(value, false), result, remove);
+  }
+  
+  virtual bool FindLE(T & result, const T & value, bool remove = false) {
+    return InternalFind(SearchBelow(value, true), result, remove);
+  }
+  
+  virtual void FindNeighbors(const T & value, T & below, bool & hasBelow,
+                             T & above, bool & hasAbove) {
+    Node * belowNode = nullptr;
+    Node * aboveNode = nullptr;
+    Node * last = nullptr;
+    Node * node = root;
+    while (node) {
+      last = node;
+      if (node->GetValue() < value) {
+        belowNode = node;
+        node = node->right;
+      } else if (node->GetValue() > value) {
+        aboveNode = node;
+        node = node->left;
+      } else {
+        break;
+      }
+    }
+    if (node) {
+      // The neighbors of an exact match are the rightmost node on its left
+      // and the leftmost node on its right. Once it is the root, splaying
+      // them up to it pays for finding them.
+      Splay(node, nullptr);
+      belowNode = node->left;
+      if (belowNode) {
+        while (belowNode->right) {
+          belowNode = belowNode->right;
+        }
+        Splay(belowNode, node);
+      }
+      aboveNode = node->right;
+      if (aboveNode) {
+        while (aboveNode->left) {
+          aboveNode = aboveNode->left;
+        }
+        Splay(aboveNode, node);
+      }
+    } else if (last) {
+      Splay(last, nullptr);
+    }
+    hasBelow = belowNode != nullptr;
+    if (hasBelow) {
+      below = belowNode->GetValue();
+    }
+    hasAbove = aboveNode != nullptr;
+    if (hasAbove) {
+      above = aboveNode->GetValue();
+    }
+  }
+  
+  virtual bool Search(T & result, const Query & function,
+                      bool remove = false) {
+    Node * last = nullptr;
+    Node * node = root;
+    while (node) {
+      last = node;
+      int comparison = function.DirectionFromNode(node->GetValue());
+      if (comparison == 0) {
+        break;
+      } else if (comparison == -1) {
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+    }
+    if (last) {
+      Splay(last, nullptr);
+    }
+    return InternalFind(node, result, remove);
+  }
+  
+  /**
+   * Returns `true` if the tree contains a given [value]. This runs in
+   * O(log(n)) amortized time.
+   */
+  virtual bool Contains(const T & value) {
+    return FindEqual(value) != nullptr;
+  }
+  
+  /**
+   * Remove a value from the tree. This runs in O(log(n)) amortized time.
+   */
+  virtual bool Remove(const T & value) {
+    Node * node = FindEqual(value);
+    if (!node) {
+      return false;
+    } else {
+      RemoveNode(node);
+      return true;
+    }
+  }
+  
+  /**
+   * Replace a value in the tree. Since the value is at the root once it has
+   * been found, only the root's summary has to be recomputed. This runs in
+   * O(log(n)) amortized time.
+   */
+  virtual bool Update(const T & value, const T & newValue) {
+    Node * node = FindEqual(value);
+    if (!node) {
+      return false;
+    }
+    node->SetValue(newValue);
+    node->RecomputeAugment();
+    return true;
+  }
+  
+  /**
+   * Add a value to the tree. This runs in O(log(n)) amortized time.
+   */
+  virtual bool Add(const T & value) {
+    Node * node = AllocNode(value);
+    if (!node) return false;
+    
+    // Find the leaf position where the node belongs
+    Node * parent = nullptr;
+    Node ** slot = &root;
+    while (*slot) {
+      parent = *slot;
+      if (value > parent->GetValue()) {
+        slot = &parent->right;
+      } else {
+        slot = &parent->left;
+      }
+    }
+    (*slot) = node;
+    node->parent = parent;
+    
+    // Every ancestor of the new node is rotated below it on its way to the
+    // root, so this also recomputes all of their summaries.
+    Splay(node, nullptr);
+    return true;
+  }
+  
+  /**
+   * Free all the nodes in this tree. This performs O(n) deallocations and
+   * runs in O(n) time (assuming constant-time deallocation).
+   */
+  virtual void Clear() {
+    DeallocAllNodes();
+  }
+  
+  /**
+   * Enumerate over the elements in the tree from least to greatest order.
+   *
+   * Unlike the other methods, this does not change the shape of the tree.
+   */
+  virtual bool Enumerate(EnumerateCallback & callback) {
+    // Walk the tree with parent pointers, since a recursive walk could
+    // overflow the stack.
+    Node * from = nullptr;
+    Node * node = root;
+    while (node) {
+      Node * next;
+      if (from == node->parent) {
+        if (!callback.EnterSubtree(node->GetValue())) {
+          next = node->parent;
+        } else if (node->left) {
+          next = node->left;
+        } else {
+          if (!callback.Yield(node->GetValue())) return false;
+          next = node->right ? node->right : node->parent;
+        }
+      } else if (from == node->left) {
+        if (!callback.Yield(node->GetValue())) return false;
+        next = node->right ? node->right : node->parent;
+      } else {
+        next = node->parent;
+      }
+      from = node;
+      node = next;
+    }
+    return true;
+  }
+  
+  /**
+   * Returns the root node of the tree, or `nullptr` if the tree is empty.
+   */
+  inline const Node * GetRoot() {
+    return root;
+  }
+  
+protected:
+  /**
+   * The root node in the tree.
+   */
+  Node * root = nullptr;
+  
+  /**
+   * Return a node's memory to the tree's allocator.
+   */
+  void DeallocNode(Node * node) {
+    this->GetAllocator().Dealloc((uintptr_t)node, sizeof(Node));
+  }
+  
+  /**
+   * Allocate a new node from the tree's allocator.
+   */
+  Node * AllocNode(const T & value) {
+    uintptr_t ptr;
+    if (!this->GetAllocator().Alloc(ptr, sizeof(Node))) {
+      return nullptr;
+    }
+    Node * node = new((Node *)ptr) Node(value);
+    node->RecomputeAugment();
+    return node;
+  }
+  
+  /**
+   * Deallocate every node in the tree, leaves first, and empty the tree.
+   */
+  void DeallocAllNodes() {
+    Node * node = root;
+    while (node) {
+      if (node->left) {
+        node = node->left;
+      } else if (node->right) {
+        node = node->right;
+      } else {
+        Node * parent = node->parent;
+        if (parent) {
+          if (parent->left == node) {
+            parent->left = nullptr;
+          } else {
+            parent->right = nullptr;
+          }
+        }
+        DeallocNode(node);
+        node = parent;
+      }
+    }
+    root = nullptr;
+  }
+  
+  /**
+   * Find the lowest node which is greater than (or equal to, if
+   * [allowEqual] is `true`) a given [value], and splay the last node on the
+   * path to it.
+   */
+  Node * SearchAbove(const T & value, bool allowEqual) {
+    Node * result = nullptr;
+    Node * last = nullptr;
+    Node * node = root;
+    while (node) {
+      last = node;
+      bool areEqual = (node->GetValue() == value);
+      if (node->GetValue() < value || (!allowEqual && areEqual)) {
+        node = node->right;
+      } else {
+        result = node;
+        if (areEqual) break;
+        node = node->left;
+      }
+    }
+    if (last) {
+      Splay(last, nullptr);
+    }
+    return result;
+  }
+  
+  /**
+   * Find the highest node which is less than (or equal to, if [allowEqual]
+   * is `true`) a given [value], and splay the last node on the path to it.
+   */
+  Node * SearchBelow(const T & value, bool allowEqual) {
+    Node * result = nullptr;
+    Node * last = nullptr;
+    Node * node = root;
+    while (node) {
+      last = node;
+      bool areEqual = (node->GetValue() == value);
+      if (node->GetValue() > value || (!allowEqual && areEqual)) {
+        node = node->left;
+      } else {
+        result = node;
+        if (areEqual) break;
+        node = node->right;
+      }
+    }
+    if (last) {
+      Splay(last, nullptr);
+    }
+    return result;
+  }
+  
+  /**
+   * The internal mechanism behind all of the find methods.
+   */
+  inline bool InternalFind(Node * node, T & output, bool remove) {
+    if (!node) {
+      return false;
+    } else {
+      output = node->GetValue();
+      if (remove) {
+        RemoveNode(node);
+      }
+      return true;
+    }
+  }
+  
+  /**
+   * Find a node in the tree which contains a given [value], and splay the
+   * last node on the path to it.
+   */
+  Node * FindEqual(const T & value) {
+    Node * last = nullptr;
+    Node * node = root;
+    while (node) {
+      last = node;
+      if (node->GetValue() == value) {
+        break;
+      } else if (node->GetValue() < value) {
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    if (last) {
+      Splay(last, nullptr);
+    }
+    return node;
+  }
+  
+  /**
+   * Remove a [node] from the tree and deallocate it.
+   */
+  void RemoveNode(Node * node) {
+    assert(node != nullptr);
+    Splay(node, nullptr);
+    Node * replacement = node->left;
+    if (!replacement) {
+      root = node->right;
+    } else {
+      // Splay the rightmost node on the left up to the root's left, where it
+      // has no right child, and give it the root's right subtree.
+      while (replacement->right) {
+        replacement = replacement->right;
+      }
+      Splay(replacement, node);
+      replacement->right = node->right;
+      if (replacement->right) {
+        replacement->right->parent = replacement;
+      }
+      replacement->RecomputeAugment();
+      root = replacement;
+    }
+    if (root) {
+      root->parent = nullptr;
+    }
+    DeallocNode(node);
+  }
+  
+  /**
+   * Rotate a [node] up until its parent is [top], or until it is the root
+   * if [top] is `nullptr`.
+   *
+   * The summaries of [node] and every node which it passes are recomputed,
+   * so [node]'s summary must be up to date beforehand.
+   */
+  void Splay(Node * node, Node * top) {
+    while (node->parent != top) {
+      Node * parent = node->parent;
+      if (parent->parent != top) {
+        // When [node] and [parent] are on the same side of their parents,
+        // the parent goes up first. This is what halves the depth of the
+        // path over time.
+        bool sameSide = (node == parent->left) ==
+          (parent == parent->parent->left);
+        RotateUp(sameSide ? parent : node);
+      }
+      RotateUp(node);
+    }
+  }
+  
+  /**
+   * Make a [node] take its parent's place.
+   */
+  void RotateUp(Node * node) {
+    Node * parent = node->parent;
+    (*NodeParentSlot(parent)) = node;
+    node->parent = parent->parent;
+    if (node == parent->left) {
+      parent->left = node->right;
+      if (parent->left) {
+        parent->left->parent = parent;
+      }
+      node->right = parent;
+    } else {
+      parent->right = node->left;
+      if (parent->right) {
+        parent->right->parent = parent;
+      }
+      node->left = parent;
+    }
+    parent->parent = node;
+    parent->RecomputeAugment();
+    node->RecomputeAugment();
+  }
+  
+  /**
+   * Returns a pointer to the field which points to a given [node].
+   */
+  Node ** NodeParentSlot(Node * node) {
+    if (!node->parent) {
+      return &root;
+    } else if (node == node->parent->right) {
+      return &node->parent->right;
+    } else {
+      return &node->parent->left;
+    }
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __ANALLOC2_PLACED_TLSF_HPP__
+#define __ANALLOC2_PLACED_TLSF_HPP__
+
+#include "tlsf.hpp"
+#include <new>
+
+namespace analloc {
+
+/**
+ * A [Tlsf] which stores itself at the beginning of the memory it manages.
+ */
+template <int SecondLevelBits = 4>
+class PlacedTlsf : public Tlsf<SecondLevelBits> {
+public:
+  typedef Tlsf<SecondLevelBits> super;
+  
+  /**
+   * Create a [PlacedTlsf] at [start] which manages the rest of the [size]
+   * bytes after it.
+   *
+   * Returns `nullptr` if there is not enough room for the allocator and one
+   * free block.
+   */
+  static PlacedTlsf * Place(uintptr_t start, size_t size) {
+    assert(ansa::IsAligned2<uintptr_t>(start, alignof(PlacedTlsf)));
+    size_t instanceSize = ansa::Align2(sizeof(PlacedTlsf), super::Granule);
+    if (instanceSize > size) {
+      return nullptr;
+    }
+    PlacedTlsf * result = new((void *)start) PlacedTlsf();
+    if (!result->AddRegion(start + instanceSize, size - instanceSize)) {
+      result->~PlacedTlsf();
+      return nullptr;
+    }
+    return result;
+  }
+  
+protected:
+  PlacedTlsf() {}
+};
+
+}
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef __ANALLOC2_TLSF_HPP__
+#define __ANALLOC2_TLSF_HPP__
+
+#include "../abstract/offset-aligner.hpp"
+#include "../bitmap/unit-math.hpp"
+#include "../free-list/boundary-tags.hpp"
+#include <ansa/math>
+#include <cstdint>
+#include <cstddef>
+
+namespace analloc {
+
+/**
+ * A two-level segregated fit allocator which allocates and frees memory in
+ * O(1) time, no matter how many free blocks there are.
+ *
+ * Free blocks are kept in segregated lists. The first level splits block
+ * sizes by powers of two, and the second level splits each power of two into
+ * `2^SecondLevelBits` equal classes. A bitmap for each level records which
+ * lists are non-empty, so a block which is big enough is found with two bit
+ * scans.
+ *
+ * Blocks use the [BoundaryTags] layout, so a freed block is merged with its
+ * neighbors without a search. Since these boundary tags are stored in the
+ * managed memory itself, addresses are pointers and no external allocator is
+ * needed.
+ */
+template <int SecondLevelBits = 4>
+class Tlsf
+    : public virtual OffsetAligner<uintptr_t, size_t>,
+      public BoundaryTags {
+public:
+  static_assert(SecondLevelBits > 0 && SecondLevelBits <= 5,
+                "Second-level bitmaps must fit in 32 bits.");
+  
+  /**
+   * Create a new [Tlsf] with no memory.
+   */
+  Tlsf() {
+    for (int i = 0; i < FirstLevelCount; ++i) {
+      secondLevelMaps[i] = 0;
+      for (int j = 0; j < SecondLevelCount; ++j) {
+        freeLists[i][j] = nullptr;
+      }
+    }
+  }
+  
+  /**
+   * Create a new [Tlsf] which manages the [size] bytes at [start].
+   */
+  Tlsf(uintptr_t start, size_t size) : Tlsf() {
+    AddRegion(start, size);
+  }
+  
+  /**
+   * Add the [size] bytes at [start] to this allocator.
+   *
+   * The region is trimmed to a multiple of [Granule], and its last
+   * [HeaderSize] bytes mark its end. Blocks from different regions are never
+   * merged.
+   *
+   * Returns the size of the free block which was added, or 0 if the region
+   * was too small to hold one.
+   */
+  size_t AddRegion(uintptr_t start, size_t size) {
+    FreeBlock * block = FormatRegion(start, size);
+    if (!block) {
+      return 0;
+    }
+    InsertFree(block);
+    return BlockSize(block);
+  }
+  
+  /**
+   * Allocate [size] bytes from the head of the smallest size class which is
+   * certain to fit them, and free the unused end of the block.
+   */
+  virtual bool Alloc(uintptr_t & addressOut, size_t size) {
+    size_t blockSize;
+    if (!GetBlockSize(size, blockSize)) {
+      return false;
+    }
+    FreeBlock * block = FindFree(blockSize);
+    if (!block) {
+      return false;
+    }
+    RemoveFree(block);
+    Use(block, blockSize);
+    addressOut = (uintptr_t)block + HeaderSize;
+    return true;
+  }
+  
+  /**
+   * Allocate [size] bytes at an aligned address.
+   *
+   * The block is searched for with enough extra room to move the allocation
+   * forward to an aligned address and free the space in front of it.
+   *
+   * Since every address is a multiple of [Granule], this fails if [offset]
+   * makes the alignment impossible to meet.
+   */
+  virtual bool OffsetAlign(uintptr_t & addressOut, uintptr_t align,
+                           uintptr_t offset, size_t size) {
+    assert(!align || ansa::IsPowerOf2(align));
+    if (align <= Granule) {
+      if (align > 1 && offset % align) {
+        return false;
+      }
+      return Alloc(addressOut, size);
+    } else if (offset % Granule) {
+      return false;
+    }
+    
+    size_t blockSize;
+    if (!GetBlockSize(size, blockSize) ||
+        ansa::AddWraps<size_t>(align, MinBlockSize) ||
+        ansa::AddWraps<size_t>(blockSize, align + MinBlockSize)) {
+      return false;
+    }
+    FreeBlock * block = FindFree(blockSize + align + MinBlockSize);
+    if (!block) {
+      return false;
+    }
+    RemoveFree(block);
+    
+    // A gap in front of the allocation must be big enough to be freed.
+    uintptr_t address = (uintptr_t)block + HeaderSize;
+    size_t gap = (size_t)((align - (address + offset) % align) % align);
+    if (gap && gap < MinBlockSize) {
+      gap += ansa::Align2<size_t>(MinBlockSize - gap, align);
+    }
+    if (gap) {
+      FreeBlock * front = block;
+      size_t totalSize = BlockSize(front);
+      block = (FreeBlock *)((uintptr_t)front + gap);
+      block->header = (totalSize - gap) | FreeFlag;
+      SetFree(front, gap);
+      InsertFree(front);
+    }
+    Use(block, blockSize);
+    addressOut = (uintptr_t)block + HeaderSize;
+    return true;
+  }
+  
+  /**
+   * Free the block which [address] was allocated from, and merge it with the
+   * blocks next to it if they are free.
+   *
+   * The [size] argument is only used for sanity checks, since the header of
+   * the block stores its size.
+   */
+  virtual void Dealloc(uintptr_t address, size_t size) {
+    FreeBlock * block = BlockAt(address);
+    assert(!(block->header & FreeFlag));
+    assert(BlockSize(block) - HeaderSize >= size);
+    (void)size;
+    
+    size_t blockSize = BlockSize(block);
+    FreeBlock * next = NextBlock(block);
+    if (next->header & FreeFlag) {
+      RemoveFree(next);
+      blockSize += BlockSize(next);
+    }
+    if (block->header & PreviousFreeFlag) {
+      FreeBlock * previous = PreviousBlock(block);
+      assert(previous->header & FreeFlag);
+      RemoveFree(previous);
+      blockSize += BlockSize(previous);
+      block = previous;
+    }
+    SetFree(block, blockSize);
+    InsertFree(block);
+  }
+  
+protected:
+  static constexpr int SecondLevelCount = 1 << SecondLevelBits;
+  static constexpr int GranuleShift = sizeof(void *) == 8 ? 3 :
+                                      (sizeof(void *) == 4 ? 2 : 1);
+  static_assert(Granule == (size_t)1 << GranuleShift,
+                "Unsupported pointer size.");
+  
+  /**
+   * Blocks smaller than [LinearLimit] get a size class for every multiple of
+   * [Granule]. Bigger blocks are split up by their highest bit.
+   */
+  static constexpr size_t LinearLimit = (size_t)SecondLevelCount <<
+                                        GranuleShift;
+  static constexpr int FirstLevelCount = (int)(sizeof(size_t) * 8) -
+                                         (SecondLevelBits + GranuleShift) + 1;
+  
+  size_t firstLevelMap = 0;
+  uint32_t secondLevelMaps[FirstLevelCount];
+  FreeBlock * freeLists[FirstLevelCount][SecondLevelCount];
+  
+  /**
+   * Compute the lists which blocks of [size] bytes are stored in.
+   */
+  static inline void Mapping(size_t size, int & firstLevel,
+                             int & secondLevel) {
+    if (size < LinearLimit) {
+      firstLevel = 0;
+      secondLevel = (int)(size >> GranuleShift);
+    } else {
+      int log = UnitBitScanLeft(size);
+      firstLevel = log - (SecondLevelBits + GranuleShift) + 1;
+      secondLevel = (int)(size >> (log - SecondLevelBits)) ^
+                    SecondLevelCount;
+    }
+  }
+  
+  /**
+   * Find a free block of at least [size] bytes without removing it.
+   *
+   * The size is rounded up to the next size class first, so that any block
+   * in the lists which are searched is big enough. If there is no such
+   * block, the head of the size class of [size] itself may still fit.
+   */
+  FreeBlock * FindFree(size_t size) {
+    int firstLevel, secondLevel;
+    if (size >= LinearLimit) {
+      int log = UnitBitScanLeft(size);
+      size_t round = ((size_t)1 << (log - SecondLevelBits)) - 1;
+      if (!ansa::AddWraps<size_t>(size, round)) {
+        Mapping(size + round, firstLevel, secondLevel);
+        FreeBlock * block = FindClass(firstLevel, secondLevel);
+        if (block) {
+          return block;
+        }
+      }
+      Mapping(size, firstLevel, secondLevel);
+      FreeBlock * block = freeLists[firstLevel][secondLevel];
+      if (block && BlockSize(block) >= size) {
+        return block;
+      }
+      return nullptr;
+    }
+    Mapping(size, firstLevel, secondLevel);
+    return FindClass(firstLevel, secondLevel);
+  }
+  
+  /**
+   * Find the head of the first non-empty list at or after the given size
+   * class.
+   */
+  FreeBlock * FindClass(int firstLevel, int secondLevel) {
+    uint32_t secondMap = secondLevelMaps[firstLevel] &
+                         (~(uint32_t)0 << secondLevel);
+    if (!secondMap) {
+      assert(firstLevel + 1 < (int)(sizeof(size_t) * 8));
+      size_t firstMap = firstLevelMap & (~(size_t)0 << (firstLevel + 1));
+      if (!firstMap) {
+        return nullptr;
+      }
+      firstLevel = UnitBitScanRight(firstMap);
+      secondMap = secondLevelMaps[firstLevel];
+    }
+    secondLevel = UnitBitScanRight(secondMap);
+    return freeLists[firstLevel][secondLevel];
+  }
+  
+  void InsertFree(FreeBlock * block) {
+    int firstLevel, secondLevel;
+    Mapping(BlockSize(block), firstLevel, secondLevel);
+    FreeBlock * head = freeLists[firstLevel][secondLevel];
+    block->nextFree = head;
+    block->previousFree = nullptr;
+    if (head) {
+      head->previousFree = block;
+    }
+    freeLists[firstLevel][secondLevel] = block;
+    firstLevelMap |= (size_t)1 << firstLevel;
+    secondLevelMaps[firstLevel] |= (uint32_t)1 << secondLevel;
+    ++freeBlockCount;
+    freeSize += BlockSize(block);
+  }
+  
+  void RemoveFree(FreeBlock * block) {
+    int firstLevel, secondLevel;
+    Mapping(BlockSize(block), firstLevel, secondLevel);
+    if (block->nextFree) {
+      block->nextFree->previousFree = block->previousFree;
+    }
+    if (block->previousFree) {
+      block->previousFree->nextFree = block->nextFree;
+    } else {
+      assert(freeLists[firstLevel][secondLevel] == block);
+      freeLists[firstLevel][secondLevel] = block->nextFree;
+      if (!block->nextFree) {
+        secondLevelMaps[firstLevel] &= ~((uint32_t)1 << secondLevel);
+        if (!secondLevelMaps[firstLevel]) {
+          firstLevelMap &= ~((size_t)1 << firstLevel);
+        }
+      }
+    }
+    --freeBlockCount;
+    freeSize -= BlockSize(block);
+  }
+  
+  /**
+   * Mark the first [size] bytes of [block], which has been removed from its
+   * free list, as used. The rest of the block is freed if it is big enough
+   * to be a block of its own.
+   */
+  void Use(FreeBlock * block, size_t size) {
+    size_t blockSize = BlockSize(block);
+    assert(blockSize >= size);
+    if (blockSize - size >= MinBlockSize) {
+      block->header = size | (block->header & PreviousFreeFlag);
+      FreeBlock * rest = NextBlock(block);
+      rest->header = 0;
+      SetFree(rest, blockSize - size);
+      InsertFree(rest);
+    } else {
+      block->header &= ~FreeFlag;
+      NextBlock(block)->header &= ~PreviousFreeFlag;
+    }
+  }
+};
+
+}
+
+#endif
@@ -1,7 +1,7 @@
 #ifndef __ANALLOC2_ALLOCATOR_TRANSFORMER_HPP__
 #define __ANALLOC2_ALLOCATOR_TRANSFORMER_HPP__
 
-#include "../abstract/allocator.hpp"
+#include "../abstract/resizer.hpp"
 #include <cassert>
 #include <ansa/math>
 
@@ -25,7 +25,7 @@ namespace analloc {
  */
 template <class T>
 class AllocatorTransformer
-    : public virtual Allocator<typename T::AddressType, typename T::SizeType> {
+    : public virtual Resizer<typename T::AddressType, typename T::SizeType> {
 public:
   typedef typename T::AddressType AddressType;
   typedef typename T::SizeType SizeType;
@@ -76,6 +76,25 @@ public:
     wrapped.Dealloc((addr - offset) / scale, ScaleSize(size));
   }
   
+  /**
+   * Resize a region in place through the wrapped allocator, if it is a
+   * [Resizer].
+   *
+   * Both sizes are scaled down first, so a resize which stays within the
+   * same number of scaled units always succeeds without calling into the
+   * wrapped allocator.
+   */
+  virtual bool TryResize(AddressType addr, SizeType size, SizeType newSize) {
+    assert(!((addr - offset) % scale));
+    SizeType scaledSize = ScaleSize(size);
+    SizeType scaledNewSize = ScaleSize(newSize);
+    if (scaledSize == scaledNewSize) {
+      return true;
+    }
+    return TryResizeAllocator(wrapped, (addr - offset) / scale, scaledSize,
+                              scaledNewSize);
+  }
+  
   /**
    * Get the scale factor which this allocator applies to addresses from its
    * wrapped allocator.
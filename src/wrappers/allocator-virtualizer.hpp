@@ -2,6 +2,7 @@
 #define __ANALLOC2_ALLOCATOR_VIRTUALIZER_HPP__
 
 #include "../abstract/virtual-allocator.hpp"
+#include "../abstract/resizer.hpp"
 #include <ansa/cstring>
 #include <ansa/math>
 
@@ -57,19 +58,25 @@ public:
   }
   
   /**
-   * Allocate a new region of memory of [size] bytes, copy over the memory from
-   * [address], deallocate [address], and return the new memory buffer through
-   * the [address] argument.
+   * Resize the region at [address] to [size] bytes.
    *
-   * Some allocators may be able to improve on this algorithm. For instance,
-   * the current region of memory may be directly expandable; in this case,
-   * there is no need for a copy operation.
+   * If the wrapped allocator is a [Resizer] and the region can be grown or
+   * shrunk in place, [address] does not change. Otherwise, a new region of
+   * memory of [size] bytes is allocated, the memory from [address] is copied
+   * over, and [address] is deallocated.
    */
   virtual bool Realloc(uintptr_t & address, size_t size) {
     // Get the information for the current buffer.
     Header * oldHeader = RegionHeader(address);
     size_t oldSize = oldHeader->size;
     
+    // Try to resize the buffer without moving it.
+    if (TryResizeAllocator(wrapped, address - headerSize,
+                           oldSize + headerSize, size + headerSize)) {
+      oldHeader->size = size;
+      return true;
+    }
+    
     // Attempt to allocate a new buffer using this classes [Alloc] method.
     uintptr_t newBuf;
     if (!Alloc(newBuf, size)) {
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <ctime>
 #include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 inline uint64_t Nanotime() {
   timeval time;
@@ -11,4 +14,16 @@ inline uint64_t Nanotime() {
   return (uint64_t)time.tv_sec * 1000000000L + (uint64_t)time.tv_usec * 1000L;
 }
 
+/**
+ * Returns the CPU's timestamp counter where one is available, or the time in
+ * nanoseconds otherwise.
+ */
+inline uint64_t Cycletime() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return Nanotime();
+#endif
+}
+
 #endif
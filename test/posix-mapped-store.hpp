@@ -0,0 +1,54 @@
+#ifndef __TEST_POSIX_MAPPED_STORE_HPP__
+#define __TEST_POSIX_MAPPED_STORE_HPP__
+
+#include <analloc2/bitmap>
+#include <cassert>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Maps a file into memory and flushes it with `msync()`.
+ */
+class PosixMappedStore : public analloc::PersistentStore {
+public:
+  PosixMappedStore(const char * path, size_t _size) : size(_size) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    assert(fd >= 0);
+    int result = ftruncate(fd, (off_t)size);
+    assert(!result);
+    (void)result;
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(region != MAP_FAILED);
+    close(fd);
+  }
+  
+  ~PosixMappedStore() {
+    munmap(region, size);
+  }
+  
+  virtual bool Flush(const void * start, size_t length) {
+    // msync() takes a page-aligned address
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)start - (uintptr_t)start % page;
+    length += (uintptr_t)start - first;
+    ++flushCount;
+    return !msync((void *)first, length, MS_SYNC);
+  }
+  
+  inline void * GetRegion() {
+    return region;
+  }
+  
+  inline size_t GetFlushCount() {
+    return flushCount;
+  }
+  
+private:
+  void * region;
+  size_t size;
+  size_t flushCount = 0;
+};
+
+#endif
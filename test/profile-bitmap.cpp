@@ -1,5 +1,8 @@
+#define ANALLOC2_SIMD
+
 #include <iostream>
 #include <cstddef>
+#include <cstdlib>
 #include <analloc2/bitmap>
 #include "nanotime.hpp"
 
@@ -14,24 +17,55 @@ uint64_t ProfileAllocBest();
 template <typename T>
 uint64_t ProfileAllocLast(size_t iterations, size_t bitCount);
 
+template <typename T>
+uint64_t ProfileSummaryAllocLast(size_t iterations, size_t bitCount);
+
+template <typename T>
+uint64_t ProfileAllocLarge(size_t iterations, size_t bitCount);
+
 template <typename T>
 uint64_t ProfileAllocFragmented(size_t iterations, size_t bitCount);
 
 template <typename T>
 uint64_t ProfileAllocPartiallyFragmented(size_t iterations, size_t bitCount);
 
+template <typename T>
+uint64_t ProfileRunTreePartiallyFragmented(size_t iterations,
+                                           size_t bitCount);
+
 template <typename T>
 uint64_t ProfileOffsetAlignLast(size_t iterations, size_t bitCount);
 
 template <typename T>
 uint64_t ProfileOffsetAlignFragmented(size_t iterations, size_t bitCount);
 
+template <typename T>
+uint64_t ProfileOffsetAlignLarge(size_t iterations, size_t bitCount);
+
+template <typename T>
+uint64_t ProfileChurn(bool nextFit, size_t iterations, size_t bitCount);
+
+template <typename T>
+uint64_t ProfileAllocMany(bool batch, size_t iterations, size_t bitCount);
+
+void ProfileKernels();
+
+void ProfileStartup();
+
+uint64_t ProfileStartupMode(BitmapInit init, size_t iterations,
+                            size_t bitCount);
+
+template <typename T>
+double ProfileKernelBitsPerCycle(size_t iterations, size_t bitCount);
+
 int main() {
   ProfileBoth<unsigned long long>();
   ProfileBoth<unsigned long>();
   ProfileBoth<unsigned int>();
   ProfileBoth<unsigned short>();
   ProfileBoth<unsigned char>();
+  ProfileKernels();
+  ProfileStartup();
   return 0;
 }
 
@@ -46,18 +80,43 @@ void ProfileBoth() {
     std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
       ">::Alloc() [last, " << bc << "] ... " << std::flush <<
       ProfileAllocLast<T>(iters >> i, bc) << std::endl;
+    std::cout << "SummaryBitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [last, " << bc << "] ... " << std::flush <<
+      ProfileSummaryAllocLast<T>(iters >> i, bc) << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [large, " << bc << "] ... " << std::flush <<
+      ProfileAllocLarge<T>(iters >> (i + 2), bc) << std::endl;
     std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
       ">::Alloc() [fragmented, " << bc << "] ... " << std::flush <<
       ProfileAllocFragmented<T>(iters >> (i + 2), bc) << std::endl;
     std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
       ">::Alloc() [partial, " << bc << "] ... " << std::flush <<
       ProfileAllocPartiallyFragmented<T>(iters >> (i + 2), bc) << std::endl;
+    std::cout << "RunTreeBitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [partial, " << bc << "] ... " << std::flush <<
+      ProfileRunTreePartiallyFragmented<T>(iters >> (i + 2), bc) <<
+      std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [churn, first-fit, " << bc << "] ... " << std::flush <<
+      ProfileChurn<T>(false, iters >> 2, bc) << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [churn, next-fit, " << bc << "] ... " << std::flush <<
+      ProfileChurn<T>(true, iters >> 2, bc) << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [0x40 singles, " << bc << "] ... " << std::flush <<
+      ProfileAllocMany<T>(false, iters >> (i + 2), bc) << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::AllocMany() [0x40, " << bc << "] ... " << std::flush <<
+      ProfileAllocMany<T>(true, iters >> (i + 2), bc) << std::endl;
     std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
       ">::OffsetAlign() [last, " << bc << "] ... " << std::flush <<
       ProfileOffsetAlignLast<T>(iters >> (i + 2), bc) << std::endl;
     std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
       ">::OffsetAlign() [fragmented, " << bc << "] ... " << std::flush <<
       ProfileOffsetAlignFragmented<T>(iters >> (i + 2), bc) << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::OffsetAlign() [large, " << bc << "] ... " << std::flush <<
+      ProfileOffsetAlignLarge<T>(iters >> (i + 2), bc) << std::endl;
   }
 }
 
@@ -98,6 +157,51 @@ uint64_t ProfileAllocLast(size_t iterations, size_t bitCount) {
   return (endTime - startTime) / iterations;
 }
 
+template <typename T>
+uint64_t ProfileSummaryAllocLast(size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  T * summary = new T[SummaryBitmap<T, size_t>::SummaryUnitCount(bitCount)];
+  SummaryBitmap<T, size_t> allocator(list, bitCount, summary);
+  
+  size_t result;
+  assert(allocator.Alloc(result, bitCount - 1));
+  assert(result == 0);
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Alloc(result, 1);
+    assert(result == bitCount - 1);
+    allocator.Dealloc(result, 1);
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] summary;
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
+template <typename T>
+uint64_t ProfileAllocLarge(size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(list, bitCount);
+  
+  // Allocate and free the entire bitmap, less a bit at either end so that the
+  // range does not start or end on a unit boundary.
+  size_t result;
+  assert(allocator.Alloc(result, 1));
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Alloc(result, bitCount - 2);
+    assert(result == 1);
+    allocator.Dealloc(result, bitCount - 2);
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
 template <typename T>
 uint64_t ProfileAllocFragmented(size_t iterations, size_t bitCount) {
   assert(bitCount % (sizeof(T) * 8) == 0);
@@ -146,6 +250,35 @@ uint64_t ProfileAllocPartiallyFragmented(size_t iterations, size_t bitCount) {
   return (endTime - startTime) / iterations;
 }
 
+template <typename T>
+uint64_t ProfileRunTreePartiallyFragmented(size_t iterations,
+                                           size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  typedef RunTreeBitmap<T, size_t> Allocator;
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  typename Allocator::Node * tree =
+      new typename Allocator::Node[Allocator::TreeNodeCount(bitCount)];
+  Allocator allocator(list, bitCount, tree);
+  
+  size_t result = 0;
+  for (size_t i = 0; i < (bitCount / 8) - 1; ++i) {
+    allocator.Alloc(result, 8);
+    assert(result == i * 8);
+    allocator.Dealloc(result, 1);
+  }
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Alloc(result, 8);
+    assert(result == bitCount - 8);
+    allocator.Dealloc(result, 8);
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] tree;
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
 template <typename T>
 uint64_t ProfileOffsetAlignLast(size_t iterations, size_t bitCount) {
   assert(bitCount % (sizeof(T) * 8) == 0);
@@ -190,3 +323,179 @@ uint64_t ProfileOffsetAlignFragmented(size_t iterations, size_t bitCount) {
   delete list;
   return (endTime - startTime) / iterations;
 }
+
+template <typename T>
+uint64_t ProfileOffsetAlignLarge(size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(list, bitCount);
+  
+  // Every aligned index is used except for the last one, and the alignment
+  // is larger than a unit.
+  size_t result;
+  for (size_t i = 0; i < (bitCount / 2) - 1; ++i) {
+    allocator.Alloc(result, 2);
+    assert(result == i * 2);
+    allocator.Dealloc(result, 1);
+  }
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.OffsetAlign(result, 0x100, 1, 1);
+    assert(result == bitCount - 1);
+    allocator.Dealloc(result, 1);
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
+template <typename T>
+uint64_t ProfileChurn(bool nextFit, size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(list, bitCount);
+  allocator.SetNextFit(nextFit);
+  
+  // Fill three quarters of the bitmap with small allocations, then keep
+  // replacing random allocations with new ones of random sizes.
+  size_t * addresses = new size_t[bitCount];
+  size_t * sizes = new size_t[bitCount];
+  size_t count = 0;
+  size_t used = 0;
+  uint32_t seed = 1;
+  while (used < bitCount * 3 / 4) {
+    seed = seed * 1103515245 + 12345;
+    sizes[count] = 1 + (seed >> 8) % 4;
+    assert(allocator.Alloc(addresses[count], sizes[count]));
+    used += sizes[count++];
+  }
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % count;
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = 1 + (seed >> 4) % 4;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] addresses;
+  delete[] sizes;
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
+template <typename T>
+uint64_t ProfileAllocMany(bool batch, size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(list, bitCount);
+  
+  // Use the first half of the bitmap, except for every eighth bit, so that
+  // the free bits are spread out like free page frames tend to be.
+  size_t result;
+  assert(allocator.Alloc(result, bitCount / 2));
+  for (size_t i = 0; i < bitCount / 2; i += 8) {
+    allocator.Dealloc(i, 1);
+  }
+  size_t addresses[0x40];
+  uint64_t startTime = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (batch) {
+      allocator.AllocMany(addresses, 0x40);
+      allocator.DeallocMany(addresses, 0x40);
+    } else {
+      for (size_t j = 0; j < 0x40; ++j) {
+        allocator.Alloc(addresses[j], 1);
+      }
+      for (size_t j = 0; j < 0x40; ++j) {
+        allocator.Dealloc(addresses[j], 1);
+      }
+    }
+  }
+  uint64_t endTime = Nanotime();
+  
+  delete[] list;
+  return (endTime - startTime) / iterations;
+}
+
+void ProfileKernels() {
+  const char * names[] = {"scalar", "sse2", "avx2", "avx512"};
+  for (int i = 0; i < UnitScanner::KernelTypeCount; ++i) {
+    UnitScanner::KernelType type = (UnitScanner::KernelType)i;
+    if (!UnitScanner::IsSupported(type)) {
+      continue;
+    }
+    UnitScanner::Select(type);
+    std::cout << "Bitmap<unsigned long long>::Alloc() [" << names[i] <<
+      ", last] ... " << std::flush <<
+      ProfileKernelBitsPerCycle<unsigned long long>(0x400, 0x100000) <<
+      " bits/cycle" << std::endl;
+#ifdef __SIZEOF_INT128__
+    std::cout << "Bitmap<unsigned __int128>::Alloc() [" << names[i] <<
+      ", last] ... " << std::flush <<
+      ProfileKernelBitsPerCycle<unsigned __int128>(0x400, 0x100000) <<
+      " bits/cycle" << std::endl;
+#endif
+  }
+  UnitScanner::Select(UnitScanner::BestSupported());
+}
+
+template <typename T>
+double ProfileKernelBitsPerCycle(size_t iterations, size_t bitCount) {
+  assert(bitCount % (sizeof(T) * 8) == 0);
+  T * list = new T[bitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(list, bitCount);
+  
+  size_t result;
+  assert(allocator.Alloc(result, bitCount - 1));
+  uint64_t startTime = Cycletime();
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Alloc(result, 1);
+    assert(result == bitCount - 1);
+    allocator.Dealloc(result, 1);
+  }
+  uint64_t endTime = Cycletime();
+  
+  delete[] list;
+  return (double)bitCount * iterations / (double)(endTime - startTime);
+}
+
+void ProfileStartup() {
+  const char * names[] = {"zero", "pre-zeroed", "lazy"};
+  const BitmapInit modes[] = {BitmapZero, BitmapPreZeroed, BitmapLazyZero};
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      size_t bc = (size_t)0x100000 << (j * 3);
+      std::cout << "Bitmap<unsigned long long>::Bitmap() [" << names[i] <<
+        ", " << bc << "] ... " << std::flush <<
+        ProfileStartupMode(modes[i], 0x10, bc) << std::endl;
+    }
+  }
+}
+
+uint64_t ProfileStartupMode(BitmapInit init, size_t iterations,
+                            size_t bitCount) {
+  // Time the constructor and the first allocation. The buffer comes from
+  // calloc(), which hands out fresh zero pages for large sizes, so it is only
+  // zeroed a second time in [BitmapZero] mode.
+  typedef unsigned long long Unit;
+  size_t unitCount = bitCount / (sizeof(Unit) * 8);
+  uint64_t total = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    Unit * list = (Unit *)calloc(unitCount, sizeof(Unit));
+    assert(list != nullptr);
+    uint64_t startTime = Nanotime();
+    Bitmap<Unit, size_t> allocator(list, bitCount, init);
+    size_t result;
+    assert(allocator.Alloc(result, 1));
+    assert(result == 0);
+    (void)result;
+    total += Nanotime() - startTime;
+    free(list);
+  }
+  return total / iterations;
+}
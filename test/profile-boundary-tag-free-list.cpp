@@ -0,0 +1,93 @@
+#include <iostream>
+#include <analloc2/free-list>
+#include "nanotime.hpp"
+#include "scoped-buffer.hpp"
+
+using namespace analloc;
+
+/**
+ * Allocations are between 1 and 16 units of 16 bytes each.
+ */
+static const size_t Unit = 0x10;
+
+uint64_t ProfileBoundaryTagChurn(bool realloc, size_t length, size_t iters);
+uint64_t ProfileVirtualPlacedChurn(bool realloc, size_t length, size_t iters);
+uint64_t ProfileChurn(VirtualAllocator & allocator, bool realloc,
+                      size_t length, size_t iters);
+
+int main() {
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "BoundaryTagFreeList::Free() [churn, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileBoundaryTagChurn(false, len, 100000) << std::endl;
+    std::cout << "VirtualPlacedFreeList::Free() [churn, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileVirtualPlacedChurn(false, len, 100000) << std::endl;
+  }
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "BoundaryTagFreeList::Realloc() [churn, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileBoundaryTagChurn(true, len, 100000) << std::endl;
+    std::cout << "VirtualPlacedFreeList::Realloc() [churn, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileVirtualPlacedChurn(true, len, 100000) << std::endl;
+  }
+}
+
+uint64_t ProfileBoundaryTagChurn(bool realloc, size_t length, size_t iters) {
+  size_t size = length * 0x20 * Unit;
+  ScopedBuffer buffer(size, sizeof(void *));
+  BoundaryTagFreeList * allocator = BoundaryTagFreeList::Place(buffer, size);
+  return ProfileChurn(*allocator, realloc, length, iters);
+}
+
+uint64_t ProfileVirtualPlacedChurn(bool realloc, size_t length,
+                                   size_t iters) {
+  // The free list keeps its region records in the same buffer, so give it
+  // room for a few records per allocation on top of the space the other
+  // allocator gets.
+  typedef VirtualPlacedFreeList<> Vpfl;
+  size_t size = length * 0x20 * Unit + length * 0x40;
+  ScopedBuffer buffer(size, sizeof(void *));
+  Vpfl * allocator = Vpfl::Place(buffer, size);
+  return ProfileChurn(*allocator, realloc, length, iters);
+}
+
+uint64_t ProfileChurn(VirtualAllocator & allocator, bool realloc,
+                      size_t length, size_t iters) {
+  // The allocator has room for about four times as many bytes as [length]
+  // allocations use. Keep replacing or resizing random allocations.
+  uintptr_t * addresses = new uintptr_t[length];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    bool result = allocator.Alloc(addresses[i], (1 + (seed >> 8) % 0x10) *
+                                                Unit);
+    assert(result);
+    (void)result;
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iters; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    size_t size = (1 + (seed >> 4) % 0x10) * Unit;
+    bool result;
+    if (realloc) {
+      result = allocator.Realloc(addresses[index], size);
+    } else {
+      allocator.Free(addresses[index]);
+      result = allocator.Alloc(addresses[index], size);
+    }
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Free(addresses[i]);
+  }
+  delete[] addresses;
+  return time / iters;
+}
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <analloc2/free-list>
+#include "nanotime.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "stack-allocator.hpp"
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+static const size_t RegionSize = sizeof(FreeList<size_t>::FreeRegion);
+
+/**
+ * The sizes of the allocations which a workload makes.
+ */
+enum Workload {
+  /**
+   * Between 1 and 16 units.
+   */
+  WorkloadUniform,
+  
+  /**
+   * Mostly between 1 and 8 units, but one in every eight allocations is
+   * between 32 and 256 units.
+   */
+  WorkloadMixed
+};
+
+void ProfilePolicies(Workload workload, const char * name);
+
+void ProfileFit(FreeListFit fit, const char * fitName, Workload workload,
+                const char * name);
+
+template <typename T>
+bool HandleFailure(T *);
+
+int main() {
+  ProfilePolicies(WorkloadUniform, "uniform");
+  ProfilePolicies(WorkloadMixed, "mixed");
+  return 0;
+}
+
+void ProfilePolicies(Workload workload, const char * name) {
+  ProfileFit(FreeListFirstFit, "first-fit", workload, name);
+  ProfileFit(FreeListNextFit, "next-fit", workload, name);
+  ProfileFit(FreeListBestFit, "best-fit", workload, name);
+  ProfileFit(FreeListWorstFit, "worst-fit", workload, name);
+}
+
+void ProfileFit(FreeListFit fit, const char * fitName, Workload workload,
+                const char * name) {
+  const size_t length = 0x400;
+  const size_t iterations = 100000;
+  StackAllocator<RegionSize> stack(length + 1, aligner);
+  FreeList<size_t> allocator(stack, HandleFailure);
+  allocator.SetFit(fit);
+  
+  // Leave about a third of the space free on average, and keep replacing
+  // random allocations with new ones. A slot whose allocation failed stays
+  // empty until it is picked again.
+  size_t averageSize = workload == WorkloadUniform ? 9 : 22;
+  allocator.Dealloc(0, length * averageSize * 3 / 2);
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  for (size_t i = 0; i < length; ++i) {
+    sizes[i] = 0;
+  }
+  uint32_t seed = 1;
+  size_t failures = 0;
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    if (sizes[index]) {
+      allocator.Dealloc(addresses[index], sizes[index]);
+    }
+    seed = seed * 1103515245 + 12345;
+    if (workload == WorkloadMixed && (seed >> 8) % 8 == 0) {
+      sizes[index] = 0x20 + (seed >> 12) % 0xe1;
+    } else if (workload == WorkloadMixed) {
+      sizes[index] = 1 + (seed >> 12) % 8;
+    } else {
+      sizes[index] = 1 + (seed >> 12) % 0x10;
+    }
+    if (!allocator.Alloc(addresses[index], sizes[index])) {
+      sizes[index] = 0;
+      ++failures;
+    }
+  }
+  uint64_t time = Nanotime() - start;
+  
+  std::cout << "FreeList [" << fitName << ", " << name << "] ... " <<
+    time / iterations << " ns/op, " << allocator.GetRegionCount() <<
+    " regions, largest " << allocator.GetLargestRegionSize() << ", " <<
+    failures << " failures" << std::endl;
+  
+  for (size_t i = 0; i < length; ++i) {
+    if (sizes[i]) {
+      allocator.Dealloc(addresses[i], sizes[i]);
+    }
+  }
+  size_t ignored;
+  while (allocator.Alloc(ignored, 1));
+  delete[] addresses;
+  delete[] sizes;
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
@@ -11,6 +11,9 @@ static const size_t RegionSize = sizeof(FreeList<size_t>::FreeRegion);
 
 uint64_t ProfileFreeListAllocEnd(size_t length, size_t iters);
 uint64_t ProfileFreeListAlignEnd(size_t length, size_t iters);
+uint64_t ProfileFreeListChurn(bool nextFit, size_t length, size_t iters);
+uint64_t ProfileFreeListDealloc(bool indexed, size_t length);
+uint64_t ProfileFreeListAllocFail(size_t length, size_t iters);
 
 template <typename T>
 bool HandleFailure(T *);
@@ -25,6 +28,28 @@ int main() {
       << std::flush << " " << ProfileFreeListAlignEnd(len, 100000)
       << std::endl;
   }
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "FreeList::Alloc() [churn, first-fit, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileFreeListChurn(false, len, 100000) << std::endl;
+    std::cout << "FreeList::Alloc() [churn, next-fit, " << len
+      << " allocations]..." << std::flush << " "
+      << ProfileFreeListChurn(true, len, 100000) << std::endl;
+  }
+  for (size_t i = 8; i < 15; i += 2) {
+    size_t len = 1 << i;
+    std::cout << "FreeList::Dealloc() [" << len << " regions]..."
+      << std::flush << " " << ProfileFreeListDealloc(false, len) << std::endl;
+    std::cout << "FreeList::Dealloc() [indexed, " << len << " regions]..."
+      << std::flush << " " << ProfileFreeListDealloc(true, len) << std::endl;
+  }
+  for (size_t i = 0; i < 13; i += 4) {
+    size_t len = 1 << i;
+    std::cout << "FreeList::Alloc() [failure, " << len << " regions]..."
+      << std::flush << " " << ProfileFreeListAllocFail(len, 100000)
+      << std::endl;
+  }
 }
 
 uint64_t ProfileFreeListAllocEnd(size_t length, size_t iterations) {
@@ -66,6 +91,101 @@ uint64_t ProfileFreeListAlignEnd(size_t length, size_t iters) {
   return (Nanotime() - start) / iters;
 }
 
+uint64_t ProfileFreeListChurn(bool nextFit, size_t length, size_t iters) {
+  StackAllocator<RegionSize> stack(length + 1, aligner);
+  FreeList<size_t> allocator(stack, HandleFailure);
+  allocator.SetNextFit(nextFit);
+  
+  // Make room for about four times as many units as [length] allocations
+  // use, then keep replacing random allocations with new ones of random
+  // sizes.
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  allocator.Dealloc(0, length * 0x20);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = 1 + (seed >> 8) % 0x10;
+    assert(allocator.Alloc(addresses[i], sizes[i]));
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iters; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = 1 + (seed >> 4) % 0x10;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(addresses[i], sizes[i]);
+  }
+  delete[] addresses;
+  delete[] sizes;
+  return time / iters;
+}
+
+uint64_t ProfileFreeListDealloc(bool indexed, size_t length) {
+  static_assert(sizeof(FreeList<size_t>::IndexNode) <= RegionSize,
+                "Index nodes must fit in the stack's objects.");
+  StackAllocator<RegionSize> stack(length * 2, aligner);
+  FreeList<size_t> allocator(stack, HandleFailure);
+  allocator.SetIndexed(indexed);
+  
+  // Carve out [length] regions of size 1, and then free the gaps between
+  // them in a random order, so that each free merges two regions.
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(i * 2, 1);
+  }
+  size_t * gaps = new size_t[length - 1];
+  for (size_t i = 0; i < length - 1; ++i) {
+    gaps[i] = i * 2 + 1;
+  }
+  uint32_t seed = 1;
+  for (size_t i = length - 1; i > 1; --i) {
+    seed = seed * 1103515245 + 12345;
+    size_t j = (seed >> 8) % i;
+    size_t gap = gaps[i - 1];
+    gaps[i - 1] = gaps[j];
+    gaps[j] = gap;
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < length - 1; ++i) {
+    allocator.Dealloc(gaps[i], 1);
+  }
+  uint64_t time = Nanotime() - start;
+  assert(allocator.GetRegionCount() == 1);
+  delete[] gaps;
+  
+  size_t ignored;
+  allocator.Alloc(ignored, length * 2 - 1);
+  return time / (length - 1);
+}
+
+uint64_t ProfileFreeListAllocFail(size_t length, size_t iterations) {
+  StackAllocator<RegionSize> stack(length, aligner);
+  FreeList<size_t> allocator(stack, HandleFailure);
+  
+  // Carve out [length] regions of size 1 and ask for more than any of them.
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(i * 2, 1);
+  }
+  uint64_t start = Nanotime();
+  size_t ignored = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    bool result = allocator.Alloc(ignored, 2);
+    assert(!result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  while (allocator.Alloc(ignored, 1));
+  return time / iterations;
+}
+
 template <typename T>
 bool HandleFailure(T *) {
   std::cerr << "allocation failure!" << std::endl;
@@ -8,26 +8,73 @@ using namespace analloc;
 
 PosixVirtualAligner aligner;
 
-template <template <class T> class Tree, template <class T> class Node>
-uint64_t ProfileFreeTreeEnd(size_t length, size_t iters);
+typedef FreeTree<AvlTree, size_t> AvlFreeTree;
+typedef AugmentedFreeTree<AvlTree, size_t> AvlAugmentedFreeTree;
+
+/**
+ * [FreeTree] keeps two nodes of the same size for every region.
+ */
+static const size_t FreeTreeNodeSize =
+    sizeof(AvlNode<AvlFreeTree::FreeRegion>);
+static const size_t AugmentedNodeSize =
+    sizeof(AvlNode<AvlAugmentedFreeTree::FreeRegion>);
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileEnd(size_t length, size_t iters);
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileAlign(size_t length, size_t iters);
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, size_t iters);
 
 template <class T>
 bool HandleFailure(T *);
 
 int main() {
+  std::cout << "FreeTreeAllocator<AvlTree> metadata: "
+    << FreeTreeNodeSize * 2
+    << " bytes per region" << std::endl;
+  std::cout << "AugmentedFreeTree<AvlTree> metadata: " << AugmentedNodeSize
+    << " bytes per region" << std::endl;
   for (size_t i = 0; i < 13; ++i) {
     size_t len = 1 << i;
     std::cout << "FreeTreeAllocator<AvlTree> (" << len << " regions) ... "
       << std::flush
-      << ProfileFreeTreeEnd<AvlTree, AvlNode>(len, 100000) << std::endl;
+      << ProfileEnd<AvlFreeTree, FreeTreeNodeSize>(len, 100000) << std::endl;
+    std::cout << "AugmentedFreeTree<AvlTree> (" << len << " regions) ... "
+      << std::flush
+      << ProfileEnd<AvlAugmentedFreeTree, AugmentedNodeSize>(len, 100000)
+      << std::endl;
+  }
+  for (size_t i = 0; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "FreeTreeAllocator<AvlTree>::Align() [fragmented, " << len
+      << " regions] ... " << std::flush
+      << ProfileAlign<AvlFreeTree, FreeTreeNodeSize>(len, 100000)
+      << std::endl;
+    std::cout << "AugmentedFreeTree<AvlTree>::Align() [fragmented, " << len
+      << " regions] ... " << std::flush
+      << ProfileAlign<AvlAugmentedFreeTree, AugmentedNodeSize>(len, 100000)
+      << std::endl;
+  }
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "FreeTreeAllocator<AvlTree> [churn, " << len
+      << " allocations] ... " << std::flush
+      << ProfileChurn<AvlFreeTree, FreeTreeNodeSize>(len, 100000)
+      << std::endl;
+    std::cout << "AugmentedFreeTree<AvlTree> [churn, " << len
+      << " allocations] ... " << std::flush
+      << ProfileChurn<AvlAugmentedFreeTree, AugmentedNodeSize>(len, 100000)
+      << std::endl;
   }
 }
 
-template <template <class T> class Tree, template <class T> class Node>
-uint64_t ProfileFreeTreeEnd(size_t length, size_t iterations) {
-  typedef Node<typename FreeTree<Tree, size_t>::FreeRegion> Region;
-  StackAllocator<sizeof(Region)> stack((length + 1) * 2, aligner);
-  FreeTree<Tree, size_t> allocator(stack, HandleFailure);
+template <typename T, size_t NodeSize>
+uint64_t ProfileEnd(size_t length, size_t iterations) {
+  StackAllocator<NodeSize> stack((length + 1) * 2, aligner);
+  T allocator(stack, HandleFailure);
   
   // Carve out [length] regions of size 1, and then one final region of size 2.
   for (size_t i = 0; i < length; ++i) {
@@ -43,6 +90,67 @@ uint64_t ProfileFreeTreeEnd(size_t length, size_t iterations) {
   return (Nanotime() - start) / iterations;
 }
 
+template <typename T, size_t NodeSize>
+uint64_t ProfileAlign(size_t length, size_t iterations) {
+  StackAllocator<NodeSize> stack((length + 2) * 2, aligner);
+  T allocator(stack, HandleFailure);
+  
+  // Carve out [length] regions which are too small for the aligned
+  // allocation, and then one final region which is big enough.
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(i * 0x40, 0x20);
+  }
+  size_t end = length * 0x40;
+  allocator.Dealloc(end, 0x100);
+  uint64_t start = Nanotime();
+  size_t addr = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Align(addr, 0x40, 0x40);
+    assert(addr == end);
+    allocator.Dealloc(addr, 0x40);
+  }
+  return (Nanotime() - start) / iterations;
+}
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, size_t iterations) {
+  StackAllocator<NodeSize> stack((length + 1) * 2, aligner);
+  T allocator(stack, HandleFailure);
+  allocator.Dealloc(0, length * 0x20);
+  
+  // The allocator has room for about four times as many units as [length]
+  // allocations use. Keep replacing random allocations with new ones of
+  // random sizes.
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = 1 + (seed >> 8) % 0x10;
+    bool result = allocator.Alloc(addresses[i], sizes[i]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = 1 + (seed >> 4) % 0x10;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(addresses[i], sizes[i]);
+  }
+  delete[] addresses;
+  delete[] sizes;
+  return time / iterations;
+}
+
 template <class T>
 bool HandleFailure(T *) {
   std::cerr << "allocation failure!" << std::endl;
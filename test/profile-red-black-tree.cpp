@@ -0,0 +1,209 @@
+#include <iostream>
+#include <analloc2/free-tree>
+#include "nanotime.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "stack-allocator.hpp"
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+
+typedef FreeTree<AvlTree, size_t> AvlFreeTree;
+typedef FreeTree<RedBlackTree, size_t> RedBlackFreeTree;
+
+template <template <class T> class Tree>
+uint64_t ProfileSequentialAdds(int count);
+
+template <template <class T> class Tree>
+uint64_t ProfileSequentialRemoves(int count);
+
+template <template <class T> class Tree>
+uint64_t ProfileRandomModifications(int count, int iterations);
+
+template <template <class T> class Tree>
+uint64_t ProfileContains(int count);
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, size_t iterations);
+
+template <class T>
+bool HandleFailure(T *);
+
+int main() {
+  for (int factor = 0; factor < 4; ++factor) {
+    int count = 0x800 << factor;
+    std::cout << "AvlTree<int>::Add() [sequential, " << count << "] ... "
+      << std::flush << ProfileSequentialAdds<AvlTree>(count) << std::endl;
+    std::cout << "RedBlackTree<int>::Add() [sequential, " << count << "] ... "
+      << std::flush << ProfileSequentialAdds<RedBlackTree>(count)
+      << std::endl;
+    std::cout << "AvlTree<int>::Remove() [sequential, " << count << "] ... "
+      << std::flush << ProfileSequentialRemoves<AvlTree>(count) << std::endl;
+    std::cout << "RedBlackTree<int>::Remove() [sequential, " << count
+      << "] ... " << std::flush
+      << ProfileSequentialRemoves<RedBlackTree>(count) << std::endl;
+  }
+  for (int factor = 0; factor < 4; ++factor) {
+    int count = 0x800 << factor;
+    std::cout << "AvlTree<int>::[Remove/Add]() [random, " << count
+      << "] ... " << std::flush
+      << ProfileRandomModifications<AvlTree>(count, 1000000) << std::endl;
+    std::cout << "RedBlackTree<int>::[Remove/Add]() [random, " << count
+      << "] ... " << std::flush
+      << ProfileRandomModifications<RedBlackTree>(count, 1000000)
+      << std::endl;
+    std::cout << "AvlTree<int>::Contains() [random, " << count << "] ... "
+      << std::flush << ProfileContains<AvlTree>(count) << std::endl;
+    std::cout << "RedBlackTree<int>::Contains() [random, " << count
+      << "] ... " << std::flush << ProfileContains<RedBlackTree>(count)
+      << std::endl;
+  }
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "FreeTreeAllocator<AvlTree> [churn, " << len
+      << " allocations] ... " << std::flush
+      << ProfileChurn<AvlFreeTree,
+                      sizeof(AvlNode<AvlFreeTree::AddressedRegion>)>(
+          len, 100000)
+      << std::endl;
+    std::cout << "FreeTreeAllocator<RedBlackTree> [churn, " << len
+      << " allocations] ... " << std::flush
+      << ProfileChurn<RedBlackFreeTree,
+                      sizeof(RedBlackNode<RedBlackFreeTree::AddressedRegion>)>(
+          len, 100000)
+      << std::endl;
+  }
+  return 0;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileSequentialAdds(int count) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count, aligner);
+  Tree<int> tree(stack);
+  
+  const int iterations = 100;
+  uint64_t total = 0;
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t start = Nanotime();
+    for (int j = 0; j < count; ++j) {
+      tree.Add(j);
+    }
+    total += Nanotime() - start;
+    tree.Clear();
+  }
+  return total / iterations;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileSequentialRemoves(int count) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count, aligner);
+  Tree<int> tree(stack);
+  
+  const int iterations = 100;
+  uint64_t total = 0;
+  for (int i = 0; i < iterations; ++i) {
+    for (int j = 0; j < count; ++j) {
+      tree.Add(j);
+    }
+    uint64_t start = Nanotime();
+    for (int j = 0; j < count; ++j) {
+      tree.Remove(j);
+    }
+    total += Nanotime() - start;
+  }
+  return total / iterations;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileRandomModifications(int count, int iterations) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count + 1, aligner);
+  Tree<int> tree(stack);
+  
+  // Fill the tree with every other value, and then keep replacing a random
+  // value with the odd or even value next to it.
+  int * values = new int[count];
+  for (int i = 0; i < count; ++i) {
+    values[i] = i * 2;
+    tree.Add(values[i]);
+  }
+  uint32_t seed = 1;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int index = (seed >> 8) % count;
+    tree.Remove(values[index]);
+    values[index] ^= 1;
+    tree.Add(values[index]);
+  }
+  uint64_t time = Nanotime() - start;
+  delete[] values;
+  tree.Clear();
+  return time / iterations;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileContains(int count) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count, aligner);
+  Tree<int> tree(stack);
+  
+  // Build the tree in a random order, and then look up random values.
+  uint32_t seed = 1;
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1103515245 + 12345;
+    tree.Add((seed >> 8) % (count * 4));
+  }
+  const int iterations = 5000000;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    __asm__ __volatile__("" : : "r" (tree.Contains((seed >> 8) %
+                                                   (count * 4))));
+  }
+  uint64_t time = Nanotime() - start;
+  tree.Clear();
+  return time / iterations;
+}
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, size_t iterations) {
+  StackAllocator<NodeSize> stack((length + 1) * 2, aligner);
+  T allocator(stack, HandleFailure);
+  allocator.Dealloc(0, length * 0x20);
+  
+  // Keep replacing random allocations with new ones of random sizes, just
+  // like the churn benchmark in profile-free-tree.
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = 1 + (seed >> 8) % 0x10;
+    bool result = allocator.Alloc(addresses[i], sizes[i]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = 1 + (seed >> 4) % 0x10;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(addresses[i], sizes[i]);
+  }
+  delete[] addresses;
+  delete[] sizes;
+  return time / iterations;
+}
+
+template <class T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <analloc2/bitmap>
+#include "nanotime.hpp"
+
+using namespace analloc;
+
+template <typename T>
+void ProfileAll();
+
+template <typename T>
+uint64_t ProfileSharded(int threadCount, size_t iterations);
+
+template <typename T>
+uint64_t ProfileLocked(int threadCount, size_t iterations);
+
+template <typename T>
+void ShardedWorker(ShardedBitmap<T, size_t> * allocator, size_t iterations);
+
+template <typename T>
+void LockedWorker(Bitmap<T, size_t> * allocator, std::mutex * lock,
+                  size_t iterations);
+
+static const size_t BitCount = 0x10000;
+static const size_t BatchSize = 0x10;
+
+int main() {
+  ProfileAll<unsigned long long>();
+  ProfileAll<unsigned int>();
+  return 0;
+}
+
+template <typename T>
+void ProfileAll() {
+  int maxThreads = (int)std::thread::hardware_concurrency();
+  if (maxThreads < 4) maxThreads = 4;
+  for (int i = 1; i <= maxThreads; i *= 2) {
+    std::cout << "ShardedBitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [" << i << " threads] ... " << std::flush <<
+      ProfileSharded<T>(i, 0x100000 / i) << " ops/ms" << std::endl;
+    std::cout << "Bitmap<" << ansa::NumericInfo<T>::name <<
+      ">::Alloc() [mutex, " << i << " threads] ... " << std::flush <<
+      ProfileLocked<T>(i, 0x100000 / i) << " ops/ms" << std::endl;
+  }
+}
+
+template <typename T>
+uint64_t ProfileSharded(int threadCount, size_t iterations) {
+  typedef ShardedBitmap<T, size_t> Allocator;
+  T * units = new T[BitCount / (sizeof(T) * 8)];
+  // One shard per thread, as there would be one per CPU. The shards are
+  // over-aligned, which `new[]` does not guarantee in C++11.
+  typedef typename Allocator::Shard Shard;
+  void * shardMemory;
+  int error = posix_memalign(&shardMemory, alignof(Shard),
+                             sizeof(Shard) * (size_t)threadCount);
+  assert(!error);
+  (void)error;
+  Shard * shards = (Shard *)shardMemory;
+  for (int i = 0; i < threadCount; ++i) {
+    new(&shards[i]) Shard;
+  }
+  Allocator * allocator = new Allocator(units, BitCount, shards,
+                                        (size_t)threadCount);
+  
+  std::vector<std::thread> threads;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < threadCount; ++i) {
+    threads.push_back(std::thread(ShardedWorker<T>, allocator, iterations));
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    threads[i].join();
+  }
+  uint64_t time = Nanotime() - start;
+  
+  delete allocator;
+  free(shardMemory);
+  delete[] units;
+  return (uint64_t)threadCount * iterations * BatchSize * 1000000 / time;
+}
+
+template <typename T>
+uint64_t ProfileLocked(int threadCount, size_t iterations) {
+  T * units = new T[BitCount / (sizeof(T) * 8)];
+  Bitmap<T, size_t> allocator(units, BitCount);
+  std::mutex lock;
+  
+  std::vector<std::thread> threads;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < threadCount; ++i) {
+    threads.push_back(std::thread(LockedWorker<T>, &allocator, &lock,
+                                  iterations));
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    threads[i].join();
+  }
+  uint64_t time = Nanotime() - start;
+  
+  delete[] units;
+  return (uint64_t)threadCount * iterations * BatchSize * 1000000 / time;
+}
+
+template <typename T>
+void ShardedWorker(ShardedBitmap<T, size_t> * allocator, size_t iterations) {
+  // Each iteration allocates a batch of IDs and then frees them again.
+  size_t ids[BatchSize];
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < BatchSize; ++j) {
+      bool result = allocator->Alloc(ids[j], 1);
+      assert(result);
+      (void)result;
+    }
+    for (size_t j = 0; j < BatchSize; ++j) {
+      allocator->Dealloc(ids[j], 1);
+    }
+  }
+}
+
+template <typename T>
+void LockedWorker(Bitmap<T, size_t> * allocator, std::mutex * lock,
+                  size_t iterations) {
+  size_t ids[BatchSize];
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < BatchSize; ++j) {
+      std::lock_guard<std::mutex> guard(*lock);
+      bool result = allocator->Alloc(ids[j], 1);
+      assert(result);
+      (void)result;
+    }
+    for (size_t j = 0; j < BatchSize; ++j) {
+      std::lock_guard<std::mutex> guard(*lock);
+      allocator->Dealloc(ids[j], 1);
+    }
+  }
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <cstdlib>
+#include <analloc2/bitmap>
+#include "posix-virtual-aligner.hpp"
+#include "nanotime.hpp"
+
+using namespace analloc;
+
+typedef SparseBitmap<uint64_t> IdBitmap;
+
+void ProfileMemory(const char * name, size_t count, uint64_t stride);
+
+uint64_t ProfileSparseChurn(size_t iterations, size_t bitCount);
+
+uint64_t ProfileBitmapChurn(size_t iterations, size_t bitCount);
+
+template <typename T>
+uint64_t ProfileChurn(T & allocator, size_t iterations, size_t bitCount);
+
+bool HandleFailure(IdBitmap *);
+
+PosixVirtualAligner aligner;
+
+int main() {
+  // IDs are allocated at a fixed stride in a 2^40-bit space, which a plain
+  // bitmap would need 128 GiB for.
+  ProfileMemory("sequential", 0x100000, 1);
+  ProfileMemory("1 in 16", 0x100000, 0x10);
+  ProfileMemory("1 in 4096", 0x10000, 0x1000);
+  ProfileMemory("1 in 2^20", 0x1000, 0x100000);
+  
+  std::cout << "SparseBitmap::Alloc() [fragmented] ... " << std::flush <<
+    ProfileSparseChurn(0x1000, 0x100000) << " ns" << std::endl;
+  std::cout << "Bitmap::Alloc() [fragmented] ... " << std::flush <<
+    ProfileBitmapChurn(0x1000, 0x100000) << " ns" << std::endl;
+  return 0;
+}
+
+void ProfileMemory(const char * name, size_t count, uint64_t stride) {
+  IdBitmap allocator((uint64_t)1 << 40, aligner, HandleFailure);
+  // Allocate the IDs and the gaps between them, then free the gaps.
+  uint64_t addr;
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < count; ++i) {
+    if (!allocator.Alloc(addr, stride)) abort();
+  }
+  for (size_t i = count; i-- > 0 && stride > 1;) {
+    allocator.Dealloc(i * stride + 1, stride - 1);
+  }
+  uint64_t time = Nanotime() - start;
+  std::cout << "SparseBitmap [" << name << ", " << count << " IDs] ... " <<
+    (double)allocator.GetMemoryUsage() / count << " bytes/ID, " <<
+    allocator.GetContainerCount() << " containers, " << time / count <<
+    " ns/ID" << std::endl;
+}
+
+uint64_t ProfileSparseChurn(size_t iterations, size_t bitCount) {
+  IdBitmap allocator(bitCount, aligner, HandleFailure);
+  return ProfileChurn(allocator, iterations, bitCount);
+}
+
+uint64_t ProfileBitmapChurn(size_t iterations, size_t bitCount) {
+  uint64_t * units = new uint64_t[bitCount / 64];
+  Bitmap<uint64_t, uint64_t> allocator(units, bitCount);
+  uint64_t result = ProfileChurn(allocator, iterations, bitCount);
+  delete[] units;
+  return result;
+}
+
+template <typename T>
+uint64_t ProfileChurn(T & allocator, size_t iterations, size_t bitCount) {
+  // Leave one bit in every eight free, so that every container of the
+  // sparse bitmap is stored as a bitmap.
+  uint64_t addr;
+  if (!allocator.Alloc(addr, bitCount)) abort();
+  for (size_t i = 0; i < bitCount; i += 8) {
+    allocator.Dealloc(i, 1);
+  }
+  uint32_t seed = 1;
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    // Free the bit after a random hole, so that the only two-bit run is
+    // somewhere in the middle, then take the run and put the hole back.
+    seed = seed * 1103515245 + 12345;
+    uint64_t index = ((seed >> 8) % (bitCount / 8)) * 8;
+    allocator.Dealloc(index + 1, 1);
+    if (!allocator.Alloc(addr, 2) || addr != index) abort();
+    allocator.Dealloc(addr, 1);
+  }
+  return (Nanotime() - start) / iterations;
+}
+
+bool HandleFailure(IdBitmap *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
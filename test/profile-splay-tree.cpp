@@ -0,0 +1,185 @@
+#include <iostream>
+#include <analloc2/free-tree>
+#include "nanotime.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "stack-allocator.hpp"
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+
+typedef FreeTree<AvlTree, size_t> AvlFreeTree;
+typedef FreeTree<SplayTree, size_t> SplayFreeTree;
+
+/**
+ * Picks which of [length] values or allocations to use next.
+ *
+ * A uniform trace picks any of them at random. A local trace picks one of the
+ * eight it picked most recently seven times out of eight, like a program
+ * which frees memory soon after allocating it.
+ */
+struct Trace {
+  uint32_t seed = 1;
+  size_t length;
+  bool local;
+  size_t recent[8] = {};
+  size_t recentIndex = 0;
+  
+  Trace(size_t _length, bool _local) : length(_length), local(_local) {}
+  
+  size_t Next() {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (local && random % 8) {
+      return recent[(random >> 3) % 8];
+    }
+    size_t index = (random >> 3) % length;
+    recent[recentIndex++ % 8] = index;
+    return index;
+  }
+};
+
+template <template <class T> class Tree>
+uint64_t ProfileContains(int count, bool local);
+
+template <template <class T> class Tree>
+uint64_t ProfileModifications(int count, bool local);
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, bool local);
+
+template <class T>
+bool HandleFailure(T *);
+
+int main() {
+  for (int local = 0; local < 2; ++local) {
+    const char * name = local ? "local" : "uniform";
+    for (int factor = 0; factor < 4; ++factor) {
+      int count = 0x800 << factor;
+      std::cout << "AvlTree<int>::Contains() [" << name << ", " << count
+        << "] ... " << std::flush << ProfileContains<AvlTree>(count, local)
+        << std::endl;
+      std::cout << "SplayTree<int>::Contains() [" << name << ", " << count
+        << "] ... " << std::flush << ProfileContains<SplayTree>(count, local)
+        << std::endl;
+      std::cout << "AvlTree<int>::[Remove/Add]() [" << name << ", " << count
+        << "] ... " << std::flush
+        << ProfileModifications<AvlTree>(count, local) << std::endl;
+      std::cout << "SplayTree<int>::[Remove/Add]() [" << name << ", " << count
+        << "] ... " << std::flush
+        << ProfileModifications<SplayTree>(count, local) << std::endl;
+    }
+  }
+  for (int local = 0; local < 2; ++local) {
+    const char * name = local ? "local" : "uniform";
+    for (size_t i = 4; i < 13; ++i) {
+      size_t len = 1 << i;
+      std::cout << "FreeTreeAllocator<AvlTree> [" << name << " churn, " << len
+        << " allocations] ... " << std::flush
+        << ProfileChurn<AvlFreeTree,
+                        sizeof(AvlNode<AvlFreeTree::AddressedRegion>)>(
+            len, local)
+        << std::endl;
+      std::cout << "FreeTreeAllocator<SplayTree> [" << name << " churn, "
+        << len << " allocations] ... " << std::flush
+        << ProfileChurn<SplayFreeTree,
+                        sizeof(SplayNode<SplayFreeTree::AddressedRegion>)>(
+            len, local)
+        << std::endl;
+    }
+  }
+  return 0;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileContains(int count, bool local) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count, aligner);
+  Tree<int> tree(stack);
+  
+  // Build the tree in a scrambled order, and then look up values.
+  for (int i = 0; i < count; ++i) {
+    tree.Add((i * 0x9e5) % count);
+  }
+  Trace trace(count, local);
+  const int iterations = 5000000;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < iterations; ++i) {
+    __asm__ __volatile__("" : : "r" (tree.Contains((int)trace.Next())));
+  }
+  uint64_t time = Nanotime() - start;
+  tree.Clear();
+  return time / iterations;
+}
+
+template <template <class T> class Tree>
+uint64_t ProfileModifications(int count, bool local) {
+  StackAllocator<sizeof(typename Tree<int>::Node)> stack(count + 1, aligner);
+  Tree<int> tree(stack);
+  
+  // Fill the tree with every other value, and then keep replacing a value
+  // with the odd or even value next to it.
+  int * values = new int[count];
+  for (int i = 0; i < count; ++i) {
+    values[i] = ((i * 0x9e5) % count) * 2;
+    tree.Add(values[i]);
+  }
+  Trace trace(count, local);
+  const int iterations = 1000000;
+  uint64_t start = Nanotime();
+  for (int i = 0; i < iterations; ++i) {
+    size_t index = trace.Next();
+    tree.Remove(values[index]);
+    values[index] ^= 1;
+    tree.Add(values[index]);
+  }
+  uint64_t time = Nanotime() - start;
+  delete[] values;
+  tree.Clear();
+  return time / iterations;
+}
+
+template <typename T, size_t NodeSize>
+uint64_t ProfileChurn(size_t length, bool local) {
+  StackAllocator<NodeSize> stack((length + 1) * 2, aligner);
+  T allocator(stack, HandleFailure);
+  allocator.Dealloc(0, length * 0x20);
+  
+  // Keep replacing allocations with new ones of random sizes, just like the
+  // churn benchmark in profile-free-tree.
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = 1 + (seed >> 8) % 0x10;
+    bool result = allocator.Alloc(addresses[i], sizes[i]);
+    assert(result);
+    (void)result;
+  }
+  Trace trace(length, local);
+  const size_t iterations = 100000;
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = trace.Next();
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = 1 + (seed >> 4) % 0x10;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(addresses[i], sizes[i]);
+  }
+  delete[] addresses;
+  delete[] sizes;
+  return time / iterations;
+}
+
+template <class T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
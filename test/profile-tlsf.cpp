@@ -0,0 +1,110 @@
+#include <iostream>
+#include <analloc2/tlsf>
+#include <analloc2/free-list>
+#include <analloc2/free-tree>
+#include "nanotime.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "scoped-buffer.hpp"
+#include "stack-allocator.hpp"
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+
+/**
+ * Allocations are between 1 and 16 units, and a unit of a [Tlsf] is 16
+ * bytes.
+ */
+static const size_t TlsfUnit = 0x10;
+
+uint64_t ProfileTlsfChurn(size_t length, size_t iters);
+uint64_t ProfileFreeListChurn(size_t length, size_t iters);
+uint64_t ProfileFreeTreeChurn(size_t length, size_t iters);
+
+template <typename T>
+uint64_t ProfileChurn(T & allocator, size_t unit, size_t length,
+                      size_t iters);
+
+template <typename T>
+bool HandleFailure(T *);
+
+int main() {
+  for (size_t i = 4; i < 13; ++i) {
+    size_t len = 1 << i;
+    std::cout << "Tlsf::Alloc() [churn, " << len << " allocations]..."
+      << std::flush << " " << ProfileTlsfChurn(len, 100000) << std::endl;
+    std::cout << "FreeList::Alloc() [churn, " << len << " allocations]..."
+      << std::flush << " " << ProfileFreeListChurn(len, 100000) << std::endl;
+    std::cout << "FreeTree::Alloc() [churn, " << len << " allocations]..."
+      << std::flush << " " << ProfileFreeTreeChurn(len, 100000) << std::endl;
+  }
+}
+
+uint64_t ProfileTlsfChurn(size_t length, size_t iters) {
+  size_t size = length * 0x20 * TlsfUnit;
+  ScopedBuffer buffer(size, sizeof(void *));
+  Tlsf<> allocator(buffer, size);
+  return ProfileChurn(allocator, TlsfUnit, length, iters);
+}
+
+uint64_t ProfileFreeListChurn(size_t length, size_t iters) {
+  StackAllocator<sizeof(FreeList<size_t>::FreeRegion)> stack(length + 1,
+                                                             aligner);
+  FreeList<size_t> allocator(stack, HandleFailure);
+  allocator.Dealloc(0, length * 0x20);
+  uint64_t result = ProfileChurn(allocator, 1, length, iters);
+  size_t ignored;
+  while (allocator.Alloc(ignored, 1));
+  return result;
+}
+
+uint64_t ProfileFreeTreeChurn(size_t length, size_t iters) {
+  typedef AvlNode<FreeTree<AvlTree, size_t>::AddressedRegion> Region;
+  StackAllocator<sizeof(Region)> stack((length + 1) * 2, aligner);
+  FreeTree<AvlTree, size_t> allocator(stack, HandleFailure);
+  allocator.Dealloc(0, length * 0x20);
+  uint64_t result = ProfileChurn(allocator, 1, length, iters);
+  size_t ignored;
+  while (allocator.Alloc(ignored, 1));
+  return result;
+}
+
+template <typename T>
+uint64_t ProfileChurn(T & allocator, size_t unit, size_t length,
+                      size_t iters) {
+  // The allocator has room for about four times as many units as [length]
+  // allocations use. Keep replacing random allocations with new ones of
+  // random sizes.
+  size_t * addresses = new size_t[length];
+  size_t * sizes = new size_t[length];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < length; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = (1 + (seed >> 8) % 0x10) * unit;
+    assert(allocator.Alloc(addresses[i], sizes[i]));
+  }
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iters; ++i) {
+    seed = seed * 1103515245 + 12345;
+    size_t index = (seed >> 8) % length;
+    allocator.Dealloc(addresses[index], sizes[index]);
+    sizes[index] = (1 + (seed >> 4) % 0x10) * unit;
+    bool result = allocator.Alloc(addresses[index], sizes[index]);
+    assert(result);
+    (void)result;
+  }
+  uint64_t time = Nanotime() - start;
+  
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(addresses[i], sizes[i]);
+  }
+  delete[] addresses;
+  delete[] sizes;
+  return time / iters;
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <analloc2/free-list>
+#include "nanotime.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "stack-allocator.hpp"
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+
+template <typename T, size_t ObjectSize>
+uint64_t ProfileAllocEnd(size_t length, size_t iters);
+
+template <typename T>
+bool HandleFailure(T *);
+
+int main() {
+  for (size_t i = 6; i < 17; i += 2) {
+    size_t len = 1 << i;
+    size_t iters = 0x1000000 / len;
+    std::cout << "FreeList::Alloc() [" << len << " regions]..."
+      << std::flush << " "
+      << ProfileAllocEnd<FreeList<size_t>,
+                         sizeof(FreeList<size_t>::FreeRegion)>(len, iters)
+      << std::endl;
+    std::cout << "UnrolledFreeList<0x80>::Alloc() [" << len << " regions]..."
+      << std::flush << " "
+      << ProfileAllocEnd<UnrolledFreeList<size_t, size_t, 0x80>,
+                         0x80>(len, iters)
+      << std::endl;
+    std::cout << "UnrolledFreeList<0x100>::Alloc() [" << len << " regions]..."
+      << std::flush << " "
+      << ProfileAllocEnd<UnrolledFreeList<size_t, size_t, 0x100>,
+                         0x100>(len, iters)
+      << std::endl;
+    std::cout << "UnrolledFreeList<0x1000>::Alloc() [" << len
+      << " regions]..." << std::flush << " "
+      << ProfileAllocEnd<UnrolledFreeList<size_t, size_t, 0x1000>,
+                         0x1000>(len, iters)
+      << std::endl;
+  }
+}
+
+template <typename T, size_t ObjectSize>
+uint64_t ProfileAllocEnd(size_t length, size_t iterations) {
+  StackAllocator<ObjectSize> stack(length + 1, aligner);
+  T allocator(stack, HandleFailure);
+  
+  // Carve out [length] regions of size 1, and then one final region of size
+  // 2 which every allocation has to scan all the way to.
+  for (size_t i = 0; i < length; ++i) {
+    allocator.Dealloc(i * 2, 1);
+  }
+  uint64_t start = Nanotime();
+  size_t ignored = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    allocator.Dealloc(length * 2, 2);
+    allocator.Alloc(ignored, 2);
+    assert(ignored == length * 2);
+  }
+  uint64_t time = Nanotime() - start;
+  
+  while (allocator.Alloc(ignored, 1));
+  return time / iterations;
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
@@ -13,6 +13,9 @@ uint64_t ProfileTrivialAlloc();
 template <typename Unit>
 uint64_t ProfileLongAlloc(size_t amountUsed);
 
+template <typename Unit>
+uint64_t ProfileGrowth(bool inPlace);
+
 int main() {
   ProfileAll<unsigned char>();
   ProfileAll<unsigned short>();
@@ -33,6 +36,12 @@ void ProfileAll() {
       ">::Alloc() [long, " << size << "] ... " << std::flush <<
       ProfileLongAlloc<Unit>(size) << std::endl;
   }
+  std::cout << "VirtualBitmapAllocator<" << ansa::NumericInfo<Unit>::name <<
+    ">::Realloc() [growing] ... " << std::flush << ProfileGrowth<Unit>(true) <<
+    std::endl;
+  std::cout << "VirtualBitmapAllocator<" << ansa::NumericInfo<Unit>::name <<
+    ">::Alloc() [growing, copied] ... " << std::flush <<
+    ProfileGrowth<Unit>(false) << std::endl;
 }
 
 template <typename Unit>
@@ -85,3 +94,44 @@ uint64_t ProfileLongAlloc(size_t amountUsed) {
   
   return (Nanotime() - start) / iterations;
 }
+
+template <typename Unit>
+uint64_t ProfileGrowth(bool inPlace) {
+  // Grow a buffer 16 bytes at a time, either with [Realloc] or by copying it
+  // to a new buffer the way [Realloc] did before it could resize in place.
+  const size_t cellSize = 0x10;
+  const size_t maxSize = 0x10000;
+  const size_t totalSize = maxSize * 4;
+  
+  ScopedBuffer data(totalSize);
+  Unit bitmap[totalSize / cellSize / ansa::NumericInfo<Unit>::bitCount];
+  
+  VirtualBitmapAllocator<Unit> allocator(cellSize, (uintptr_t)data, bitmap,
+                                         totalSize);
+  uintptr_t addr;
+  bool res = allocator.Alloc(addr, cellSize);
+  assert(res);
+  (void)res;
+  
+  const size_t iterations = maxSize / cellSize - 1;
+  uint64_t start = Nanotime();
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t size = (i + 2) * cellSize;
+    if (inPlace) {
+      bool res = allocator.Realloc(addr, size);
+      assert(res);
+      (void)res;
+    } else {
+      uintptr_t newAddr;
+      bool res = allocator.Alloc(newAddr, size);
+      assert(res);
+      (void)res;
+      ansa::Memcpy((void *)newAddr, (void *)addr, size - cellSize);
+      allocator.Free(addr);
+      addr = newAddr;
+    }
+  }
+  uint64_t time = Nanotime() - start;
+  allocator.Free(addr);
+  return time / iterations;
+}
@@ -0,0 +1,236 @@
+#include "scoped-pass.hpp"
+#include "posix-virtual-aligner.hpp"
+#include <analloc2/free-tree>
+#include <analloc2/free-list>
+
+using namespace analloc;
+
+PosixVirtualAligner posixAligner;
+typedef AugmentedFreeTree<AvlTree, uint16_t, uint8_t> AllocatorClass;
+
+void TestFirstFit();
+void TestJoins();
+void TestSplits();
+void TestTryResize();
+void TestReference();
+
+template <typename T>
+bool HandleFailure(T *);
+
+int main() {
+  TestFirstFit();
+  assert(posixAligner.GetAllocCount() == 0);
+  TestJoins();
+  assert(posixAligner.GetAllocCount() == 0);
+  TestSplits();
+  assert(posixAligner.GetAllocCount() == 0);
+  TestTryResize();
+  assert(posixAligner.GetAllocCount() == 0);
+  TestReference();
+  assert(posixAligner.GetAllocCount() == 0);
+  return 0;
+}
+
+void TestFirstFit() {
+  ScopedPass pass("AugmentedFreeTree::Alloc() [first-fit]");
+  AllocatorClass allocator(posixAligner, HandleFailure);
+  uint16_t addr;
+  
+  // Each region should only take up a single node.
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x111, 0x1);
+  allocator.Dealloc(0x120, 0x10);
+  assert(posixAligner.GetAllocCount() == 3);
+  
+  // Allocations come from the lowest region which is big enough, even if a
+  // smaller region would fit.
+  assert(allocator.Alloc(addr, 0x1));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x120);
+  assert(!allocator.Alloc(addr, 0x10));
+  assert(allocator.Alloc(addr, 0xf));
+  assert(addr == 0x101);
+  assert(allocator.Alloc(addr, 0x1));
+  assert(addr == 0x111);
+  assert(!allocator.Alloc(addr, 0x1));
+  assert(posixAligner.GetAllocCount() == 0);
+  
+  for (int i = 0; i < 0x10; ++i) {
+    allocator.Dealloc(0x200 + i * 0x10, 1 + i);
+  }
+  assert(posixAligner.GetAllocCount() == 0x10);
+  for (int i = 0x10; i > 0; --i) {
+    assert(allocator.Alloc(addr, i));
+    assert(addr == 0x200 + (i - 1) * 0x10);
+  }
+  assert(!allocator.Alloc(addr, 1));
+}
+
+void TestJoins() {
+  ScopedPass pass("AugmentedFreeTree::Dealloc() [joins]");
+  AllocatorClass allocator(posixAligner, HandleFailure);
+  uint16_t addr;
+  
+  // Joining a middle region to two outer regions
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x120, 0x10);
+  allocator.Dealloc(0x110, 0x10);
+  assert(posixAligner.GetAllocCount() == 1);
+  assert(allocator.Alloc(addr, 0x30));
+  assert(addr == 0x100);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Joining a region with its previous region
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x120, 0x10);
+  allocator.Dealloc(0x110, 0xf);
+  assert(posixAligner.GetAllocCount() == 2);
+  assert(allocator.Alloc(addr, 0x1f));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x120);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Joining a region with its next region
+  allocator.Dealloc(0x100, 0xf);
+  allocator.Dealloc(0x120, 0x10);
+  allocator.Dealloc(0x110, 0x10);
+  assert(posixAligner.GetAllocCount() == 2);
+  assert(allocator.Alloc(addr, 0x20));
+  assert(addr == 0x110);
+  assert(allocator.Alloc(addr, 0xf));
+  assert(addr == 0x100);
+  assert(!allocator.Alloc(addr, 1));
+}
+
+void TestSplits() {
+  ScopedPass pass("AugmentedFreeTree::Align() [splits]");
+  AllocatorClass aligner(posixAligner, HandleFailure);
+  uint16_t addr;
+  
+  // Test when the region doesn't have enough room
+  aligner.Dealloc(0, 0x20);
+  assert(!aligner.Align(addr, 0x100, 0x21));
+  assert(!aligner.OffsetAlign(addr, 0x40, 1, 0x20));
+  
+  // There is exactly enough room in this region and offset = 0
+  assert(aligner.Align(addr, 8, 0x20));
+  assert(addr == 0);
+  assert(!aligner.Alloc(addr, 1));
+  
+  // Just enough room with offset != 0
+  aligner.Dealloc(0xf, 0x21);
+  assert(aligner.Align(addr, 0x10, 0x20));
+  assert(addr == 0x10);
+  assert(aligner.Alloc(addr, 1));
+  assert(addr == 0xf);
+  assert(!aligner.Alloc(addr, 1));
+  
+  // More than enough room with offset != 0
+  aligner.Dealloc(0xf, 0x21);
+  assert(aligner.OffsetAlign(addr, 0x10, 4, 0x10));
+  assert(addr == 0x1c);
+  assert(aligner.Alloc(addr, 0xd));
+  assert(addr == 0xf);
+  assert(aligner.Alloc(addr, 0x4));
+  assert(addr == 0x2c);
+  assert(!aligner.Alloc(addr, 1));
+}
+
+void TestTryResize() {
+  ScopedPass pass("AugmentedFreeTree::TryResize()");
+  AllocatorClass allocator(posixAligner, HandleFailure);
+  uint16_t addr;
+  
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x120, 0x20);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x100);
+  
+  // Growing should take the front of the region right after the allocation,
+  // and fail if that region is too small or does not exist.
+  assert(allocator.TryResize(0x100, 4, 8));
+  assert(!allocator.TryResize(0x100, 8, 0x11));
+  assert(allocator.TryResize(0x100, 8, 0x10));
+  assert(!allocator.TryResize(0x100, 0x10, 0x11));
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x120);
+  assert(allocator.TryResize(0x120, 0x10, 0x20));
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Shrinking should free the tail.
+  assert(allocator.TryResize(0x120, 0x20, 0x18));
+  assert(allocator.TryResize(0x100, 0x10, 0));
+  assert(!allocator.Alloc(addr, 0x11));
+  assert(allocator.Alloc(addr, 8));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 8));
+  assert(addr == 0x108);
+  assert(allocator.Alloc(addr, 8));
+  assert(addr == 0x138);
+  assert(!allocator.Alloc(addr, 1));
+}
+
+void TestReference() {
+  ScopedPass pass("AugmentedFreeTree [reference]");
+  AugmentedFreeTree<AvlTree, uint32_t> allocator(posixAligner, HandleFailure);
+  FreeList<uint32_t> reference(posixAligner, HandleFailure);
+  for (uint32_t i = 0; i < 0x200; ++i) {
+    allocator.Dealloc(i * 0x10, 1 + i % 0xf);
+    reference.Dealloc(i * 0x10, 1 + i % 0xf);
+  }
+  
+  // Every operation should have the same result as it does on a first-fit
+  // [FreeList].
+  uint32_t addrs[0x100];
+  uint32_t sizes[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 3 == 0)) {
+      size_t index = (random >> 2) % count;
+      allocator.Dealloc(addrs[index], sizes[index]);
+      reference.Dealloc(addrs[index], sizes[index]);
+      addrs[index] = addrs[--count];
+      sizes[index] = sizes[count];
+    } else if (count && random % 3 == 1) {
+      size_t index = (random >> 2) % count;
+      uint32_t newSize = 1 + (random >> 10) % 0x18;
+      bool result = allocator.TryResize(addrs[index], sizes[index], newSize);
+      assert(result == reference.TryResize(addrs[index], sizes[index],
+                                           newSize));
+      if (result) {
+        sizes[index] = newSize;
+      }
+    } else {
+      uint32_t size = 1 + (random >> 2) % 0x18;
+      uint32_t align = 1 << ((random >> 7) % 6);
+      uint32_t offset = (random >> 10) % 4;
+      uint32_t addr;
+      bool result = allocator.OffsetAlign(addrs[count], align, offset, size);
+      assert(result == reference.OffsetAlign(addr, align, offset, size));
+      if (result) {
+        assert(addr == addrs[count]);
+        sizes[count++] = size;
+      }
+    }
+    // There should be exactly one node for every free region.
+    assert(posixAligner.GetAllocCount() == reference.GetRegionCount() * 2);
+  }
+  
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+    reference.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(reference.GetRegionCount() == 0x200);
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "HandleFailure()" << std::endl;
+  abort();
+}
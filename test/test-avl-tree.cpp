@@ -1,5 +1,6 @@
 #include "scoped-pass.hpp"
 #include "posix-virtual-aligner.hpp"
+#include "weighted-value.hpp"
 #include <analloc2/free-tree>
 
 using namespace analloc;
@@ -16,8 +17,12 @@ void TestUnbalancedTrivialDeletions();
 void TestBalancedNontrivialDeletions();
 void TestRandomModifications();
 void TestFindMethods();
+void TestFindNeighbors();
+void TestUpdate();
 void TestSearchFunction();
 void TestEnumerator();
+void TestAugment();
+void TestPrunedEnumerator();
 
 bool IsLeaf(const AvlNode<int> * node);
 bool IsFull(const AvlNode<int> * node);
@@ -26,6 +31,7 @@ bool IsRightOnly(const AvlNode<int> * node);
 bool ValidateParent(const AvlNode<int> * node);
 bool ValidateRoot(const AvlNode<int> * node);
 bool ValidateBalance(const AvlNode<int> * node, int & depthOut);
+bool ValidateAugment(const AvlNode<WeightedValue> * node);
 
 int main() {
   TestBalancedInsertions();
@@ -48,10 +54,18 @@ int main() {
   assert(aligner.GetAllocCount() == 0);
   TestFindMethods();
   assert(aligner.GetAllocCount() == 0);
+  TestFindNeighbors();
+  assert(aligner.GetAllocCount() == 0);
+  TestUpdate();
+  assert(aligner.GetAllocCount() == 0);
   TestSearchFunction();
   assert(aligner.GetAllocCount() == 0);
   TestEnumerator();
   assert(aligner.GetAllocCount() == 0);
+  TestAugment();
+  assert(aligner.GetAllocCount() == 0);
+  TestPrunedEnumerator();
+  assert(aligner.GetAllocCount() == 0);
   
   // TODO: test AVL tree with multiple occurances of the same value
   
@@ -1043,6 +1057,80 @@ void TestFindMethods() {
   assert(!tree.Contains(8));
 }
 
+void TestFindNeighbors() {
+  ScopedPass pass("AvlTree<int>::FindNeighbors()");
+  AvlTree<int> tree(aligner);
+  int below, above;
+  bool hasBelow, hasAbove;
+  
+  tree.FindNeighbors(5, below, hasBelow, above, hasAbove);
+  assert(!hasBelow && !hasAbove);
+  
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.Add(i * 2));
+  }
+  
+  // Values which are not in the tree sit between two neighbors.
+  for (int i = -1; i < 0x81; i += 2) {
+    tree.FindNeighbors(i, below, hasBelow, above, hasAbove);
+    assert(hasBelow == (i > 0));
+    assert(!hasBelow || below == i - 1);
+    assert(hasAbove == (i < 0x7e));
+    assert(!hasAbove || above == i + 1);
+  }
+  
+  // Values which are in the tree find their neighbors in their subtrees.
+  for (int i = 0; i < 0x80; i += 2) {
+    tree.FindNeighbors(i, below, hasBelow, above, hasAbove);
+    assert(hasBelow == (i > 0));
+    assert(!hasBelow || below == i - 2);
+    assert(hasAbove == (i < 0x7e));
+    assert(!hasAbove || above == i + 2);
+  }
+  
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.Remove(i * 2));
+  }
+}
+
+void TestUpdate() {
+  ScopedPass pass("AvlTree<WeightedValue>::Update()");
+  AvlTree<WeightedValue> tree(aligner);
+  
+  assert(!tree.Update(WeightedValue(1), WeightedValue(1)));
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.Add(WeightedValue(i * 4)));
+  }
+  
+  // Moving values between their neighbors should keep the tree in order and
+  // keep every summary up to date.
+  uint32_t seed = 1;
+  int keys[0x40];
+  for (int i = 0; i < 0x40; ++i) {
+    keys[i] = i * 4;
+  }
+  for (int i = 0; i < 0x400; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int index = (seed >> 8) % 0x40;
+    int newKey = index * 4 + (seed >> 16) % 3 - 1;
+    int weight = (seed >> 20) % 0x100;
+    assert(tree.Update(WeightedValue(keys[index]),
+                       WeightedValue(newKey, weight)));
+    assert(!tree.Contains(WeightedValue(keys[index])) ||
+           keys[index] == newKey);
+    keys[index] = newKey;
+    assert(tree.Contains(WeightedValue(newKey)));
+    assert(ValidateAugment(tree.GetRoot()));
+  }
+  
+  WeightedValue result;
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.FindGE(result, WeightedValue(i * 4 - 1), true));
+    assert(result.key == keys[i]);
+  }
+  assert(tree.GetRoot() == nullptr);
+}
+
 void TestSearchFunction() {
   ScopedPass pass("AvlTree<int>::Search()");
   AvlTree<int> tree(aligner);
@@ -1169,6 +1257,81 @@ void TestEnumerator() {
   }
 }
 
+void TestAugment() {
+  ScopedPass pass("AvlTree<WeightedValue>::[Remove/Add]() [augmented]");
+  AvlTree<WeightedValue> tree(aligner);
+  
+  // Every rotation and removal should leave each node with an up-to-date
+  // summary of its subtree.
+  bool present[0x100] = {};
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 0x100;
+    if (present[key]) {
+      assert(tree.Remove(WeightedValue(key)));
+    } else {
+      assert(tree.Add(WeightedValue(key, (seed >> 16) % 0x1000)));
+    }
+    present[key] = !present[key];
+    assert(ValidateAugment(tree.GetRoot()));
+  }
+  for (int i = 0; i < 0x100; ++i) {
+    if (present[i]) {
+      assert(tree.Remove(WeightedValue(i)));
+    }
+  }
+  assert(tree.GetRoot() == nullptr);
+}
+
+void TestPrunedEnumerator() {
+  struct HeavyEnumerator : public AvlTree<WeightedValue>::EnumerateCallback {
+    int threshold;
+    int keys[0x100];
+    int idx = 0;
+    int entered = 0;
+    
+    virtual bool Yield(const WeightedValue & value) {
+      if (value.weight >= threshold) {
+        keys[idx++] = value.key;
+      }
+      return true;
+    }
+    
+    virtual bool EnterSubtree(const WeightedValue & root) {
+      ++entered;
+      return root.heaviest >= threshold;
+    }
+  };
+  
+  ScopedPass pass("AvlTree<WeightedValue>::Enumerate() [pruned]");
+  AvlTree<WeightedValue> tree(aligner);
+  
+  // Only every 0x40th value is heavy, so most subtrees should be skipped.
+  for (int i = 0; i < 0x100; ++i) {
+    assert(tree.Add(WeightedValue(i, i % 0x40 ? 1 : 2)));
+  }
+  HeavyEnumerator enumerator;
+  enumerator.threshold = 2;
+  assert(tree.Enumerate(enumerator));
+  assert(enumerator.idx == 4);
+  for (int i = 0; i < 4; ++i) {
+    assert(enumerator.keys[i] == i * 0x40);
+  }
+  assert(enumerator.entered < 0x80);
+  
+  // Nothing is heavy enough, so only the root should be looked at.
+  HeavyEnumerator empty;
+  empty.threshold = 3;
+  assert(tree.Enumerate(empty));
+  assert(empty.idx == 0);
+  assert(empty.entered == 1);
+  
+  for (int i = 0; i < 0x100; ++i) {
+    assert(tree.Remove(WeightedValue(i)));
+  }
+}
+
 bool IsLeaf(const AvlNode<int> * node) {
   if (!node) return false;
   return node->left == nullptr && node->right == nullptr;
@@ -1221,3 +1384,14 @@ bool ValidateBalance(const AvlNode<int> * node, int & depthOut) {
   }
   return true;
 }
+
+bool ValidateAugment(const AvlNode<WeightedValue> * node) {
+  if (!node) return true;
+  if (!ValidateAugment(node->left) || !ValidateAugment(node->right)) {
+    return false;
+  }
+  WeightedValue expected = node->GetValue();
+  UpdateTreeAugment(expected, node->left ? &node->left->GetValue() : nullptr,
+                    node->right ? &node->right->GetValue() : nullptr);
+  return expected.heaviest == node->GetValue().heaviest;
+}
@@ -1,6 +1,7 @@
 #include "scoped-pass.hpp"
 #include <analloc2/bitmap>
 #include <ansa/numeric-info>
+#include <cstring>
 #include <cstdint>
 
 using namespace ansa;
@@ -18,12 +19,27 @@ void TestIntOverflowAllocation();
 template <typename T>
 void TestFragmentedAllocation();
 
+template <typename T>
+void TestRunAllocation(uint16_t bitCount);
+
+template <typename T>
+void TestAlignedRunAllocation(uint16_t bitCount);
+
+template <typename T>
+void TestDeferredInit(uint16_t bitCount);
+
+void TestDeferredInitLimit();
+void TestDeferredAlignment();
+
 void TestLargeAlignment();
 void TestUnitAlignment();
 void TestOverflowAlignment();
 void TestLastUnitAlignment();
 void TestSimpleOffsetAlignment();
 void TestMultitypeOffsetAlignment();
+void TestNextFit();
+void TestAllocMany();
+void TestTryResize();
 
 int main() {
   TestAllAllocation<unsigned char>();
@@ -32,12 +48,17 @@ int main() {
   TestAllAllocation<unsigned long>();
   TestAllAllocation<unsigned long long>();
   
+  TestDeferredInitLimit();
+  TestDeferredAlignment();
   TestLargeAlignment();
   TestUnitAlignment();
   TestOverflowAlignment();
   TestLastUnitAlignment();
   TestSimpleOffsetAlignment();
   TestMultitypeOffsetAlignment();
+  TestNextFit();
+  TestAllocMany();
+  TestTryResize();
   
   return 0;
 }
@@ -47,6 +68,12 @@ void TestAllAllocation() {
   TestStepAllocation<T>();
   TestIntOverflowAllocation<T>();
   TestFragmentedAllocation<T>();
+  TestRunAllocation<T>(0x200);
+  TestRunAllocation<T>(0x200 - 5);
+  TestAlignedRunAllocation<T>(0x200);
+  TestAlignedRunAllocation<T>(0x200 - 5);
+  TestDeferredInit<T>(0x200);
+  TestDeferredInit<T>(0x200 - 5);
 }
 
 template <typename T>
@@ -137,6 +164,226 @@ void TestFragmentedAllocation() {
   assert(!allocator.Alloc(addr, 1));
 }
 
+template <typename T>
+void TestRunAllocation(uint16_t bitCount) {
+  ScopedPass pass("Bitmap<", NumericInfo<T>::name,
+                  ", uint16_t>::Alloc() [runs, ", bitCount, "]");
+  T cells[0x200 / (sizeof(T) * 8)];
+  bool used[0x200] = {false};
+  Bitmap<T, uint16_t> allocator(cells, bitCount);
+  
+  // Compare every allocation to the lowest run that a linear search finds.
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    uint16_t size = (uint16_t)(1 + (random >> 4) % (random % 4 ? 0x10 : 0x90));
+    if (random % 5 == 0) {
+      uint16_t start = (uint16_t)((random >> 12) % (bitCount - size + 1));
+      for (uint16_t j = start; j < start + size; ++j) {
+        used[j] = false;
+      }
+      allocator.Dealloc(start, size);
+      continue;
+    }
+    int expected = -1;
+    for (int start = 0; start + size <= bitCount && expected < 0; ++start) {
+      int j = start;
+      while (j < start + size && !used[j]) {
+        ++j;
+      }
+      if (j == start + size) {
+        expected = start;
+      }
+    }
+    uint16_t addr;
+    if (expected < 0) {
+      assert(!allocator.Alloc(addr, size));
+      continue;
+    }
+    assert(allocator.Alloc(addr, size));
+    assert(addr == expected);
+    for (uint16_t j = addr; j < addr + size; ++j) {
+      used[j] = true;
+    }
+  }
+}
+
+template <typename T>
+void TestAlignedRunAllocation(uint16_t bitCount) {
+  ScopedPass pass("Bitmap<", NumericInfo<T>::name,
+                  ", uint16_t>::OffsetAlign() [runs, ", bitCount, "]");
+  T cells[0x200 / (sizeof(T) * 8)];
+  bool used[0x200] = {false};
+  Bitmap<T, uint16_t> allocator(cells, bitCount);
+  // Alignments which do and do not divide the unit size
+  const uint16_t aligns[] = {2, 3, 4, 6, 8, 12, 16, 32, 64, 0x60, 0x80};
+  
+  // Compare every allocation to the lowest aligned run that a linear search
+  // finds.
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    uint16_t size = (uint16_t)(1 + (random >> 4) % (random % 4 ? 0x10 : 0x90));
+    if (random % 3 == 0) {
+      uint16_t start = (uint16_t)((random >> 12) % (bitCount - size + 1));
+      for (uint16_t j = start; j < start + size; ++j) {
+        used[j] = false;
+      }
+      allocator.Dealloc(start, size);
+      continue;
+    }
+    uint16_t align = aligns[(random >> 14) % (sizeof(aligns) / 2)];
+    uint16_t offset = (uint16_t)((random >> 18) % 0x100);
+    int expected = -1;
+    for (int start = 0; start + size <= bitCount && expected < 0; ++start) {
+      if ((start + offset) % align) {
+        continue;
+      }
+      int j = start;
+      while (j < start + size && !used[j]) {
+        ++j;
+      }
+      if (j == start + size) {
+        expected = start;
+      }
+    }
+    uint16_t addr;
+    if (expected < 0) {
+      assert(!allocator.OffsetAlign(addr, align, offset, size));
+      continue;
+    }
+    assert(allocator.OffsetAlign(addr, align, offset, size));
+    assert(addr == expected);
+    for (uint16_t j = addr; j < addr + size; ++j) {
+      used[j] = true;
+    }
+  }
+}
+
+template <typename T>
+void TestDeferredInit(uint16_t bitCount) {
+  ScopedPass pass("Bitmap<", NumericInfo<T>::name,
+                  ", uint16_t>::Bitmap() [deferred, ", bitCount, "]");
+  T lazyCells[0x200 / (sizeof(T) * 8)];
+  T zeroCells[0x200 / (sizeof(T) * 8)];
+  T cells[0x200 / (sizeof(T) * 8)];
+  // The lazy bitmap starts out full of garbage, and the bits past its end must
+  // survive the first write to the last unit.
+  memset(lazyCells, 0xa5, sizeof(lazyCells));
+  memset(zeroCells, 0, sizeof(zeroCells));
+  Bitmap<T, uint16_t> lazy(lazyCells, bitCount, BitmapLazyZero);
+  Bitmap<T, uint16_t> preZeroed(zeroCells, bitCount, BitmapPreZeroed);
+  Bitmap<T, uint16_t> reference(cells, bitCount);
+  
+  // Every operation should give the same result as an eagerly zeroed bitmap.
+  uint16_t starts[0x40];
+  uint16_t sizes[0x40];
+  int count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x800; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x40 || (count && random % 3 == 0)) {
+      int index = (int)((random >> 2) % (uint32_t)count);
+      lazy.Dealloc(starts[index], sizes[index]);
+      preZeroed.Dealloc(starts[index], sizes[index]);
+      reference.Dealloc(starts[index], sizes[index]);
+      --count;
+      starts[index] = starts[count];
+      sizes[index] = sizes[count];
+      continue;
+    }
+    uint16_t size = (uint16_t)(1 + (random >> 2) % 0x30);
+    uint16_t addr, lazyAddr, preZeroedAddr;
+    bool result;
+    if (random % 3 == 1) {
+      result = reference.Alloc(addr, size);
+      assert(lazy.Alloc(lazyAddr, size) == result);
+      assert(preZeroed.Alloc(preZeroedAddr, size) == result);
+    } else {
+      uint16_t align = (uint16_t)(1 << ((random >> 10) % 6));
+      result = reference.Align(addr, align, size);
+      assert(lazy.Align(lazyAddr, align, size) == result);
+      assert(preZeroed.Align(preZeroedAddr, align, size) == result);
+    }
+    if (result) {
+      assert(lazyAddr == addr);
+      assert(preZeroedAddr == addr);
+      starts[count] = addr;
+      sizes[count++] = size;
+    }
+  }
+  
+  size_t padding = 0x200 - bitCount;
+  if (padding) {
+    T mask = (T)((T)~(T)0 << (sizeof(T) * 8 - padding));
+    T lastUnit = lazyCells[sizeof(lazyCells) / sizeof(T) - 1];
+    assert((lastUnit & mask) == ((T)0xa5a5a5a5a5a5a5a5ULL & mask));
+  }
+}
+
+void TestDeferredInitLimit() {
+  ScopedPass pass("Bitmap::Bitmap() [deferred, SizeType limit]");
+  
+  // The bit index of the end of the last unit does not fit in the size type,
+  // so zeroing must not overflow.
+  unsigned long long smallCells[4];
+  memset(smallCells, 0xff, sizeof(smallCells));
+  Bitmap<unsigned long long, uint8_t> small(smallCells, 200, BitmapLazyZero);
+  uint8_t smallAddr;
+  assert(small.OffsetAlign(smallAddr, 2, 0, 1));
+  assert(smallAddr == 0);
+  small.Dealloc(0, 1);
+  assert(small.Alloc(smallAddr, 200));
+  assert(smallAddr == 0);
+  assert(smallCells[3] == ~0ULL);
+  small.Dealloc(0, 200);
+  assert(smallCells[3] == ~0ULL << 8);
+  
+  static unsigned long long largeCells[0x400];
+  memset(largeCells, 0xff, sizeof(largeCells));
+  Bitmap<unsigned long long, uint16_t> large(largeCells, 0xffff,
+                                             BitmapLazyZero);
+  uint16_t largeAddr;
+  assert(large.OffsetAlign(largeAddr, 2, 0, 1));
+  assert(largeAddr == 0);
+  large.Dealloc(0, 1);
+  assert(large.Alloc(largeAddr, 0xffff));
+  assert(largeAddr == 0);
+  large.Dealloc(0, 0xffff);
+  assert(largeCells[0x3ff] == 1ULL << 63);
+}
+
+void TestDeferredAlignment() {
+  ScopedPass pass("Bitmap::OffsetAlign() [deferred]");
+  unsigned char cells[8];
+  memset(cells, 0xa5, sizeof(cells));
+  Bitmap<unsigned char, uint16_t> allocator(cells, 0x40, BitmapLazyZero);
+  uint16_t addr;
+  
+  // Aligned allocations should only zero the units which they claim.
+  assert(allocator.OffsetAlign(addr, 4, 0, 3));
+  assert(addr == 0);
+  assert(cells[0] == 0x07 && cells[1] == 0xa5);
+  assert(allocator.OffsetAlign(addr, 8, 1, 0xa));
+  assert(addr == 7);
+  assert(cells[0] == 0x87 && cells[1] == 0xff && cells[2] == 0x01);
+  assert(allocator.OffsetAlign(addr, 3, 0, 2));
+  assert(addr == 3);
+  assert(cells[0] == 0x9f);
+  
+  // Runs which reach into units that have not been zeroed should treat them
+  // as free.
+  assert(allocator.OffsetAlign(addr, 4, 0, 0x10));
+  assert(addr == 0x14);
+  assert(cells[2] == 0xf1 && cells[3] == 0xff && cells[4] == 0x0f);
+  for (int i = 5; i < 8; ++i) {
+    assert(cells[i] == 0xa5);
+  }
+}
+
 void TestLargeAlignment() {
   ScopedPass pass("Bitmap::Alloc() [large]");
   
@@ -252,7 +499,7 @@ void TestMultitypeOffsetAlignment() {
   assert(aligner.OffsetAlign(address, 0x200, 0x1f8, 1));
   assert(address == 0x8);
   assert(!aligner.OffsetAlign(address, 0x200, 0x1f8, 1));
-
+  
   // Wrap-around alignments
   assert(aligner.OffsetAlign(address, 0x100, 0xfffe, 1));
   assert(address == 2);
@@ -260,3 +507,151 @@ void TestMultitypeOffsetAlignment() {
   assert(aligner.OffsetAlign(address, 0x100, 0xffff, 1));
   assert(address == 1);
 }
+
+void TestNextFit() {
+  ScopedPass pass("Bitmap<unsigned int, uint16_t>::Alloc() [next-fit]");
+  unsigned int cells[4];
+  Bitmap<unsigned int, uint16_t> allocator(cells, 0x7e);
+  uint16_t addr;
+  
+  assert(!allocator.IsNextFit());
+  allocator.SetNextFit(true);
+  assert(allocator.IsNextFit());
+  assert(allocator.LastUsedAddress() == 0);
+  
+  // Freed addresses should not be reused until the cursor wraps around.
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x10);
+  allocator.Dealloc(0, 0x10);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x20);
+  assert(allocator.LastUsedAddress() == 0x20);
+  
+  // A run which doesn't fit before the end should come from the beginning.
+  assert(allocator.Alloc(addr, 0x50));
+  assert(addr == 0x24);
+  assert(allocator.Alloc(addr, 0xc));
+  assert(addr == 0);
+  assert(allocator.LastUsedAddress() == 0);
+  
+  // Filling the end of the bitmap should reset the cursor.
+  assert(allocator.Alloc(addr, 0xa));
+  assert(addr == 0x74);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0xc);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // A run which starts before the cursor and ends after it should be found
+  // once the search wraps around.
+  allocator.Dealloc(0x8, 0x10);
+  assert(allocator.Alloc(addr, 0xc));
+  assert(addr == 0x8);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x14);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Aligned allocations should also resume at the cursor.
+  allocator.Dealloc(0, 0x7e);
+  assert(allocator.Align(addr, 0x10, 1));
+  assert(addr == 0x20);
+  assert(allocator.Align(addr, 0x10, 1));
+  assert(addr == 0x30);
+  allocator.Dealloc(0x20, 1);
+  assert(allocator.OffsetAlign(addr, 0x20, 0x10, 0x20));
+  assert(addr == 0x50);
+  assert(allocator.Align(addr, 0x20, 1));
+  assert(addr == 0);
+  
+  allocator.SetNextFit(false);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 1);
+}
+
+void TestAllocMany() {
+  ScopedPass pass("Bitmap<unsigned char, uint16_t>::AllocMany()");
+  unsigned char cells[0x10];
+  Bitmap<unsigned char, uint16_t> allocator(cells, 0x7e);
+  uint16_t addrs[0x80];
+  uint16_t addr;
+  
+  // Bits should be handed out from lowest to highest, skipping used ones.
+  assert(allocator.AllocMany(addrs, 0));
+  assert(allocator.Alloc(addr, 3));
+  assert(allocator.Alloc(addr, 0x10));
+  allocator.Dealloc(1, 1);
+  allocator.Dealloc(0x8, 0x8);
+  assert(allocator.AllocMany(addrs, 0xa));
+  assert(addrs[0] == 1);
+  for (int i = 1; i < 9; ++i) {
+    assert(addrs[i] == 7 + i);
+  }
+  assert(addrs[9] == 0x13);
+  assert(allocator.LastUsedAddress() == 0x13);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x14);
+  
+  // A batch which does not fit should leave the bitmap untouched.
+  assert(!allocator.AllocMany(addrs, 0x7e - 0x14));
+  assert(allocator.AllocMany(addrs, 0x7e - 0x15));
+  assert(addrs[0] == 0x15);
+  assert(addrs[0x7e - 0x16] == 0x7d);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Freeing a batch should free exactly its bits, in any order.
+  addrs[0] = 0x40;
+  addrs[1] = 0x3;
+  addrs[2] = 0x41;
+  addrs[3] = 0x7d;
+  allocator.DeallocMany(addrs, 4);
+  assert(allocator.Alloc(addr, 2));
+  assert(addr == 0x40);
+  assert(allocator.AllocMany(addrs, 2));
+  assert(addrs[0] == 0x3);
+  assert(addrs[1] == 0x7d);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // In next-fit mode, batches begin at the cursor and wrap around.
+  allocator.Dealloc(0, 0x7e);
+  allocator.SetNextFit(true);
+  assert(allocator.Alloc(addr, 0x70));
+  allocator.Dealloc(0x10, 1);
+  assert(allocator.AllocMany(addrs, 0xf));
+  assert(addrs[0] == 0x70);
+  assert(addrs[0xd] == 0x7d);
+  assert(addrs[0xe] == 0x10);
+  assert(allocator.AllocMany(addrs, 0) && !allocator.AllocMany(addrs, 1));
+}
+
+void TestTryResize() {
+  ScopedPass pass("Bitmap<unsigned char, uint16_t>::TryResize()");
+  unsigned char cells[4] = {0xff, 0xff, 0xff, 0xff};
+  Bitmap<unsigned char, uint16_t> allocator(cells, 0x1e, BitmapLazyZero);
+  uint16_t addr;
+  
+  // Growing into units which have not been zeroed yet should treat them as
+  // free and zero them.
+  assert(allocator.Alloc(addr, 3));
+  assert(addr == 0);
+  assert(allocator.TryResize(0, 3, 0xc));
+  assert(cells[0] == 0xff && cells[1] == 0xf && cells[2] == 0xff);
+  assert(allocator.TryResize(0, 0xc, 0x10));
+  assert(allocator.Alloc(addr, 2));
+  assert(addr == 0x10);
+  
+  // Growing should fail if a bit is used or the region would pass the end.
+  assert(!allocator.TryResize(0, 0x10, 0x11));
+  assert(allocator.TryResize(0x10, 2, 0xe));
+  assert(!allocator.TryResize(0x10, 0xe, 0xf));
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Shrinking should free the tail and keep the head.
+  assert(allocator.TryResize(0, 0x10, 4));
+  assert(allocator.Alloc(addr, 0xc));
+  assert(addr == 4);
+  assert(allocator.TryResize(0x10, 0xe, 0));
+  assert(allocator.TryResize(4, 0xc, 0xc));
+  assert(allocator.Alloc(addr, 0xe));
+  assert(addr == 0x10);
+}
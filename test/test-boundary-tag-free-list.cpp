@@ -0,0 +1,283 @@
+#include "scoped-pass.hpp"
+#include "scoped-buffer.hpp"
+#include <analloc2/free-list>
+#include <ansa/cstring>
+#include <cassert>
+#include <cstring>
+
+using namespace analloc;
+
+typedef BoundaryTagFreeList AllocatorClass;
+
+void TestAllocFree();
+void TestExhaustion();
+void TestRealloc();
+void TestOffsetAlign();
+void TestRandom();
+void TestPlace();
+
+int main() {
+  TestAllocFree();
+  TestExhaustion();
+  TestRealloc();
+  TestOffsetAlign();
+  TestRandom();
+  TestPlace();
+  return 0;
+}
+
+void TestAllocFree() {
+  ScopedPass pass("BoundaryTagFreeList::[Alloc/Free]()");
+  ScopedBuffer buffer(0x1000, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  size_t blockSize = allocator.AddRegion(buffer, 0x1000);
+  assert(blockSize == 0x1000 - AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+  
+  // Allocations should be carved off of the end of the free block, so the
+  // free block itself stays where it is.
+  uintptr_t end = (uintptr_t)buffer + blockSize;
+  uintptr_t addrs[3];
+  assert(allocator.Alloc(addrs[0], 1));
+  assert(addrs[0] == end - AllocatorClass::MinBlockSize +
+                     AllocatorClass::HeaderSize);
+  assert(allocator.Alloc(addrs[1], 0x100));
+  assert(addrs[1] == addrs[0] - 0x100 - AllocatorClass::HeaderSize);
+  assert(allocator.Alloc(addrs[2], 0));
+  assert(addrs[2] == addrs[1] - AllocatorClass::MinBlockSize);
+  assert(allocator.GetFreeBlockCount() == 1);
+  memset((void *)addrs[1], 0xff, 0x100);
+  
+  // Freeing the middle allocation should not merge it with anything, but
+  // freeing its neighbors should merge everything back together.
+  allocator.Free(addrs[1]);
+  assert(allocator.GetFreeBlockCount() == 2);
+  allocator.Dealloc(addrs[0], 1);
+  assert(allocator.GetFreeBlockCount() == 2);
+  allocator.Free(addrs[2]);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+  
+  // The whole block can be allocated at once, but no more.
+  uintptr_t addr;
+  assert(!allocator.Alloc(addr, blockSize));
+  assert(!allocator.Alloc(addr, ~(size_t)0));
+  assert(allocator.Alloc(addr, blockSize - AllocatorClass::HeaderSize));
+  assert(addr == (uintptr_t)buffer + AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeBlockCount() == 0);
+  assert(!allocator.Alloc(addr, 0));
+  allocator.Free(addr);
+  assert(allocator.GetFreeSize() == blockSize);
+}
+
+void TestExhaustion() {
+  ScopedPass pass("BoundaryTagFreeList::Free() [merging]");
+  const size_t count = 0x100;
+  const size_t size = count * AllocatorClass::MinBlockSize +
+                      AllocatorClass::HeaderSize;
+  ScopedBuffer buffer(size, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  assert(allocator.AddRegion(buffer, size));
+  
+  uintptr_t addrs[count];
+  for (size_t i = 0; i < count; ++i) {
+    assert(allocator.Alloc(addrs[i], 1));
+  }
+  uintptr_t addr;
+  assert(!allocator.Alloc(addr, 1));
+  assert(allocator.GetFreeSize() == 0);
+  
+  // Free every other block, then the rest, so every free merges with both
+  // of its neighbors.
+  for (size_t i = 0; i < count; i += 2) {
+    allocator.Free(addrs[i]);
+  }
+  assert(allocator.GetFreeBlockCount() == count / 2);
+  assert(!allocator.Alloc(addr, AllocatorClass::MinBlockSize));
+  for (size_t i = 1; i < count; i += 2) {
+    allocator.Free(addrs[i]);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == size - AllocatorClass::HeaderSize);
+}
+
+void TestRealloc() {
+  ScopedPass pass("BoundaryTagFreeList::Realloc()");
+  ScopedBuffer buffer(0x1000, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  size_t blockSize = allocator.AddRegion(buffer, 0x1000);
+  const uintptr_t first = (uintptr_t)buffer + AllocatorClass::HeaderSize;
+  const size_t spaceSize = blockSize - AllocatorClass::MinBlockSize;
+  
+  // The first allocation comes from the end of the region, so growing it
+  // has to move it.
+  uintptr_t addr;
+  assert(allocator.Alloc(addr, 3));
+  uintptr_t oldAddr = addr;
+  ansa::Memcpy((void *)addr, "hey", 3);
+  assert(allocator.Realloc(addr, 0x100));
+  assert(addr != oldAddr);
+  assert(ansa::Memcmp((void *)addr, "hey", 3) == 0);
+  allocator.Free(addr);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+  
+  // Take the whole space in front of a small allocation, then shrink and
+  // grow it in place.
+  uintptr_t wall;
+  assert(allocator.Alloc(wall, 1));
+  assert(allocator.Alloc(addr, spaceSize - AllocatorClass::HeaderSize));
+  assert(addr == first);
+  assert(allocator.GetFreeBlockCount() == 0);
+  assert(allocator.Realloc(addr, 3));
+  assert(addr == first);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == spaceSize - AllocatorClass::MinBlockSize);
+  ansa::Memcpy((void *)addr, "sup", 3);
+  assert(allocator.Realloc(addr, 0x100));
+  assert(addr == first);
+  assert(allocator.GetFreeSize() == spaceSize - 0x100 -
+                                    AllocatorClass::HeaderSize);
+  assert(allocator.Realloc(addr, spaceSize - AllocatorClass::HeaderSize));
+  assert(addr == first);
+  assert(allocator.GetFreeBlockCount() == 0);
+  assert(ansa::Memcmp((void *)addr, "sup", 3) == 0);
+  
+  // Growing past the wall is impossible, and leaves the allocation alone.
+  assert(!allocator.Realloc(addr, spaceSize));
+  assert(addr == first);
+  assert(ansa::Memcmp((void *)addr, "sup", 3) == 0);
+  
+  allocator.Free(wall);
+  allocator.Free(addr);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+}
+
+void TestOffsetAlign() {
+  ScopedPass pass("BoundaryTagFreeList::OffsetAlign()");
+  ScopedBuffer buffer(0x4000, 0x1000);
+  AllocatorClass allocator;
+  allocator.AddRegion(buffer, 0x4000);
+  uintptr_t addr;
+  
+  // Alignments up to the granule need no padding, and offsets which break
+  // them cannot be met.
+  assert(allocator.Align(addr, 0, 1));
+  allocator.Free(addr);
+  assert(!allocator.OffsetAlign(addr, AllocatorClass::Granule, 1, 1));
+  assert(!allocator.OffsetAlign(addr, 0x100, 1, 1));
+  
+  // Bigger alignments should leave a free block in front of the allocation.
+  assert(allocator.Align(addr, 0x100, 0x10));
+  assert(addr == (uintptr_t)buffer + 0x100);
+  assert(allocator.GetFreeBlockCount() == 2);
+  allocator.Free(addr);
+  assert(allocator.GetFreeBlockCount() == 1);
+  
+  // The gap in front of the allocation is never smaller than a block.
+  uintptr_t offset = 0x100 - AllocatorClass::Granule * 2;
+  assert(allocator.OffsetAlign(addr, 0x100, offset, 0x10));
+  assert(addr == (uintptr_t)buffer + 0x100 + AllocatorClass::Granule * 2);
+  allocator.Free(addr);
+  
+  uintptr_t addrs[0x10];
+  for (int i = 0; i < 0x10; ++i) {
+    uintptr_t align = (uintptr_t)0x10 << (i % 6);
+    offset = (uintptr_t)AllocatorClass::Granule * (i % 3);
+    assert(allocator.OffsetAlign(addrs[i], align, offset, 0x20 + i));
+    assert((addrs[i] + offset) % align == 0);
+    memset((void *)addrs[i], i, 0x20 + i);
+  }
+  for (int i = 0; i < 0x10; ++i) {
+    for (int j = 0; j < 0x20 + i; ++j) {
+      assert(((unsigned char *)addrs[i])[j] == i);
+    }
+    allocator.Free(addrs[i]);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(!allocator.Align(addr, 0x1000, 0x4000));
+}
+
+void TestRandom() {
+  ScopedPass pass("BoundaryTagFreeList [random]");
+  const size_t size = 0x10000;
+  ScopedBuffer buffer(size, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  size_t totalSize = allocator.AddRegion(buffer, size);
+  
+  uintptr_t addrs[0x40];
+  size_t sizes[0x40];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x10000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    if (count && (seed >> 8) % 4 == 0) {
+      // Resizing should keep the contents which fit in the new size.
+      size_t index = (seed >> 9) % count;
+      size_t newSize = (seed >> 20) % 0x400;
+      if (!allocator.Realloc(addrs[index], newSize)) {
+        continue;
+      }
+      for (size_t j = 0; j < sizes[index] && j < newSize; ++j) {
+        assert(((unsigned char *)addrs[index])[j] == (unsigned char)index);
+      }
+      sizes[index] = newSize;
+      memset((void *)addrs[index], (int)index, newSize);
+      continue;
+    }
+    if (count == 0x40 || (count && (seed >> 8) % 2)) {
+      // Check that nothing else was allocated over the region.
+      size_t index = (seed >> 9) % count;
+      for (size_t j = 0; j < sizes[index]; ++j) {
+        assert(((unsigned char *)addrs[index])[j] == (unsigned char)index);
+      }
+      allocator.Dealloc(addrs[index], sizes[index]);
+      --count;
+      if (index != count) {
+        addrs[index] = addrs[count];
+        sizes[index] = sizes[count];
+        memset((void *)addrs[index], (int)index, sizes[index]);
+      }
+      continue;
+    }
+    sizes[count] = (seed >> 9) % 0x400;
+    uintptr_t align = (uintptr_t)1 << ((seed >> 20) % 10);
+    if (!allocator.Align(addrs[count], align, sizes[count])) {
+      continue;
+    }
+    assert(addrs[count] % align == 0);
+    assert(addrs[count] >= (uintptr_t)buffer);
+    assert(addrs[count] + sizes[count] <= (uintptr_t)buffer + size);
+    memset((void *)addrs[count], (int)count, sizes[count]);
+    ++count;
+  }
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == totalSize);
+}
+
+void TestPlace() {
+  ScopedPass pass("BoundaryTagFreeList::Place()");
+  ScopedBuffer buffer(0x4000, sizeof(void *));
+  uintptr_t start = buffer;
+  
+  assert(!AllocatorClass::Place(start, sizeof(AllocatorClass)));
+  AllocatorClass * allocator = AllocatorClass::Place(start, 0x4000);
+  assert(allocator != nullptr);
+  assert((uintptr_t)allocator == start);
+  
+  uintptr_t addr;
+  for (size_t i = 0; i < 0x1000; ++i) {
+    assert(allocator->Alloc(addr, 1));
+    assert(addr >= start + sizeof(AllocatorClass));
+    assert(addr + 1 <= start + 0x4000);
+    allocator->Free(addr);
+  }
+  assert(allocator->GetFreeBlockCount() == 1);
+  assert(allocator->GetFreeSize() + sizeof(AllocatorClass) < 0x4000);
+}
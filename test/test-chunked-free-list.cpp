@@ -8,6 +8,7 @@ PosixVirtualAligner posixAligner;
 
 void TestAlloc();
 void TestAlign();
+void TestCounters();
 
 template <typename T>
 bool HandleFailure(T *);
@@ -17,6 +18,8 @@ int main() {
   assert(posixAligner.GetAllocCount() == 0);
   TestAlign();
   assert(posixAligner.GetAllocCount() == 0);
+  TestCounters();
+  assert(posixAligner.GetAllocCount() == 0);
   return 0;
 }
 
@@ -63,6 +66,29 @@ void TestAlign() {
   assert(!aligner.Align(addr, 1, 1));
 }
 
+void TestCounters() {
+  ScopedPass pass("ChunkedFreeList [counters]");
+  
+  ChunkedFreeList<uint16_t> allocator(0x10, posixAligner, HandleFailure);
+  
+  // Sizes are counted in whole chunks.
+  uint16_t addr;
+  allocator.Dealloc(0x100, 1);
+  allocator.Dealloc(0x200, 0x21);
+  assert(allocator.GetRegionCount() == 2);
+  assert(allocator.GetFreeSize() == 0x40);
+  assert(allocator.GetLargestRegionBound() == 0x30);
+  assert(!allocator.Alloc(addr, 0x31));
+  assert(allocator.Alloc(addr, 0x21));
+  assert(addr == 0x200);
+  assert(allocator.GetFreeSize() == 0x10);
+  assert(!allocator.Align(addr, 0x20, 0x11));
+  assert(allocator.GetLargestRegionBound() == 0x10);
+  assert(allocator.Alloc(addr, 1));
+  assert(allocator.GetRegionCount() == 0);
+  assert(allocator.GetFreeSize() == 0);
+}
+
 template <typename T>
 bool HandleFailure(T *) {
   std::cerr << "allocation failure!" << std::endl;
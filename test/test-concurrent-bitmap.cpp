@@ -0,0 +1,210 @@
+#include "scoped-pass.hpp"
+#include <analloc2/bitmap>
+#include <ansa/numeric-info>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using namespace ansa;
+using namespace analloc;
+
+template <typename T>
+void TestAll();
+
+template <typename T>
+void TestStepAllocation();
+
+template <typename T>
+void TestRunAllocation();
+
+template <typename T>
+void TestHintedRuns();
+
+template <typename T>
+void TestThreads(int threadCount);
+
+template <typename T>
+void ThreadWorker(ConcurrentBitmap<T, size_t> * allocator,
+                  std::atomic<int> * owners, int id);
+
+/**
+ * A [ConcurrentBitmap] which lets the calling thread's hint be set.
+ */
+template <typename T>
+class HintedBitmap : public ConcurrentBitmap<T, size_t> {
+public:
+  HintedBitmap(std::atomic<T> * ptr, size_t bc)
+      : ConcurrentBitmap<T, size_t>(ptr, bc) {}
+  
+  void SetHint(size_t unitIndex) {
+    this->ThreadHint() = unitIndex;
+  }
+};
+
+int main() {
+  TestAll<unsigned char>();
+  TestAll<unsigned short>();
+  TestAll<unsigned int>();
+  TestAll<unsigned long>();
+  TestAll<unsigned long long>();
+  return 0;
+}
+
+template <typename T>
+void TestAll() {
+  TestStepAllocation<T>();
+  TestRunAllocation<T>();
+  TestHintedRuns<T>();
+  TestThreads<T>(4);
+}
+
+template <typename T>
+void TestStepAllocation() {
+  ScopedPass pass("ConcurrentBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [step]");
+  const size_t bitCount = 0x100 - 3;
+  std::atomic<T> units[0x100 / (sizeof(T) * 8)];
+  // Bits past the end of the bitmap should be left alone.
+  units[0x100 / (sizeof(T) * 8) - 1] = (T)~(T)0;
+  ConcurrentBitmap<T, size_t> allocator(units, bitCount);
+  T lastUnit = units[0x100 / (sizeof(T) * 8) - 1];
+  assert(lastUnit == (T)((T)7 << (sizeof(T) * 8 - 3)));
+  
+  bool used[bitCount] = {false};
+  size_t addr;
+  for (size_t i = 0; i < bitCount; ++i) {
+    assert(allocator.Alloc(addr, 1));
+    assert(addr < bitCount);
+    assert(!used[addr]);
+    assert(allocator.GetBit(addr));
+    used[addr] = true;
+  }
+  assert(!allocator.Alloc(addr, 1));
+  
+  allocator.Dealloc(0x42, 1);
+  assert(!allocator.GetBit(0x42));
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x42);
+  assert(!allocator.Alloc(addr, 1));
+  allocator.Dealloc(0, bitCount);
+  assert(allocator.Alloc(addr, bitCount));
+  assert(addr == 0);
+}
+
+template <typename T>
+void TestRunAllocation() {
+  ScopedPass pass("ConcurrentBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [runs]");
+  const size_t unitBits = sizeof(T) * 8;
+  std::atomic<T> units[0x200 / unitBits];
+  ConcurrentBitmap<T, size_t> allocator(units, 0x200);
+  size_t addr;
+  
+  // Fill the bitmap, then free a run which crosses a unit boundary.
+  assert(allocator.Alloc(addr, 0x200));
+  allocator.Dealloc(unitBits * 3 - 2, 4);
+  assert(!allocator.Alloc(addr, 5));
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == unitBits * 3 - 2);
+  
+  // Free a unit and a run which spans three units.
+  allocator.Dealloc(unitBits, unitBits);
+  allocator.Dealloc(unitBits * 4 - 1, unitBits * 2 + 2);
+  assert(allocator.Alloc(addr, unitBits + 2));
+  assert(addr == unitBits * 4 - 1);
+  assert(allocator.Alloc(addr, unitBits));
+  assert(addr == unitBits);
+  assert(allocator.Alloc(addr, unitBits));
+  assert(addr == unitBits * 5 + 1);
+  assert(!allocator.Alloc(addr, 1));
+  allocator.Dealloc(unitBits * 5 + 1, unitBits - 2);
+  assert(allocator.Alloc(addr, unitBits - 2));
+  assert(addr == unitBits * 5 + 1);
+}
+
+template <typename T>
+void TestHintedRuns() {
+  ScopedPass pass("ConcurrentBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [hinted runs]");
+  const size_t unitBits = sizeof(T) * 8;
+  std::atomic<T> units[8];
+  HintedBitmap<T> allocator(units, unitBits * 8);
+  size_t addr;
+  
+  // Runs which span units should be searched for starting at the hint, and
+  // the hint should follow them.
+  allocator.SetHint(2);
+  assert(allocator.Alloc(addr, unitBits + 1));
+  assert(addr == unitBits * 2);
+  assert(allocator.Alloc(addr, unitBits * 3));
+  assert(addr == unitBits * 3 + 1);
+  
+  // When the rest of the bitmap is too small, the search wraps around.
+  assert(allocator.Alloc(addr, unitBits * 2));
+  assert(addr == 0);
+  assert(allocator.Alloc(addr, unitBits + 1));
+  assert(addr == unitBits * 6 + 1);
+  assert(!allocator.Alloc(addr, unitBits));
+}
+
+template <typename T>
+void TestThreads(int threadCount) {
+  ScopedPass pass("ConcurrentBitmap<", NumericInfo<T>::name, "> [",
+                  threadCount, " threads]");
+  const size_t bitCount = 0x400;
+  std::atomic<T> units[bitCount / (sizeof(T) * 8)];
+  ConcurrentBitmap<T, size_t> allocator(units, bitCount);
+  std::atomic<int> owners[bitCount];
+  for (size_t i = 0; i < bitCount; ++i) {
+    owners[i] = -1;
+  }
+  
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadCount; ++i) {
+    threads.push_back(std::thread(ThreadWorker<T>, &allocator, owners, i));
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    threads[i].join();
+  }
+  
+  // Every thread freed what it allocated.
+  size_t addr;
+  assert(allocator.Alloc(addr, bitCount));
+  assert(addr == 0);
+}
+
+template <typename T>
+void ThreadWorker(ConcurrentBitmap<T, size_t> * allocator,
+                  std::atomic<int> * owners, int id) {
+  // Allocate runs of various sizes and check that no other thread holds any
+  // of their bits.
+  size_t addresses[0x10];
+  size_t sizes[0x10];
+  uint32_t seed = (uint32_t)id + 1;
+  for (int i = 0; i < 0x800; ++i) {
+    int count = 0;
+    for (int j = 0; j < 0x10; ++j) {
+      seed = seed * 1103515245 + 12345;
+      size_t size = 1 + (seed >> 8) % (j % 4 ? 4 : 0x30);
+      if (!allocator->Alloc(addresses[count], size)) {
+        continue;
+      }
+      sizes[count] = size;
+      for (size_t k = 0; k < size; ++k) {
+        int expected = -1;
+        bool exchanged = owners[addresses[count] + k]
+            .compare_exchange_strong(expected, id);
+        assert(exchanged);
+        (void)exchanged;
+      }
+      ++count;
+    }
+    while (count--) {
+      for (size_t k = 0; k < sizes[count]; ++k) {
+        owners[addresses[count] + k] = -1;
+      }
+      allocator->Dealloc(addresses[count], sizes[count]);
+    }
+  }
+}
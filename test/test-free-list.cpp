@@ -15,6 +15,16 @@ void TestSplitCases();
 void TestOffsetAlign();
 void TestEmptyAlign();
 
+void TestNextFit();
+void TestBestFit();
+void TestWorstFit();
+
+void TestIndex();
+
+void TestTryResize();
+
+void TestCounters();
+
 template <typename T>
 bool HandleFailure(T *);
 
@@ -33,6 +43,20 @@ int main() {
   TestOffsetAlign();
   TestEmptyAlign();
   
+  // Next-fit
+  TestNextFit();
+  TestBestFit();
+  TestWorstFit();
+  
+  // Index
+  TestIndex();
+  
+  // Resize
+  TestTryResize();
+  
+  // Counters
+  TestCounters();
+  
   assert(aligner.GetAllocCount() == 0);
   return 0;
 }
@@ -296,6 +320,319 @@ void TestEmptyAlign() {
   assert(addr == 8);
 }
 
+void TestNextFit() {
+  ScopedPass pass("FreeList::Alloc() [next-fit]");
+  FreeList<uint16_t> allocator(aligner, HandleFailure);
+  uint16_t addr;
+  
+  assert(!allocator.IsNextFit());
+  allocator.SetNextFit(true);
+  assert(allocator.IsNextFit());
+  assert(allocator.LastUsedAddress() == 0);
+  
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x200, 0x10);
+  allocator.Dealloc(0x300, 0x10);
+  assert(allocator.Alloc(addr, 8));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x200);
+  assert(allocator.LastUsedAddress() == 0x200);
+  
+  // Freeing memory before the cursor should not affect the next search.
+  allocator.Dealloc(0x100, 8);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x300);
+  assert(allocator.Alloc(addr, 0xc));
+  assert(addr == 0x304);
+  assert(allocator.GetRegionCount() == 1);
+  
+  // The search should wrap around to the beginning of the list.
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x100);
+  allocator.Dealloc(0x400, 0x20);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x104);
+  assert(allocator.Align(addr, 0x10, 4));
+  assert(addr == 0x400);
+  assert(allocator.Align(addr, 0x10, 4));
+  assert(addr == 0x410);
+  
+  // Carving out the middle of a region should resume after the carved out
+  // memory.
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x414);
+  assert(allocator.Alloc(addr, 0xc));
+  assert(addr == 0x404);
+  assert(!allocator.Alloc(addr, 0x10));
+  
+  allocator.SetNextFit(false);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x108);
+  
+  // Release all of the regions so the aligner's allocation count is zero.
+  while (allocator.Alloc(addr, 1));
+}
+
+void TestBestFit() {
+  ScopedPass pass("FreeList::Alloc() [best-fit]");
+  FreeList<uint16_t> allocator(aligner, HandleFailure);
+  uint16_t addr;
+  
+  allocator.SetFit(FreeListBestFit);
+  assert(allocator.GetFit() == FreeListBestFit);
+  assert(!allocator.IsNextFit());
+  
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x200, 0x4);
+  allocator.Dealloc(0x300, 0x8);
+  allocator.Dealloc(0x400, 0x20);
+  allocator.Dealloc(0x500, 0x8);
+  assert(allocator.GetLargestRegionSize() == 0x20);
+  
+  // The smallest region which fits should be used, and the lowest one when
+  // there is a tie.
+  assert(allocator.Alloc(addr, 5));
+  assert(addr == 0x300);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x200);
+  assert(allocator.Alloc(addr, 3));
+  assert(addr == 0x305);
+  assert(allocator.Alloc(addr, 0x11));
+  assert(addr == 0x400);
+  assert(!allocator.Alloc(addr, 0x11));
+  assert(allocator.GetRegionCount() == 3);
+  
+  // Aligned allocations are judged by the regions which can hold them.
+  allocator.Dealloc(0x608, 0x8);
+  assert(allocator.Align(addr, 0x10, 4));
+  assert(addr == 0x500);
+  assert(allocator.Align(addr, 0x10, 8));
+  assert(addr == 0x100);
+  assert(!allocator.Align(addr, 0x10, 0x10));
+  assert(allocator.GetLargestRegionSize() == 0xf);
+  
+  // Release all of the regions so the aligner's allocation count is zero.
+  while (allocator.Alloc(addr, 1));
+  assert(allocator.GetLargestRegionSize() == 0);
+  
+  // A region which only fits exactly once it is aligned is still bigger than
+  // a smaller region which comes after it.
+  allocator.Dealloc(0x70c, 0x8);
+  allocator.Dealloc(0x800, 0x5);
+  assert(allocator.Align(addr, 0x10, 4));
+  assert(addr == 0x800);
+  while (allocator.Alloc(addr, 1));
+}
+
+void TestWorstFit() {
+  ScopedPass pass("FreeList::Alloc() [worst-fit]");
+  FreeList<uint16_t> allocator(aligner, HandleFailure);
+  uint16_t addr;
+  
+  allocator.SetFit(FreeListWorstFit);
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x200, 0x8);
+  allocator.Dealloc(0x300, 0x10);
+  
+  // The largest region should be used, and the lowest one when there is a
+  // tie.
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x300);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x104);
+  assert(allocator.Align(addr, 8, 4));
+  assert(addr == 0x308);
+  assert(allocator.GetRegionCount() == 4);
+  
+  // Switching back to first-fit should use the lowest region again.
+  allocator.SetNextFit(false);
+  assert(allocator.GetFit() == FreeListFirstFit);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x108);
+  
+  while (allocator.Alloc(addr, 1));
+}
+
+void TestIndex() {
+  ScopedPass pass("FreeList [index]");
+  FreeList<uint32_t> allocator(aligner, HandleFailure);
+  FreeList<uint32_t> reference(aligner, HandleFailure);
+  
+  // Fragment the space so that the index gets several levels.
+  allocator.SetIndexed(true);
+  assert(allocator.IsIndexed());
+  for (uint32_t i = 0; i < 0x1000; ++i) {
+    allocator.Dealloc(i * 4, 2);
+    reference.Dealloc(i * 4, 2);
+  }
+  assert(allocator.GetIndexLevelCount() > 1);
+  
+  // Every operation should have the same result with and without the index.
+  uint32_t addrs[0x100];
+  uint32_t sizes[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    if (i == 0x2000) {
+      // Rebuilding the index should not change anything either.
+      allocator.SetIndexed(false);
+      assert(allocator.GetIndexLevelCount() == 0);
+      assert(aligner.GetAllocCount() == allocator.GetRegionCount() +
+                                        reference.GetRegionCount());
+      allocator.SetIndexed(true);
+    }
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 3 == 0)) {
+      size_t index = (random >> 2) % count;
+      allocator.Dealloc(addrs[index], sizes[index]);
+      reference.Dealloc(addrs[index], sizes[index]);
+      addrs[index] = addrs[--count];
+      sizes[index] = sizes[count];
+    } else if (count && random % 3 == 1) {
+      size_t index = (random >> 2) % count;
+      uint32_t newSize = 1 + (random >> 10) % 4;
+      bool result = allocator.TryResize(addrs[index], sizes[index], newSize);
+      assert(result == reference.TryResize(addrs[index], sizes[index],
+                                           newSize));
+      if (result) {
+        sizes[index] = newSize;
+      }
+    } else {
+      uint32_t size = 1 + (random >> 2) % 4;
+      uint32_t align = 1 << ((random >> 4) % 3);
+      uint32_t addr;
+      bool result = allocator.Align(addrs[count], align, size);
+      assert(result == reference.Align(addr, align, size));
+      if (result) {
+        assert(addr == addrs[count]);
+        sizes[count++] = size;
+      }
+    }
+    assert(allocator.GetRegionCount() == reference.GetRegionCount());
+  }
+  
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+    reference.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(allocator.GetRegionCount() == 0x1000);
+  assert(reference.GetRegionCount() == 0x1000);
+}
+
+void TestTryResize() {
+  ScopedPass pass("FreeList::TryResize()");
+  FreeList<uint16_t, uint8_t> allocator(aligner, HandleFailure);
+  uint16_t addr;
+  
+  // Growing should take the front of the region right after the allocation.
+  allocator.Dealloc(0x10, 0x20);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x10);
+  assert(allocator.TryResize(0x10, 4, 0x10));
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x20);
+  assert(!allocator.TryResize(0x10, 0x10, 0x11));
+  assert(!allocator.TryResize(0x20, 4, 0x11));
+  
+  // Growing by exactly the size of the region should remove it.
+  assert(allocator.TryResize(0x20, 4, 0x10));
+  assert(allocator.GetRegionCount() == 0);
+  assert(!allocator.TryResize(0x20, 0x10, 0x11));
+  
+  // Shrinking should free the tail and join it with its neighbors.
+  assert(allocator.TryResize(0x20, 0x10, 8));
+  assert(allocator.TryResize(0x10, 0x10, 2));
+  assert(allocator.GetRegionCount() == 2);
+  allocator.Dealloc(0x10, 2);
+  allocator.Dealloc(0x20, 8);
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.Alloc(addr, 0x20));
+  assert(addr == 0x10);
+}
+
+void TestCounters() {
+  ScopedPass pass("FreeList [counters]");
+  FreeList<uint32_t> allocator(aligner, HandleFailure);
+  uint32_t addr;
+  
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x200, 0x40);
+  allocator.Dealloc(0x120, 0x20);
+  assert(allocator.GetRegionCount() == 3);
+  assert(allocator.GetFreeSize() == 0x70);
+  assert(allocator.GetLargestRegionBound() == 0x40);
+  
+  // The bound only shrinks once an allocation scans the whole list.
+  assert(allocator.Alloc(addr, 0x40));
+  assert(addr == 0x200);
+  assert(allocator.GetFreeSize() == 0x30);
+  assert(allocator.GetLargestRegionBound() == 0x40);
+  assert(!allocator.Alloc(addr, 0x21));
+  assert(allocator.GetLargestRegionBound() == 0x20);
+  assert(!allocator.Align(addr, 0x100, 0x21));
+  assert(!allocator.Align(addr, 0x1000, 0x10));
+  assert(allocator.GetLargestRegionBound() == 0x20);
+  
+  // Merging regions raises the bound right away.
+  allocator.Dealloc(0x110, 0x10);
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.GetFreeSize() == 0x40);
+  assert(allocator.GetLargestRegionBound() == 0x40);
+  
+  // Every fit policy keeps the counters up to date.
+  FreeListFit fits[] = {FreeListFirstFit, FreeListNextFit, FreeListBestFit,
+                        FreeListWorstFit};
+  for (int i = 0; i < 4; ++i) {
+    allocator.SetFit(fits[i]);
+    uint32_t addrs[0x20];
+    uint32_t sizes[0x20];
+    size_t count = 0;
+    uint32_t seed = 1;
+    uint32_t used = 0;
+    for (int j = 0; j < 0x1000; ++j) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t random = seed >> 8;
+      if (count == 0x20 || (count && random % 2)) {
+        size_t index = (random >> 1) % count;
+        allocator.Dealloc(addrs[index], sizes[index]);
+        used -= sizes[index];
+        addrs[index] = addrs[--count];
+        sizes[index] = sizes[count];
+      } else {
+        uint32_t size = 1 + (random >> 1) % 8;
+        uint32_t align = 1 << ((random >> 4) % 3);
+        if (allocator.Align(addrs[count], align, size)) {
+          sizes[count++] = size;
+          used += size;
+        } else {
+          assert(allocator.GetLargestRegionBound() < size + align - 1);
+        }
+      }
+      assert(allocator.GetFreeSize() == 0x40 - used);
+      assert(allocator.GetLargestRegionBound() >=
+             allocator.GetLargestRegionSize());
+    }
+    while (count) {
+      --count;
+      allocator.Dealloc(addrs[count], sizes[count]);
+    }
+    assert(allocator.GetRegionCount() == 1);
+    assert(allocator.GetFreeSize() == 0x40);
+  }
+  
+  assert(allocator.Alloc(addr, 0x40));
+  assert(allocator.GetRegionCount() == 0);
+  assert(allocator.GetFreeSize() == 0);
+  assert(!allocator.Alloc(addr, 1));
+  assert(allocator.GetLargestRegionBound() == 0);
+}
+
 template <typename T>
 bool HandleFailure(T *) {
   std::cerr << "allocation failure!" << std::endl;
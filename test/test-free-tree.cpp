@@ -1,6 +1,7 @@
 #include "scoped-pass.hpp"
 #include "posix-virtual-aligner.hpp"
 #include <analloc2/free-tree>
+#include <analloc2/free-list>
 
 using namespace analloc;
 
@@ -11,6 +12,8 @@ void TestFullRegion();
 void TestPartialRegion();
 void TestJoins();
 void TestSplits();
+void TestTryResize();
+void TestAlignReference();
 
 template <typename T>
 bool HandleFailure(T *);
@@ -24,6 +27,10 @@ int main() {
   assert(posixAligner.GetAllocCount() == 0);
   TestSplits();
   assert(posixAligner.GetAllocCount() == 0);
+  TestTryResize();
+  assert(posixAligner.GetAllocCount() == 0);
+  TestAlignReference();
+  assert(posixAligner.GetAllocCount() == 0);
   return 0;
 }
 
@@ -176,6 +183,83 @@ void TestSplits() {
   assert(!aligner.Alloc(addr, 1));
 }
 
+void TestTryResize() {
+  ScopedPass pass("FreeTree::TryResize()");
+  AllocatorClass allocator(posixAligner, HandleFailure);
+  uint16_t addr;
+  
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x120, 0x20);
+  assert(allocator.Alloc(addr, 4));
+  assert(addr == 0x100);
+  
+  // Growing should take the front of the region right after the allocation,
+  // and fail if that region is too small or does not exist.
+  assert(allocator.TryResize(0x100, 4, 8));
+  assert(!allocator.TryResize(0x100, 8, 0x11));
+  assert(allocator.TryResize(0x100, 8, 0x10));
+  assert(!allocator.TryResize(0x100, 0x10, 0x11));
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x120);
+  assert(allocator.TryResize(0x120, 0x10, 0x20));
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Shrinking should free the tail.
+  assert(allocator.TryResize(0x120, 0x20, 0x18));
+  assert(allocator.TryResize(0x100, 0x10, 0));
+  assert(allocator.Alloc(addr, 8));
+  assert(addr == 0x138);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x100);
+}
+
+void TestAlignReference() {
+  ScopedPass pass("FreeTree::OffsetAlign() [reference]");
+  FreeTree<AvlTree, uint32_t> allocator(posixAligner, HandleFailure);
+  FreeList<uint32_t> reference(posixAligner, HandleFailure);
+  for (uint32_t i = 0; i < 0x200; ++i) {
+    allocator.Dealloc(i * 0x10, 1 + i % 0xf);
+    reference.Dealloc(i * 0x10, 1 + i % 0xf);
+  }
+  
+  // Aligned allocations should come from the lowest region which fits, just
+  // like they do on a first-fit [FreeList].
+  uint32_t addrs[0x100];
+  uint32_t sizes[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 2)) {
+      size_t index = (random >> 1) % count;
+      allocator.Dealloc(addrs[index], sizes[index]);
+      reference.Dealloc(addrs[index], sizes[index]);
+      addrs[index] = addrs[--count];
+      sizes[index] = sizes[count];
+    } else {
+      uint32_t size = 1 + (random >> 1) % 0x18;
+      uint32_t align = 1 << ((random >> 6) % 6);
+      uint32_t offset = (random >> 9) % 4;
+      uint32_t addr;
+      bool result = allocator.OffsetAlign(addrs[count], align, offset, size);
+      assert(result == reference.OffsetAlign(addr, align, offset, size));
+      if (result) {
+        assert(addr == addrs[count]);
+        assert((addr + offset) % align == 0);
+        sizes[count++] = size;
+      }
+    }
+  }
+  
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+    reference.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(reference.GetRegionCount() == 0x200);
+}
+
 template <typename T>
 bool HandleFailure(T *) {
   std::cerr << "HandleFailure()" << std::endl;
@@ -0,0 +1,357 @@
+#include "scoped-pass.hpp"
+#include "posix-mapped-store.hpp"
+#include <analloc2/bitmap>
+#include <ansa/numeric-info>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+using namespace ansa;
+using namespace analloc;
+
+/**
+ * A store which copies flushed bytes from a "live" buffer to a "disk" buffer,
+ * and which can be told to crash part-way through a flush.
+ *
+ * Before every flush, a random word of the live buffer is written back early,
+ * as the kernel may do with the dirty pages of a mapped file. Flushes may
+ * also be made to fail cleanly, without writing anything.
+ */
+class SimulatedStore : public PersistentStore {
+public:
+  SimulatedStore(uint8_t * _live, uint8_t * _disk, size_t _size,
+                 uint32_t _seed)
+      : live(_live), disk(_disk), size(_size), seed(_seed) {}
+  
+  virtual bool Flush(const void * start, size_t length) {
+    if (crashed) return false;
+    size_t offset = (size_t)((const uint8_t *)start - live);
+    assert(offset + length <= size);
+    if (Random() % 2) {
+      size_t word = (Random() % (size / 8)) * 8;
+      memcpy(disk + word, live + word, 8);
+    }
+    if (!flushesLeft) {
+      // Crash after an arbitrary number of whole words have been written.
+      size_t end = offset + Random() % (length + 1);
+      end -= end % 8;
+      if (end > offset) {
+        memcpy(disk + offset, live + offset, end - offset);
+      }
+      crashed = true;
+      return false;
+    }
+    --flushesLeft;
+    if (failRate && !(Random() % failRate)) {
+      ++failureCount;
+      return false;
+    }
+    memcpy(disk + offset, live + offset, length);
+    return true;
+  }
+  
+  inline void CrashAfter(size_t flushes) {
+    flushesLeft = flushes;
+  }
+  
+  inline void SetFailRate(uint32_t rate) {
+    failRate = rate;
+  }
+  
+  inline bool IsCrashed() {
+    return crashed;
+  }
+  
+  inline size_t GetFailureCount() {
+    return failureCount;
+  }
+  
+  uint32_t Random() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  }
+  
+private:
+  uint8_t * live;
+  uint8_t * disk;
+  size_t size;
+  uint32_t seed;
+  size_t flushesLeft = ~(size_t)0;
+  uint32_t failRate = 0;
+  size_t failureCount = 0;
+  bool crashed = false;
+};
+
+template <typename T>
+void TestAll();
+
+template <typename T>
+void TestMappedFile();
+
+template <typename T>
+void TestLogWraps();
+
+template <typename T>
+void TestCrashes(size_t bitCount, bool nextFit, uint32_t failRate);
+
+int main() {
+  TestAll<unsigned char>();
+  TestAll<unsigned short>();
+  TestAll<unsigned int>();
+  TestAll<unsigned long>();
+  TestAll<unsigned long long>();
+  return 0;
+}
+
+template <typename T>
+void TestAll() {
+  TestMappedFile<T>();
+  TestLogWraps<T>();
+  TestCrashes<T>(0x200, false, 0);
+  TestCrashes<T>(0x200 - 3, true, 0);
+  TestCrashes<T>(0x200, false, 8);
+}
+
+template <typename T>
+void TestMappedFile() {
+  ScopedPass pass("PersistentBitmap<", NumericInfo<T>::name,
+                  "> [mapped file]");
+  typedef PersistentBitmap<T, size_t> Allocator;
+  const char * path = "test-persistent-bitmap.bin";
+  const size_t bitCount = 0x1000;
+  const size_t size = Allocator::RegionSize(bitCount, 0x10);
+  remove(path);
+  
+  size_t addr;
+  {
+    PosixMappedStore store(path, size);
+    assert(!Allocator::IsFormatted(store.GetRegion(), bitCount, 0x10));
+    assert(Allocator::Format(store.GetRegion(), bitCount, 0x10, store));
+    assert(Allocator::IsFormatted(store.GetRegion(), bitCount, 0x10));
+    assert(!Allocator::IsFormatted(store.GetRegion(), bitCount, 0x11));
+    assert(!Allocator::IsFormatted(store.GetRegion(), bitCount - 1, 0x10));
+    
+    Allocator allocator(store.GetRegion(), bitCount, 0x10, store);
+    assert(allocator.Alloc(addr, 0x800));
+    assert(addr == 0);
+    assert(allocator.Align(addr, 0x100, 0x10));
+    assert(addr == 0x800);
+    allocator.Dealloc(0x100, 0x100);
+    assert(allocator.GetLogCount() == 3);
+    
+    // Every change flushes one record, and a sync flushes every dirty unit
+    // at once and then the header.
+    size_t flushCount = store.GetFlushCount();
+    for (size_t i = 0; i < 8; ++i) {
+      assert(allocator.Alloc(addr, 0x20));
+      assert(addr == 0x100 + i * 0x20);
+    }
+    assert(store.GetFlushCount() == flushCount + 8);
+    assert(allocator.Sync());
+    assert(store.GetFlushCount() == flushCount + 10);
+    assert(allocator.GetLogCount() == 0);
+    assert(allocator.Sync());
+    assert(store.GetFlushCount() == flushCount + 10);
+    
+    // Leave some records in the log for the next mapping to replay.
+    allocator.Dealloc(0x100, 0x40);
+    assert(allocator.Alloc(addr, 0x10));
+    assert(addr == 0x100);
+  }
+  {
+    PosixMappedStore store(path, size);
+    assert(Allocator::IsFormatted(store.GetRegion(), bitCount, 0x10));
+    Allocator allocator(store.GetRegion(), bitCount, 0x10, store);
+    assert(allocator.GetLogCount() == 0);
+    assert(allocator.GetBit(0x10f));
+    assert(!allocator.GetBit(0x110));
+    assert(allocator.Alloc(addr, 0x30));
+    assert(addr == 0x110);
+    assert(allocator.Alloc(addr, 0x7f0));
+    assert(addr == 0x810);
+    assert(!allocator.Alloc(addr, 1));
+  }
+  remove(path);
+}
+
+template <typename T>
+void TestLogWraps() {
+  ScopedPass pass("PersistentBitmap<", NumericInfo<T>::name,
+                  "> [log wraps]");
+  typedef PersistentBitmap<T, size_t> Allocator;
+  const size_t bitCount = 0x100;
+  uint64_t live[0x40];
+  uint64_t disk[0x40];
+  size_t size = Allocator::RegionSize(bitCount, 4);
+  assert(size <= sizeof(live));
+  SimulatedStore store((uint8_t *)live, (uint8_t *)disk, size, 1);
+  assert(Allocator::Format(live, bitCount, 4, store));
+  
+  // The log is synced automatically before a fifth record is written.
+  Allocator allocator(live, bitCount, 4, store);
+  size_t addr;
+  for (size_t i = 0; i < 0x20; ++i) {
+    assert(allocator.Alloc(addr, 8));
+    assert(addr == i * 8);
+    assert(allocator.GetLogCount() == i % 4 + 1);
+  }
+  assert(!allocator.Alloc(addr, 1));
+  for (size_t i = 0; i < 0x20; i += 2) {
+    allocator.Dealloc(i * 8, 8);
+  }
+  
+  // The disk holds everything after the last sync, plus the log.
+  memcpy(live, disk, size);
+  Allocator reopened(live, bitCount, 4, store);
+  for (size_t i = 0; i < bitCount; ++i) {
+    assert(reopened.GetBit(i) == (i / 8) % 2);
+  }
+}
+
+template <typename T>
+void TestCrashes(size_t bitCount, bool nextFit, uint32_t failRate) {
+  ScopedPass pass("PersistentBitmap<", NumericInfo<T>::name, "> [crashes, ",
+                  bitCount, nextFit ? ", next-fit" : "",
+                  failRate ? ", failures]" : "]");
+  typedef PersistentBitmap<T, size_t> Allocator;
+  const size_t logCapacity = 8;
+  uint64_t live[0x80];
+  uint64_t disk[0x80];
+  size_t size = Allocator::RegionSize(bitCount, logCapacity);
+  assert(size <= sizeof(live));
+  
+  struct Allocation {
+    size_t address;
+    size_t size;
+  };
+  
+  for (uint32_t trial = 0; trial < 0x200; ++trial) {
+    SimulatedStore store((uint8_t *)live, (uint8_t *)disk, size, trial + 1);
+    assert(Allocator::Format(live, bitCount, logCapacity, store));
+    store.CrashAfter(store.Random() % 0x100);
+    store.SetFailRate(failRate);
+    
+    bool used[0x200] = {false};
+    // Bits whose free was never logged, which may be in either state until
+    // the next successful sync.
+    bool unsynced[0x200] = {false};
+    Allocation allocations[0x40];
+    size_t count = 0;
+    // The operation which was running when the crash happened
+    bool inFlightAlloc = false;
+    Allocation inFlightFree = {0, 0};
+    size_t inFlightSize = 0;
+    
+    {
+      Allocator allocator(live, bitCount, logCapacity, store);
+      allocator.SetNextFit(nextFit);
+      while (!store.IsCrashed()) {
+        uint32_t random = store.Random();
+        size_t failureCount = store.GetFailureCount();
+        if (random % 8 == 0) {
+          if (allocator.Sync()) {
+            memset(unsynced, 0, sizeof(unsynced));
+          }
+        } else if (count == 0x40 || (count && random % 8 < 4)) {
+          size_t index = (random >> 3) % count;
+          Allocation allocation = allocations[index];
+          allocations[index] = allocations[--count];
+          allocator.Dealloc(allocation.address, allocation.size);
+          if (store.IsCrashed()) {
+            inFlightFree = allocation;
+            break;
+          }
+          for (size_t i = 0; i < allocation.size; ++i) {
+            used[allocation.address + i] = false;
+            if (store.GetFailureCount() != failureCount) {
+              unsynced[allocation.address + i] = true;
+            }
+          }
+        } else if (count && random % 8 == 4) {
+          Allocation & allocation = allocations[(random >> 3) % count];
+          size_t extra = 1 + (random >> 8) % 8;
+          bool result = allocator.TryResize(allocation.address,
+                                            allocation.size,
+                                            allocation.size + extra);
+          if (store.IsCrashed()) {
+            inFlightAlloc = true;
+            inFlightSize = extra;
+            break;
+          } else if (!result) {
+            continue;
+          }
+          for (size_t i = allocation.size; i < allocation.size + extra; ++i) {
+            assert(!used[allocation.address + i]);
+            used[allocation.address + i] = true;
+            unsynced[allocation.address + i] = false;
+          }
+          allocation.size += extra;
+        } else {
+          size_t allocSize = 1 + (random >> 3) % 0x20;
+          size_t align = (size_t)1 << ((random >> 8) % 5);
+          size_t addr;
+          bool result = allocator.OffsetAlign(addr, align, 0, allocSize);
+          if (store.IsCrashed()) {
+            inFlightAlloc = true;
+            inFlightSize = allocSize;
+            break;
+          } else if (!result) {
+            continue;
+          }
+          for (size_t i = 0; i < allocSize; ++i) {
+            assert(!used[addr + i]);
+            used[addr + i] = true;
+            unsynced[addr + i] = false;
+          }
+          allocations[count].address = addr;
+          allocations[count].size = allocSize;
+          ++count;
+        }
+      }
+    }
+    
+    // Reopen the bitmap from whatever reached the disk.
+    memcpy(live, disk, size);
+    assert(Allocator::IsFormatted(live, bitCount, logCapacity));
+    SimulatedStore recoveryStore((uint8_t *)live, (uint8_t *)disk, size, 1);
+    Allocator recovered(live, bitCount, logCapacity, recoveryStore);
+    
+    // Apart from unlogged frees, only the in-flight operation may be
+    // missing, and only in full.
+    size_t firstDiff = bitCount;
+    size_t lastDiff = 0;
+    size_t diffCount = 0;
+    for (size_t i = 0; i < bitCount; ++i) {
+      if (!unsynced[i] && recovered.GetBit(i) != used[i]) {
+        if (!diffCount) firstDiff = i;
+        lastDiff = i;
+        ++diffCount;
+      }
+    }
+    if (diffCount) {
+      if (inFlightAlloc) {
+        assert(lastDiff - firstDiff < inFlightSize);
+        for (size_t i = firstDiff; i <= lastDiff; ++i) {
+          assert(recovered.GetBit(i) && (unsynced[i] || !used[i]));
+        }
+      } else {
+        assert(firstDiff >= inFlightFree.address);
+        assert(lastDiff < inFlightFree.address + inFlightFree.size);
+        for (size_t i = firstDiff; i <= lastDiff; ++i) {
+          assert(!recovered.GetBit(i));
+        }
+      }
+    }
+    
+    // The recovered bitmap hands out exactly the free bits.
+    size_t freeCount = 0;
+    for (size_t i = 0; i < bitCount; ++i) {
+      if (!recovered.GetBit(i)) ++freeCount;
+    }
+    size_t addr;
+    for (size_t i = 0; i < freeCount; ++i) {
+      assert(recovered.Alloc(addr, 1));
+    }
+    assert(!recovered.Alloc(addr, 1));
+  }
+}
@@ -14,6 +14,9 @@ void TestSetBit();
 template <typename T>
 void TestSetBits();
 
+template <typename T>
+void TestRanges();
+
 int main() {
   TestSetBit<unsigned char>();
   TestSetBit<unsigned short>();
@@ -26,6 +29,12 @@ int main() {
   TestSetBits<unsigned int>();
   TestSetBits<unsigned long>();
   TestSetBits<unsigned long long>();
+  
+  TestRanges<unsigned char>();
+  TestRanges<unsigned short>();
+  TestRanges<unsigned int>();
+  TestRanges<unsigned long>();
+  TestRanges<unsigned long long>();
   return 0;
 }
 
@@ -85,3 +94,52 @@ void TestSetBits() {
     }
   }
 }
+
+template <typename T>
+void TestRanges() {
+  ScopedPass pass("RawBitmap<", NumericInfo<T>::name, ">::[Set/Clear]Range()");
+  
+  // Use a bit count which ends in the middle of a unit and make sure the bits
+  // after it are never touched.
+  T units[4];
+  size_t bitCount = sizeof(T) * 8 * 3 + 3;
+  RawBitmap<T> bm(units, bitCount);
+  for (size_t idx = 0; idx < bitCount; ++idx) {
+    for (size_t len = 0; len <= bitCount - idx; ++len) {
+      ansa::Bzero((void *)units, sizeof(units));
+      units[3] = (T)~(T)7;
+      bm.SetRange(idx, len);
+      assert(units[3] >> 3 == (T)~(T)7 >> 3);
+      for (size_t i = 0; i < bitCount; ++i) {
+        assert(bm.GetBit(i) == (i >= idx && i < idx + len));
+      }
+      
+      // Look for set bits before, at, and inside the range
+      size_t result;
+      assert(bm.IsRangeClear(0, idx));
+      if (len) {
+        assert(!bm.IsRangeClear(0, idx + 1));
+        assert(bm.FindFirstSet(0, bitCount, result));
+        assert(result == idx);
+        assert(bm.FindFirstSet(idx + len - 1, 1, result));
+        assert(result == idx + len - 1);
+      } else {
+        assert(!bm.FindFirstSet(0, bitCount, result));
+      }
+      assert(bm.IsRangeClear(idx + len, bitCount - (idx + len)));
+      
+      // Clear the range from a completely set bitmap
+      bm.SetRange(0, bitCount);
+      bm.ClearRange(idx, len);
+      assert(units[3] >> 3 == (T)~(T)7 >> 3);
+      for (size_t i = 0; i < bitCount; ++i) {
+        assert(bm.GetBit(i) == (i < idx || i >= idx + len));
+      }
+      assert(bm.IsRangeClear(idx, len));
+      if (idx + len < bitCount) {
+        assert(bm.FindFirstSet(idx, bitCount - idx, result));
+        assert(result == idx + len);
+      }
+    }
+  }
+}
@@ -0,0 +1,253 @@
+#include "scoped-pass.hpp"
+#include <analloc2/bitmap>
+#include <ansa/numeric-info>
+#include <cstdint>
+
+using namespace ansa;
+using namespace analloc;
+
+template <typename T>
+void TestAll();
+
+template <typename T>
+void TestLongestRun();
+
+template <typename T>
+void TestBestFit();
+
+template <typename T>
+void TestMatchesBitmap(size_t bitCount, bool nextFit);
+
+template <typename T>
+void TestRandomBestFit(size_t bitCount);
+
+void TestSmallSizeType();
+
+int main() {
+  TestAll<unsigned char>();
+  TestAll<unsigned short>();
+  TestAll<unsigned int>();
+  TestAll<unsigned long>();
+  TestAll<unsigned long long>();
+  TestSmallSizeType();
+  return 0;
+}
+
+template <typename T>
+void TestAll() {
+  TestLongestRun<T>();
+  TestBestFit<T>();
+  TestMatchesBitmap<T>(0x1000, false);
+  TestMatchesBitmap<T>(0x1000 - 3, false);
+  TestMatchesBitmap<T>(0x1000 - 3, true);
+  TestRandomBestFit<T>(0x800);
+  TestRandomBestFit<T>(0x800 - 5);
+}
+
+template <typename T>
+void TestLongestRun() {
+  ScopedPass pass("RunTreeBitmap<", NumericInfo<T>::name,
+                  ">::LongestFreeRun()");
+  typedef RunTreeBitmap<T, size_t> Allocator;
+  const size_t unitBits = sizeof(T) * 8;
+  T units[0x400 / (sizeof(T) * 8)];
+  typename Allocator::Node tree[Allocator::TreeNodeCount(0x400 - 1)];
+  Allocator allocator(units, 0x400 - 1, tree);
+  assert(allocator.LongestFreeRun() == 0x400 - 1);
+  
+  size_t addr;
+  assert(allocator.Alloc(addr, 0x400 - 1));
+  assert(allocator.LongestFreeRun() == 0);
+  
+  // Runs which cross unit boundaries should be joined together.
+  allocator.Dealloc(unitBits - 3, unitBits + 6);
+  assert(allocator.LongestFreeRun() == unitBits + 6);
+  allocator.Dealloc(0x200, 0x80);
+  assert(allocator.LongestFreeRun() == 0x80);
+  allocator.Dealloc(0x3f8, 7);
+  allocator.Dealloc(0x280, 0x10);
+  assert(allocator.LongestFreeRun() == 0x90);
+  assert(allocator.Alloc(addr, 0x90));
+  assert(addr == 0x200);
+  assert(allocator.LongestFreeRun() == unitBits + 6);
+}
+
+template <typename T>
+void TestBestFit() {
+  ScopedPass pass("RunTreeBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [best-fit]");
+  typedef RunTreeBitmap<T, size_t> Allocator;
+  T units[0x400 / (sizeof(T) * 8)];
+  typename Allocator::Node tree[Allocator::TreeNodeCount(0x400)];
+  Allocator allocator(units, 0x400, tree);
+  assert(!allocator.IsBestFit());
+  allocator.SetBestFit(true);
+  assert(allocator.IsBestFit());
+  
+  size_t addr;
+  assert(allocator.Alloc(addr, 0x400));
+  allocator.Dealloc(0x10, 0x40);
+  allocator.Dealloc(0x100, 0x8);
+  allocator.Dealloc(0x180, 0x6);
+  allocator.Dealloc(0x300, 0x100);
+  
+  // The smallest run which fits should be used, even if it comes last.
+  assert(allocator.Alloc(addr, 5));
+  assert(addr == 0x180);
+  assert(allocator.Alloc(addr, 5));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x185);
+  assert(allocator.Alloc(addr, 0x41));
+  assert(addr == 0x300);
+  assert(allocator.Alloc(addr, 0x20));
+  assert(addr == 0x10);
+  
+  // Aligned allocations should use the smallest run with a fitting aligned
+  // index.
+  allocator.Dealloc(0x10, 0x20);
+  assert(allocator.Align(addr, 0x20, 0x10));
+  assert(addr == 0x20);
+  assert(allocator.Align(addr, 0x40, 0x40));
+  assert(addr == 0x380);
+  assert(!allocator.Align(addr, 0x100, 1));
+}
+
+template <typename T>
+void TestMatchesBitmap(size_t bitCount, bool nextFit) {
+  ScopedPass pass("RunTreeBitmap<", NumericInfo<T>::name, "> [random, ",
+                  bitCount, nextFit ? ", next-fit]" : "]");
+  const size_t unitCount = 0x1000 / (sizeof(T) * 8);
+  T units[unitCount];
+  T referenceUnits[unitCount];
+  typedef RunTreeBitmap<T, size_t> Allocator;
+  typename Allocator::Node tree[Allocator::TreeNodeCount(0x1000)];
+  Allocator allocator(units, bitCount, tree);
+  Bitmap<T, size_t> reference(referenceUnits, bitCount);
+  allocator.SetNextFit(nextFit);
+  reference.SetNextFit(nextFit);
+  
+  struct Allocation {
+    size_t address;
+    size_t size;
+  };
+  Allocation allocations[0x100];
+  size_t count = 0;
+  
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 3 == 0)) {
+      size_t index = (random >> 2) % count;
+      allocator.Dealloc(allocations[index].address, allocations[index].size);
+      reference.Dealloc(allocations[index].address, allocations[index].size);
+      allocations[index] = allocations[--count];
+      continue;
+    }
+    size_t size = 1 + (random >> 2) % (random % 4 ? 0x20 : 0x100);
+    size_t addr, refAddr;
+    bool result;
+    if (random % 3 == 1) {
+      result = allocator.Alloc(addr, size);
+      assert(result == reference.Alloc(refAddr, size));
+    } else {
+      size_t align = (size_t)1 << ((random >> 10) % 8);
+      size_t offset = (random >> 13) % 3;
+      result = allocator.OffsetAlign(addr, align, offset, size);
+      assert(result == reference.OffsetAlign(refAddr, align, offset, size));
+    }
+    if (result) {
+      assert(addr == refAddr);
+      allocations[count].address = addr;
+      allocations[count].size = size;
+      ++count;
+    }
+  }
+  while (count) {
+    --count;
+    allocator.Dealloc(allocations[count].address, allocations[count].size);
+  }
+  size_t addr;
+  assert(allocator.LongestFreeRun() == bitCount);
+  assert(allocator.Alloc(addr, bitCount));
+  assert(addr == 0);
+}
+
+template <typename T>
+void TestRandomBestFit(size_t bitCount) {
+  ScopedPass pass("RunTreeBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [random best-fit, ", bitCount, "]");
+  T units[0x800 / (sizeof(T) * 8)];
+  typedef RunTreeBitmap<T, size_t> Allocator;
+  typename Allocator::Node tree[Allocator::TreeNodeCount(0x800)];
+  Allocator allocator(units, bitCount, tree);
+  allocator.SetBestFit(true);
+  bool used[0x800] = {false};
+  
+  // Compare every allocation to the smallest run that a linear search finds.
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    size_t size = 1 + (random >> 4) % (random % 4 ? 0x10 : 0x90);
+    if (random % 5 < 2) {
+      size_t start = (random >> 12) % (bitCount - size + 1);
+      for (size_t j = start; j < start + size; ++j) {
+        used[j] = false;
+      }
+      allocator.Dealloc(start, size);
+      continue;
+    }
+    size_t expected = bitCount;
+    size_t expectedLength = 0;
+    size_t runLength = 0;
+    for (size_t j = 0; j <= bitCount; ++j) {
+      if (j < bitCount && !used[j]) {
+        ++runLength;
+        continue;
+      }
+      if (runLength >= size &&
+          (expected == bitCount || runLength < expectedLength)) {
+        expected = j - runLength;
+        expectedLength = runLength;
+      }
+      runLength = 0;
+    }
+    size_t addr;
+    if (expected == bitCount) {
+      assert(!allocator.Alloc(addr, size));
+      continue;
+    }
+    assert(allocator.Alloc(addr, size));
+    assert(addr == expected);
+    for (size_t j = addr; j < addr + size; ++j) {
+      used[j] = true;
+    }
+  }
+}
+
+void TestSmallSizeType() {
+  ScopedPass pass("RunTreeBitmap<unsigned char, uint8_t>::Alloc()");
+  typedef RunTreeBitmap<unsigned char, uint8_t> Allocator;
+  
+  // The root of the tree spans more bits than [uint8_t] can count.
+  unsigned char units[0x20];
+  Allocator::Node tree[Allocator::TreeNodeCount(0xff)];
+  Allocator allocator(units, 0xff, tree);
+  assert(allocator.LongestFreeRun() == 0xff);
+  
+  uint8_t addr;
+  assert(allocator.Alloc(addr, 0xff));
+  assert(addr == 0);
+  assert(!allocator.Alloc(addr, 1));
+  allocator.Dealloc(0x80, 0x7f);
+  assert(allocator.LongestFreeRun() == 0x7f);
+  assert(!allocator.Alloc(addr, 0x80));
+  assert(allocator.Align(addr, 0x40, 0x40));
+  assert(addr == 0x80);
+  assert(!allocator.Align(addr, 0x40, 0x40));
+  assert(allocator.Align(addr, 0x40, 0x3f));
+  assert(addr == 0xc0);
+  assert(!allocator.Alloc(addr, 1));
+}
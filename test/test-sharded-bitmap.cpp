@@ -0,0 +1,218 @@
+#include "scoped-pass.hpp"
+#include <analloc2/bitmap>
+#include <ansa/numeric-info>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using namespace ansa;
+using namespace analloc;
+
+template <typename T>
+void TestAll();
+
+template <typename T>
+void TestLayout();
+
+template <typename T>
+void TestStealing();
+
+template <typename T>
+void TestOwnership();
+
+template <typename T>
+void TestThreads(int threadCount);
+
+template <typename T>
+void ThreadWorker(ShardedBitmap<T, size_t> * allocator,
+                  std::atomic<int> * owners, int id);
+
+int main() {
+  TestAll<unsigned char>();
+  TestAll<unsigned short>();
+  TestAll<unsigned int>();
+  TestAll<unsigned long>();
+  TestAll<unsigned long long>();
+  return 0;
+}
+
+template <typename T>
+void TestAll() {
+  TestLayout<T>();
+  TestStealing<T>();
+  TestOwnership<T>();
+  TestThreads<T>(4);
+}
+
+template <typename T>
+void TestLayout() {
+  ScopedPass pass("ShardedBitmap<", NumericInfo<T>::name, "> [layout]");
+  typedef ShardedBitmap<T, size_t> Allocator;
+  const size_t unitBits = sizeof(T) * 8;
+  const size_t bitCount = unitBits * 10 - 3;
+  T units[10];
+  typename Allocator::Shard shards[4];
+  Allocator allocator(units, bitCount, shards, 4);
+  assert(allocator.GetShardCount() == 4);
+  
+  // Ten units split four ways gives shards of 2, 3, 2 and 3 units, and the
+  // last shard loses the padding bits.
+  const size_t starts[4] = {0, 2, 5, 7};
+  for (size_t i = 0; i < 4; ++i) {
+    size_t end = i == 3 ? bitCount : starts[i + 1] * unitBits;
+    assert(allocator.GetShardStart(i) == starts[i] * unitBits);
+    assert(allocator.GetShardBitCount(i) == end - starts[i] * unitBits);
+    assert(allocator.GetShardUsed(i) == 0);
+    for (size_t j = starts[i] * unitBits; j < end; ++j) {
+      assert(allocator.ShardOf(j) == i);
+    }
+  }
+  
+  // As many shards as units gives one unit per shard.
+  typename Allocator::Shard moreShards[10];
+  Allocator unitShards(units, bitCount, moreShards, 10);
+  for (size_t i = 0; i < bitCount; ++i) {
+    assert(unitShards.ShardOf(i) == i / unitBits);
+  }
+}
+
+template <typename T>
+void TestStealing() {
+  ScopedPass pass("ShardedBitmap<", NumericInfo<T>::name,
+                  ">::AllocLocal() [stealing]");
+  typedef ShardedBitmap<T, size_t> Allocator;
+  const size_t shardBits = sizeof(T) * 8 * 2;
+  T units[8];
+  typename Allocator::Shard shards[4];
+  Allocator allocator(units, shardBits * 4, shards, 4);
+  
+  // Fill shard 2 from its own home, then keep going and steal from shard 3,
+  // then wrap around to shard 0.
+  size_t addr;
+  for (size_t i = 0; i < shardBits * 2 + 1; ++i) {
+    assert(allocator.AllocLocal(2, addr, 1));
+    assert(addr == shardBits * 2 + i || i >= shardBits * 2);
+  }
+  assert(addr == 0);
+  assert(allocator.GetShardUsed(0) == 1);
+  assert(allocator.GetShardUsed(1) == 0);
+  assert(allocator.GetShardUsed(2) == shardBits);
+  assert(allocator.GetShardUsed(3) == shardBits);
+  
+  // A run which fits in no shard fails, even if there are enough free bits
+  // in total.
+  assert(!allocator.AllocLocal(1, addr, shardBits + 1));
+  assert(allocator.AllocLocal(3, addr, shardBits));
+  assert(addr == shardBits);
+  assert(allocator.GetShardUsed(1) == shardBits);
+  assert(!allocator.AllocLocal(0, addr, shardBits));
+  assert(allocator.AllocLocal(0, addr, shardBits - 1));
+  assert(addr == 1);
+  assert(!allocator.AllocLocal(2, addr, 1));
+  
+  assert(allocator.AllocLocal(1, addr, 0));
+  assert(addr == 0);
+}
+
+template <typename T>
+void TestOwnership() {
+  ScopedPass pass("ShardedBitmap<", NumericInfo<T>::name,
+                  ">::Dealloc() [ownership]");
+  typedef ShardedBitmap<T, size_t> Allocator;
+  const size_t shardBits = sizeof(T) * 8 * 2;
+  T units[6];
+  typename Allocator::Shard shards[3];
+  Allocator allocator(units, shardBits * 3, shards, 3);
+  
+  size_t addr;
+  assert(allocator.AllocLocal(0, addr, shardBits));
+  assert(allocator.AllocLocal(0, addr, shardBits));
+  assert(addr == shardBits);
+  assert(allocator.AllocLocal(0, addr, 3));
+  assert(addr == shardBits * 2);
+  
+  // Bits freed from shard 0 go back to shard 1 when shard 1 owns them.
+  allocator.Dealloc(shardBits + 4, 2);
+  assert(allocator.GetShardUsed(0) == shardBits);
+  assert(allocator.GetShardUsed(1) == shardBits - 2);
+  assert(allocator.GetShardUsed(2) == 3);
+  assert(allocator.AllocLocal(0, addr, 2));
+  assert(addr == shardBits + 4);
+  assert(allocator.GetShardUsed(1) == shardBits);
+  
+  allocator.Dealloc(0, shardBits);
+  allocator.Dealloc(shardBits, shardBits);
+  allocator.Dealloc(shardBits * 2, 3);
+  for (size_t i = 0; i < 3; ++i) {
+    assert(allocator.GetShardUsed(i) == 0);
+    assert(allocator.AllocLocal(i, addr, shardBits));
+    assert(addr == shardBits * i);
+  }
+}
+
+template <typename T>
+void TestThreads(int threadCount) {
+  ScopedPass pass("ShardedBitmap<", NumericInfo<T>::name, "> [",
+                  threadCount, " threads]");
+  typedef ShardedBitmap<T, size_t> Allocator;
+  const size_t bitCount = 0x400;
+  T units[bitCount / (sizeof(T) * 8)];
+  typename Allocator::Shard shards[4];
+  Allocator allocator(units, bitCount, shards, 4);
+  std::atomic<int> owners[bitCount];
+  for (size_t i = 0; i < bitCount; ++i) {
+    owners[i] = -1;
+  }
+  
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadCount; ++i) {
+    threads.push_back(std::thread(ThreadWorker<T>, &allocator, owners, i));
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    threads[i].join();
+  }
+  
+  // Every thread freed what it allocated, so every shard is empty again.
+  size_t addr;
+  for (size_t i = 0; i < 4; ++i) {
+    assert(allocator.GetShardUsed(i) == 0);
+    assert(allocator.AllocLocal(i, addr, bitCount / 4));
+    assert(addr == i * (bitCount / 4));
+  }
+}
+
+template <typename T>
+void ThreadWorker(ShardedBitmap<T, size_t> * allocator,
+                  std::atomic<int> * owners, int id) {
+  // Allocate enough to overflow the home shard, so that threads steal from
+  // each other, and check that no other thread holds any of the bits.
+  size_t addresses[0x20];
+  size_t sizes[0x20];
+  uint32_t seed = (uint32_t)id + 1;
+  for (int i = 0; i < 0x400; ++i) {
+    int count = 0;
+    for (int j = 0; j < 0x20; ++j) {
+      seed = seed * 1103515245 + 12345;
+      size_t size = 1 + (seed >> 8) % (j % 4 ? 4 : 0x30);
+      if (!allocator->Alloc(addresses[count], size)) {
+        continue;
+      }
+      sizes[count] = size;
+      for (size_t k = 0; k < size; ++k) {
+        int expected = -1;
+        bool exchanged = owners[addresses[count] + k]
+            .compare_exchange_strong(expected, id);
+        assert(exchanged);
+        (void)exchanged;
+      }
+      ++count;
+    }
+    while (count--) {
+      for (size_t k = 0; k < sizes[count]; ++k) {
+        owners[addresses[count] + k] = -1;
+      }
+      allocator->Dealloc(addresses[count], sizes[count]);
+    }
+  }
+}
@@ -0,0 +1,336 @@
+#include "scoped-pass.hpp"
+#include "posix-virtual-aligner.hpp"
+#include <analloc2/bitmap>
+#include <analloc2/wrappers>
+#include <iostream>
+#include <cassert>
+#include <cstdint>
+
+using namespace analloc;
+
+typedef SparseBitmap<uint64_t> HugeBitmap;
+typedef SparseBitmap<size_t> SmallBitmap;
+
+/**
+ * An allocator which forwards to a [PosixVirtualAligner] until it is told to
+ * start failing.
+ */
+class FailingAllocator : public Allocator<uintptr_t, size_t> {
+public:
+  FailingAllocator(PosixVirtualAligner & anAligner) : aligner(anAligner) {}
+  
+  virtual bool Alloc(uintptr_t & out, size_t size) {
+    if (failing) return false;
+    return aligner.Alloc(out, size);
+  }
+  
+  virtual void Dealloc(uintptr_t address, size_t size) {
+    aligner.Dealloc(address, size);
+  }
+  
+  bool failing = false;
+  
+private:
+  PosixVirtualAligner & aligner;
+};
+
+void TestHugeSpace();
+void TestContainerTypes();
+void TestRandom(size_t bitCount, bool fragmented);
+void TestFailures();
+void TestTransformer();
+
+template <typename T>
+bool HandleFailure(T *);
+
+template <typename T>
+bool GiveUp(T *);
+
+template <typename T>
+bool StopFailing(T *);
+
+PosixVirtualAligner aligner;
+FailingAllocator failingAllocator(aligner);
+int failureCount = 0;
+
+int main() {
+  TestHugeSpace();
+  TestContainerTypes();
+  TestRandom(0x40000, false);
+  TestRandom(0x40000 - 5, false);
+  TestRandom(0x40000, true);
+  TestFailures();
+  TestTransformer();
+  
+  assert(aligner.GetAllocCount() == 0);
+  return 0;
+}
+
+void TestHugeSpace() {
+  ScopedPass pass("SparseBitmap [huge space]");
+  const uint64_t bitCount = (uint64_t)1 << 40;
+  HugeBitmap allocator(bitCount, aligner, HandleFailure<HugeBitmap>);
+  assert(allocator.GetBitCount() == bitCount);
+  assert(allocator.GetContainerCount() == 0);
+  assert(allocator.GetMemoryUsage() == 0);
+  
+  uint64_t addr;
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0);
+  assert(allocator.Alloc(addr, 0x30000));
+  assert(addr == 1);
+  assert(allocator.Align(addr, (uint64_t)1 << 39, 5));
+  assert(addr == (uint64_t)1 << 39);
+  assert(allocator.OffsetAlign(addr, (uint64_t)1 << 39, 3, 2));
+  assert(addr == ((uint64_t)1 << 39) - 3);
+  assert(!allocator.Align(addr, (uint64_t)1 << 39, 1));
+  
+  // Three full containers, one bit, and the far-away allocations on either
+  // side of a container boundary.
+  assert(allocator.GetContainerCount() == 6);
+  assert(allocator.GetContainerType(0) == HugeBitmap::FullContainer);
+  assert(allocator.GetContainerType(2) == HugeBitmap::FullContainer);
+  assert(allocator.GetContainerType(3) == HugeBitmap::ArrayContainer);
+  assert(allocator.GetMemoryUsage() < 0x400);
+  assert(allocator.GetBit(0x30000));
+  assert(!allocator.GetBit(0x30001));
+  assert(allocator.GetBit(((uint64_t)1 << 39) - 2));
+  assert(!allocator.GetBit(((uint64_t)1 << 39) - 1));
+  
+  // Freeing across containers leaves a run at either edge.
+  allocator.Dealloc(0x8000, 0x20000);
+  assert(allocator.GetContainerCount() == 5);
+  assert(allocator.GetContainerType(0) == HugeBitmap::RunContainer);
+  assert(allocator.GetContainerType(1) == HugeBitmap::RunContainer);
+  assert(allocator.Alloc(addr, 0x20000));
+  assert(addr == 0x8000);
+  assert(allocator.GetContainerType(0) == HugeBitmap::FullContainer);
+  assert(allocator.GetContainerType(1) == HugeBitmap::FullContainer);
+  
+  allocator.Dealloc(0, 0x30001);
+  allocator.Dealloc((uint64_t)1 << 39, 5);
+  allocator.Dealloc(((uint64_t)1 << 39) - 3, 2);
+  assert(allocator.GetContainerCount() == 0);
+}
+
+void TestContainerTypes() {
+  ScopedPass pass("SparseBitmap [container types]");
+  SmallBitmap allocator(0x20000, aligner, HandleFailure<SmallBitmap>);
+  
+  size_t addr;
+  assert(allocator.Alloc(addr, 1));
+  assert(allocator.GetContainerType(0) == SmallBitmap::ArrayContainer);
+  assert(allocator.Alloc(addr, 0x3fff));
+  assert(allocator.GetContainerType(0) == SmallBitmap::RunContainer);
+  
+  // Splitting the run into many pieces eventually makes a bitmap smaller.
+  // The bitmap is used once the runs take twice as much room as it would.
+  for (size_t i = 1; i < 0x4000; i += 2) {
+    allocator.Dealloc(i, 1);
+    SmallBitmap::ContainerType type = allocator.GetContainerType(0);
+    if ((i + 1) / 2 + 1 < 0x1000) {
+      assert(type == SmallBitmap::RunContainer);
+    } else {
+      assert(type == SmallBitmap::BitmapContainer);
+    }
+  }
+  
+  // An array is only used once it is half the size of the bitmap.
+  for (size_t i = 0; i < 0x3000; i += 2) {
+    allocator.Dealloc(i, 1);
+    SmallBitmap::ContainerType type = allocator.GetContainerType(0);
+    if (0x2000 - (i / 2 + 1) > 0x800) {
+      assert(type == SmallBitmap::BitmapContainer);
+    } else {
+      assert(type == SmallBitmap::ArrayContainer);
+    }
+  }
+  for (size_t i = 0; i < 0x4000; ++i) {
+    assert(allocator.GetBit(i) == (i >= 0x3000 && i % 2 == 0));
+  }
+  
+  // Filling the gaps makes a single run, then a full container.
+  for (size_t i = 0; i < 0x3000; ++i) {
+    assert(allocator.Alloc(addr, 1));
+    assert(addr == i);
+  }
+  for (size_t i = 0x3000; i < 0x4000; i += 2) {
+    assert(allocator.Alloc(addr, 1));
+    assert(addr == i + 1);
+  }
+  assert(allocator.GetContainerType(0) == SmallBitmap::RunContainer);
+  assert(allocator.Alloc(addr, 0xc000));
+  assert(allocator.GetContainerType(0) == SmallBitmap::FullContainer);
+  assert(allocator.GetContainerCount() == 1);
+  
+  allocator.Dealloc(0x8000, 1);
+  assert(allocator.GetContainerType(0) == SmallBitmap::RunContainer);
+  allocator.Dealloc(0, 0x8000);
+  allocator.Dealloc(0x8001, 0x7fff);
+  assert(allocator.GetContainerCount() == 0);
+}
+
+void TestRandom(size_t bitCount, bool fragmented) {
+  ScopedPass pass("SparseBitmap [random vs. Bitmap, ", bitCount,
+                  fragmented ? ", fragmented]" : "]");
+  struct Allocation {
+    size_t address;
+    size_t size;
+  };
+  
+  uint64_t units[0x1000];
+  Bitmap<uint64_t, size_t> reference(units, bitCount);
+  RawBitmap<uint64_t, size_t> referenceBits(units, bitCount);
+  SmallBitmap allocator(bitCount, aligner, HandleFailure<SmallBitmap>);
+  Allocation allocations[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  
+  // Free scattered bits from a full bitmap, so that most containers are
+  // stored as bitmaps full of short free runs.
+  if (fragmented) {
+    size_t addr;
+    assert(reference.Alloc(addr, bitCount));
+    assert(allocator.Alloc(addr, bitCount));
+    for (size_t i = 0; i < bitCount; i += 1 + seed % 5) {
+      seed = seed * 1103515245 + 12345;
+      size_t size = ansa::Min<size_t>((seed >> 8) % 3 + 1, bitCount - i);
+      reference.Dealloc(i, size);
+      allocator.Dealloc(i, size);
+      i += size;
+    }
+  }
+  
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 2)) {
+      // Free either all of an allocation, or just the front of it.
+      Allocation & allocation = allocations[(random >> 1) % count];
+      size_t size = allocation.size;
+      if (random % 3 == 0 && size > 1) {
+        size = 1 + (random >> 9) % (size - 1);
+      }
+      reference.Dealloc(allocation.address, size);
+      allocator.Dealloc(allocation.address, size);
+      allocation.address += size;
+      allocation.size -= size;
+      if (!allocation.size) {
+        allocation = allocations[--count];
+      }
+    } else {
+      size_t size = 1 + (random >> 1) % (random % 7 ? 0x40 : 0x18000);
+      size_t align = (size_t)1 << ((random >> 4) % 18);
+      size_t offset = (random >> 12) % align;
+      size_t expected;
+      size_t addr;
+      bool result = reference.OffsetAlign(expected, align, offset, size);
+      assert(allocator.OffsetAlign(addr, align, offset, size) == result);
+      if (!result) continue;
+      assert(addr == expected);
+      allocations[count].address = addr;
+      allocations[count].size = size;
+      ++count;
+    }
+    if (i % 0x400 == 0) {
+      for (size_t j = 0; j < bitCount; ++j) {
+        assert(allocator.GetBit(j) == referenceBits.GetBit(j));
+      }
+    }
+  }
+  
+  while (count--) {
+    allocator.Dealloc(allocations[count].address, allocations[count].size);
+  }
+  assert(fragmented || allocator.GetContainerCount() == 0);
+}
+
+void TestFailures() {
+  ScopedPass pass("SparseBitmap [failures]");
+  SmallBitmap allocator(0x20000, failingAllocator, GiveUp<SmallBitmap>);
+  size_t addr;
+  
+  // The index itself cannot be allocated.
+  failingAllocator.failing = true;
+  failureCount = 0;
+  assert(!allocator.Alloc(addr, 1));
+  assert(failureCount == 1);
+  assert(allocator.GetContainerCount() == 0);
+  
+  // A full container needs no storage, but the bit after it does.
+  failingAllocator.failing = false;
+  assert(allocator.Alloc(addr, 0x100));
+  assert(addr == 0);
+  failingAllocator.failing = true;
+  assert(allocator.Alloc(addr, 0xff00));
+  assert(addr == 0x100);
+  assert(allocator.GetContainerType(0) == SmallBitmap::FullContainer);
+  assert(!allocator.Alloc(addr, 1));
+  assert(failureCount == 2);
+  assert(allocator.GetContainerCount() == 1);
+  
+  // Splitting the run needs room for a second run. If none can be found,
+  // the bits are leaked.
+  allocator.Dealloc(0x10, 0x10);
+  assert(failureCount == 3);
+  assert(allocator.GetBit(0x10));
+  assert(allocator.GetContainerType(0) == SmallBitmap::FullContainer);
+  allocator.Dealloc(0, 0x10);
+  assert(failureCount == 4);
+  assert(allocator.GetBit(0));
+  
+  failingAllocator.failing = false;
+  allocator.Dealloc(0, 0x10);
+  assert(!allocator.GetBit(0));
+  assert(allocator.GetContainerType(0) == SmallBitmap::RunContainer);
+  
+  // The handler is called until it gives up or the allocation succeeds.
+  SmallBitmap retrying(0x20000, failingAllocator, StopFailing<SmallBitmap>);
+  failingAllocator.failing = true;
+  failureCount = 0;
+  assert(retrying.Alloc(addr, 0x10));
+  assert(addr == 0);
+  assert(failureCount == 1);
+  assert(!failingAllocator.failing);
+}
+
+void TestTransformer() {
+  ScopedPass pass("AlignerTransformer<SparseBitmap>");
+  typedef AlignerTransformer<HugeBitmap> Transformer;
+  const uint64_t base = (uint64_t)1 << 48;
+  Allocator<uintptr_t, size_t> * anAlloc = &aligner;
+  Transformer transformer(0x1000, base, (uint64_t)1 << 36, anAlloc,
+                          HandleFailure<HugeBitmap>);
+  
+  uint64_t addr;
+  assert(transformer.Alloc(addr, 0x3000));
+  assert(addr == base);
+  assert(transformer.Alloc(addr, 0x800));
+  assert(addr == base + 0x3000);
+  assert(transformer.Align(addr, 0x10000, 0x1000));
+  assert(addr == base + 0x10000);
+  assert(transformer.OffsetAlign(addr, 0x10000, 0x2000, 0x1000));
+  assert(addr == base + 0xe000);
+  transformer.Dealloc(base, 0x3000);
+  assert(transformer.Alloc(addr, 0x2000));
+  assert(addr == base);
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
+
+template <typename T>
+bool GiveUp(T *) {
+  ++failureCount;
+  return false;
+}
+
+template <typename T>
+bool StopFailing(T *) {
+  ++failureCount;
+  failingAllocator.failing = false;
+  return true;
+}
@@ -0,0 +1,653 @@
+#include "scoped-pass.hpp"
+#include "posix-virtual-aligner.hpp"
+#include "weighted-value.hpp"
+#include <analloc2/free-tree>
+#include <analloc2/free-list>
+
+using namespace analloc;
+
+PosixVirtualAligner aligner;
+
+void TestBasicInsertions();
+void TestSequentialInsertions();
+void TestBasicDeletions();
+void TestSequentialDeletions();
+void TestRandomModifications();
+void TestFindMethods();
+void TestFindNeighbors();
+void TestUpdate();
+void TestSearchFunction();
+void TestEnumerator();
+void TestAugment();
+void TestPrunedEnumerator();
+void TestFreeTrees();
+
+template <typename T>
+bool ValidateTree(const SplayNode<T> * root, int & countOut,
+                  int & depthOut);
+template <typename T>
+bool ValidateNode(const SplayNode<T> * node, int & countOut,
+                  int & depthOut);
+bool ValidateAugment(const SplayNode<WeightedValue> * node);
+
+template <typename T>
+bool HandleFailure(T *);
+
+int main() {
+  TestBasicInsertions();
+  assert(aligner.GetAllocCount() == 0);
+  TestSequentialInsertions();
+  assert(aligner.GetAllocCount() == 0);
+  TestBasicDeletions();
+  assert(aligner.GetAllocCount() == 0);
+  TestSequentialDeletions();
+  assert(aligner.GetAllocCount() == 0);
+  TestRandomModifications();
+  assert(aligner.GetAllocCount() == 0);
+  TestFindMethods();
+  assert(aligner.GetAllocCount() == 0);
+  TestFindNeighbors();
+  assert(aligner.GetAllocCount() == 0);
+  TestUpdate();
+  assert(aligner.GetAllocCount() == 0);
+  TestSearchFunction();
+  assert(aligner.GetAllocCount() == 0);
+  TestEnumerator();
+  assert(aligner.GetAllocCount() == 0);
+  TestAugment();
+  assert(aligner.GetAllocCount() == 0);
+  TestPrunedEnumerator();
+  assert(aligner.GetAllocCount() == 0);
+  TestFreeTrees();
+  assert(aligner.GetAllocCount() == 0);
+  return 0;
+}
+
+void TestBasicInsertions() {
+  ScopedPass pass("SplayTree<int>::Add() [basic]");
+  SplayTree<int> tree(aligner);
+  
+  // Every new value is splayed to the root, so adding values in order makes
+  // a chain down the left of the tree.
+  assert(tree.Add(1));
+  assert(aligner.GetAllocCount() == 1);
+  assert(tree.GetRoot()->GetValue() == 1);
+  assert(tree.Add(2));
+  assert(tree.Add(3));
+  assert(aligner.GetAllocCount() == 3);
+  assert(tree.GetRoot()->GetValue() == 3);
+  assert(tree.GetRoot()->left->GetValue() == 2);
+  assert(tree.GetRoot()->left->left->GetValue() == 1);
+  assert(!tree.GetRoot()->right);
+  
+  // Finding the bottom of the chain rotates its parent up first.
+  assert(tree.Contains(1));
+  assert(tree.GetRoot()->GetValue() == 1);
+  assert(tree.GetRoot()->right->GetValue() == 2);
+  assert(tree.GetRoot()->right->right->GetValue() == 3);
+  
+  // A value which is added between its parent and grandparent is rotated up
+  // in a zig-zag.
+  tree.Clear();
+  assert(aligner.GetAllocCount() == 0);
+  assert(tree.Add(10));
+  assert(tree.Add(20));
+  assert(tree.Add(15));
+  assert(tree.GetRoot()->GetValue() == 15);
+  assert(tree.GetRoot()->left->GetValue() == 10);
+  assert(tree.GetRoot()->right->GetValue() == 20);
+  
+  // A search which fails splays the last node it reached.
+  assert(!tree.Contains(25));
+  assert(tree.GetRoot()->GetValue() == 20);
+  assert(tree.GetRoot()->left->GetValue() == 15);
+  
+  int count, depth;
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(count == 3);
+}
+void TestSequentialInsertions() {
+  ScopedPass pass("SplayTree<int>::Add() [sequential]");
+  SplayTree<int> tree(aligner);
+  
+  int count, depth;
+  for (int i = 0; i < 0x400; ++i) {
+    assert(tree.Add(i));
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+    assert(count == i + 1);
+    assert(depth == i + 1);
+  }
+  
+  // Finding the bottom of a chain should roughly halve its depth.
+  assert(tree.Contains(0));
+  assert(tree.GetRoot()->GetValue() == 0);
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(depth <= 0x202);
+  for (int i = 0; i < 0x400; ++i) {
+    assert(tree.Contains(i));
+    assert(tree.GetRoot()->GetValue() == i);
+  }
+  assert(!tree.Contains(-1));
+  assert(!tree.Contains(0x400));
+}
+void TestBasicDeletions() {
+  ScopedPass pass("SplayTree<int>::Remove() [basic]");
+  SplayTree<int> tree(aligner);
+  
+  for (int i = 0; i < 7; ++i) {
+    assert(tree.Add(i));
+  }
+  int count, depth;
+  
+  // Ensure that we can't remove absent values
+  assert(!tree.Remove(-1));
+  assert(!tree.Remove(7));
+  assert(aligner.GetAllocCount() == 7);
+  
+  // Removing a node with no left subtree replaces it with its right subtree
+  assert(tree.Remove(0));
+  assert(aligner.GetAllocCount() == 6);
+  assert(!tree.Remove(0));
+  assert(tree.GetRoot()->GetValue() == 1);
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(count == 6);
+  
+  // Otherwise, the node is replaced by its predecessor
+  assert(tree.Remove(4));
+  assert(aligner.GetAllocCount() == 5);
+  assert(!tree.Contains(4));
+  assert(tree.Remove(5));
+  assert(tree.GetRoot()->GetValue() == 3);
+  assert(tree.GetRoot()->right->GetValue() == 6);
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(count == 4);
+  
+  assert(tree.Remove(3));
+  assert(tree.Remove(6));
+  assert(tree.Remove(1));
+  assert(tree.Remove(2));
+  assert(tree.GetRoot() == nullptr);
+  assert(aligner.GetAllocCount() == 0);
+}
+void TestSequentialDeletions() {
+  ScopedPass pass("SplayTree<int>::Remove() [sequential]");
+  SplayTree<int> tree(aligner);
+  
+  for (int i = 0; i < 0x400; ++i) {
+    assert(tree.Add(i));
+  }
+  // Remove from the front, then from the back, then from the middle.
+  int count, depth;
+  for (int i = 0; i < 0x100; ++i) {
+    assert(tree.Remove(i));
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+    assert(count == 0x3ff - i);
+  }
+  for (int i = 0x3ff; i >= 0x300; --i) {
+    assert(tree.Remove(i));
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+  }
+  for (int i = 0x100; i < 0x300; i += 2) {
+    assert(tree.Remove(i));
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+  }
+  for (int i = 0x101; i < 0x300; i += 2) {
+    assert(tree.Remove(i));
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+  }
+  assert(tree.GetRoot() == nullptr);
+}
+
+void TestRandomModifications() {
+  ScopedPass pass("SplayTree<int>::[Remove/Add]() [random]");
+  SplayTree<int> tree(aligner);
+  
+  bool present[0x200] = {};
+  int expectedCount = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int value = (seed >> 8) % 0x200;
+    if (present[value]) {
+      assert(tree.Remove(value));
+      --expectedCount;
+    } else {
+      assert(!tree.Contains(value));
+      assert(tree.Add(value));
+      ++expectedCount;
+    }
+    present[value] = !present[value];
+    int count, depth;
+    assert(ValidateTree(tree.GetRoot(), count, depth));
+    assert(count == expectedCount);
+  }
+  for (int i = 0; i < 0x200; ++i) {
+    assert(tree.Contains(i) == present[i]);
+  }
+}
+
+void TestFindMethods() {
+  ScopedPass pass("SplayTree<int>::[Find*]()");
+  SplayTree<int> tree(aligner);
+  
+  tree.Add(10);
+  tree.Add(6);
+  tree.Add(16);
+  tree.Add(4);
+  tree.Add(8);
+  tree.Add(12);
+  tree.Add(18);
+  tree.Add(2);
+  tree.Add(14);
+  
+  int result;
+  
+  // Values inside the dataset
+  assert(tree.FindGT(result, 15));
+  assert(result == 16);
+  assert(tree.FindGE(result, 15));
+  assert(result == 16);
+  assert(tree.FindGT(result, 14));
+  assert(result == 16);
+  assert(tree.FindGE(result, 14));
+  assert(result == 14);
+  assert(tree.FindLT(result, 7));
+  assert(result == 6);
+  assert(tree.FindLE(result, 7));
+  assert(result == 6);
+  assert(tree.FindLT(result, 8));
+  assert(result == 6);
+  assert(tree.FindLE(result, 8));
+  assert(result == 8);
+  
+  // Values outside of the range of the dataset
+  assert(!tree.FindLT(result, 2));
+  assert(tree.FindLE(result, 2));
+  assert(result == 2);
+  assert(!tree.FindLE(result, 1));
+  assert(!tree.FindGT(result, 18));
+  assert(tree.FindGE(result, 18));
+  assert(result == 18);
+  assert(!tree.FindGE(result, 19));
+  
+  // Find and remove functionality
+  int count, depth;
+  assert(tree.FindLE(result, 6, true));
+  assert(result == 6);
+  assert(!tree.Contains(6));
+  assert(tree.FindLT(result, 5, true));
+  assert(result == 4);
+  assert(!tree.Contains(4));
+  assert(tree.FindGT(result, 1, true));
+  assert(result == 2);
+  assert(!tree.Contains(2));
+  assert(tree.FindGE(result, 8, true));
+  assert(result == 8);
+  assert(!tree.Contains(8));
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(count == 5);
+}
+
+void TestFindNeighbors() {
+  ScopedPass pass("SplayTree<int>::FindNeighbors()");
+  SplayTree<int> tree(aligner);
+  int below, above;
+  bool hasBelow, hasAbove;
+  
+  tree.FindNeighbors(5, below, hasBelow, above, hasAbove);
+  assert(!hasBelow && !hasAbove);
+  
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.Add(i * 2));
+  }
+  
+  // Values which are not in the tree sit between two neighbors.
+  for (int i = -1; i < 0x81; i += 2) {
+    tree.FindNeighbors(i, below, hasBelow, above, hasAbove);
+    assert(hasBelow == (i > 0));
+    assert(!hasBelow || below == i - 1);
+    assert(hasAbove == (i < 0x7e));
+    assert(!hasAbove || above == i + 1);
+  }
+  
+  // Values which are in the tree find their neighbors in their subtrees.
+  for (int i = 0; i < 0x80; i += 2) {
+    tree.FindNeighbors(i, below, hasBelow, above, hasAbove);
+    assert(hasBelow == (i > 0));
+    assert(!hasBelow || below == i - 2);
+    assert(hasAbove == (i < 0x7e));
+    assert(!hasAbove || above == i + 2);
+  }
+}
+
+void TestUpdate() {
+  ScopedPass pass("SplayTree<WeightedValue>::Update()");
+  SplayTree<WeightedValue> tree(aligner);
+  
+  assert(!tree.Update(WeightedValue(1), WeightedValue(1)));
+  int keys[0x40];
+  for (int i = 0; i < 0x40; ++i) {
+    keys[i] = i * 4;
+    assert(tree.Add(WeightedValue(keys[i])));
+  }
+  
+  // Moving values between their neighbors should keep the tree in order and
+  // keep every summary up to date.
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x400; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int index = (seed >> 8) % 0x40;
+    int newKey = index * 4 + (seed >> 16) % 3 - 1;
+    int weight = (seed >> 20) % 0x100;
+    assert(tree.Update(WeightedValue(keys[index]),
+                       WeightedValue(newKey, weight)));
+    keys[index] = newKey;
+    assert(tree.Contains(WeightedValue(newKey)));
+    assert(ValidateAugment(tree.GetRoot()));
+  }
+  
+  WeightedValue result;
+  for (int i = 0; i < 0x40; ++i) {
+    assert(tree.FindGE(result, WeightedValue(i * 4 - 1), true));
+    assert(result.key == keys[i]);
+  }
+  assert(tree.GetRoot() == nullptr);
+}
+
+void TestSearchFunction() {
+  ScopedPass pass("SplayTree<int>::Search()");
+  SplayTree<int> tree(aligner);
+  
+  struct SearchFunc : public SplayTree<int>::Query {
+    virtual int DirectionFromNode(const int & test) const {
+      if (value > test) return 1;
+      else if (value < test) return -1;
+      else return 0;
+    }
+    
+    int value;
+  };
+  
+  tree.Add(10);
+  tree.Add(6);
+  tree.Add(16);
+  tree.Add(4);
+  tree.Add(8);
+  tree.Add(12);
+  tree.Add(18);
+  tree.Add(2);
+  tree.Add(14);
+  
+  SearchFunc func;
+  int result;
+  
+  // Basic searches
+  func.value = 2;
+  assert(tree.Search(result, func));
+  assert(result == 2);
+  func.value = 1;
+  assert(!tree.Search(result, func));
+  func.value = 18;
+  assert(tree.Search(result, func));
+  assert(result == 18);
+  func.value = 19;
+  assert(!tree.Search(result, func));
+  func.value = 10;
+  assert(tree.Search(result, func));
+  assert(result == 10);
+  func.value = 9;
+  assert(!tree.Search(result, func));
+  
+  // Deleting searches
+  func.value = 2;
+  assert(tree.Search(result, func, true));
+  assert(result == 2);
+  assert(!tree.Contains(2));
+  assert(!tree.Search(result, func, true));
+  func.value = 18;
+  assert(tree.Search(result, func, true));
+  assert(result == 18);
+  assert(!tree.Contains(18));
+  func.value = 10;
+  assert(tree.Search(result, func, true));
+  assert(result == 10);
+  assert(!tree.Contains(10));
+  assert(!tree.Search(result, func));
+  int count, depth;
+  assert(ValidateTree(tree.GetRoot(), count, depth));
+  assert(count == 6);
+}
+
+void TestEnumerator() {
+  struct RollingEnumerator : public SplayTree<int>::EnumerateCallback {
+    int values[100];
+    int idx = 0;
+    int cutoff = 100;
+    
+    virtual bool Yield(const int & value) {
+      assert(idx < 100);
+      values[idx++] = value;
+      return idx != cutoff;
+    }
+  };
+  
+  ScopedPass pass("SplayTree<int>::Enumerate()");
+  SplayTree<int> tree(aligner);
+  
+  uint32_t seed = 1;
+  bool added[100] = {};
+  for (int i = 0; i < 100; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int value = (seed >> 8) % 100;
+    while (added[value]) {
+      value = (value + 1) % 100;
+    }
+    added[value] = true;
+    tree.Add(value + 1);
+  }
+  RollingEnumerator enum1;
+  enum1.cutoff = 101;
+  RollingEnumerator enum2;
+  enum2.cutoff = 20;
+  RollingEnumerator enum3;
+  assert(tree.Enumerate(enum1));
+  assert(enum1.idx == 100);
+  for (int i = 0; i < 100; ++i) {
+    assert(enum1.values[i] == i + 1);
+  }
+  assert(!tree.Enumerate(enum2));
+  assert(enum2.idx == 20);
+  for (int i = 0; i < 20; ++i) {
+    assert(enum2.values[i] == i + 1);
+  }
+  assert(!tree.Enumerate(enum3));
+  assert(enum3.idx == 100);
+}
+
+void TestAugment() {
+  ScopedPass pass("SplayTree<WeightedValue>::[Remove/Add]() [augmented]");
+  SplayTree<WeightedValue> tree(aligner);
+  
+  // Every rotation and removal should leave each node with an up-to-date
+  // summary of its subtree.
+  bool present[0x100] = {};
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 0x100;
+    if (present[key]) {
+      assert(tree.Remove(WeightedValue(key)));
+    } else {
+      assert(tree.Add(WeightedValue(key, (seed >> 16) % 0x1000)));
+    }
+    present[key] = !present[key];
+    assert(ValidateAugment(tree.GetRoot()));
+  }
+  for (int i = 0; i < 0x100; ++i) {
+    if (present[i]) {
+      assert(tree.Remove(WeightedValue(i)));
+    }
+  }
+  assert(tree.GetRoot() == nullptr);
+}
+
+void TestPrunedEnumerator() {
+  struct HeavyEnumerator
+      : public SplayTree<WeightedValue>::EnumerateCallback {
+    int threshold;
+    int keys[0x100];
+    int idx = 0;
+    int entered = 0;
+    
+    virtual bool Yield(const WeightedValue & value) {
+      if (value.weight >= threshold) {
+        keys[idx++] = value.key;
+      }
+      return true;
+    }
+    
+    virtual bool EnterSubtree(const WeightedValue & root) {
+      ++entered;
+      return root.heaviest >= threshold;
+    }
+  };
+  
+  ScopedPass pass("SplayTree<WeightedValue>::Enumerate() [pruned]");
+  SplayTree<WeightedValue> tree(aligner);
+  
+  // Only every 0x40th value is heavy, so most subtrees should be skipped.
+  // Adding the values in order would leave a chain, in which every subtree
+  // holds a heavy value, so they are added in a scrambled order.
+  for (int i = 0; i < 0x100; ++i) {
+    int key = (i * 0x65) % 0x100;
+    assert(tree.Add(WeightedValue(key, key % 0x40 ? 1 : 2)));
+  }
+  HeavyEnumerator enumerator;
+  enumerator.threshold = 2;
+  assert(tree.Enumerate(enumerator));
+  assert(enumerator.idx == 4);
+  for (int i = 0; i < 4; ++i) {
+    assert(enumerator.keys[i] == i * 0x40);
+  }
+  assert(enumerator.entered < 0x80);
+  
+  // Nothing is heavy enough, so only the root should be looked at.
+  HeavyEnumerator empty;
+  empty.threshold = 3;
+  assert(tree.Enumerate(empty));
+  assert(empty.idx == 0);
+  assert(empty.entered == 1);
+  
+  tree.Clear();
+  assert(tree.GetRoot() == nullptr);
+}
+
+void TestFreeTrees() {
+  ScopedPass pass("[Augmented]FreeTree<SplayTree> [reference]");
+  FreeTree<SplayTree, uint32_t> freeTree(aligner, HandleFailure);
+  AugmentedFreeTree<SplayTree, uint32_t> augmented(aligner,
+                                                      HandleFailure);
+  FreeList<uint32_t> reference(aligner, HandleFailure);
+  freeTree.Dealloc(0, 0x10000);
+  for (uint32_t i = 0; i < 0x200; ++i) {
+    augmented.Dealloc(i * 0x10, 1 + i % 0xf);
+    reference.Dealloc(i * 0x10, 1 + i % 0xf);
+  }
+  
+  // [AugmentedFreeTree] should act like a first-fit [FreeList], and
+  // [FreeTree] should never hand out overlapping regions.
+  uint32_t addrs[0x100];
+  uint32_t sizes[0x100];
+  uint32_t treeAddrs[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 2)) {
+      size_t index = (random >> 1) % count;
+      augmented.Dealloc(addrs[index], sizes[index]);
+      reference.Dealloc(addrs[index], sizes[index]);
+      freeTree.Dealloc(treeAddrs[index], sizes[index]);
+      --count;
+      addrs[index] = addrs[count];
+      sizes[index] = sizes[count];
+      treeAddrs[index] = treeAddrs[count];
+    } else {
+      uint32_t size = 1 + (random >> 1) % 0x18;
+      uint32_t align = 1 << ((random >> 6) % 6);
+      uint32_t addr;
+      bool result = augmented.Align(addrs[count], align, size);
+      assert(result == reference.Align(addr, align, size));
+      if (result) {
+        assert(addr == addrs[count]);
+        assert(freeTree.Align(treeAddrs[count], align, size));
+        assert(treeAddrs[count] % align == 0);
+        for (size_t j = 0; j < count; ++j) {
+          assert(treeAddrs[j] + sizes[j] <= treeAddrs[count] ||
+                 treeAddrs[count] + size <= treeAddrs[j]);
+        }
+        sizes[count++] = size;
+      }
+    }
+  }
+  
+  while (count) {
+    --count;
+    augmented.Dealloc(addrs[count], sizes[count]);
+    reference.Dealloc(addrs[count], sizes[count]);
+    freeTree.Dealloc(treeAddrs[count], sizes[count]);
+  }
+  uint32_t addr;
+  assert(freeTree.Alloc(addr, 0x10000));
+  assert(addr == 0);
+  assert(reference.GetRegionCount() == 0x200);
+}
+
+template <typename T>
+bool ValidateTree(const SplayNode<T> * root, int & countOut,
+                  int & depthOut) {
+  countOut = 0;
+  if (root && root->parent) return false;
+  return ValidateNode(root, countOut, depthOut);
+}
+
+template <typename T>
+bool ValidateNode(const SplayNode<T> * node, int & countOut,
+                  int & depthOut) {
+  if (!node) {
+    depthOut = 0;
+    return true;
+  }
+  if (node->left) {
+    if (node->left->parent != node) return false;
+    if (!(node->left->GetValue() <= node->GetValue())) return false;
+  }
+  if (node->right) {
+    if (node->right->parent != node) return false;
+    if (!(node->right->GetValue() > node->GetValue())) return false;
+  }
+  int leftDepth, rightDepth;
+  if (!ValidateNode(node->left, countOut, leftDepth)) return false;
+  if (!ValidateNode(node->right, countOut, rightDepth)) return false;
+  depthOut = 1 + ansa::Max(leftDepth, rightDepth);
+  ++countOut;
+  return true;
+}
+
+bool ValidateAugment(const SplayNode<WeightedValue> * node) {
+  if (!node) return true;
+  if (!ValidateAugment(node->left) || !ValidateAugment(node->right)) {
+    return false;
+  }
+  WeightedValue expected = node->GetValue();
+  UpdateTreeAugment(expected, node->left ? &node->left->GetValue() : nullptr,
+                    node->right ? &node->right->GetValue() : nullptr);
+  return expected.heaviest == node->GetValue().heaviest;
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "HandleFailure()" << std::endl;
+  abort();
+}
@@ -0,0 +1,182 @@
+#include "scoped-pass.hpp"
+#include <analloc2/bitmap>
+#include <ansa/numeric-info>
+#include <cstdint>
+
+using namespace ansa;
+using namespace analloc;
+
+template <typename T>
+void TestAll();
+
+template <typename T>
+void TestLevels();
+
+template <typename T>
+void TestStepAllocation();
+
+template <typename T>
+void TestLowestFree();
+
+template <typename T>
+void TestMatchesBitmap(size_t bitCount);
+
+int main() {
+  TestAll<unsigned char>();
+  TestAll<unsigned short>();
+  TestAll<unsigned int>();
+  TestAll<unsigned long>();
+  TestAll<unsigned long long>();
+  return 0;
+}
+
+template <typename T>
+void TestAll() {
+  TestLevels<T>();
+  TestStepAllocation<T>();
+  TestLowestFree<T>();
+  TestMatchesBitmap<T>(0x1000);
+  TestMatchesBitmap<T>(0x1000 - 3);
+}
+
+template <typename T>
+void TestLevels() {
+  ScopedPass pass("SummaryBitmap<", NumericInfo<T>::name,
+                  ">::SummaryBitmap()");
+  typedef SummaryBitmap<T, size_t> Allocator;
+  const size_t unitBits = sizeof(T) * 8;
+  
+  assert(Allocator::SummaryUnitCount(unitBits) == 0);
+  assert(Allocator::SummaryUnitCount(unitBits + 1) == 1);
+  assert(Allocator::SummaryUnitCount(unitBits * unitBits) == 1);
+  assert(Allocator::SummaryUnitCount(unitBits * unitBits + 1) == 3);
+  
+  T units[4];
+  T summary[1];
+  Allocator small(units, unitBits, summary);
+  assert(small.GetLevelCount() == 0);
+  Allocator twoUnits(units, unitBits * 2, summary);
+  assert(twoUnits.GetLevelCount() == 1);
+  assert(summary[0] == 0);
+}
+
+template <typename T>
+void TestStepAllocation() {
+  ScopedPass pass("SummaryBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [step]");
+  const size_t bitCount = 0x1000;
+  T units[bitCount / (sizeof(T) * 8)];
+  T summary[SummaryBitmap<T, size_t>::SummaryUnitCount(bitCount)];
+  SummaryBitmap<T, size_t> allocator(units, bitCount, summary);
+  
+  size_t addr;
+  for (size_t i = 0; i < bitCount; ++i) {
+    assert(allocator.Alloc(addr, 1));
+    assert(addr == i);
+  }
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Freeing the last bit should make it the only candidate.
+  allocator.Dealloc(bitCount - 1, 1);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == bitCount - 1);
+  assert(!allocator.Alloc(addr, 1));
+  
+  for (size_t i = 0; i < bitCount; i += 2) {
+    allocator.Dealloc(i, 2);
+  }
+  assert(allocator.Alloc(addr, bitCount));
+  assert(addr == 0);
+  allocator.Dealloc(0, bitCount);
+}
+
+template <typename T>
+void TestLowestFree() {
+  ScopedPass pass("SummaryBitmap<", NumericInfo<T>::name,
+                  ">::Alloc() [lowest free]");
+  const size_t bitCount = 0x1000;
+  T units[bitCount / (sizeof(T) * 8)];
+  T summary[SummaryBitmap<T, size_t>::SummaryUnitCount(bitCount)];
+  SummaryBitmap<T, size_t> allocator(units, bitCount, summary);
+  
+  size_t addr;
+  assert(allocator.Alloc(addr, bitCount));
+  
+  // Free IDs from the top down, like an fd table would; each allocation
+  // should always pick the lowest free ID.
+  allocator.Dealloc(0xfff, 1);
+  allocator.Dealloc(0x800, 1);
+  allocator.Dealloc(0x123, 1);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x123);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x800);
+  allocator.Dealloc(0x3, 1);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x3);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0xfff);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Aligned allocations should skip summarized units as well.
+  allocator.Dealloc(0xf10, 0x10);
+  assert(!allocator.Align(addr, 0x20, 0x10));
+  assert(allocator.Align(addr, 0x10, 0x10));
+  assert(addr == 0xf10);
+}
+
+template <typename T>
+void TestMatchesBitmap(size_t bitCount) {
+  ScopedPass pass("SummaryBitmap<", NumericInfo<T>::name, "> [random, ",
+                  bitCount, "]");
+  const size_t unitCount = 0x1000 / (sizeof(T) * 8);
+  T units[unitCount];
+  T referenceUnits[unitCount];
+  T summary[SummaryBitmap<T, size_t>::SummaryUnitCount(0x1000)];
+  SummaryBitmap<T, size_t> allocator(units, bitCount, summary);
+  Bitmap<T, size_t> reference(referenceUnits, bitCount);
+  
+  struct Allocation {
+    size_t address;
+    size_t size;
+  };
+  Allocation allocations[0x200];
+  size_t count = 0;
+  
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x200 || (count && random % 3 == 0)) {
+      size_t index = (random >> 2) % count;
+      allocator.Dealloc(allocations[index].address, allocations[index].size);
+      reference.Dealloc(allocations[index].address, allocations[index].size);
+      allocations[index] = allocations[--count];
+      continue;
+    }
+    size_t size = 1 + (random >> 2) % 0x20;
+    size_t addr, refAddr;
+    bool result;
+    if (random % 3 == 1) {
+      result = allocator.Alloc(addr, size);
+      assert(result == reference.Alloc(refAddr, size));
+    } else {
+      size_t align = (size_t)1 << ((random >> 10) % 8);
+      result = allocator.Align(addr, align, size);
+      assert(result == reference.Align(refAddr, align, size));
+    }
+    if (result) {
+      assert(addr == refAddr);
+      allocations[count].address = addr;
+      allocations[count].size = size;
+      ++count;
+    }
+  }
+  while (count) {
+    --count;
+    allocator.Dealloc(allocations[count].address, allocations[count].size);
+  }
+  size_t addr;
+  assert(allocator.Alloc(addr, bitCount));
+  assert(addr == 0);
+}
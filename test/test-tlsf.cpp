@@ -0,0 +1,240 @@
+#include "scoped-pass.hpp"
+#include "scoped-buffer.hpp"
+#include <analloc2/tlsf>
+#include <cassert>
+#include <cstring>
+
+using namespace analloc;
+
+typedef Tlsf<> AllocatorClass;
+
+void TestAllocDealloc();
+void TestExhaustion();
+void TestOffsetAlign();
+void TestRegions();
+void TestRandom();
+void TestPlace();
+
+int main() {
+  TestAllocDealloc();
+  TestExhaustion();
+  TestOffsetAlign();
+  TestRegions();
+  TestRandom();
+  TestPlace();
+  return 0;
+}
+
+void TestAllocDealloc() {
+  ScopedPass pass("Tlsf::Alloc() [simple]");
+  ScopedBuffer buffer(0x1000, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  size_t blockSize = allocator.AddRegion(buffer, 0x1000);
+  assert(blockSize == 0x1000 - AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+  
+  // Allocations should be carved off of the front of the block, one after
+  // the other.
+  uintptr_t addrs[3];
+  assert(allocator.Alloc(addrs[0], 1));
+  assert(addrs[0] == (uintptr_t)buffer + AllocatorClass::HeaderSize);
+  assert(allocator.Alloc(addrs[1], 0x100));
+  assert(addrs[1] == addrs[0] + AllocatorClass::MinBlockSize);
+  assert(allocator.Alloc(addrs[2], 0));
+  assert(addrs[2] == addrs[1] + 0x100 + AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeBlockCount() == 1);
+  memset((void *)addrs[1], 0xff, 0x100);
+  
+  // Freeing the middle allocation should not merge it with anything, but
+  // freeing one of its neighbors should.
+  allocator.Dealloc(addrs[1], 0x100);
+  assert(allocator.GetFreeBlockCount() == 2);
+  assert(allocator.Alloc(addrs[1], 0x80));
+  assert(addrs[1] == addrs[0] + AllocatorClass::MinBlockSize);
+  allocator.Dealloc(addrs[1], 0x80);
+  allocator.Dealloc(addrs[0], 1);
+  assert(allocator.GetFreeBlockCount() == 2);
+  allocator.Dealloc(addrs[2], 0);
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == blockSize);
+  
+  // The whole block can be allocated at once, but no more.
+  uintptr_t addr;
+  assert(!allocator.Alloc(addr, blockSize));
+  assert(!allocator.Alloc(addr, ~(size_t)0));
+  assert(allocator.Alloc(addr, blockSize - AllocatorClass::HeaderSize));
+  assert(allocator.GetFreeBlockCount() == 0);
+  assert(!allocator.Alloc(addr, 0));
+  allocator.Dealloc(addr, blockSize - AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeSize() == blockSize);
+}
+
+void TestExhaustion() {
+  ScopedPass pass("Tlsf::Alloc() [exhaustion]");
+  const size_t count = 0x100;
+  const size_t size = count * AllocatorClass::MinBlockSize +
+                      AllocatorClass::HeaderSize;
+  ScopedBuffer buffer(size, AllocatorClass::Granule);
+  AllocatorClass allocator(buffer, size);
+  
+  // Every minimum-sized block should be handed out in order.
+  uintptr_t addrs[count];
+  for (size_t i = 0; i < count; ++i) {
+    assert(allocator.Alloc(addrs[i], 1));
+    assert(addrs[i] == (uintptr_t)buffer + AllocatorClass::HeaderSize +
+                       i * AllocatorClass::MinBlockSize);
+  }
+  uintptr_t addr;
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Free every other block, then the rest, so every free merges with both
+  // of its neighbors.
+  for (size_t i = 0; i < count; i += 2) {
+    allocator.Dealloc(addrs[i], 1);
+  }
+  assert(allocator.GetFreeBlockCount() == count / 2);
+  assert(!allocator.Alloc(addr, AllocatorClass::MinBlockSize));
+  for (size_t i = 1; i < count; i += 2) {
+    allocator.Dealloc(addrs[i], 1);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == size - AllocatorClass::HeaderSize);
+}
+
+void TestOffsetAlign() {
+  ScopedPass pass("Tlsf::OffsetAlign()");
+  ScopedBuffer buffer(0x4000, 0x1000);
+  AllocatorClass allocator(buffer, 0x4000);
+  uintptr_t addr;
+  
+  // Alignments up to the granule need no padding, and offsets which break
+  // them cannot be met.
+  assert(allocator.Align(addr, 0, 1));
+  assert(addr == (uintptr_t)buffer + AllocatorClass::HeaderSize);
+  allocator.Dealloc(addr, 1);
+  assert(!allocator.OffsetAlign(addr, AllocatorClass::Granule, 1, 1));
+  assert(!allocator.OffsetAlign(addr, 0x100, 1, 1));
+  
+  // Bigger alignments should leave a free block in front of the allocation.
+  assert(allocator.Align(addr, 0x100, 0x10));
+  assert(addr == (uintptr_t)buffer + 0x100);
+  assert(allocator.GetFreeBlockCount() == 2);
+  allocator.Dealloc(addr, 0x10);
+  assert(allocator.GetFreeBlockCount() == 1);
+  
+  // The gap in front of the allocation is never smaller than a block.
+  uintptr_t offset = 0x100 - AllocatorClass::Granule * 2;
+  assert(allocator.OffsetAlign(addr, 0x100, offset, 0x10));
+  assert(addr == (uintptr_t)buffer + 0x100 + AllocatorClass::Granule * 2);
+  allocator.Dealloc(addr, 0x10);
+  
+  uintptr_t addrs[0x10];
+  for (int i = 0; i < 0x10; ++i) {
+    uintptr_t align = (uintptr_t)0x10 << (i % 6);
+    offset = (uintptr_t)AllocatorClass::Granule * (i % 3);
+    assert(allocator.OffsetAlign(addrs[i], align, offset, 0x20 + i));
+    assert((addrs[i] + offset) % align == 0);
+    memset((void *)addrs[i], i, 0x20 + i);
+  }
+  for (int i = 0; i < 0x10; ++i) {
+    for (int j = 0; j < 0x20 + i; ++j) {
+      assert(((unsigned char *)addrs[i])[j] == i);
+    }
+    allocator.Dealloc(addrs[i], 0x20 + i);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(!allocator.Align(addr, 0x4000, 1));
+}
+
+void TestRegions() {
+  ScopedPass pass("Tlsf::AddRegion()");
+  ScopedBuffer buffer(0x400, AllocatorClass::Granule);
+  AllocatorClass allocator;
+  uintptr_t start = buffer;
+  
+  // Regions are trimmed to the granule, and tiny ones are ignored.
+  assert(!allocator.AddRegion(start + 1, AllocatorClass::MinBlockSize));
+  assert(allocator.AddRegion(start + 1, 0x200 - 1) ==
+         0x200 - AllocatorClass::Granule - AllocatorClass::HeaderSize);
+  assert(allocator.AddRegion(start + 0x200, 0x200 + 3) ==
+         0x200 - AllocatorClass::HeaderSize);
+  assert(allocator.GetFreeBlockCount() == 2);
+  
+  // Blocks from separate regions should never be merged.
+  uintptr_t addr;
+  assert(!allocator.Alloc(addr, 0x200));
+  uintptr_t addrs[2];
+  assert(allocator.Alloc(addrs[0], 0x180));
+  assert(allocator.Alloc(addrs[1], 0x180));
+  assert(addrs[0] != addrs[1]);
+  allocator.Dealloc(addrs[0], 0x180);
+  allocator.Dealloc(addrs[1], 0x180);
+  assert(allocator.GetFreeBlockCount() == 2);
+}
+
+void TestRandom() {
+  ScopedPass pass("Tlsf [random]");
+  const size_t size = 0x10000;
+  ScopedBuffer buffer(size, AllocatorClass::Granule);
+  AllocatorClass allocator(buffer, size);
+  size_t totalSize = allocator.GetFreeSize();
+  
+  uintptr_t addrs[0x40];
+  size_t sizes[0x40];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x10000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    if (count == 0x40 || (count && (seed >> 8) % 2)) {
+      // Check that nothing else was allocated over the region.
+      size_t index = (seed >> 9) % count;
+      for (size_t j = 0; j < sizes[index]; ++j) {
+        assert(((unsigned char *)addrs[index])[j] == (unsigned char)index);
+      }
+      allocator.Dealloc(addrs[index], sizes[index]);
+      --count;
+      if (index != count) {
+        addrs[index] = addrs[count];
+        sizes[index] = sizes[count];
+        memset((void *)addrs[index], (int)index, sizes[index]);
+      }
+      continue;
+    }
+    sizes[count] = (seed >> 9) % 0x400;
+    uintptr_t align = (uintptr_t)1 << ((seed >> 20) % 10);
+    if (!allocator.Align(addrs[count], align, sizes[count])) {
+      continue;
+    }
+    assert(addrs[count] % align == 0);
+    assert(addrs[count] >= (uintptr_t)buffer);
+    assert(addrs[count] + sizes[count] <= (uintptr_t)buffer + size);
+    memset((void *)addrs[count], (int)count, sizes[count]);
+    ++count;
+  }
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(allocator.GetFreeBlockCount() == 1);
+  assert(allocator.GetFreeSize() == totalSize);
+}
+
+void TestPlace() {
+  ScopedPass pass("PlacedTlsf::Place()");
+  ScopedBuffer buffer(0x4000, sizeof(void *));
+  uintptr_t start = buffer;
+  
+  assert(!PlacedTlsf<>::Place(start, sizeof(PlacedTlsf<>)));
+  PlacedTlsf<> * allocator = PlacedTlsf<>::Place(start, 0x4000);
+  assert(allocator != nullptr);
+  assert((uintptr_t)allocator == start);
+  
+  uintptr_t addr;
+  assert(allocator->Alloc(addr, 0x100));
+  assert(addr >= start + sizeof(PlacedTlsf<>));
+  assert(addr + 0x100 <= start + 0x4000);
+  allocator->Dealloc(addr, 0x100);
+  assert(allocator->GetFreeBlockCount() == 1);
+  assert(allocator->GetFreeSize() + sizeof(PlacedTlsf<>) < 0x4000);
+}
@@ -6,11 +6,13 @@ using namespace analloc;
 void TestScaled();
 void TestOffset();
 void TestScaledOffset();
+void TestAllocMany();
 
 int main() {
   TestScaled();
   TestOffset();
   TestScaledOffset();
+  TestAllocMany();
   return 0;
 }
 
@@ -163,3 +165,30 @@ void TestScaledOffset() {
   allocator.Dealloc(0x300, 9);
   assert(bitmap == empty);
 }
+
+void TestAllocMany() {
+  ScopedPass pass("TransformedBitmapAllocator::AllocMany()");
+  
+  uint32_t bitmap = 0xffffffff;
+  const uint32_t empty = 0xffff0000;
+  
+  // Range of addresses: [0x300, 0x330)
+  TransformedBitmapAllocator<uint32_t, uint16_t, uint8_t>
+      allocator(3, 0x300, &bitmap, 16);
+  
+  uint16_t address;
+  uint16_t addresses[0x10];
+  assert(allocator.Alloc(address, 4));
+  assert(allocator.AllocMany(addresses, 3));
+  assert(addresses[0] == 0x306);
+  assert(addresses[1] == 0x309);
+  assert(addresses[2] == 0x30c);
+  uint16_t extraAddresses[0x10];
+  assert(!allocator.AllocMany(extraAddresses, 12));
+  assert(allocator.AllocMany(addresses + 3, 11));
+  assert(addresses[13] == 0x32d);
+  assert(bitmap == 0xffffffff);
+  allocator.DeallocMany(addresses, 14);
+  allocator.Dealloc(0x300, 4);
+  assert(bitmap == empty);
+}
@@ -0,0 +1,119 @@
+#define ANALLOC2_SIMD
+
+#include "scoped-pass.hpp"
+#include <analloc2/bitmap>
+#include <cstring>
+#include <cstdint>
+
+using namespace analloc;
+
+const char * KernelName(UnitScanner::KernelType type);
+
+void TestKernel(UnitScanner::KernelType type);
+void TestNextNonFull();
+void TestWideUnits();
+
+int main() {
+  for (int i = 0; i < UnitScanner::KernelTypeCount; ++i) {
+    UnitScanner::KernelType type = (UnitScanner::KernelType)i;
+    if (UnitScanner::IsSupported(type)) {
+      TestKernel(type);
+    }
+  }
+  TestNextNonFull();
+  TestWideUnits();
+  return 0;
+}
+
+const char * KernelName(UnitScanner::KernelType type) {
+  switch (type) {
+    case UnitScanner::ScalarKernel:
+      return "scalar";
+    case UnitScanner::Sse2Kernel:
+      return "sse2";
+    case UnitScanner::Avx2Kernel:
+      return "avx2";
+    case UnitScanner::Avx512Kernel:
+      return "avx512";
+    default:
+      return "unknown";
+  }
+}
+
+void TestKernel(UnitScanner::KernelType type) {
+  ScopedPass pass("UnitScanner [", KernelName(type), "]");
+  UnitScanner::Kernel kernel = UnitScanner::KernelForType(type);
+  
+  // Use an aligned buffer which is big enough for a few iterations of the
+  // widest unrolled loop, and test every alignment of the start and end.
+  alignas(64) uint8_t buffer[0x400];
+  for (size_t start = 0; start < 0x48; ++start) {
+    for (size_t end = 0x400 - 0x48; end <= 0x400; end += 7) {
+      memset(buffer, 0xff, sizeof(buffer));
+      assert(kernel(buffer, start, end) == end);
+      // Bytes outside of the range must be ignored
+      if (start) buffer[start - 1] = 0;
+      if (end < sizeof(buffer)) buffer[end] = 0;
+      assert(kernel(buffer, start, end) == end);
+    }
+  }
+  for (size_t pos = 0; pos < sizeof(buffer); ++pos) {
+    memset(buffer, 0xff, sizeof(buffer));
+    buffer[pos] = 0x7f;
+    for (size_t start = 0; start <= pos; start += 5) {
+      assert(kernel(buffer, start, sizeof(buffer)) == pos);
+      assert(kernel(buffer, start, pos) == pos);
+    }
+    // A later non-full byte must never hide an earlier one.
+    if (pos + 1 < sizeof(buffer)) {
+      buffer[sizeof(buffer) - 1] = 0;
+      assert(kernel(buffer, 0, sizeof(buffer)) == pos);
+    }
+  }
+}
+
+void TestNextNonFull() {
+  ScopedPass pass("UnitScanner::NextNonFull()");
+  
+  uint32_t units[0x100];
+  memset(units, 0xff, sizeof(units));
+  assert(UnitScanner::NextNonFull(units, 0, 0x100) == 0x100);
+  assert(UnitScanner::NextNonFull(units, 0x10, 0x10) == 0x10);
+  
+  // A clear bit in the highest byte of a unit should still find the unit.
+  units[0x33] = 0x7fffffff;
+  assert(UnitScanner::NextNonFull(units, 0, 0x100) == 0x33);
+  assert(UnitScanner::NextNonFull(units, 0x33, 0x100) == 0x33);
+  assert(UnitScanner::NextNonFull(units, 0x34, 0x100) == 0x100);
+  assert(UnitScanner::NextNonFull(units, 0, 0x33) == 0x33);
+  units[0x80] = 0xfffffffe;
+  assert(UnitScanner::NextNonFull(units, 0x34, 0x100) == 0x80);
+}
+
+void TestWideUnits() {
+  ScopedPass pass("Bitmap<unsigned __int128>::Alloc()");
+#ifdef __SIZEOF_INT128__
+  typedef unsigned __int128 Unit;
+  const size_t bitCount = 0x800;
+  Unit units[bitCount / 128];
+  Bitmap<Unit, size_t> allocator(units, bitCount);
+  
+  size_t addr;
+  for (size_t i = 0; i < bitCount; ++i) {
+    assert(allocator.Alloc(addr, 1));
+    assert(addr == i);
+  }
+  assert(!allocator.Alloc(addr, 1));
+  allocator.Dealloc(0x7ff, 1);
+  allocator.Dealloc(0x480, 0x100);
+  assert(allocator.Alloc(addr, 0x100));
+  assert(addr == 0x480);
+  assert(allocator.Alloc(addr, 1));
+  assert(addr == 0x7ff);
+  allocator.Dealloc(0x101, 0x80);
+  assert(allocator.Align(addr, 0x40, 0x40));
+  assert(addr == 0x140);
+  assert(allocator.Alloc(addr, 0x3f));
+  assert(addr == 0x101);
+#endif
+}
@@ -0,0 +1,233 @@
+#include "scoped-pass.hpp"
+#include "posix-virtual-aligner.hpp"
+#include <analloc2/free-list>
+#include <cassert>
+
+using namespace analloc;
+
+/**
+ * Nodes with room for six regions, so that they split and merge often.
+ */
+typedef UnrolledFreeList<uint32_t, uint32_t, 0x40> SmallList;
+
+void TestAllocDealloc();
+void TestSplitMerge();
+void TestOffsetAlign();
+void TestTryResize();
+void TestReference();
+
+template <typename T>
+bool HandleFailure(T *);
+
+PosixVirtualAligner aligner;
+
+int main() {
+  TestAllocDealloc();
+  TestSplitMerge();
+  TestOffsetAlign();
+  TestTryResize();
+  TestReference();
+  assert(aligner.GetAllocCount() == 0);
+  return 0;
+}
+
+void TestAllocDealloc() {
+  ScopedPass pass("UnrolledFreeList::[Alloc/Dealloc]()");
+  UnrolledFreeList<uint16_t, uint8_t> allocator(aligner, HandleFailure);
+  uint16_t addr;
+  
+  allocator.Dealloc(0x100, 0x10);
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x100);
+  assert(allocator.GetRegionCount() == 0);
+  assert(allocator.GetNodeCount() == 0);
+  assert(!allocator.Alloc(addr, 1));
+  
+  // Regions should be joined with both of their neighbors.
+  allocator.Dealloc(0x140, 0x20);
+  allocator.Dealloc(0x100, 0x10);
+  allocator.Dealloc(0x120, 0x10);
+  assert(allocator.GetRegionCount() == 3);
+  assert(allocator.GetLargestRegionSize() == 0x20);
+  allocator.Dealloc(0x110, 0x10);
+  assert(allocator.GetRegionCount() == 2);
+  allocator.Dealloc(0x130, 0x10);
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.GetLargestRegionSize() == 0x60);
+  
+  // Allocations come from the front of the lowest region which fits.
+  assert(allocator.Alloc(addr, 0x10));
+  assert(addr == 0x100);
+  assert(allocator.Alloc(addr, 0x50));
+  assert(addr == 0x110);
+  assert(allocator.GetRegionCount() == 0);
+  assert(allocator.GetNodeCount() == 0);
+}
+
+void TestSplitMerge() {
+  ScopedPass pass("UnrolledFreeList [nodes]");
+  SmallList allocator(aligner, HandleFailure);
+  assert(SmallList::Capacity == 6);
+  assert(sizeof(SmallList::Node) <= 0x40);
+  
+  // Filling the list in a random order should split nodes in the middle.
+  uint32_t seed = 1;
+  bool added[0x100] = {};
+  for (int i = 0; i < 0x100; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t index = (seed >> 8) % 0x100;
+    while (added[index]) {
+      index = (index + 1) % 0x100;
+    }
+    added[index] = true;
+    allocator.Dealloc(index * 4, 2);
+    assert(allocator.GetRegionCount() == (size_t)i + 1);
+  }
+  size_t nodeCount = allocator.GetNodeCount();
+  assert(nodeCount >= 0x100 / SmallList::Capacity);
+  assert(nodeCount <= 0x100 / (SmallList::Capacity / 2));
+  assert(aligner.GetAllocCount() == nodeCount);
+  
+  // Every region should come back in order.
+  uint32_t addr;
+  for (uint32_t i = 0; i < 0x80; ++i) {
+    assert(allocator.Alloc(addr, 2));
+    assert(addr == i * 4);
+  }
+  assert(allocator.GetRegionCount() == 0x80);
+  assert(allocator.GetNodeCount() < nodeCount);
+  
+  // Filling the gaps between the rest should merge the nodes back together.
+  for (uint32_t i = 0x80; i < 0xff; ++i) {
+    allocator.Dealloc(i * 4 + 2, 2);
+  }
+  assert(allocator.GetRegionCount() == 1);
+  assert(allocator.GetNodeCount() == 1);
+  assert(allocator.GetLargestRegionSize() == 0x1fe);
+  assert(allocator.Alloc(addr, 0x1fe));
+  assert(addr == 0x200);
+  assert(allocator.GetNodeCount() == 0);
+}
+
+void TestOffsetAlign() {
+  ScopedPass pass("UnrolledFreeList::OffsetAlign()");
+  SmallList allocator(aligner, HandleFailure);
+  uint32_t addr;
+  
+  allocator.Dealloc(1, 0x3f);
+  allocator.Dealloc(0x80, 0x80);
+  
+  // Carving the middle out of a region should leave a region on each side.
+  assert(allocator.Align(addr, 0x20, 0x10));
+  assert(addr == 0x20);
+  assert(allocator.GetRegionCount() == 3);
+  assert(allocator.OffsetAlign(addr, 0x40, 0x10, 0x10));
+  assert(addr == 0x30);
+  assert(allocator.GetRegionCount() == 2);
+  assert(allocator.OffsetAlign(addr, 0x40, 0x10, 0x10));
+  assert(addr == 0xb0);
+  assert(allocator.GetRegionCount() == 3);
+  assert(!allocator.Align(addr, 0x100, 1));
+  
+  allocator.Dealloc(0x20, 0x10);
+  allocator.Dealloc(0x30, 0x10);
+  allocator.Dealloc(0xb0, 0x10);
+  assert(allocator.GetRegionCount() == 2);
+  assert(allocator.Align(addr, 0x80, 0x80));
+  assert(addr == 0x80);
+  assert(allocator.Alloc(addr, 0x3f));
+  assert(addr == 1);
+}
+
+void TestTryResize() {
+  ScopedPass pass("UnrolledFreeList::TryResize()");
+  SmallList allocator(aligner, HandleFailure);
+  
+  // Growing should take the front of the region right after the allocation,
+  // even if it is the first one in the next node.
+  for (uint32_t i = 0; i < SmallList::Capacity * 2; ++i) {
+    allocator.Dealloc(i * 0x10 + 8, 8);
+  }
+  assert(allocator.GetNodeCount() == 2);
+  uint32_t boundary = (uint32_t)SmallList::Capacity * 0x10;
+  assert(allocator.TryResize(boundary, 8, 0xc));
+  assert(allocator.GetRegionCount() == SmallList::Capacity * 2);
+  assert(!allocator.TryResize(boundary, 0xc, 0x11));
+  assert(allocator.TryResize(boundary, 0xc, 0x10));
+  assert(allocator.GetRegionCount() == SmallList::Capacity * 2 - 1);
+  assert(!allocator.TryResize(boundary, 0x10, 0x11));
+  
+  // Shrinking should free the tail and join it with its neighbors.
+  assert(allocator.TryResize(boundary, 0x10, 0));
+  assert(allocator.GetRegionCount() == SmallList::Capacity * 2 - 1);
+  assert(allocator.GetLargestRegionSize() == 0x18);
+  assert(allocator.TryResize(boundary - 0x10, 8, 0));
+  assert(allocator.GetRegionCount() == SmallList::Capacity * 2 - 2);
+  assert(allocator.GetLargestRegionSize() == 0x28);
+  uint32_t addr;
+  while (allocator.Alloc(addr, 1));
+}
+
+void TestReference() {
+  ScopedPass pass("UnrolledFreeList [reference]");
+  SmallList allocator(aligner, HandleFailure);
+  FreeList<uint32_t> reference(aligner, HandleFailure);
+  for (uint32_t i = 0; i < 0x400; ++i) {
+    allocator.Dealloc(i * 4, 2);
+    reference.Dealloc(i * 4, 2);
+  }
+  
+  // Every operation should have the same result as it does on a [FreeList].
+  uint32_t addrs[0x100];
+  uint32_t sizes[0x100];
+  size_t count = 0;
+  uint32_t seed = 1;
+  for (int i = 0; i < 0x4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t random = seed >> 8;
+    if (count == 0x100 || (count && random % 3 == 0)) {
+      size_t index = (random >> 2) % count;
+      allocator.Dealloc(addrs[index], sizes[index]);
+      reference.Dealloc(addrs[index], sizes[index]);
+      addrs[index] = addrs[--count];
+      sizes[index] = sizes[count];
+    } else if (count && random % 3 == 1) {
+      size_t index = (random >> 2) % count;
+      uint32_t newSize = 1 + (random >> 10) % 4;
+      bool result = allocator.TryResize(addrs[index], sizes[index], newSize);
+      assert(result == reference.TryResize(addrs[index], sizes[index],
+                                           newSize));
+      if (result) {
+        sizes[index] = newSize;
+      }
+    } else {
+      uint32_t size = 1 + (random >> 2) % 4;
+      uint32_t align = 1 << ((random >> 4) % 3);
+      uint32_t addr;
+      bool result = allocator.Align(addrs[count], align, size);
+      assert(result == reference.Align(addr, align, size));
+      if (result) {
+        assert(addr == addrs[count]);
+        sizes[count++] = size;
+      }
+    }
+    assert(allocator.GetRegionCount() == reference.GetRegionCount());
+    assert(allocator.GetLargestRegionSize() ==
+           reference.GetLargestRegionSize());
+  }
+  
+  while (count) {
+    --count;
+    allocator.Dealloc(addrs[count], sizes[count]);
+    reference.Dealloc(addrs[count], sizes[count]);
+  }
+  assert(allocator.GetRegionCount() == 0x400);
+  assert(aligner.GetAllocCount() == allocator.GetNodeCount() + 0x400);
+}
+
+template <typename T>
+bool HandleFailure(T *) {
+  std::cerr << "allocation failure!" << std::endl;
+  abort();
+}
@@ -102,8 +102,34 @@ void TestConstructed(size_t pageSize, size_t pageCount, size_t headerSize) {
   ansa::Memcpy((void *)addr, "hey", 3);
   assert(allocator.Realloc(addr, nextSize));
   assert(ansa::Memcmp(bitmap, zeroBitmap, sizeof(bitmap)) != 0);
-  assert(addr == start + (headerSize * 2) + firstSize);
+  // The pages after the region were free, so it grew in place
+  assert(addr == start + headerSize);
+  assert(ansa::Memcmp((void *)addr, "hey", 3) == 0);
+  // Once the next page is taken, the region has to move
+  uintptr_t blocker;
+  assert(allocator.Alloc(blocker, 1));
+  assert(blocker == start + (headerSize * 2) + nextSize);
+  size_t blockerSize = ansa::Align<size_t>(headerSize + 1, pageSize);
+  assert(allocator.Realloc(addr, nextSize + 1));
+  assert(addr == blocker + blockerSize);
   assert(ansa::Memcmp((void *)addr, "hey", 3) == 0);
+  // Shrinking always happens in place
+  assert(allocator.Realloc(addr, 1));
+  assert(addr == blocker + blockerSize);
+  allocator.Free(blocker);
+  allocator.Free(addr);
+  assert(ansa::Memcmp(bitmap, zeroBitmap, sizeof(bitmap)) == 0);
+  
+  // Test batches of pages, which have no headers
+  uintptr_t pages[0x20];
+  assert(allocator.Alloc(addr, 1));
+  assert(allocator.AllocMany(pages, 0x20));
+  for (size_t i = 0; i < 0x20; ++i) {
+    assert(pages[i] == start + headerSize + pageSize * (i + 1));
+  }
+  uintptr_t extraPages[pageCount];
+  assert(!allocator.AllocMany(extraPages, pageCount));
+  allocator.DeallocMany(pages, 0x20);
   allocator.Free(addr);
   assert(ansa::Memcmp(bitmap, zeroBitmap, sizeof(bitmap)) == 0);
 }
@@ -168,7 +194,8 @@ void TestNormalPlace(size_t pageSize, size_t pageCount,
   assert(addr == freeStart + headerSize);
   ansa::Memcpy((void *)addr, "hey", 3);
   assert(allocator->Realloc(addr, nextSize));
-  assert(addr == freeStart + (headerSize * 2) + firstSize);
+  assert(addr == freeStart + headerSize);
+  assert(ansa::Memcmp((void *)addr, "hey", 3) == 0);
   allocator->Free(addr);
   // Ensure that the whole buffer is now free
   assert(allocator->Alloc(addr, freeSize - headerSize));
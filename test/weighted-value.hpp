@@ -0,0 +1,41 @@
+#ifndef __TEST_WEIGHTED_VALUE_HPP__
+#define __TEST_WEIGHTED_VALUE_HPP__
+
+#include <ansa/math>
+
+/**
+ * A value which keeps the heaviest weight in its subtree.
+ */
+struct WeightedValue {
+  int key;
+  int weight;
+  int heaviest;
+  
+  WeightedValue() : key(0), weight(0), heaviest(0) {}
+  
+  WeightedValue(int _key, int _weight = 0)
+      : key(_key), weight(_weight), heaviest(_weight) {}
+  
+  bool operator==(const WeightedValue & v) const { return key == v.key; }
+  bool operator<(const WeightedValue & v) const { return key < v.key; }
+  bool operator>(const WeightedValue & v) const { return key > v.key; }
+  bool operator<=(const WeightedValue & v) const { return key <= v.key; }
+  bool operator>=(const WeightedValue & v) const { return key >= v.key; }
+  
+  friend bool UpdateTreeAugment(WeightedValue & value,
+                                const WeightedValue * left,
+                                const WeightedValue * right) {
+    int heaviest = value.weight;
+    if (left) {
+      heaviest = ansa::Max(heaviest, left->heaviest);
+    }
+    if (right) {
+      heaviest = ansa::Max(heaviest, right->heaviest);
+    }
+    bool changed = heaviest != value.heaviest;
+    value.heaviest = heaviest;
+    return changed;
+  }
+};
+
+#endif